@@ -16,6 +16,9 @@ int const WINDOW_WIDTH = 2048;
 int const WINDOW_HEIGHT = 1024;
 char const* APPLICATION_NAME = "Path Tracer";
 
+// Seconds without interaction before background BVH rebuilds are started.
+double const MESH_TREE_UPGRADE_IDLE_TIME = 1.0;
+
 bool HandleCameraMovement(application* App)
 {
     ImGuiIO& IO = ImGui::GetIO();
@@ -60,7 +63,7 @@ bool HandleCameraMovement(application* App)
 
     if (WasMoved && App->SceneCameraToRender)
     {
-        App->Scene->DirtyFlags |= SCENE_DIRTY_CAMERAS;
+        MarkEntityDirty(App->Scene, App->SceneCameraToRender);
         App->PreviewCamera.Position = App->SceneCameraToRender->Transform.Position;
         App->PreviewCamera.Rotation = App->SceneCameraToRender->Transform.Rotation;
     }
@@ -88,7 +91,19 @@ void Update(application* App)
     if (HandleCameraMovement(App))
         Restart = true;
 
-    uint DirtyFlags = PackSceneData(App->Scene);
+    double Time = ImGui::GetTime();
+    if (Restart || IO.MouseDown[0] || IO.MouseDown[1] || ImGui::IsAnyItemActive() || App->Scene->DirtyFlags != 0)
+        App->LastInteractionTime = Time;
+
+    if (App->Scene->DirtyFlags != 0 && App->PendingEditTime < 0)
+        App->PendingEditTime = glfwGetTime();
+
+    UpdateMeshTreeUpgrades(App->Scene, Time - App->LastInteractionTime < MESH_TREE_UPGRADE_IDLE_TIME);
+
+    // Textures and meshes are packed in the background, and the previous
+    // packs are rendered until the new ones are ready.
+    uint DirtyFlags = PackSceneDataAsync(App->Scene);
+    bool EditIsRendered = App->PendingEditTime >= 0 && !IsScenePackPending(App->Scene);
 
     if (DirtyFlags != 0)
         Restart = true;
@@ -163,6 +178,12 @@ void Update(application* App)
     RenderImGui(App->Vulkan, &App->ImGuiRenderContext);
 
     EndVulkanFrame(App->Vulkan);
+
+    if (EditIsRendered)
+    {
+        App->EditLatency = glfwGetTime() - App->PendingEditTime;
+        App->PendingEditTime = -1.0;
+    }
 }
 
 static void MouseButtonInputCallback(GLFWwindow* Window, int Button, int Action, int Mods)
@@ -406,6 +427,13 @@ void RunApplication(application* App)
 
     DestroyVulkanScene(App->Vulkan, App->VulkanScene);
 
+    WaitForSceneSave();
+
+    // Waits for the background pack and mesh BVH jobs, which use the thread
+    // pool, before it is destroyed at exit.
+    DestroyScene(App->Scene);
+    App->Scene = nullptr;
+
     DestroyVulkan(App->Vulkan);
 
     glfwDestroyWindow(App->Window);
@@ -45,6 +45,23 @@ struct application
     imgui_render_context ImGuiRenderContext = {};
     bool                 ImGuiIsVisible     = true;
 
+    // Options for importing models.
+    bool ImportUseSpatialSplits = false;
+    bool ImportUseFastBuilder = false;
+
+    // Time limit for optimizing the BVH of the selected mesh.
+    float MeshTreeOptimizationTime = 10.0f;
+
+    // Time of the last camera movement or scene edit, for deferring work
+    // until the user stops interacting.
+    double LastInteractionTime = 0.0;
+
+    // Time of the oldest scene edit not yet rendered, or negative if there
+    // is none, and the time from the most recent such edit until the first
+    // frame rendered with it was submitted.
+    double PendingEditTime = -1.0;
+    double EditLatency = 0.0;
+
     // Selection state.
     selection_type SelectionType    = SELECTION_TYPE_NONE;
     texture*       SelectedTexture  = nullptr;
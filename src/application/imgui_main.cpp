@@ -123,9 +123,12 @@ static void TextureInspector(application* App, texture* Texture)
 
     C |= ImGui::Checkbox("Nearest Filtering", &Texture->EnableNearestFiltering);
 
-    size_t TextureID = Texture->PackedTextureIndex + 1;
-    float Width = ImGui::GetWindowWidth() - 16;
-    ImGui::Image(reinterpret_cast<ImTextureID>(TextureID), ImVec2(Width, Width));
+    if (Texture->PackedTextureIndex != TEXTURE_INDEX_NONE)
+    {
+        size_t TextureID = Texture->PackedTextureIndex + 1;
+        float Width = ImGui::GetWindowWidth() - 16;
+        ImGui::Image(reinterpret_cast<ImTextureID>(TextureID), ImVec2(Width, Width));
+    }
 
     if (C) Scene->DirtyFlags |= SCENE_DIRTY_TEXTURES;
 
@@ -177,7 +180,7 @@ static void MaterialInspector(application* App, material* Material, bool Referen
 
     C |= MaterialInspectorX(App->Scene, Material);
 
-    if (C) Scene->DirtyFlags |= SCENE_DIRTY_MATERIALS;
+    if (C) MarkMaterialDirty(Scene, Material);
 
     ImGui::PopID();
 }
@@ -202,8 +205,24 @@ static void MeshInspector(application* App, mesh* Mesh, bool Referenced = false)
         ImGui::InputText("Name", &Mesh->Name);
     }
 
+    ImGui::Text("Faces: %zu, Nodes: %zu, Depth: %u", Mesh->Faces.size(), Mesh->Nodes.size(), Mesh->Depth);
+    ImGui::Text("BVH Cost: %.1f", Mesh->TreeCost);
+    if (Mesh->TreeOptimizationTime > 0.0f)
+        ImGui::Text("BVH optimization in progress");
+    else if (Mesh->NeedsTreeUpgrade)
+        ImGui::Text("SAH rebuild pending");
+
     bool C = false;
 
+    if (!Referenced)
+    {
+        ImGui::DragFloat("Optimization Time (s)", &App->MeshTreeOptimizationTime, 1.0f, 1.0f, 600.0f);
+        ImGui::BeginDisabled(Mesh->TreeOptimizationTime > 0.0f);
+        if (ImGui::Button("Optimize BVH"))
+            OptimizeMeshTree(Scene, Mesh, App->MeshTreeOptimizationTime);
+        ImGui::EndDisabled();
+    }
+
     if (C) Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
 
     ImGui::PopID();
@@ -361,6 +380,21 @@ static void EntityInspector(application* App, entity* Entity)
             if (ResourceSelectorDropDown("Skybox Texture", Scene->Textures, &Root->SkyboxTexture))
                 Scene->DirtyFlags |= SCENE_DIRTY_SKYBOX_TEXTURE;
 
+            if (ImGui::BeginCombo("Mesh Face Encoding", MeshFaceEncodingName(Root->MeshFaceEncoding)))
+            {
+                for (int I = 0; I < MESH_FACE_ENCODING__COUNT; I++)
+                {
+                    auto Encoding = static_cast<mesh_face_encoding>(I);
+                    bool IsSelected = Root->MeshFaceEncoding == Encoding;
+                    if (ImGui::Selectable(MeshFaceEncodingName(Encoding), &IsSelected))
+                    {
+                        Root->MeshFaceEncoding = Encoding;
+                        Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
             if (C) Scene->DirtyFlags |= SCENE_DIRTY_GLOBALS;
             break;
         }
@@ -404,9 +438,28 @@ static void EntityInspector(application* App, entity* Entity)
             MaterialInspector(App, Cube->Material, true);
             break;
         }
+        case ENTITY_TYPE_PREFAB_INSTANCE:
+        {
+            auto Instance = static_cast<prefab_entity*>(Entity);
+            char const* PrefabName = Instance->Prefab ? Instance->Prefab->Entity->Name.c_str() : "(none)";
+            if (ImGui::BeginCombo("Prefab", PrefabName))
+            {
+                for (prefab* Prefab : Scene->Prefabs)
+                {
+                    if (ImGui::Selectable(Prefab->Entity->Name.c_str(), Instance->Prefab == Prefab))
+                    {
+                        Instance->Prefab = Prefab;
+                        C = true;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            break;
+        }
     }
 
-    if (C) Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
+    if (C)
+        MarkEntityDirty(Scene, Entity);
 
     ImGui::PopID();
 }
@@ -442,7 +495,7 @@ static void EntityTreeNode(application* App, entity* Entity, bool PrefabMode=fal
         {
             for (int I = 0; I < ENTITY_TYPE__COUNT; I++)
             {
-                if (I == ENTITY_TYPE_ROOT) continue;
+                if (I == ENTITY_TYPE_ROOT || I == ENTITY_TYPE_PREFAB_INSTANCE) continue;
                 char Buffer[256];
                 auto EntityType = static_cast<entity_type>(I);
                 snprintf(Buffer, std::size(Buffer), "Create %s...", EntityTypeName(EntityType));
@@ -458,6 +511,20 @@ static void EntityTreeNode(application* App, entity* Entity, bool PrefabMode=fal
             if (!App->Scene->Prefabs.empty())
             {
                 if (ImGui::BeginMenu("Create Prefab Instance"))
+                {
+                    for (prefab* Prefab : App->Scene->Prefabs)
+                    {
+                        if (ImGui::MenuItem(Prefab->Entity->Name.c_str()))
+                        {
+                            auto Child = CreatePrefabInstance(App->Scene, Prefab, Entity);
+                            App->Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
+                            App->SelectionType = SELECTION_TYPE_ENTITY;
+                            App->SelectedEntity = Child;
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Create Prefab Copy"))
                 {
                     for (prefab* Prefab : App->Scene->Prefabs)
                     {
@@ -713,12 +780,17 @@ void PrefabBrowserWindow(application* App)
     {
         nfdu8filteritem_t Filters[] =
         {
-            { "Wavefront OBJ", "obj" }
+            { "Model File", "obj,glb,ply" },
+            { "Wavefront OBJ", "obj" },
+            { "Binary glTF", "glb" },
+            { "Binary PLY", "ply" },
         };
         std::optional<std::filesystem::path> Path = OpenDialog(Filters);
         if (Path.has_value()) {
             load_model_options Options;
             Options.DirectoryPath = Path.value().parent_path().string();
+            Options.UseSpatialSplits = App->ImportUseSpatialSplits;
+            Options.TreeBuilder = App->ImportUseFastBuilder ? MESH_TREE_BUILDER_LBVH : MESH_TREE_BUILDER_SAH;
             App->SelectedPrefab = LoadModelAsPrefab(App->Scene, Path.value().string().c_str(), &Options);
             App->SelectionType = SELECTION_TYPE_PREFAB;
         }
@@ -732,6 +804,13 @@ void PrefabBrowserWindow(application* App)
         App->SelectionType = SELECTION_TYPE_NONE;
     }
     ImGui::EndDisabled();
+    ImGui::SameLine();
+    // Spatial splits only apply to the SAH builder.
+    if (ImGui::Checkbox("Spatial Splits", &App->ImportUseSpatialSplits) && App->ImportUseSpatialSplits)
+        App->ImportUseFastBuilder = false;
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Fast BVH", &App->ImportUseFastBuilder) && App->ImportUseFastBuilder)
+        App->ImportUseSpatialSplits = false;
 
     scene* Scene = App->Scene;
 
@@ -807,7 +886,7 @@ void PreviewSettingsWindow(application* App, ImGuiDockNode* Node)
 {
     if (App->SceneCameraToRender) return;
 
-    ImVec2 Size = { 400, 70 };
+    ImVec2 Size = { 400, 94 };
     ImVec2 Margin = { 16, 16 };
 
     ImVec2 Position = Node->Pos;
@@ -840,6 +919,8 @@ void PreviewSettingsWindow(application* App, ImGuiDockNode* Node)
 
     ImGui::SliderFloat("Brightness", &App->PreviewBrightness, 0.01f, 100.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
 
+    ImGui::LabelText("Edit Latency", "%.1f ms", 1000.0 * App->EditLatency);
+
     ImGui::End();
 }
 
@@ -847,7 +928,7 @@ void RenderSettingsWindow(application* App, ImGuiDockNode* Node)
 {
     if (!App->SceneCameraToRender) return;
 
-    ImVec2 Size = { 400, 120 };
+    ImVec2 Size = { 400, 144 };
     ImVec2 Margin = { 16, 16 };
 
     ImVec2 Position = Node->Pos;
@@ -892,6 +973,8 @@ void RenderSettingsWindow(application* App, ImGuiDockNode* Node)
         ImGui::SliderFloat("White Level", &ResolveParameters->ToneMappingWhiteLevel, 0.01f, 100.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
     }
 
+    ImGui::LabelText("Edit Latency", "%.1f ms", 1000.0 * App->EditLatency);
+
     //ImGui::CheckboxFlags("Sample Accumulation", &Camera->RenderFlags, RENDER_FLAG_ACCUMULATE);
     //ImGui::CheckboxFlags("Sample Jitter", &Camera->RenderFlags, RENDER_FLAG_SAMPLE_JITTER);
 
@@ -958,7 +1041,9 @@ void MainMenuBar(application* App)
             std::optional<std::filesystem::path> Path = SaveDialog(Filters, "scene.json");
             if (Path.has_value())
             {
-                SaveScene(Path.value().string().c_str(), App->Scene);
+                save_scene_options Options;
+                Options.SaveInBackground = true;
+                SaveScene(Path.value().string().c_str(), App->Scene, &Options);
             }
         }
         ImGui::EndMenu();
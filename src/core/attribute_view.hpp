@@ -0,0 +1,121 @@
+#pragma once
+
+#include "core/common.hpp"
+
+enum attribute_type
+{
+    ATTRIBUTE_TYPE_INT8    = 0,
+    ATTRIBUTE_TYPE_UINT8   = 1,
+    ATTRIBUTE_TYPE_INT16   = 2,
+    ATTRIBUTE_TYPE_UINT16  = 3,
+    ATTRIBUTE_TYPE_INT32   = 4,
+    ATTRIBUTE_TYPE_UINT32  = 5,
+    ATTRIBUTE_TYPE_FLOAT32 = 6,
+    ATTRIBUTE_TYPE_FLOAT64 = 7,
+};
+
+inline uint32_t AttributeTypeSize(attribute_type Type)
+{
+    switch (Type)
+    {
+        case ATTRIBUTE_TYPE_INT8:
+        case ATTRIBUTE_TYPE_UINT8:
+            return 1;
+        case ATTRIBUTE_TYPE_INT16:
+        case ATTRIBUTE_TYPE_UINT16:
+            return 2;
+        case ATTRIBUTE_TYPE_INT32:
+        case ATTRIBUTE_TYPE_UINT32:
+        case ATTRIBUTE_TYPE_FLOAT32:
+            return 4;
+        case ATTRIBUTE_TYPE_FLOAT64:
+            return 8;
+    }
+    return 0;
+}
+
+// Strided view of a per-element attribute, such as a vertex position or a
+// face index, stored in a memory-mapped file.  Each component of the
+// attribute has its own offset within the element, which allows the view
+// to describe both interleaved (glTF) and per-property (PLY) layouts.
+struct attribute_view
+{
+    uint8_t const* Data = nullptr; // Null if the attribute is not present.
+    size_t         Count = 0;
+    size_t         Stride = 0;
+    uint32_t       ComponentCount = 0;
+    uint32_t       ComponentOffsets[4] = {};
+    attribute_type Type = ATTRIBUTE_TYPE_FLOAT32;
+    bool           Normalized = false; // Map integer values to [0, 1] or [-1, 1].
+    bool           BigEndian = false;
+};
+
+// Reads one component of one element of an attribute as a float.
+inline float ReadAttribute(attribute_view const& View, size_t Index, uint32_t Component)
+{
+    uint8_t const* P = View.Data + Index * View.Stride + View.ComponentOffsets[Component];
+    uint32_t Size = AttributeTypeSize(View.Type);
+
+    uint8_t Bytes[8];
+    memcpy(Bytes, P, Size);
+    if (View.BigEndian)
+        std::reverse(Bytes, Bytes + Size);
+
+    auto As = [&]<typename type>(type) { type Value; memcpy(&Value, Bytes, sizeof(type)); return Value; };
+
+    switch (View.Type)
+    {
+        case ATTRIBUTE_TYPE_INT8:
+            return View.Normalized ? std::max(As(int8_t()) / 127.0f, -1.0f) : As(int8_t());
+        case ATTRIBUTE_TYPE_UINT8:
+            return View.Normalized ? As(uint8_t()) / 255.0f : As(uint8_t());
+        case ATTRIBUTE_TYPE_INT16:
+            return View.Normalized ? std::max(As(int16_t()) / 32767.0f, -1.0f) : As(int16_t());
+        case ATTRIBUTE_TYPE_UINT16:
+            return View.Normalized ? As(uint16_t()) / 65535.0f : As(uint16_t());
+        case ATTRIBUTE_TYPE_INT32:
+            return static_cast<float>(As(int32_t()));
+        case ATTRIBUTE_TYPE_UINT32:
+            return static_cast<float>(As(uint32_t()));
+        case ATTRIBUTE_TYPE_FLOAT32:
+            return As(float());
+        case ATTRIBUTE_TYPE_FLOAT64:
+            return static_cast<float>(As(double()));
+    }
+    return 0.0f;
+}
+
+// Reads one component of one element of an integer attribute as an index.
+inline uint32_t ReadAttributeIndex(attribute_view const& View, size_t Index, uint32_t Component = 0)
+{
+    uint8_t const* P = View.Data + Index * View.Stride + View.ComponentOffsets[Component];
+    uint32_t Size = AttributeTypeSize(View.Type);
+
+    uint8_t Bytes[8] = {};
+    memcpy(Bytes, P, Size);
+    if (View.BigEndian)
+        std::reverse(Bytes, Bytes + Size);
+
+    switch (View.Type)
+    {
+        case ATTRIBUTE_TYPE_INT8:
+        case ATTRIBUTE_TYPE_UINT8:
+            return Bytes[0];
+        case ATTRIBUTE_TYPE_INT16:
+        case ATTRIBUTE_TYPE_UINT16:
+        {
+            uint16_t Value;
+            memcpy(&Value, Bytes, 2);
+            return Value;
+        }
+        case ATTRIBUTE_TYPE_INT32:
+        case ATTRIBUTE_TYPE_UINT32:
+        {
+            uint32_t Value;
+            memcpy(&Value, Bytes, 4);
+            return Value;
+        }
+        default:
+            return static_cast<uint32_t>(ReadAttribute(View, Index, Component));
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <format>
 #include <span>
@@ -112,3 +113,42 @@ inline vec3 UnpackUnitVector(uint PackedV)
     if (Z < 0.0f) P = (1.0f - glm::abs(P.yx())) * SignNotZero(P);
     return glm::normalize(glm::vec3(P, Z));
 }
+
+// Packs a four-character code into a 32-bit value, first character in the
+// most significant byte.  This is the value GCC, Clang and MSVC give the
+// equivalent multi-character literal, which file headers used before.
+constexpr uint32_t MakeFourCC(char const (&Code)[5])
+{
+    return uint32_t(uint8_t(Code[0])) << 24
+         | uint32_t(uint8_t(Code[1])) << 16
+         | uint32_t(uint8_t(Code[2])) << 8
+         | uint32_t(uint8_t(Code[3]));
+}
+
+// Computes a 64-bit (non-cryptographic) hash of a block of memory.
+inline uint64_t HashBytes(void const* Data, size_t Size, uint64_t Seed = 0)
+{
+    constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+    auto Bytes = static_cast<uint8_t const*>(Data);
+    uint64_t Hash = (Seed ^ 0xCBF29CE484222325ull) + Size * MULTIPLIER;
+
+    size_t Index = 0;
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        uint64_t Word;
+        memcpy(&Word, Bytes + Index, 8);
+        Hash = (Hash ^ Word) * MULTIPLIER;
+        Hash ^= Hash >> 32;
+    }
+    for (; Index < Size; Index++)
+    {
+        Hash = (Hash ^ Bytes[Index]) * MULTIPLIER;
+        Hash ^= Hash >> 32;
+    }
+
+    Hash ^= Hash >> 29;
+    Hash *= 0xBF58476D1CE4E5B9ull;
+    Hash ^= Hash >> 32;
+    return Hash;
+}
@@ -0,0 +1,390 @@
+#include "core/gltf_parser.hpp"
+#include "core/json.hpp"
+
+#include <format>
+
+using nlohmann::json;
+
+uint32_t const GLB_MAGIC       = 0x46546C67; // "glTF"
+uint32_t const GLB_CHUNK_JSON  = 0x4E4F534A; // "JSON"
+uint32_t const GLB_CHUNK_BIN   = 0x004E4942; // "BIN\0"
+uint32_t const GLB_MAX_DEPTH   = 64;
+
+struct glb_header
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Length;
+};
+
+struct glb_chunk_header
+{
+    uint32_t Length;
+    uint32_t Type;
+};
+
+static int GetIndex(json const& JSON, char const* Key)
+{
+    auto It = JSON.find(Key);
+    return It != JSON.end() && It->is_number_integer() ? It->get<int>() : -1;
+}
+
+static size_t GetSize(json const& JSON, char const* Key)
+{
+    auto It = JSON.find(Key);
+    return It != JSON.end() && It->is_number_unsigned() ? It->get<size_t>() : 0;
+}
+
+static std::string GetString(json const& JSON, char const* Key)
+{
+    auto It = JSON.find(Key);
+    return It != JSON.end() && It->is_string() ? It->get<std::string>() : std::string();
+}
+
+static json const& GetArray(json const& JSON, char const* Key)
+{
+    static json const Empty = json::array();
+    auto It = JSON.find(Key);
+    return It != JSON.end() && It->is_array() ? *It : Empty;
+}
+
+// Reads a fixed-size array of numbers, leaving Values unchanged if the key
+// is not present or has the wrong size.
+static void GetNumbers(json const& JSON, char const* Key, float* Values, size_t Count)
+{
+    json const& Array = GetArray(JSON, Key);
+    if (Array.size() != Count) return;
+    for (size_t I = 0; I < Count; I++)
+        if (Array[I].is_number())
+            Values[I] = Array[I].get<float>();
+}
+
+static bool ReadAccessor
+(
+    json const& Root,
+    int AccessorIndex,
+    uint8_t const* Bin,
+    size_t BinSize,
+    attribute_view* View,
+    std::string* Errors
+)
+{
+    json const& Accessors = GetArray(Root, "accessors");
+    json const& BufferViews = GetArray(Root, "bufferViews");
+
+    if (AccessorIndex < 0 || AccessorIndex >= static_cast<int>(Accessors.size()))
+    {
+        *Errors += "Invalid accessor index\n";
+        return false;
+    }
+
+    json const& Accessor = Accessors[AccessorIndex];
+
+    switch (GetIndex(Accessor, "componentType"))
+    {
+        case 5120: View->Type = ATTRIBUTE_TYPE_INT8; break;
+        case 5121: View->Type = ATTRIBUTE_TYPE_UINT8; break;
+        case 5122: View->Type = ATTRIBUTE_TYPE_INT16; break;
+        case 5123: View->Type = ATTRIBUTE_TYPE_UINT16; break;
+        case 5125: View->Type = ATTRIBUTE_TYPE_UINT32; break;
+        case 5126: View->Type = ATTRIBUTE_TYPE_FLOAT32; break;
+        default:
+            *Errors += "Invalid accessor component type\n";
+            return false;
+    }
+
+    std::string Type = GetString(Accessor, "type");
+    if (Type == "SCALAR")    View->ComponentCount = 1;
+    else if (Type == "VEC2") View->ComponentCount = 2;
+    else if (Type == "VEC3") View->ComponentCount = 3;
+    else if (Type == "VEC4") View->ComponentCount = 4;
+    else
+    {
+        *Errors += std::format("Unsupported accessor type '{}'\n", Type);
+        return false;
+    }
+
+    if (Accessor.contains("sparse"))
+    {
+        *Errors += "Sparse accessors are not supported\n";
+        return false;
+    }
+
+    int BufferViewIndex = GetIndex(Accessor, "bufferView");
+    if (BufferViewIndex < 0 || BufferViewIndex >= static_cast<int>(BufferViews.size()))
+    {
+        *Errors += "Accessors without a buffer view are not supported\n";
+        return false;
+    }
+
+    json const& BufferView = BufferViews[BufferViewIndex];
+    if (GetIndex(BufferView, "buffer") != 0 || !Bin)
+    {
+        *Errors += "Buffers outside of the binary chunk are not supported\n";
+        return false;
+    }
+
+    uint32_t ComponentSize = AttributeTypeSize(View->Type);
+    size_t ElementSize = ComponentSize * View->ComponentCount;
+    size_t ViewOffset = GetSize(BufferView, "byteOffset");
+    size_t ViewLength = GetSize(BufferView, "byteLength");
+    size_t AccessorOffset = GetSize(Accessor, "byteOffset");
+
+    View->Count = GetSize(Accessor, "count");
+    View->Stride = GetSize(BufferView, "byteStride");
+    if (View->Stride == 0) View->Stride = ElementSize;
+    auto Normalized = Accessor.find("normalized");
+    View->Normalized = Normalized != Accessor.end() && Normalized->is_boolean() && Normalized->get<bool>();
+
+    for (uint32_t I = 0; I < View->ComponentCount; I++)
+        View->ComponentOffsets[I] = I * ComponentSize;
+
+    if (View->Count > 0)
+    {
+        size_t Extent = AccessorOffset + (View->Count - 1) * View->Stride + ElementSize;
+        if (ViewOffset + ViewLength > BinSize || Extent > ViewLength)
+        {
+            *Errors += "Accessor data out of bounds\n";
+            return false;
+        }
+    }
+
+    View->Data = Bin + ViewOffset + AccessorOffset;
+    return true;
+}
+
+// Returns the path of the image of a texture, if the image is an external
+// file.
+static std::string GetTexturePath(json const& Root, json const& TextureInfo, std::string* Warnings)
+{
+    int TextureIndex = GetIndex(TextureInfo, "index");
+    json const& Textures = GetArray(Root, "textures");
+    if (TextureIndex < 0 || TextureIndex >= static_cast<int>(Textures.size()))
+        return {};
+
+    int ImageIndex = GetIndex(Textures[TextureIndex], "source");
+    json const& Images = GetArray(Root, "images");
+    if (ImageIndex < 0 || ImageIndex >= static_cast<int>(Images.size()))
+        return {};
+
+    std::string URI = GetString(Images[ImageIndex], "uri");
+    if (URI.empty() || URI.starts_with("data:"))
+    {
+        *Warnings += std::format("Image {} is embedded in the file, which is not supported\n", ImageIndex);
+        return {};
+    }
+
+    return URI;
+}
+
+static mat4 GetNodeTransform(json const& Node)
+{
+    json const& Matrix = GetArray(Node, "matrix");
+    if (Matrix.size() == 16)
+    {
+        mat4 Transform;
+        for (int I = 0; I < 16; I++)
+            Transform[I / 4][I % 4] = Matrix[I].is_number() ? Matrix[I].get<float>() : 0.0f;
+        return Transform;
+    }
+
+    float Translation[3] = { 0, 0, 0 };
+    float Rotation[4] = { 0, 0, 0, 1 };
+    float Scale[3] = { 1, 1, 1 };
+    GetNumbers(Node, "translation", Translation, 3);
+    GetNumbers(Node, "rotation", Rotation, 4);
+    GetNumbers(Node, "scale", Scale, 3);
+
+    return glm::translate(mat4(1), vec3(Translation[0], Translation[1], Translation[2]))
+         * glm::mat4_cast(glm::quat(Rotation[3], Rotation[0], Rotation[1], Rotation[2]))
+         * glm::scale(mat4(1), vec3(Scale[0], Scale[1], Scale[2]));
+}
+
+static void CollectInstances(glb_file* Glb, json const& Root, int NodeIndex, mat4 const& ParentTransform, uint32_t Depth)
+{
+    json const& Nodes = GetArray(Root, "nodes");
+    if (NodeIndex < 0 || NodeIndex >= static_cast<int>(Nodes.size()) || Depth > GLB_MAX_DEPTH)
+        return;
+
+    json const& Node = Nodes[NodeIndex];
+    mat4 Transform = ParentTransform * GetNodeTransform(Node);
+
+    int MeshIndex = GetIndex(Node, "mesh");
+    if (MeshIndex >= 0 && MeshIndex < static_cast<int>(Glb->Meshes.size()))
+    {
+        std::string Name = GetString(Node, "name");
+        if (Name.empty()) Name = Glb->Meshes[MeshIndex].Name;
+
+        Glb->Instances.push_back
+        ({
+            .Name = Name,
+            .MeshIndex = static_cast<uint32_t>(MeshIndex),
+            .Transform = Transform,
+        });
+    }
+
+    for (json const& Child : GetArray(Node, "children"))
+        if (Child.is_number_integer())
+            CollectInstances(Glb, Root, Child.get<int>(), Transform, Depth + 1);
+}
+
+bool OpenGlbFile(char const* Path, glb_file* Glb, std::string* Warnings, std::string* Errors)
+{
+    *Glb = {};
+
+    if (!MapFile(&Glb->File, Path))
+    {
+        *Errors += std::format("Cannot open file [{}]\n", Path);
+        return false;
+    }
+
+    auto Fail = [&](std::string const& Message)
+    {
+        *Errors += std::format("{}: {}\n", Path, Message);
+        CloseGlbFile(Glb);
+        return false;
+    };
+
+    auto Data = static_cast<uint8_t const*>(Glb->File.Data);
+    size_t Size = Glb->File.Size;
+
+    glb_header Header;
+    if (Size < sizeof(glb_header))
+        return Fail("Not a binary glTF file");
+    memcpy(&Header, Data, sizeof(glb_header));
+    if (Header.Magic != GLB_MAGIC || Header.Version != 2)
+        return Fail("Not a binary glTF 2.0 file");
+
+    // Locate the JSON and binary chunks.
+    char const* JSONText = nullptr;
+    size_t JSONSize = 0;
+    uint8_t const* Bin = nullptr;
+    size_t BinSize = 0;
+
+    size_t Offset = sizeof(glb_header);
+    while (Offset + sizeof(glb_chunk_header) <= Size)
+    {
+        glb_chunk_header Chunk;
+        memcpy(&Chunk, Data + Offset, sizeof(glb_chunk_header));
+        Offset += sizeof(glb_chunk_header);
+        if (Chunk.Length > Size - Offset)
+            return Fail("Truncated chunk");
+
+        if (Chunk.Type == GLB_CHUNK_JSON && !JSONText)
+        {
+            JSONText = reinterpret_cast<char const*>(Data + Offset);
+            JSONSize = Chunk.Length;
+        }
+        else if (Chunk.Type == GLB_CHUNK_BIN && !Bin)
+        {
+            Bin = Data + Offset;
+            BinSize = Chunk.Length;
+        }
+
+        Offset += (Chunk.Length + 3) & ~3u;
+    }
+
+    if (!JSONText)
+        return Fail("Missing JSON chunk");
+
+    json Root = json::parse(JSONText, JSONText + JSONSize, nullptr, false);
+    if (Root.is_discarded() || !Root.is_object())
+        return Fail("Invalid JSON chunk");
+
+    // Materials.
+    for (json const& Material : GetArray(Root, "materials"))
+    {
+        glb_material& Result = Glb->Materials.emplace_back();
+        Result.Name = GetString(Material, "name");
+
+        float BaseColor[4] = { 1, 1, 1, 1 };
+        float Emission[3] = { 0, 0, 0 };
+
+        auto PBR = Material.find("pbrMetallicRoughness");
+        if (PBR != Material.end() && PBR->is_object())
+        {
+            GetNumbers(*PBR, "baseColorFactor", BaseColor, 4);
+            if (PBR->contains("baseColorTexture"))
+                Result.BaseColorTexturePath = GetTexturePath(Root, (*PBR)["baseColorTexture"], Warnings);
+        }
+
+        GetNumbers(Material, "emissiveFactor", Emission, 3);
+        if (Material.contains("emissiveTexture"))
+            Result.EmissionColorTexturePath = GetTexturePath(Root, Material["emissiveTexture"], Warnings);
+
+        Result.BaseColor = vec3(BaseColor[0], BaseColor[1], BaseColor[2]);
+        Result.EmissionColor = vec3(Emission[0], Emission[1], Emission[2]);
+    }
+
+    // Meshes.
+    for (json const& Mesh : GetArray(Root, "meshes"))
+    {
+        glb_mesh& Result = Glb->Meshes.emplace_back();
+        Result.Name = GetString(Mesh, "name");
+
+        for (json const& Primitive : GetArray(Mesh, "primitives"))
+        {
+            int Mode = GetIndex(Primitive, "mode");
+            if (Mode >= 0 && Mode != 4)
+            {
+                *Warnings += std::format("Skipping non-triangle primitive in mesh '{}'\n", Result.Name);
+                continue;
+            }
+
+            auto Attributes = Primitive.find("attributes");
+            if (Attributes == Primitive.end() || !Attributes->is_object())
+                return Fail("Primitive has no attributes");
+
+            glb_primitive& P = Result.Primitives.emplace_back();
+            P.MaterialIndex = GetIndex(Primitive, "material");
+
+            int PositionIndex = GetIndex(*Attributes, "POSITION");
+            int NormalIndex = GetIndex(*Attributes, "NORMAL");
+            int TexCoordIndex = GetIndex(*Attributes, "TEXCOORD_0");
+            int IndicesIndex = GetIndex(Primitive, "indices");
+
+            if (!ReadAccessor(Root, PositionIndex, Bin, BinSize, &P.Positions, Errors))
+                return Fail("Cannot read primitive positions");
+            if (NormalIndex >= 0 && !ReadAccessor(Root, NormalIndex, Bin, BinSize, &P.Normals, Errors))
+                return Fail("Cannot read primitive normals");
+            if (TexCoordIndex >= 0 && !ReadAccessor(Root, TexCoordIndex, Bin, BinSize, &P.TexCoords, Errors))
+                return Fail("Cannot read primitive texture coordinates");
+            if (IndicesIndex >= 0 && !ReadAccessor(Root, IndicesIndex, Bin, BinSize, &P.Indices, Errors))
+                return Fail("Cannot read primitive indices");
+
+            if (P.Positions.ComponentCount != 3
+             || (P.Normals.Data && (P.Normals.ComponentCount != 3 || P.Normals.Count != P.Positions.Count))
+             || (P.TexCoords.Data && (P.TexCoords.ComponentCount != 2 || P.TexCoords.Count != P.Positions.Count))
+             || (P.Indices.Data && P.Indices.ComponentCount != 1))
+                return Fail("Invalid primitive attributes");
+
+            if (P.MaterialIndex >= static_cast<int>(Glb->Materials.size()))
+                P.MaterialIndex = -1;
+        }
+    }
+
+    // Instances, from the node hierarchy of the default scene.
+    json const& Scenes = GetArray(Root, "scenes");
+    int SceneIndex = std::max(GetIndex(Root, "scene"), 0);
+
+    if (SceneIndex < static_cast<int>(Scenes.size()))
+    {
+        for (json const& Node : GetArray(Scenes[SceneIndex], "nodes"))
+            if (Node.is_number_integer())
+                CollectInstances(Glb, Root, Node.get<int>(), mat4(1), 0);
+    }
+    else
+    {
+        // Without scenes, place every mesh once at the origin.
+        for (uint32_t I = 0; I < Glb->Meshes.size(); I++)
+            Glb->Instances.push_back({ Glb->Meshes[I].Name, I, mat4(1) });
+    }
+
+    return true;
+}
+
+void CloseGlbFile(glb_file* Glb)
+{
+    UnmapFile(&Glb->File);
+    *Glb = {};
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "core/attribute_view.hpp"
+#include "core/mapped_file.hpp"
+
+#include <string>
+#include <vector>
+
+// Triangle list with a single material.  The attributes are views into the
+// binary chunk of the file.  Indices is empty for non-indexed primitives.
+struct glb_primitive
+{
+    attribute_view Positions;
+    attribute_view Normals;
+    attribute_view TexCoords;
+    attribute_view Indices;
+    int32_t        MaterialIndex; // -1 if the primitive has no material.
+};
+
+struct glb_mesh
+{
+    std::string                Name;
+    std::vector<glb_primitive> Primitives;
+};
+
+struct glb_material
+{
+    std::string Name;
+    vec3        BaseColor;
+    vec3        EmissionColor;
+    std::string BaseColorTexturePath; // Relative to the file, or empty.
+    std::string EmissionColorTexturePath;
+};
+
+// Placement of a mesh in the default scene of the file.
+struct glb_instance
+{
+    std::string Name;
+    uint32_t    MeshIndex;
+    mat4        Transform; // Mesh to world.
+};
+
+// Contents of a binary glTF 2.0 file.  The file stays mapped into memory
+// while it is open, so that the vertex and index data can be read directly
+// from it.
+struct glb_file
+{
+    mapped_file               File;
+    std::vector<glb_mesh>     Meshes;
+    std::vector<glb_material> Materials;
+    std::vector<glb_instance> Instances;
+};
+
+// Opens a binary glTF (.glb) file.  Only triangle primitives are read, and
+// all buffer data must be in the binary chunk of the file.  Textures are
+// only supported as external image files.
+bool OpenGlbFile(char const* Path, glb_file* Glb, std::string* Warnings, std::string* Errors);
+
+void CloseGlbFile(glb_file* Glb);
@@ -0,0 +1,113 @@
+#include "core/mapped_file.hpp"
+
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MapFile(mapped_file* File, char const* Path)
+{
+    *File = {};
+
+#ifdef _WIN32
+    HANDLE FileHandle = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (FileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER FileSize = {};
+    if (!GetFileSizeEx(FileHandle, &FileSize) || FileSize.QuadPart == 0)
+    {
+        CloseHandle(FileHandle);
+        return false;
+    }
+
+    // The mapping object keeps the file open, so the file handle itself
+    // is no longer needed once the mapping has been created.
+    HANDLE MappingHandle = CreateFileMappingA(FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(FileHandle);
+    if (!MappingHandle)
+        return false;
+
+    void* Data = MapViewOfFile(MappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!Data)
+    {
+        CloseHandle(MappingHandle);
+        return false;
+    }
+
+    File->Data = Data;
+    File->Size = static_cast<size_t>(FileSize.QuadPart);
+    File->Handle = MappingHandle;
+#else
+    int FileDescriptor = open(Path, O_RDONLY);
+    if (FileDescriptor < 0)
+        return false;
+
+    struct stat Stat = {};
+    if (fstat(FileDescriptor, &Stat) != 0 || Stat.st_size == 0)
+    {
+        close(FileDescriptor);
+        return false;
+    }
+
+    // The mapping stays valid after the file descriptor is closed.
+    void* Data = mmap(nullptr, static_cast<size_t>(Stat.st_size), PROT_READ, MAP_PRIVATE, FileDescriptor, 0);
+    close(FileDescriptor);
+    if (Data == MAP_FAILED)
+        return false;
+
+    File->Data = Data;
+    File->Size = static_cast<size_t>(Stat.st_size);
+#endif
+
+    return true;
+}
+
+void UnmapFile(mapped_file* File)
+{
+    if (!File->Data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(File->Data);
+    CloseHandle(static_cast<HANDLE>(File->Handle));
+#else
+    munmap(const_cast<void*>(File->Data), File->Size);
+#endif
+
+    *File = {};
+}
+
+bool WriteFileAtomically(std::filesystem::path const& FilePath, std::function<void(std::ostream&)> const& Write)
+{
+    auto TempFilePath = FilePath;
+    TempFilePath += ".tmp";
+
+    bool Success;
+    {
+        auto File = std::ofstream(TempFilePath, std::ios::binary);
+        if (!File) return false;
+        Write(File);
+        File.close();
+        Success = !File.fail();
+    }
+
+    std::error_code Error;
+    if (Success)
+        std::filesystem::rename(TempFilePath, FilePath, Error);
+    if (!Success || Error)
+    {
+        std::filesystem::remove(TempFilePath, Error);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "core/common.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <ostream>
+
+// Read-only view of the contents of a file mapped into memory.
+struct mapped_file
+{
+    void const* Data   = nullptr;
+    size_t      Size   = 0;
+    void*       Handle = nullptr;
+};
+
+bool MapFile(mapped_file* File, char const* Path);
+
+void UnmapFile(mapped_file* File);
+
+// Writes a file by first writing a temporary file and then renaming it over
+// the target, so that the target is never observed partially written.
+bool WriteFileAtomically(std::filesystem::path const& FilePath, std::function<void(std::ostream&)> const& Write);
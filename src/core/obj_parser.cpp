@@ -0,0 +1,1020 @@
+#include "core/obj_parser.hpp"
+#include "core/mapped_file.hpp"
+#include "core/parallel.hpp"
+
+#include <cmath>
+#include <format>
+#include <limits>
+#include <set>
+
+/* --- Tokenization -------------------------------------------------------- */
+
+// The token parsing functions below mirror the ones in tinyobjloader, so
+// that the parsed values are bit-identical to what tinyobj::LoadObj()
+// produces.  Lines are not null-terminated, so every function takes the
+// end of the line as well.
+
+static bool IsSpace(char C)
+{
+    return C == ' ' || C == '\t';
+}
+
+static bool IsDigit(char C)
+{
+    return static_cast<unsigned int>(C - '0') < 10u;
+}
+
+static bool IsLineEnd(char const* P, char const* End)
+{
+    return P >= End || *P == '\r' || *P == '\n' || *P == '\0';
+}
+
+static char const* SkipBlanks(char const* P, char const* End)
+{
+    while (P < End && IsSpace(*P)) P++;
+    return P;
+}
+
+static char const* SkipSeparators(char const* P, char const* End)
+{
+    while (P < End && (IsSpace(*P) || *P == '\r')) P++;
+    return P;
+}
+
+static char const* FindTokenEnd(char const* P, char const* End)
+{
+    while (P < End && !IsSpace(*P) && *P != '\r' && *P != '\0') P++;
+    return P;
+}
+
+static char const* FindIndexEnd(char const* P, char const* End)
+{
+    while (P < End && *P != '/' && !IsSpace(*P) && *P != '\r' && *P != '\0') P++;
+    return P;
+}
+
+// Equivalent of atoi().
+static int ParseInt(char const* P, char const* End)
+{
+    while (P < End && (IsSpace(*P) || *P == '\n' || *P == '\v' || *P == '\f' || *P == '\r')) P++;
+
+    bool Negative = false;
+    if (P < End && (*P == '+' || *P == '-'))
+        Negative = *P++ == '-';
+
+    int Value = 0;
+    while (P < End && IsDigit(*P))
+        Value = 10 * Value + (*P++ - '0');
+
+    return Negative ? -Value : Value;
+}
+
+static bool ParseDouble(char const* S, char const* End, double* Result)
+{
+    if (S >= End) return false;
+
+    double Mantissa = 0.0;
+    int Exponent = 0;
+    char Sign = '+';
+    char ExponentSign = '+';
+    char const* P = S;
+    int Read = 0;
+    bool LeadingDecimalDot = false;
+
+    if (*P == '+' || *P == '-')
+    {
+        Sign = *P++;
+        if (P != End && *P == '.')
+            LeadingDecimalDot = true;
+    }
+    else if (*P == '.')
+    {
+        LeadingDecimalDot = true;
+    }
+    else if (!IsDigit(*P))
+    {
+        return false;
+    }
+
+    // Integer part.
+    if (!LeadingDecimalDot)
+    {
+        while (P != End && IsDigit(*P))
+        {
+            Mantissa *= 10;
+            Mantissa += static_cast<int>(*P - '0');
+            P++;
+            Read++;
+        }
+        if (Read == 0) return false;
+    }
+
+    if (P != End)
+    {
+        // Fractional part.
+        if (*P == '.')
+        {
+            static double const POWERS[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+            P++;
+            Read = 1;
+            while (P != End && IsDigit(*P))
+            {
+                Mantissa += static_cast<int>(*P - '0') * (Read < 8 ? POWERS[Read] : std::pow(10.0, -Read));
+                Read++;
+                P++;
+            }
+        }
+        else if (*P != 'e' && *P != 'E')
+        {
+            P = End;
+        }
+
+        // Exponent part.
+        if (P != End && (*P == 'e' || *P == 'E'))
+        {
+            P++;
+            if (P != End && (*P == '+' || *P == '-'))
+                ExponentSign = *P++;
+            else if (P == End || !IsDigit(*P))
+                return false;
+
+            Read = 0;
+            while (P != End && IsDigit(*P))
+            {
+                if (Exponent > 2147483647 / 10)
+                    return false;
+                Exponent = 10 * Exponent + static_cast<int>(*P - '0');
+                P++;
+                Read++;
+            }
+            Exponent *= ExponentSign == '+' ? 1 : -1;
+            if (Read == 0) return false;
+        }
+    }
+
+    *Result = (Sign == '+' ? 1 : -1) * (Exponent ? std::ldexp(Mantissa * std::pow(5.0, Exponent), Exponent) : Mantissa);
+
+    return true;
+}
+
+static float ParseReal(char const*& P, char const* End, double Default = 0.0)
+{
+    P = SkipBlanks(P, End);
+    char const* TokenEnd = FindTokenEnd(P, End);
+    double Value = Default;
+    ParseDouble(P, TokenEnd, &Value);
+    P = TokenEnd;
+    return static_cast<float>(Value);
+}
+
+static bool ParseReal(char const*& P, char const* End, float* Out)
+{
+    P = SkipBlanks(P, End);
+    char const* TokenEnd = FindTokenEnd(P, End);
+    double Value;
+    bool Result = ParseDouble(P, TokenEnd, &Value);
+    if (Result) *Out = static_cast<float>(Value);
+    P = TokenEnd;
+    return Result;
+}
+
+static std::string ParseString(char const*& P, char const* End)
+{
+    P = SkipBlanks(P, End);
+    char const* TokenEnd = FindTokenEnd(P, End);
+    auto String = std::string(P, TokenEnd);
+    P = TokenEnd;
+    return String;
+}
+
+static void SplitString(std::string const& String, char Delimiter, char Escape, std::vector<std::string>& Elements)
+{
+    std::string Token;
+    bool Escaping = false;
+    for (char C : String)
+    {
+        if (Escaping)
+        {
+            Escaping = false;
+        }
+        else if (C == Escape)
+        {
+            Escaping = true;
+            continue;
+        }
+        else if (C == Delimiter)
+        {
+            if (!Token.empty())
+                Elements.push_back(Token);
+            Token.clear();
+            continue;
+        }
+        Token += C;
+    }
+    Elements.push_back(Token);
+}
+
+/* --- Chunk Parsing ------------------------------------------------------- */
+
+struct obj_face
+{
+    uint32_t FirstVertex;
+    uint32_t VertexCount;
+    uint32_t Line;
+    // Number of positions, normals and texture coordinates defined in the
+    // chunk before this face, for resolving relative indices.
+    uint32_t PositionCount;
+    uint32_t NormalCount;
+    uint32_t TexCoordCount;
+};
+
+enum obj_command_type
+{
+    OBJ_COMMAND_GROUP,
+    OBJ_COMMAND_OBJECT,
+    OBJ_COMMAND_USE_MATERIAL,
+    OBJ_COMMAND_MATERIAL_LIBRARY,
+    OBJ_COMMAND_SMOOTHING_GROUP,
+};
+
+// Statement that affects how the faces following it are assembled.
+struct obj_command
+{
+    obj_command_type Type;
+    uint32_t         FaceIndex;     // Index of the next face in the chunk.
+    uint32_t         TriangleIndex; // Index of the next triangle in the chunk.
+    uint32_t         Line;
+    int              Value;         // Smoothing group, material ID, or 1 for an empty group name.
+    std::string      Argument;
+};
+
+struct obj_chunk
+{
+    char const* Begin;
+    char const* End;
+
+    uint32_t LineCount = 0;
+
+    std::vector<float> Positions;
+    std::vector<float> Weights;
+    std::vector<float> Colors;
+    std::vector<float> Normals;
+    std::vector<float> TexCoords;
+
+    // Raw (position, texcoord, normal) index triples of the face vertices,
+    // with 0 meaning that the index was not given.
+    std::vector<int>         FaceVertices;
+    std::vector<obj_face>    Faces;
+    std::vector<obj_command> Commands;
+
+    // Filled in when merging the chunks.
+    size_t       PositionOffset = 0;
+    size_t       NormalOffset = 0;
+    size_t       TexCoordOffset = 0;
+    size_t       TriangleOffset = 0;
+    size_t       LineOffset = 0;
+    int          InitialMaterialId = -1;
+    unsigned int InitialSmoothingGroupId = 0;
+
+    // Triangulated faces.
+    std::vector<tinyobj::index_t> Indices;
+    std::vector<int>              MaterialIds;
+    std::vector<unsigned int>     SmoothingGroupIds;
+    int                           GreatestIndex[3] = { -1, -1, -1 };
+
+    std::string Warnings;
+    std::string Errors;
+    uint32_t    ErrorLine = 0;
+};
+
+static void ParseChunk(obj_chunk* Chunk)
+{
+    char const* P = Chunk->Begin;
+
+    while (P < Chunk->End)
+    {
+        char const* End = static_cast<char const*>(memchr(P, '\n', Chunk->End - P));
+        char const* Next = End ? End + 1 : Chunk->End;
+        if (!End) End = Chunk->End;
+        if (End > P && End[-1] == '\r') End--;
+
+        uint32_t Line = Chunk->LineCount++;
+        char const* T = SkipBlanks(P, End);
+        P = Next;
+
+        if (T == End || *T == '#' || *T == '\0')
+            continue;
+
+        char C0 = *T;
+        char C1 = T + 1 < End ? T[1] : '\0';
+        char C2 = T + 2 < End ? T[2] : '\0';
+
+        // Vertex position, with an optional weight or color.
+        if (C0 == 'v' && IsSpace(C1))
+        {
+            T += 2;
+            float X = ParseReal(T, End);
+            float Y = ParseReal(T, End);
+            float Z = ParseReal(T, End);
+            float R, G, B;
+            if (!ParseReal(T, End, &R))
+                R = G = B = 1.0f;
+            else if (!ParseReal(T, End, &G))
+                G = B = 1.0f;
+            else if (!ParseReal(T, End, &B))
+                R = G = B = 1.0f;
+
+            Chunk->Positions.insert(Chunk->Positions.end(), { X, Y, Z });
+            Chunk->Weights.push_back(R);
+            Chunk->Colors.insert(Chunk->Colors.end(), { R, G, B });
+            continue;
+        }
+
+        // Vertex normal.
+        if (C0 == 'v' && C1 == 'n' && IsSpace(C2))
+        {
+            T += 3;
+            float X = ParseReal(T, End);
+            float Y = ParseReal(T, End);
+            float Z = ParseReal(T, End);
+            Chunk->Normals.insert(Chunk->Normals.end(), { X, Y, Z });
+            continue;
+        }
+
+        // Texture coordinate.
+        if (C0 == 'v' && C1 == 't' && IsSpace(C2))
+        {
+            T += 3;
+            float X = ParseReal(T, End);
+            float Y = ParseReal(T, End);
+            Chunk->TexCoords.insert(Chunk->TexCoords.end(), { X, Y });
+            continue;
+        }
+
+        // Face.
+        if (C0 == 'f' && IsSpace(C1))
+        {
+            T = SkipBlanks(T + 2, End);
+
+            obj_face Face =
+            {
+                .FirstVertex = static_cast<uint32_t>(Chunk->FaceVertices.size() / 3),
+                .VertexCount = 0,
+                .Line = Line,
+                .PositionCount = static_cast<uint32_t>(Chunk->Positions.size() / 3),
+                .NormalCount = static_cast<uint32_t>(Chunk->Normals.size() / 3),
+                .TexCoordCount = static_cast<uint32_t>(Chunk->TexCoords.size() / 2),
+            };
+
+            while (!IsLineEnd(T, End))
+            {
+                int Index[3] = {};
+
+                Index[0] = ParseInt(T, End);
+                if (Index[0] == 0)
+                {
+                    Chunk->Errors += "Failed to parse `f' line (e.g. a zero value for vertex index or invalid relative vertex index).";
+                    Chunk->ErrorLine = Line;
+                    return;
+                }
+                T = FindIndexEnd(T, End);
+
+                if (T < End && *T == '/')
+                {
+                    T++;
+                    if (T < End && *T == '/')
+                    {
+                        // i//k
+                        T++;
+                        Index[2] = ParseInt(T, End);
+                        T = FindIndexEnd(T, End);
+                    }
+                    else
+                    {
+                        // i/j or i/j/k
+                        Index[1] = ParseInt(T, End);
+                        T = FindIndexEnd(T, End);
+                        if (T < End && *T == '/')
+                        {
+                            T++;
+                            Index[2] = ParseInt(T, End);
+                            T = FindIndexEnd(T, End);
+                        }
+                    }
+                }
+
+                Chunk->FaceVertices.insert(Chunk->FaceVertices.end(), { Index[0], Index[1], Index[2] });
+                Face.VertexCount++;
+
+                T = SkipSeparators(T, End);
+            }
+
+            Chunk->Faces.push_back(Face);
+            continue;
+        }
+
+        obj_command Command =
+        {
+            .FaceIndex = static_cast<uint32_t>(Chunk->Faces.size()),
+            .Line = Line,
+            .Value = 0,
+        };
+
+        // Material selection.
+        if (End - T >= 6 && strncmp(T, "usemtl", 6) == 0)
+        {
+            T += 6;
+            Command.Type = OBJ_COMMAND_USE_MATERIAL;
+            Command.Argument = ParseString(T, End);
+            Chunk->Commands.push_back(std::move(Command));
+            continue;
+        }
+
+        // Material library.
+        if (End - T >= 7 && strncmp(T, "mtllib", 6) == 0 && IsSpace(T[6]))
+        {
+            Command.Type = OBJ_COMMAND_MATERIAL_LIBRARY;
+            Command.Argument = std::string(T + 7, End);
+            Chunk->Commands.push_back(std::move(Command));
+            continue;
+        }
+
+        // Group name.
+        if (C0 == 'g' && IsSpace(C1))
+        {
+            std::vector<std::string> Names;
+            while (!IsLineEnd(T, End))
+            {
+                Names.push_back(ParseString(T, End));
+                T = SkipSeparators(T, End);
+            }
+
+            Command.Type = OBJ_COMMAND_GROUP;
+            if (Names.size() < 2)
+            {
+                Command.Value = 1;
+            }
+            else
+            {
+                Command.Argument = Names[1];
+                for (size_t I = 2; I < Names.size(); I++)
+                    Command.Argument += " " + Names[I];
+            }
+            Chunk->Commands.push_back(std::move(Command));
+            continue;
+        }
+
+        // Object name.
+        if (C0 == 'o' && IsSpace(C1))
+        {
+            Command.Type = OBJ_COMMAND_OBJECT;
+            Command.Argument = std::string(T + 2, End);
+            Chunk->Commands.push_back(std::move(Command));
+            continue;
+        }
+
+        // Smoothing group.
+        if (C0 == 's' && IsSpace(C1))
+        {
+            T = SkipBlanks(T + 2, End);
+            if (IsLineEnd(T, End))
+                continue;
+
+            Command.Type = OBJ_COMMAND_SMOOTHING_GROUP;
+            if (End - T >= 3 && strncmp(T, "off", 3) == 0)
+                Command.Value = 0;
+            else
+                Command.Value = std::max(ParseInt(T, End), 0);
+            Chunk->Commands.push_back(std::move(Command));
+            continue;
+        }
+
+        // Other statements (lines, points, skin weights, tags) are ignored.
+    }
+}
+
+// Resolves a raw OBJ index into a zero-based index, given the number of
+// elements defined before it.  Returns false for an invalid relative index.
+static bool ResolveIndex(int Raw, size_t Count, int* Index)
+{
+    if (Raw > 0)
+        *Index = Raw - 1;
+    else if (Raw == 0)
+        *Index = -1;
+    else
+        *Index = static_cast<int>(Count) + Raw;
+    return *Index >= -1 && (Raw == 0 || *Index >= 0);
+}
+
+// Even-odd test of whether a point is inside a 2D triangle.
+static bool IsInsideTriangle(float const X[3], float const Y[3], float TestX, float TestY)
+{
+    bool Inside = false;
+    for (int I = 0, J = 2; I < 3; J = I++)
+    {
+        if ((Y[I] > TestY) != (Y[J] > TestY) && TestX < (X[J] - X[I]) * (TestY - Y[I]) / (Y[J] - Y[I]) + X[I])
+            Inside = !Inside;
+    }
+    return Inside;
+}
+
+// Triangulates a polygon of more than four vertices by ear clipping in the
+// coordinate plane of its first corner, exactly like tinyobjloader does, so
+// that concave polygons give the same triangles.  Consumes the polygon.
+template<typename emit_function>
+static void TriangulatePolygon(std::vector<tinyobj::index_t>& Polygon, std::vector<float> const& Positions, emit_function&& Emit)
+{
+    auto IsValid = [&](size_t V, size_t Offset) { return 3 * V + Offset < Positions.size(); };
+
+    // Find the two axes to work in.
+    size_t Axes[2] = { 1, 2 };
+    size_t Count = Polygon.size();
+
+    for (size_t K = 0; K < Count; K++)
+    {
+        size_t V0 = static_cast<size_t>(Polygon[(K + 0) % Count].vertex_index);
+        size_t V1 = static_cast<size_t>(Polygon[(K + 1) % Count].vertex_index);
+        size_t V2 = static_cast<size_t>(Polygon[(K + 2) % Count].vertex_index);
+        if (!IsValid(V0, 2) || !IsValid(V1, 2) || !IsValid(V2, 2))
+            continue;
+
+        float E0X = Positions[3*V1+0] - Positions[3*V0+0];
+        float E0Y = Positions[3*V1+1] - Positions[3*V0+1];
+        float E0Z = Positions[3*V1+2] - Positions[3*V0+2];
+        float E1X = Positions[3*V2+0] - Positions[3*V1+0];
+        float E1Y = Positions[3*V2+1] - Positions[3*V1+1];
+        float E1Z = Positions[3*V2+2] - Positions[3*V1+2];
+        float CX = std::fabs(E0Y * E1Z - E0Z * E1Y);
+        float CY = std::fabs(E0Z * E1X - E0X * E1Z);
+        float CZ = std::fabs(E0X * E1Y - E0Y * E1X);
+
+        float const Epsilon = std::numeric_limits<float>::epsilon();
+        if (CX > Epsilon || CY > Epsilon || CZ > Epsilon)
+        {
+            if (!(CX > CY && CX > CZ))
+            {
+                Axes[0] = 0;
+                if (CZ > CX && CZ > CY)
+                    Axes[1] = 1;
+            }
+            break;
+        }
+    }
+
+    size_t GuessIndex = 0;
+    size_t RemainingIterations = Count;
+    size_t PreviousCount = Count;
+
+    while (Polygon.size() > 3 && RemainingIterations > 0)
+    {
+        Count = Polygon.size();
+        if (GuessIndex >= Count)
+            GuessIndex -= Count;
+
+        // Give up once a full round finds no ear.
+        if (PreviousCount != Count)
+        {
+            PreviousCount = Count;
+            RemainingIterations = Count;
+        }
+        else
+        {
+            RemainingIterations--;
+        }
+
+        tinyobj::index_t Corners[3];
+        float X[3], Y[3];
+        for (int K = 0; K < 3; K++)
+        {
+            Corners[K] = Polygon[(GuessIndex + K) % Count];
+            size_t V = static_cast<size_t>(Corners[K].vertex_index);
+            bool Valid = IsValid(V, Axes[0]) && IsValid(V, Axes[1]);
+            X[K] = Valid ? Positions[3*V+Axes[0]] : 0.0f;
+            Y[K] = Valid ? Positions[3*V+Axes[1]] : 0.0f;
+        }
+
+        // Skip reflex corners.
+        float Cross = (X[1] - X[0]) * (Y[2] - Y[1]) - (Y[1] - Y[0]) * (X[2] - X[1]);
+        float Area = (X[0] * Y[1] - Y[0] * X[1]) * 0.5f;
+        if (Cross * Area < 0.0f)
+        {
+            GuessIndex++;
+            continue;
+        }
+
+        // Skip corners whose triangle contains another vertex.
+        bool Overlap = false;
+        for (size_t K = 3; K < Count; K++)
+        {
+            size_t V = static_cast<size_t>(Polygon[(GuessIndex + K) % Count].vertex_index);
+            if (!IsValid(V, Axes[0]) || !IsValid(V, Axes[1]))
+                continue;
+            if (IsInsideTriangle(X, Y, Positions[3*V+Axes[0]], Positions[3*V+Axes[1]]))
+            {
+                Overlap = true;
+                break;
+            }
+        }
+
+        if (Overlap)
+        {
+            GuessIndex++;
+            continue;
+        }
+
+        Emit(Corners[0], Corners[1], Corners[2]);
+        Polygon.erase(Polygon.begin() + (GuessIndex + 1) % Count);
+    }
+
+    if (Polygon.size() == 3)
+        Emit(Polygon[0], Polygon[1], Polygon[2]);
+}
+
+// Triangulates the faces of a chunk, using the global position array for
+// choosing the split diagonal of quads and clipping the ears of polygons.
+static void TriangulateChunk(obj_chunk* Chunk, std::vector<float> const& Positions)
+{
+    int MaterialId = Chunk->InitialMaterialId;
+    unsigned int SmoothingGroupId = Chunk->InitialSmoothingGroupId;
+
+    size_t CommandIndex = 0;
+    std::vector<tinyobj::index_t> Polygon;
+
+    auto Emit = [&](tinyobj::index_t const& A, tinyobj::index_t const& B, tinyobj::index_t const& C)
+    {
+        Chunk->Indices.insert(Chunk->Indices.end(), { A, B, C });
+        Chunk->MaterialIds.push_back(MaterialId);
+        Chunk->SmoothingGroupIds.push_back(SmoothingGroupId);
+    };
+
+    auto ApplyCommands = [&](size_t FaceIndex)
+    {
+        while (CommandIndex < Chunk->Commands.size() && Chunk->Commands[CommandIndex].FaceIndex <= FaceIndex)
+        {
+            obj_command& Command = Chunk->Commands[CommandIndex++];
+            Command.TriangleIndex = static_cast<uint32_t>(Chunk->MaterialIds.size());
+            if (Command.Type == OBJ_COMMAND_USE_MATERIAL)
+                MaterialId = Command.Value;
+            else if (Command.Type == OBJ_COMMAND_SMOOTHING_GROUP)
+                SmoothingGroupId = static_cast<unsigned int>(Command.Value);
+        }
+    };
+
+    for (size_t FaceIndex = 0; FaceIndex < Chunk->Faces.size(); FaceIndex++)
+    {
+        ApplyCommands(FaceIndex);
+
+        obj_face const& Face = Chunk->Faces[FaceIndex];
+
+        Polygon.resize(Face.VertexCount);
+        for (uint32_t I = 0; I < Face.VertexCount; I++)
+        {
+            int const* Raw = &Chunk->FaceVertices[3 * (Face.FirstVertex + I)];
+            tinyobj::index_t& Index = Polygon[I];
+
+            bool Valid = ResolveIndex(Raw[0], Chunk->PositionOffset + Face.PositionCount, &Index.vertex_index)
+                      && ResolveIndex(Raw[1], Chunk->TexCoordOffset + Face.TexCoordCount, &Index.texcoord_index)
+                      && ResolveIndex(Raw[2], Chunk->NormalOffset + Face.NormalCount, &Index.normal_index);
+
+            if (!Valid)
+            {
+                Chunk->Errors += "Failed to parse `f' line (e.g. a zero value for vertex index or invalid relative vertex index).";
+                Chunk->ErrorLine = Face.Line;
+                return;
+            }
+
+            Chunk->GreatestIndex[0] = std::max(Chunk->GreatestIndex[0], Index.vertex_index);
+            Chunk->GreatestIndex[1] = std::max(Chunk->GreatestIndex[1], Index.normal_index);
+            Chunk->GreatestIndex[2] = std::max(Chunk->GreatestIndex[2], Index.texcoord_index);
+        }
+
+        if (Face.VertexCount < 3)
+        {
+            Chunk->Warnings += "Degenerated face found\n.";
+            continue;
+        }
+
+        if (Face.VertexCount == 3)
+        {
+            Emit(Polygon[0], Polygon[1], Polygon[2]);
+            continue;
+        }
+
+        if (Face.VertexCount == 4)
+        {
+            size_t V[4];
+            for (int I = 0; I < 4; I++)
+                V[I] = static_cast<size_t>(Polygon[I].vertex_index);
+
+            if (3 * V[0] + 2 >= Positions.size() || 3 * V[1] + 2 >= Positions.size()
+             || 3 * V[2] + 2 >= Positions.size() || 3 * V[3] + 2 >= Positions.size())
+            {
+                Chunk->Warnings += "Face with invalid vertex index found.\n";
+                continue;
+            }
+
+            // Split the quad along its shorter diagonal.
+            float E02X = Positions[3*V[2]+0] - Positions[3*V[0]+0];
+            float E02Y = Positions[3*V[2]+1] - Positions[3*V[0]+1];
+            float E02Z = Positions[3*V[2]+2] - Positions[3*V[0]+2];
+            float E13X = Positions[3*V[3]+0] - Positions[3*V[1]+0];
+            float E13Y = Positions[3*V[3]+1] - Positions[3*V[1]+1];
+            float E13Z = Positions[3*V[3]+2] - Positions[3*V[1]+2];
+            float Length02 = E02X * E02X + E02Y * E02Y + E02Z * E02Z;
+            float Length13 = E13X * E13X + E13Y * E13Y + E13Z * E13Z;
+
+            if (Length02 < Length13)
+            {
+                Emit(Polygon[0], Polygon[1], Polygon[2]);
+                Emit(Polygon[0], Polygon[2], Polygon[3]);
+            }
+            else
+            {
+                Emit(Polygon[0], Polygon[1], Polygon[3]);
+                Emit(Polygon[1], Polygon[2], Polygon[3]);
+            }
+            continue;
+        }
+
+        TriangulatePolygon(Polygon, Positions, Emit);
+    }
+
+    ApplyCommands(SIZE_MAX);
+}
+
+/* --- Parsing ------------------------------------------------------------- */
+
+bool ParseObjFile
+(
+    char const*                       Path,
+    char const*                       MaterialDirectory,
+    tinyobj::attrib_t*                Attrib,
+    std::vector<tinyobj::shape_t>*    Shapes,
+    std::vector<tinyobj::material_t>* Materials,
+    std::string*                      Warnings,
+    std::string*                      Errors,
+    std::vector<std::string>*         MaterialFilePaths
+)
+{
+    *Attrib = {};
+    Shapes->clear();
+
+    mapped_file File;
+    if (!MapFile(&File, Path))
+    {
+        *Errors += std::format("Cannot open file [{}]\n", Path);
+        return false;
+    }
+
+    // Split the file into chunks at line boundaries.
+    size_t const CHUNK_SIZE = 4 << 20;
+
+    auto Begin = static_cast<char const*>(File.Data);
+    auto End = Begin + File.Size;
+
+    std::vector<obj_chunk> Chunks;
+    for (char const* P = Begin; P < End;)
+    {
+        char const* ChunkEnd = End;
+        if (static_cast<size_t>(End - P) > CHUNK_SIZE)
+        {
+            auto NewLine = static_cast<char const*>(memchr(P + CHUNK_SIZE, '\n', End - P - CHUNK_SIZE));
+            if (NewLine) ChunkEnd = NewLine + 1;
+        }
+
+        obj_chunk& Chunk = Chunks.emplace_back();
+        Chunk.Begin = P;
+        Chunk.End = ChunkEnd;
+        P = ChunkEnd;
+    }
+
+    ParallelFor(Chunks.size(), [&](size_t Index)
+    {
+        ParseChunk(&Chunks[Index]);
+    });
+
+    auto Fail = [&](obj_chunk const& Chunk)
+    {
+        *Errors += std::format("{} Line {}).\n", Chunk.Errors, Chunk.LineOffset + Chunk.ErrorLine + 1);
+        UnmapFile(&File);
+        return false;
+    };
+
+    // Compute the offsets of the chunks in the merged arrays, and load the
+    // material libraries and resolve material names in file order.
+    std::string BaseDirectory = MaterialDirectory ? MaterialDirectory : "";
+    if (!BaseDirectory.empty() && BaseDirectory.back() != '/' && BaseDirectory.back() != '\\')
+    {
+#ifdef _WIN32
+        BaseDirectory += '\\';
+#else
+        BaseDirectory += '/';
+#endif
+    }
+    auto ReadMaterialFile = tinyobj::MaterialFileReader(BaseDirectory);
+
+    std::map<std::string, int> MaterialMap;
+    std::set<std::string> MaterialFileNames;
+
+    size_t PositionCount = 0, NormalCount = 0, TexCoordCount = 0, LineCount = 0;
+    int MaterialId = -1;
+    unsigned int SmoothingGroupId = 0;
+
+    for (obj_chunk& Chunk : Chunks)
+    {
+        if (!Chunk.Errors.empty())
+        {
+            Chunk.LineOffset = LineCount;
+            return Fail(Chunk);
+        }
+
+        Chunk.PositionOffset = PositionCount;
+        Chunk.NormalOffset = NormalCount;
+        Chunk.TexCoordOffset = TexCoordCount;
+        Chunk.LineOffset = LineCount;
+        Chunk.InitialMaterialId = MaterialId;
+        Chunk.InitialSmoothingGroupId = SmoothingGroupId;
+
+        PositionCount += Chunk.Positions.size() / 3;
+        NormalCount += Chunk.Normals.size() / 3;
+        TexCoordCount += Chunk.TexCoords.size() / 2;
+        LineCount += Chunk.LineCount;
+
+        for (obj_command& Command : Chunk.Commands)
+        {
+            if (Command.Type == OBJ_COMMAND_MATERIAL_LIBRARY)
+            {
+                std::vector<std::string> FileNames;
+                SplitString(Command.Argument, ' ', '\\', FileNames);
+
+                bool Found = false;
+                for (std::string const& FileName : FileNames)
+                {
+                    if (MaterialFileNames.contains(FileName))
+                    {
+                        Found = true;
+                        continue;
+                    }
+
+                    std::string MaterialWarnings, MaterialErrors;
+                    bool Result = ReadMaterialFile(FileName, Materials, &MaterialMap, &MaterialWarnings, &MaterialErrors);
+                    *Warnings += MaterialWarnings;
+                    *Errors += MaterialErrors;
+
+                    if (Result)
+                    {
+                        Found = true;
+                        MaterialFileNames.insert(FileName);
+                        if (MaterialFilePaths)
+                            MaterialFilePaths->push_back(BaseDirectory + FileName);
+                        break;
+                    }
+                }
+
+                if (!Found)
+                    *Warnings += "Failed to load material file(s). Use default material.\n";
+            }
+            else if (Command.Type == OBJ_COMMAND_USE_MATERIAL)
+            {
+                auto It = MaterialMap.find(Command.Argument);
+                if (It != MaterialMap.end())
+                    Command.Value = It->second;
+                else
+                {
+                    Command.Value = -1;
+                    *Warnings += "material [ '" + Command.Argument + "' ] not found in .mtl\n";
+                }
+                MaterialId = Command.Value;
+            }
+            else if (Command.Type == OBJ_COMMAND_SMOOTHING_GROUP)
+            {
+                SmoothingGroupId = static_cast<unsigned int>(Command.Value);
+            }
+            else if (Command.Type == OBJ_COMMAND_GROUP && Command.Value)
+            {
+                *Warnings += std::format("Empty group name. line: {}\n", Chunk.LineOffset + Command.Line + 1);
+            }
+        }
+    }
+
+    // Merge the vertex attribute arrays.
+    Attrib->vertices.resize(3 * PositionCount);
+    Attrib->vertex_weights.resize(PositionCount);
+    Attrib->colors.resize(3 * PositionCount);
+    Attrib->normals.resize(3 * NormalCount);
+    Attrib->texcoords.resize(2 * TexCoordCount);
+
+    ParallelFor(Chunks.size(), [&](size_t Index)
+    {
+        obj_chunk& Chunk = Chunks[Index];
+        std::ranges::copy(Chunk.Positions, Attrib->vertices.begin() + 3 * Chunk.PositionOffset);
+        std::ranges::copy(Chunk.Weights, Attrib->vertex_weights.begin() + Chunk.PositionOffset);
+        std::ranges::copy(Chunk.Colors, Attrib->colors.begin() + 3 * Chunk.PositionOffset);
+        std::ranges::copy(Chunk.Normals, Attrib->normals.begin() + 3 * Chunk.NormalOffset);
+        std::ranges::copy(Chunk.TexCoords, Attrib->texcoords.begin() + 2 * Chunk.TexCoordOffset);
+    });
+
+    ParallelFor(Chunks.size(), [&](size_t Index)
+    {
+        TriangulateChunk(&Chunks[Index], Attrib->vertices);
+    });
+
+    // Collect warnings and errors, and compute the triangle offsets.
+    size_t TriangleCount = 0;
+    int GreatestIndex[3] = { -1, -1, -1 };
+    for (obj_chunk& Chunk : Chunks)
+    {
+        *Warnings += Chunk.Warnings;
+        if (!Chunk.Errors.empty())
+            return Fail(Chunk);
+
+        Chunk.TriangleOffset = TriangleCount;
+        TriangleCount += Chunk.MaterialIds.size();
+
+        for (int I = 0; I < 3; I++)
+            GreatestIndex[I] = std::max(GreatestIndex[I], Chunk.GreatestIndex[I]);
+    }
+
+    if (GreatestIndex[0] >= static_cast<int>(PositionCount))
+        *Warnings += std::format("Vertex indices out of bounds (line {}.)\n\n", LineCount);
+    if (GreatestIndex[1] >= static_cast<int>(NormalCount))
+        *Warnings += std::format("Vertex normal indices out of bounds (line {}.)\n\n", LineCount);
+    if (GreatestIndex[2] >= static_cast<int>(TexCoordCount))
+        *Warnings += std::format("Vertex texcoord indices out of bounds (line {}.)\n\n", LineCount);
+
+    // Group and object statements start new shapes.  Each shape covers a
+    // range of the triangles, and shapes without any are dropped.
+    struct shape_range
+    {
+        std::string Name;
+        size_t      Begin;
+        size_t      End;
+    };
+
+    std::vector<shape_range> Ranges;
+    shape_range Current = { "", 0, 0 };
+
+    for (obj_chunk const& Chunk : Chunks)
+    {
+        for (obj_command const& Command : Chunk.Commands)
+        {
+            if (Command.Type != OBJ_COMMAND_GROUP && Command.Type != OBJ_COMMAND_OBJECT)
+                continue;
+
+            Current.End = Chunk.TriangleOffset + Command.TriangleIndex;
+            if (Current.End > Current.Begin)
+                Ranges.push_back(Current);
+
+            Current = { Command.Argument, Current.End, Current.End };
+        }
+    }
+
+    Current.End = TriangleCount;
+    if (Current.End > Current.Begin)
+        Ranges.push_back(Current);
+
+    Shapes->resize(Ranges.size());
+    for (size_t Index = 0; Index < Ranges.size(); Index++)
+    {
+        tinyobj::shape_t& Shape = (*Shapes)[Index];
+        size_t Count = Ranges[Index].End - Ranges[Index].Begin;
+        Shape.name = Ranges[Index].Name;
+        Shape.mesh.indices.resize(3 * Count);
+        Shape.mesh.num_face_vertices.assign(Count, 3);
+        Shape.mesh.material_ids.resize(Count);
+        Shape.mesh.smoothing_group_ids.resize(Count);
+    }
+
+    // Copy the triangles of each chunk into the shapes that they belong to.
+    ParallelFor(Chunks.size(), [&](size_t Index)
+    {
+        obj_chunk const& Chunk = Chunks[Index];
+
+        size_t ChunkBegin = Chunk.TriangleOffset;
+        size_t ChunkEnd = Chunk.TriangleOffset + Chunk.MaterialIds.size();
+
+        auto It = std::ranges::upper_bound(Ranges, ChunkBegin, {}, &shape_range::Begin);
+        size_t RangeIndex = It == Ranges.begin() ? 0 : It - Ranges.begin() - 1;
+
+        for (; RangeIndex < Ranges.size() && Ranges[RangeIndex].Begin < ChunkEnd; RangeIndex++)
+        {
+            shape_range const& Range = Ranges[RangeIndex];
+            size_t CopyBegin = std::max(ChunkBegin, Range.Begin);
+            size_t CopyEnd = std::min(ChunkEnd, Range.End);
+            if (CopyBegin >= CopyEnd) continue;
+
+            size_t Source = CopyBegin - ChunkBegin;
+            size_t Target = CopyBegin - Range.Begin;
+            size_t Count = CopyEnd - CopyBegin;
+
+            tinyobj::mesh_t& Mesh = (*Shapes)[RangeIndex].mesh;
+            std::copy_n(Chunk.Indices.begin() + 3 * Source, 3 * Count, Mesh.indices.begin() + 3 * Target);
+            std::copy_n(Chunk.MaterialIds.begin() + Source, Count, Mesh.material_ids.begin() + Target);
+            std::copy_n(Chunk.SmoothingGroupIds.begin() + Source, Count, Mesh.smoothing_group_ids.begin() + Target);
+        }
+    });
+
+    UnmapFile(&File);
+
+    return true;
+}
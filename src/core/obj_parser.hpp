@@ -0,0 +1,28 @@
+#pragma once
+
+#include "core/tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+// Parses a Wavefront OBJ file into the same data that tinyobj::LoadObj()
+// produces with its default options, using all available cores.  The file
+// is mapped into memory and split into chunks at line boundaries, which
+// are parsed concurrently and then merged with their indices fixed up.
+//
+// Differences to tinyobj::LoadObj(): line, point, skin weight and tag
+// elements are ignored.
+//
+// If MaterialFilePaths is given, the paths of the material libraries that
+// were loaded are appended to it.
+bool ParseObjFile
+(
+    char const*                       Path,
+    char const*                       MaterialDirectory,
+    tinyobj::attrib_t*                Attrib,
+    std::vector<tinyobj::shape_t>*    Shapes,
+    std::vector<tinyobj::material_t>* Materials,
+    std::string*                      Warnings,
+    std::string*                      Errors,
+    std::vector<std::string>*         MaterialFilePaths = nullptr
+);
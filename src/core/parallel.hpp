@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns the number of worker threads to use for parallel loops.
+inline uint32_t GetWorkerThreadCount()
+{
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/* --- Thread Pool -------------------------------------------------------- */
+
+// Worker threads shared by all parallel loops and task graphs, so that
+// concurrent users split one set of cores instead of each starting their
+// own threads.  The threads that submit work also take part in it, so the
+// pool has one thread less than the worker thread count.  Jobs must not
+// block on other queued jobs.
+struct thread_pool
+{
+    std::mutex                        Mutex;
+    std::condition_variable           Condition;
+    std::deque<std::function<void()>> Jobs;
+    std::vector<std::thread>          Threads;
+    bool                              IsStopping = false;
+
+    thread_pool()
+    {
+        for (uint32_t I = 1; I < GetWorkerThreadCount(); I++)
+        {
+            Threads.emplace_back([this]()
+            {
+                std::unique_lock<std::mutex> Lock(Mutex);
+                while (true)
+                {
+                    Condition.wait(Lock, [this] { return !Jobs.empty() || IsStopping; });
+                    if (IsStopping) break;
+
+                    std::function<void()> Job = std::move(Jobs.front());
+                    Jobs.pop_front();
+
+                    Lock.unlock();
+                    Job();
+                    Lock.lock();
+                }
+            });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            IsStopping = true;
+        }
+        Condition.notify_all();
+        for (std::thread& Thread : Threads)
+            Thread.join();
+    }
+};
+
+inline thread_pool& GetThreadPool()
+{
+    static thread_pool Pool;
+    return Pool;
+}
+
+// Queues Count copies of a job to run on the threads of the pool.
+inline void SubmitThreadPoolJobs(size_t Count, std::function<void()> const& Job)
+{
+    if (Count == 0) return;
+
+    thread_pool& Pool = GetThreadPool();
+    {
+        std::lock_guard<std::mutex> Lock(Pool.Mutex);
+        for (size_t I = 0; I < Count; I++)
+            Pool.Jobs.push_back(Job);
+    }
+    Pool.Condition.notify_all();
+}
+
+/* --- Parallel Loops ------------------------------------------------------ */
+
+// Set on threads that are running the body of a ParallelFor() loop.
+inline thread_local bool IsInsideParallelFor = false;
+
+// Calls Function(Index) for every Index in [0, Count), distributing the
+// calls dynamically over the threads of the pool.  The calling thread
+// participates in the work, and the call returns once all of it is done.
+// Nested loops run serially on the thread that encounters them.
+template<typename function>
+void ParallelFor(size_t Count, function const& Function)
+{
+    size_t ThreadCount = std::min<size_t>(GetWorkerThreadCount(), Count);
+
+    if (ThreadCount <= 1 || IsInsideParallelFor)
+    {
+        for (size_t Index = 0; Index < Count; Index++)
+            Function(Index);
+        return;
+    }
+
+    // Pool threads may pick up their copy of the job after the loop is
+    // over, so the loop state is shared with them.  They only touch the
+    // function while indices remain.
+    struct loop_state
+    {
+        std::atomic<size_t> NextIndex = 0;
+        std::atomic<size_t> DoneCount = 0;
+    };
+
+    auto Loop = std::make_shared<loop_state>();
+
+    auto Worker = [Loop, Count, &Function]()
+    {
+        bool WasInsideParallelFor = IsInsideParallelFor;
+        IsInsideParallelFor = true;
+        while (true)
+        {
+            size_t Index = Loop->NextIndex.fetch_add(1, std::memory_order_relaxed);
+            if (Index >= Count) break;
+            Function(Index);
+            if (Loop->DoneCount.fetch_add(1, std::memory_order_acq_rel) + 1 == Count)
+                Loop->DoneCount.notify_all();
+        }
+        IsInsideParallelFor = WasInsideParallelFor;
+    };
+
+    SubmitThreadPoolJobs(ThreadCount - 1, Worker);
+
+    Worker();
+
+    // Wait for the indices still running on the pool threads.
+    size_t DoneCount;
+    while ((DoneCount = Loop->DoneCount.load(std::memory_order_acquire)) != Count)
+        Loop->DoneCount.wait(DoneCount, std::memory_order_acquire);
+}
+
+// Calls Function(Begin, End) for consecutive blocks of at most BlockSize
+// indices covering [0, Count), in parallel as with ParallelFor().
+template<typename function>
+void ParallelForRange(size_t Count, size_t BlockSize, function const& Function)
+{
+    size_t BlockCount = (Count + BlockSize - 1) / BlockSize;
+
+    ParallelFor(BlockCount, [&](size_t BlockIndex)
+    {
+        size_t Begin = BlockIndex * BlockSize;
+        size_t End = std::min(Begin + BlockSize, Count);
+        Function(Begin, End);
+    });
+}
+
+/* --- Task Graph ---------------------------------------------------------- */
+
+inline constexpr uint32_t TASK_NONE = ~0u;
+
+struct task
+{
+    char const*           Name;
+    std::function<void()> Function;
+    std::vector<uint32_t> Dependents;
+    uint32_t              DependencyCount = 0;
+    double                Duration = 0.0; // In milliseconds, set by RunTaskGraph().
+};
+
+// Set of tasks, each of which runs once all of its dependencies are done.
+struct task_graph
+{
+    std::vector<task> Tasks;
+};
+
+// Adds a task to the graph and returns its index.  Dependencies equal to
+// TASK_NONE are ignored, so that optional tasks can be passed directly.
+inline uint32_t AddTask(task_graph* Graph, char const* Name, std::function<void()> Function, std::initializer_list<uint32_t> Dependencies = {})
+{
+    uint32_t Index = static_cast<uint32_t>(Graph->Tasks.size());
+
+    task& Task = Graph->Tasks.emplace_back();
+    Task.Name = Name;
+    Task.Function = std::move(Function);
+
+    for (uint32_t Dependency : Dependencies)
+    {
+        if (Dependency == TASK_NONE) continue;
+        assert(Dependency < Index);
+        Graph->Tasks[Dependency].Dependents.push_back(Index);
+        Task.DependencyCount++;
+    }
+
+    return Index;
+}
+
+// State of a running task graph, shared with the pool threads that help
+// run it.
+struct task_graph_run
+{
+    task_graph*             Graph;
+    std::mutex              Mutex;
+    std::condition_variable Condition;
+    std::vector<uint32_t>   Ready;
+    std::vector<uint32_t>   Remaining; // Number of unfinished dependencies.
+    size_t                  FinishedCount = 0;
+};
+
+// Runs ready tasks of a graph until there are none left, or if WaitForAll
+// is set, until all tasks of the graph are done.
+inline void RunReadyTasks(std::shared_ptr<task_graph_run> const& Run, bool WaitForAll)
+{
+    size_t TaskCount = Run->Remaining.size();
+
+    std::unique_lock<std::mutex> Lock(Run->Mutex);
+    while (true)
+    {
+        if (WaitForAll)
+            Run->Condition.wait(Lock, [&] { return !Run->Ready.empty() || Run->FinishedCount == TaskCount; });
+        if (Run->Ready.empty()) break;
+
+        uint32_t Index = Run->Ready.back();
+        Run->Ready.pop_back();
+        task& Task = Run->Graph->Tasks[Index];
+
+        Lock.unlock();
+        auto StartTime = std::chrono::steady_clock::now();
+        Task.Function();
+        Task.Duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+        Lock.lock();
+
+        size_t ReadyCount = 0;
+        for (uint32_t Dependent : Task.Dependents)
+        {
+            if (--Run->Remaining[Dependent] == 0)
+            {
+                Run->Ready.push_back(Dependent);
+                ReadyCount++;
+            }
+        }
+
+        Run->FinishedCount++;
+        Run->Condition.notify_all();
+
+        // This thread continues with one of the new tasks, and the pool
+        // is asked to help with the rest.
+        if (ReadyCount > 1)
+            SubmitThreadPoolJobs(ReadyCount - 1, [Run]() { RunReadyTasks(Run, false); });
+    }
+}
+
+// Runs the tasks of a graph on the thread pool, including the calling
+// thread, and returns once all of them are done.  Unlike the body of a
+// ParallelFor() loop, a task can itself use ParallelFor().
+inline void RunTaskGraph(task_graph* Graph)
+{
+    size_t TaskCount = Graph->Tasks.size();
+    if (TaskCount == 0) return;
+
+    auto Run = std::make_shared<task_graph_run>();
+    Run->Graph = Graph;
+    Run->Remaining.resize(TaskCount);
+
+    for (uint32_t Index = 0; Index < TaskCount; Index++)
+    {
+        Run->Remaining[Index] = Graph->Tasks[Index].DependencyCount;
+        if (Run->Remaining[Index] == 0)
+            Run->Ready.push_back(Index);
+    }
+
+    SubmitThreadPoolJobs(Run->Ready.size() - 1, [Run]() { RunReadyTasks(Run, false); });
+
+    RunReadyTasks(Run, true);
+}
@@ -0,0 +1,313 @@
+#include "core/ply_parser.hpp"
+
+#include <charconv>
+#include <format>
+#include <optional>
+#include <string_view>
+
+struct ply_property
+{
+    std::string    Name;
+    attribute_type Type;
+    bool           IsList;
+    attribute_type CountType; // Type of the element count, for lists.
+};
+
+struct ply_element
+{
+    std::string               Name;
+    size_t                    Count;
+    std::vector<ply_property> Properties;
+};
+
+static std::optional<attribute_type> ParsePlyType(std::string_view Name)
+{
+    if (Name == "char"   || Name == "int8")    return ATTRIBUTE_TYPE_INT8;
+    if (Name == "uchar"  || Name == "uint8")   return ATTRIBUTE_TYPE_UINT8;
+    if (Name == "short"  || Name == "int16")   return ATTRIBUTE_TYPE_INT16;
+    if (Name == "ushort" || Name == "uint16")  return ATTRIBUTE_TYPE_UINT16;
+    if (Name == "int"    || Name == "int32")   return ATTRIBUTE_TYPE_INT32;
+    if (Name == "uint"   || Name == "uint32")  return ATTRIBUTE_TYPE_UINT32;
+    if (Name == "float"  || Name == "float32") return ATTRIBUTE_TYPE_FLOAT32;
+    if (Name == "double" || Name == "float64") return ATTRIBUTE_TYPE_FLOAT64;
+    return std::nullopt;
+}
+
+static std::vector<std::string_view> SplitWords(std::string_view Line)
+{
+    std::vector<std::string_view> Words;
+    size_t P = 0;
+    while (P < Line.size())
+    {
+        while (P < Line.size() && (Line[P] == ' ' || Line[P] == '\t' || Line[P] == '\r')) P++;
+        size_t Begin = P;
+        while (P < Line.size() && Line[P] != ' ' && Line[P] != '\t' && Line[P] != '\r') P++;
+        if (P > Begin) Words.push_back(Line.substr(Begin, P - Begin));
+    }
+    return Words;
+}
+
+// Builds a view of a set of scalar properties of a fixed-size element.
+// Returns an empty view unless all of the named properties are present and
+// have the same type.
+static attribute_view MakePropertyView
+(
+    ply_element const& Element,
+    uint8_t const* Data,
+    size_t Stride,
+    bool BigEndian,
+    std::initializer_list<char const*> Names
+)
+{
+    attribute_view View;
+    View.Count = Element.Count;
+    View.Stride = Stride;
+    View.BigEndian = BigEndian;
+
+    for (char const* Name : Names)
+    {
+        uint32_t Offset = 0;
+        ply_property const* Found = nullptr;
+        for (ply_property const& Property : Element.Properties)
+        {
+            if (Property.Name == Name)
+            {
+                Found = &Property;
+                break;
+            }
+            Offset += AttributeTypeSize(Property.Type);
+        }
+
+        if (!Found || (View.ComponentCount > 0 && Found->Type != View.Type))
+            return {};
+
+        View.Type = Found->Type;
+        View.ComponentOffsets[View.ComponentCount++] = Offset;
+    }
+
+    View.Data = Data;
+    return View;
+}
+
+bool OpenPlyFile(char const* Path, ply_file* Ply, std::string* Errors)
+{
+    *Ply = {};
+
+    if (!MapFile(&Ply->File, Path))
+    {
+        *Errors += std::format("Cannot open file [{}]\n", Path);
+        return false;
+    }
+
+    auto Fail = [&](std::string const& Message)
+    {
+        *Errors += std::format("{}: {}\n", Path, Message);
+        ClosePlyFile(Ply);
+        return false;
+    };
+
+    auto Begin = static_cast<uint8_t const*>(Ply->File.Data);
+    auto End = Begin + Ply->File.Size;
+
+    // Parse the header.
+    std::string_view Text(reinterpret_cast<char const*>(Begin), Ply->File.Size);
+    std::vector<ply_element> Elements;
+    bool BigEndian = false;
+    bool HasFormat = false;
+    size_t LineBegin = 0;
+    size_t DataOffset = 0;
+
+    for (int LineIndex = 0; ; LineIndex++)
+    {
+        size_t LineEnd = Text.find('\n', LineBegin);
+        if (LineEnd == std::string_view::npos)
+            return Fail("Unterminated header");
+
+        std::vector<std::string_view> Words = SplitWords(Text.substr(LineBegin, LineEnd - LineBegin));
+        LineBegin = LineEnd + 1;
+
+        if (LineIndex == 0)
+        {
+            if (Words.size() != 1 || Words[0] != "ply")
+                return Fail("Not a PLY file");
+            continue;
+        }
+
+        if (Words.empty() || Words[0] == "comment" || Words[0] == "obj_info")
+            continue;
+
+        if (Words[0] == "end_header")
+        {
+            DataOffset = LineBegin;
+            break;
+        }
+
+        if (Words[0] == "format" && Words.size() >= 2)
+        {
+            if (Words[1] == "binary_little_endian")
+                BigEndian = false;
+            else if (Words[1] == "binary_big_endian")
+                BigEndian = true;
+            else
+                return Fail(std::format("Unsupported format '{}'", Words[1]));
+            HasFormat = true;
+        }
+        else if (Words[0] == "element" && Words.size() >= 3)
+        {
+            ply_element& Element = Elements.emplace_back();
+            Element.Name = Words[1];
+            auto Result = std::from_chars(Words[2].data(), Words[2].data() + Words[2].size(), Element.Count);
+            if (Result.ec != std::errc())
+                return Fail("Invalid element count");
+        }
+        else if (Words[0] == "property" && !Elements.empty())
+        {
+            ply_property Property = {};
+            if (Words.size() >= 5 && Words[1] == "list")
+            {
+                auto CountType = ParsePlyType(Words[2]);
+                auto Type = ParsePlyType(Words[3]);
+                if (!CountType || !Type)
+                    return Fail("Invalid list property type");
+                Property.IsList = true;
+                Property.CountType = *CountType;
+                Property.Type = *Type;
+                Property.Name = Words[4];
+            }
+            else if (Words.size() >= 3)
+            {
+                auto Type = ParsePlyType(Words[1]);
+                if (!Type)
+                    return Fail(std::format("Invalid property type '{}'", Words[1]));
+                Property.Type = *Type;
+                Property.Name = Words[2];
+            }
+            else
+            {
+                return Fail("Invalid property");
+            }
+            Elements.back().Properties.push_back(Property);
+        }
+        else
+        {
+            return Fail(std::format("Unexpected header line {}", LineIndex + 1));
+        }
+    }
+
+    if (!HasFormat)
+        return Fail("Missing format");
+
+    // Walk over the element data.  Elements without list properties have a
+    // fixed size and are skipped over directly, while elements with lists
+    // have to be scanned.
+    uint8_t const* P = Begin + DataOffset;
+
+    for (ply_element const& Element : Elements)
+    {
+        bool HasLists = false;
+        size_t Stride = 0;
+        for (ply_property const& Property : Element.Properties)
+        {
+            HasLists |= Property.IsList;
+            Stride += AttributeTypeSize(Property.Type);
+        }
+
+        if (!HasLists)
+        {
+            if (Stride != 0 && static_cast<size_t>(End - P) / Stride < Element.Count)
+                return Fail(std::format("Truncated element '{}'", Element.Name));
+
+            if (Element.Name == "vertex")
+            {
+                Ply->Positions = MakePropertyView(Element, P, Stride, BigEndian, { "x", "y", "z" });
+                Ply->Normals = MakePropertyView(Element, P, Stride, BigEndian, { "nx", "ny", "nz" });
+                for (auto Names : { std::pair("u", "v"), std::pair("s", "t"), std::pair("texture_u", "texture_v"), std::pair("texture_s", "texture_t") })
+                {
+                    Ply->TexCoords = MakePropertyView(Element, P, Stride, BigEndian, { Names.first, Names.second });
+                    if (Ply->TexCoords.Data) break;
+                }
+
+                if (!Ply->Positions.Data)
+                    return Fail("Vertex element has no position");
+            }
+
+            P += Element.Count * Stride;
+            continue;
+        }
+
+        bool IsFace = Element.Name == "face";
+
+        for (size_t I = 0; I < Element.Count; I++)
+        {
+            for (ply_property const& Property : Element.Properties)
+            {
+                uint32_t Size = AttributeTypeSize(Property.Type);
+
+                if (!Property.IsList)
+                {
+                    if (static_cast<size_t>(End - P) < Size)
+                        return Fail(std::format("Truncated element '{}'", Element.Name));
+                    P += Size;
+                    continue;
+                }
+
+                attribute_view CountView;
+                CountView.Data = P;
+                CountView.Count = 1;
+                CountView.ComponentCount = 1;
+                CountView.Type = Property.CountType;
+                CountView.BigEndian = BigEndian;
+
+                uint32_t CountSize = AttributeTypeSize(Property.CountType);
+                if (static_cast<size_t>(End - P) < CountSize)
+                    return Fail(std::format("Truncated element '{}'", Element.Name));
+
+                uint32_t Count = ReadAttributeIndex(CountView, 0);
+                P += CountSize;
+
+                if (static_cast<size_t>(End - P) / Size < Count)
+                    return Fail(std::format("Truncated element '{}'", Element.Name));
+
+                if (IsFace && (Property.Name == "vertex_indices" || Property.Name == "vertex_index"))
+                {
+                    attribute_view IndexView;
+                    IndexView.Data = P;
+                    IndexView.Count = Count;
+                    IndexView.Stride = Size;
+                    IndexView.ComponentCount = 1;
+                    IndexView.Type = Property.Type;
+                    IndexView.BigEndian = BigEndian;
+
+                    // Triangulate as a fan.
+                    for (uint32_t J = 2; J < Count; J++)
+                    {
+                        Ply->Indices.push_back(ReadAttributeIndex(IndexView, 0));
+                        Ply->Indices.push_back(ReadAttributeIndex(IndexView, J - 1));
+                        Ply->Indices.push_back(ReadAttributeIndex(IndexView, J));
+                    }
+                }
+
+                P += Count * Size;
+            }
+        }
+    }
+
+    if (!Ply->Positions.Data)
+        return Fail("No vertex element");
+
+    // Point clouds are not supported.
+    if (Ply->Indices.empty())
+        return Fail("No faces");
+
+    for (uint32_t Index : Ply->Indices)
+        if (Index >= Ply->Positions.Count)
+            return Fail("Vertex index out of range");
+
+    return true;
+}
+
+void ClosePlyFile(ply_file* Ply)
+{
+    UnmapFile(&Ply->File);
+    *Ply = {};
+}
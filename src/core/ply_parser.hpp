@@ -0,0 +1,25 @@
+#pragma once
+
+#include "core/attribute_view.hpp"
+#include "core/mapped_file.hpp"
+
+#include <string>
+#include <vector>
+
+// Contents of a binary PLY file.  The file stays mapped into memory while
+// it is open, and the vertex attributes are views directly into it.  Faces
+// are triangulated as fans into a separate index array.
+struct ply_file
+{
+    mapped_file           File;
+    attribute_view        Positions;
+    attribute_view        Normals;
+    attribute_view        TexCoords;
+    std::vector<uint32_t> Indices; // Three per triangle.
+};
+
+// Opens a binary (little or big endian) PLY file.  ASCII PLY files and
+// files without faces are not supported.
+bool OpenPlyFile(char const* Path, ply_file* Ply, std::string* Errors);
+
+void ClosePlyFile(ply_file* Ply);
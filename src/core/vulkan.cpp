@@ -147,11 +147,14 @@ void WriteToVulkanBuffer
     vulkan*         Vulkan,
     vulkan_buffer*  Buffer,
     void const*     Data,
-    size_t          Size
+    size_t          Size,
+    size_t          Offset
 )
 {
     if (Size == 0) return;
 
+    assert(Offset + Size <= Buffer->Size);
+
     if (Buffer->IsDeviceLocal)
     {
         // Create a staging buffer and copy the data into it.
@@ -161,11 +164,11 @@ void WriteToVulkanBuffer
             Vulkan, &Staging,
             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            Buffer->Size
+            Size
         );
 
         void* BufferMemory;
-        vkMapMemory(Vulkan->Device, Staging.Memory, 0, Buffer->Size, 0, &BufferMemory);
+        vkMapMemory(Vulkan->Device, Staging.Memory, 0, Size, 0, &BufferMemory);
         memcpy(BufferMemory, Data, Size);
         vkUnmapMemory(Vulkan->Device, Staging.Memory);
 
@@ -191,8 +194,8 @@ void WriteToVulkanBuffer
         VkBufferCopy Region =
         {
             .srcOffset  = 0,
-            .dstOffset  = 0,
-            .size       = Buffer->Size,
+            .dstOffset  = Offset,
+            .size       = Size,
         };
         vkCmdCopyBuffer(CommandBuffer, Staging.Buffer, Buffer->Buffer, 1, &Region);
 
@@ -215,7 +218,7 @@ void WriteToVulkanBuffer
     else
     {
         void* BufferMemory;
-        vkMapMemory(Vulkan->Device, Buffer->Memory, 0, Buffer->Size, 0, &BufferMemory);
+        vkMapMemory(Vulkan->Device, Buffer->Memory, Offset, Size, 0, &BufferMemory);
         memcpy(BufferMemory, Data, Size);
         vkUnmapMemory(Vulkan->Device, Buffer->Memory);
     }
@@ -175,12 +175,15 @@ VkResult CreateVulkanBuffer
 
 void DestroyVulkanBuffer(vulkan* Vulkan, vulkan_buffer* Buffer);
 
+// Writes Size bytes of data into a buffer, starting at the given byte
+// offset.
 void WriteToVulkanBuffer
 (
     vulkan*        Vulkan,
     vulkan_buffer* Buffer,
     void const*    Data,
-    size_t         Size
+    size_t         Size,
+    size_t         Offset = 0
 );
 
 VkResult CreateVulkanImage
@@ -0,0 +1,373 @@
+#include "scene/model_cache.hpp"
+
+#include "core/mapped_file.hpp"
+#include "core/parallel.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <stdio.h>
+
+// The model cache keeps fully processed imported models on disk, one file
+// per model, named after the model cache key.  A cache file starts with a
+// model_cache_header, followed by the paths and content hashes of the
+// dependencies of the model, then the materials, the meshes with their
+// vertex, face and node arrays, and finally the mesh instances.
+//
+// Cache files are touched whenever they are read, so that their write times
+// order them by recency of use for eviction.
+
+char const* const MODEL_CACHE_DIRECTORY  = "ModelCache";
+uint64_t const    MODEL_CACHE_SIZE_LIMIT = 2ull << 30;
+uint32_t const    MODEL_CACHE_MAGIC      = MakeFourCC("MDLC");
+uint32_t const    MODEL_CACHE_VERSION    = 4;
+
+struct model_cache_header
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint32_t DependencyCount;
+    uint32_t MaterialCount;
+    uint32_t MeshCount;
+    uint32_t InstanceCount;
+};
+
+static model_cache_stats ModelCacheStats = {};
+
+static std::filesystem::path GetModelCacheFilePath(uint64_t Key)
+{
+    return std::filesystem::path(MODEL_CACHE_DIRECTORY) / std::format("{:016x}.model", Key);
+}
+
+// Hashes the contents of a file, in parallel for large files.  Returns 0 if
+// the file cannot be read.
+static uint64_t HashFileContents(char const* Path)
+{
+    size_t const BLOCK_SIZE = 16 << 20;
+
+    mapped_file File;
+    if (!MapFile(&File, Path))
+        return 0;
+
+    auto Data = static_cast<uint8_t const*>(File.Data);
+    std::vector<uint64_t> BlockHashes((File.Size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    ParallelFor(BlockHashes.size(), [&](size_t Index)
+    {
+        size_t Begin = Index * BLOCK_SIZE;
+        size_t End = std::min(Begin + BLOCK_SIZE, File.Size);
+        BlockHashes[Index] = HashBytes(Data + Begin, End - Begin);
+    });
+
+    uint64_t Hash = HashBytes(BlockHashes.data(), BlockHashes.size() * sizeof(uint64_t), File.Size);
+
+    UnmapFile(&File);
+
+    return Hash | 1; // Never 0.
+}
+
+uint64_t GetModelCacheKey(char const* Path, load_model_options const* Options)
+{
+    uint64_t Key = HashFileContents(Path);
+    if (!Key) return 0;
+
+    Key = HashBytes(&MODEL_CACHE_VERSION, sizeof(uint32_t), Key);
+    Key = HashBytes(Options->DirectoryPath.data(), Options->DirectoryPath.size(), Key);
+    Key = HashBytes(&Options->VertexTransform, sizeof(mat4), Key);
+    Key = HashBytes(&Options->NormalTransform, sizeof(mat4), Key);
+    Key = HashBytes(&Options->TextureCoordinateTransform, sizeof(mat3), Key);
+    Key = HashBytes(&Options->InstanceDuplicateMeshes, sizeof(bool), Key);
+    Key = HashBytes(&Options->UseSpatialSplits, sizeof(bool), Key);
+    Key = HashBytes(&Options->SpatialSplitBudget, sizeof(float), Key);
+    Key = HashBytes(&Options->TreeOptimizationTime, sizeof(float), Key);
+    Key = HashBytes(&Options->OptimizeMeshLayout, sizeof(bool), Key);
+    Key = HashBytes(&Options->MaximumTreeDepth, sizeof(uint32_t), Key);
+    Key = HashBytes(&Options->TreeBuilder, sizeof(mesh_tree_builder), Key);
+    Key = HashBytes(&Options->OptimizeLinearTreeTop, sizeof(bool), Key);
+
+    return Key ? Key : 1;
+}
+
+/* --- Reading ------------------------------------------------------------- */
+
+struct model_cache_reader
+{
+    uint8_t const* Cursor;
+    uint8_t const* End;
+    bool           Failed = false;
+};
+
+static void Read(model_cache_reader& R, void* Data, size_t Size)
+{
+    if (R.Failed || static_cast<size_t>(R.End - R.Cursor) < Size)
+    {
+        R.Failed = true;
+        return;
+    }
+    memcpy(Data, R.Cursor, Size);
+    R.Cursor += Size;
+}
+
+template<typename type>
+static void Read(model_cache_reader& R, type& Value)
+{
+    Read(R, &Value, sizeof(type));
+}
+
+static void Read(model_cache_reader& R, std::string& String)
+{
+    uint32_t Length = 0;
+    Read(R, Length);
+    if (R.Failed || static_cast<size_t>(R.End - R.Cursor) < Length)
+    {
+        R.Failed = true;
+        return;
+    }
+    String.assign(reinterpret_cast<char const*>(R.Cursor), Length);
+    R.Cursor += Length;
+}
+
+template<typename type>
+static void Read(model_cache_reader& R, std::vector<type>& Array)
+{
+    uint32_t Count = 0;
+    Read(R, Count);
+    if (R.Failed || static_cast<size_t>(R.End - R.Cursor) / sizeof(type) < Count)
+    {
+        R.Failed = true;
+        return;
+    }
+    Array.resize(Count);
+    Read(R, Array.data(), Count * sizeof(type));
+}
+
+static bool ReadModelCacheFile(mapped_file const& File, uint64_t Key, imported_model* Model)
+{
+    auto R = model_cache_reader
+    {
+        .Cursor = static_cast<uint8_t const*>(File.Data),
+        .End = static_cast<uint8_t const*>(File.Data) + File.Size,
+    };
+
+    model_cache_header Header;
+    Read(R, Header);
+    if (R.Failed
+     || Header.Magic != MODEL_CACHE_MAGIC
+     || Header.Version != MODEL_CACHE_VERSION
+     || Header.Key != Key)
+        return false;
+
+    for (uint32_t I = 0; I < Header.DependencyCount; I++)
+    {
+        std::string Path;
+        uint64_t Hash = 0;
+        Read(R, Path);
+        Read(R, Hash);
+        if (R.Failed || HashFileContents(Path.c_str()) != Hash)
+            return false;
+        Model->DependencyPaths.push_back(Path);
+    }
+
+    for (uint32_t I = 0; I < Header.MaterialCount && !R.Failed; I++)
+    {
+        imported_material& Material = Model->Materials.emplace_back();
+        Read(R, Material.Name);
+        Read(R, Material.BaseColor);
+        Read(R, Material.EmissionColor);
+        Read(R, Material.BaseColorTextureName);
+        Read(R, Material.EmissionColorTextureName);
+    }
+
+    for (uint32_t I = 0; I < Header.MeshCount && !R.Failed; I++)
+    {
+        auto Mesh = Model->Meshes.emplace_back(new mesh);
+        Read(R, Mesh->Depth);
+        Read(R, Mesh->Vertices);
+        Read(R, Mesh->Faces);
+        Read(R, Mesh->Nodes);
+        Mesh->TreeCost = R.Failed ? 0.0f : GetMeshTreeCost(Mesh);
+    }
+
+    for (uint32_t I = 0; I < Header.InstanceCount && !R.Failed; I++)
+    {
+        imported_instance& Instance = Model->Instances.emplace_back();
+        Read(R, Instance.MeshIndex);
+        Read(R, Instance.Name);
+        Read(R, Instance.ShapeIndex);
+        Read(R, Instance.MaterialIndex);
+        Read(R, Instance.Position);
+        Read(R, Instance.Rotation);
+        Read(R, Instance.Scale);
+
+        if (Instance.MeshIndex >= Header.MeshCount
+         || Instance.MaterialIndex >= static_cast<int32_t>(Header.MaterialCount))
+            R.Failed = true;
+    }
+
+    return !R.Failed;
+}
+
+bool ReadModelCache(uint64_t Key, imported_model* Model)
+{
+    auto FilePath = GetModelCacheFilePath(Key);
+
+    mapped_file File;
+    bool Hit = MapFile(&File, FilePath.string().c_str());
+
+    if (Hit)
+    {
+        Hit = ReadModelCacheFile(File, Key, Model);
+        UnmapFile(&File);
+    }
+
+    std::error_code Error;
+    if (Hit)
+    {
+        std::filesystem::last_write_time(FilePath, std::filesystem::file_time_type::clock::now(), Error);
+        ModelCacheStats.HitCount++;
+    }
+    else
+    {
+        for (mesh* Mesh : Model->Meshes)
+            delete Mesh;
+        *Model = {};
+        ModelCacheStats.MissCount++;
+    }
+
+    return Hit;
+}
+
+/* --- Writing ------------------------------------------------------------- */
+
+static void Write(std::ostream& Stream, void const* Data, size_t Size)
+{
+    Stream.write(static_cast<char const*>(Data), Size);
+}
+
+template<typename type>
+static void Write(std::ostream& Stream, type const& Value)
+{
+    Write(Stream, &Value, sizeof(type));
+}
+
+static void Write(std::ostream& Stream, std::string const& String)
+{
+    Write(Stream, static_cast<uint32_t>(String.size()));
+    Write(Stream, String.data(), String.size());
+}
+
+template<typename type>
+static void Write(std::ostream& Stream, std::vector<type> const& Array)
+{
+    Write(Stream, static_cast<uint32_t>(Array.size()));
+    Write(Stream, Array.data(), Array.size() * sizeof(type));
+}
+
+// Evicts the least recently used cache files until the total size of the
+// cache is within the size limit.  The file at KeepPath is never evicted.
+static void EvictModelCacheFiles(std::filesystem::path const& KeepPath)
+{
+    struct cache_file
+    {
+        std::filesystem::path           Path;
+        uint64_t                        Size;
+        std::filesystem::file_time_type LastUseTime;
+    };
+
+    std::error_code Error;
+    std::vector<cache_file> Files;
+    uint64_t TotalSize = 0;
+
+    for (auto const& Entry : std::filesystem::directory_iterator(MODEL_CACHE_DIRECTORY, Error))
+    {
+        if (!Entry.is_regular_file(Error) || Entry.path().extension() != ".model")
+            continue;
+        uint64_t Size = Entry.file_size(Error);
+        TotalSize += Size;
+        if (Entry.path() != KeepPath)
+            Files.push_back({ Entry.path(), Size, Entry.last_write_time(Error) });
+    }
+
+    std::ranges::sort(Files, {}, &cache_file::LastUseTime);
+
+    for (cache_file const& File : Files)
+    {
+        if (TotalSize <= MODEL_CACHE_SIZE_LIMIT) break;
+        if (std::filesystem::remove(File.Path, Error))
+        {
+            TotalSize -= File.Size;
+            ModelCacheStats.EvictionCount++;
+        }
+    }
+}
+
+void WriteModelCache(uint64_t Key, imported_model const& Model)
+{
+    std::error_code Error;
+    std::filesystem::create_directories(MODEL_CACHE_DIRECTORY, Error);
+
+    auto FilePath = GetModelCacheFilePath(Key);
+
+    bool Success = WriteFileAtomically(FilePath, [&](std::ostream& Stream)
+    {
+        auto Header = model_cache_header
+        {
+            .Magic = MODEL_CACHE_MAGIC,
+            .Version = MODEL_CACHE_VERSION,
+            .Key = Key,
+            .DependencyCount = static_cast<uint32_t>(Model.DependencyPaths.size()),
+            .MaterialCount = static_cast<uint32_t>(Model.Materials.size()),
+            .MeshCount = static_cast<uint32_t>(Model.Meshes.size()),
+            .InstanceCount = static_cast<uint32_t>(Model.Instances.size()),
+        };
+        Write(Stream, Header);
+
+        for (std::string const& Path : Model.DependencyPaths)
+        {
+            Write(Stream, Path);
+            Write(Stream, HashFileContents(Path.c_str()));
+        }
+
+        for (imported_material const& Material : Model.Materials)
+        {
+            Write(Stream, Material.Name);
+            Write(Stream, Material.BaseColor);
+            Write(Stream, Material.EmissionColor);
+            Write(Stream, Material.BaseColorTextureName);
+            Write(Stream, Material.EmissionColorTextureName);
+        }
+
+        for (mesh const* Mesh : Model.Meshes)
+        {
+            Write(Stream, Mesh->Depth);
+            Write(Stream, Mesh->Vertices);
+            Write(Stream, Mesh->Faces);
+            Write(Stream, Mesh->Nodes);
+        }
+
+        for (imported_instance const& Instance : Model.Instances)
+        {
+            Write(Stream, Instance.MeshIndex);
+            Write(Stream, Instance.Name);
+            Write(Stream, Instance.ShapeIndex);
+            Write(Stream, Instance.MaterialIndex);
+            Write(Stream, Instance.Position);
+            Write(Stream, Instance.Rotation);
+            Write(Stream, Instance.Scale);
+        }
+    });
+
+    if (!Success)
+    {
+        printf("Failed to write model cache file %s\n", FilePath.string().c_str());
+        return;
+    }
+
+    EvictModelCacheFiles(FilePath);
+}
+
+model_cache_stats GetModelCacheStats()
+{
+    return ModelCacheStats;
+}
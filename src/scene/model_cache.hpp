@@ -0,0 +1,59 @@
+#pragma once
+
+#include "scene/scene.hpp"
+
+// Material definition read from a model file.
+struct imported_material
+{
+    std::string Name;
+    vec3        BaseColor;
+    vec3        EmissionColor;
+    std::string BaseColorTextureName;
+    std::string EmissionColorTextureName;
+};
+
+// Instance of a mesh built from the faces of one shape with one material.
+// Shapes that are identical up to a rigid transform share a single mesh,
+// and differ only by the transforms of their instances.
+struct imported_instance
+{
+    uint32_t    MeshIndex;     // Index into imported_model::Meshes.
+    std::string Name;          // Name of the shape, or empty.
+    uint32_t    ShapeIndex;
+    int32_t     MaterialIndex; // Index into imported_model::Materials, or -1.
+    vec3        Position;
+    vec3        Rotation;
+    vec3        Scale = vec3(1);
+};
+
+// Fully processed contents of a model file, before they are added to a
+// scene.
+struct imported_model
+{
+    std::vector<imported_material> Materials;
+    std::vector<mesh*>             Meshes;
+    std::vector<imported_instance> Instances;
+    std::vector<std::string>       DependencyPaths; // Other files the model was read from.
+};
+
+struct model_cache_stats
+{
+    uint32_t HitCount;
+    uint32_t MissCount;
+    uint32_t EvictionCount;
+};
+
+// Computes the key of a model file in the model cache from the contents of
+// the file and the import options that affect the imported geometry.
+// Returns 0 if the file cannot be read.
+uint64_t GetModelCacheKey(char const* Path, load_model_options const* Options);
+
+// Reads an imported model from the cache.  Returns false on a cache miss,
+// including when any of the dependencies of the model have changed.
+bool ReadModelCache(uint64_t Key, imported_model* Model);
+
+// Writes an imported model into the cache, and evicts the least recently
+// used entries if the cache exceeds its size limit.
+void WriteModelCache(uint64_t Key, imported_model const& Model);
+
+model_cache_stats GetModelCacheStats();
@@ -1,35 +1,44 @@
 #include "core/tiny_obj_loader.h"
+#include "core/gltf_parser.hpp"
+#include "core/obj_parser.hpp"
+#include "core/ply_parser.hpp"
+#include "core/parallel.hpp"
 #include "core/stb_image.h"
 #include "core/stb_rect_pack.h"
 
 #include "scene/scene.hpp"
+#include "scene/model_cache.hpp"
 
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <unordered_map>
-#include <unordered_set>
 #include <format>
 #include <filesystem>
 #include <stdio.h>
+#include <thread>
 
-namespace std
+static bool operator==(mesh_vertex const& A, mesh_vertex const& B)
 {
-    template<>
-    struct hash<mesh_vertex>
-    {
-        size_t operator()(mesh_vertex const& Vertex) const
-        {
-            size_t Hash;
-            Hash = hash<vec3>()(Vertex.Position);
-            Hash ^= hash<vec3>()(Vertex.Normal) << 1;
-            Hash >>= 1;
-            Hash ^= hash<vec2>()(Vertex.UV) << 1;
-            return Hash;
-        }
-    };
+    return A.Position == B.Position && A.Normal == B.Normal && A.UV == B.UV;
 }
 
-static bool operator==(mesh_vertex const& A, mesh_vertex const& B)
+// Hashes the bits of the components of a mesh vertex.  Negative zeros are
+// folded into positive ones, so that vertices that compare equal also have
+// equal hashes.
+static uint64_t HashMeshVertex(mesh_vertex const& Vertex)
 {
-    return A.Position == B.Position && A.Normal == B.Normal && A.UV == B.UV;
+    float Values[8] =
+    {
+        Vertex.Position.x, Vertex.Position.y, Vertex.Position.z,
+        Vertex.Normal.x, Vertex.Normal.y, Vertex.Normal.z,
+        Vertex.UV.x, Vertex.UV.y,
+    };
+
+    for (float& Value : Values)
+        if (Value == 0.0f) Value = 0.0f;
+
+    return HashBytes(Values, sizeof(Values));
 }
 
 static void Grow(glm::vec3& Minimum, glm::vec3& Maximum, glm::vec3 Point)
@@ -94,13 +103,14 @@ char const* EntityTypeName(entity_type Type)
 {
     switch (Type)
     {
-        case ENTITY_TYPE_ROOT:          return "Root";
-        case ENTITY_TYPE_CONTAINER:     return "Container";
-        case ENTITY_TYPE_CAMERA:        return "Camera";
-        case ENTITY_TYPE_MESH_INSTANCE: return "Mesh Instance";
-        case ENTITY_TYPE_PLANE:         return "Plane";
-        case ENTITY_TYPE_SPHERE:        return "Sphere";
-        case ENTITY_TYPE_CUBE:          return "Cube";
+        case ENTITY_TYPE_ROOT:            return "Root";
+        case ENTITY_TYPE_CONTAINER:       return "Container";
+        case ENTITY_TYPE_CAMERA:          return "Camera";
+        case ENTITY_TYPE_MESH_INSTANCE:   return "Mesh Instance";
+        case ENTITY_TYPE_PLANE:           return "Plane";
+        case ENTITY_TYPE_SPHERE:          return "Sphere";
+        case ENTITY_TYPE_CUBE:            return "Cube";
+        case ENTITY_TYPE_PREFAB_INSTANCE: return "Prefab Instance";
     }
     return "Entity";
 }
@@ -124,38 +134,142 @@ static void ForEachEntity
     Function(Entity);
 }
 
-template<typename function_type>
-static void ForEachEntityWithTransform
-(
-    entity* Entity,
-    mat4 const& OuterTransform,
-    function_type&& Function)
+/* --- Entity Table ------------------------------------------------------- */
+
+static mat4 GetEntityLocalTransform(entity const* Entity)
+{
+    return MakeTransformMatrix
+    (
+        Entity->Transform.Position,
+        Entity->Transform.Rotation,
+        Entity->Transform.Scale
+    );
+}
+
+static void AppendEntityTableSubtree(scene_entity_table& Table, entity* Entity, uint32_t ParentIndex)
+{
+    uint32_t Index = static_cast<uint32_t>(Table.Entities.size());
+
+    mat4 Local = GetEntityLocalTransform(Entity);
+    bool IsTreeActive = Entity->Active && (ParentIndex == ENTITY_INDEX_NONE || Table.IsTreeActive[ParentIndex]);
+
+    Entity->EntityIndex = Index;
+    Table.Entities.push_back(Entity);
+    Table.ParentIndices.push_back(ParentIndex);
+    Table.SubtreeEnds.push_back(0);
+    Table.IsActive.push_back(Entity->Active);
+    Table.IsTreeActive.push_back(IsTreeActive);
+    Table.IsDirty.push_back(false);
+    Table.LocalTransforms.push_back(Local);
+    Table.WorldTransforms.push_back(ParentIndex == ENTITY_INDEX_NONE ? Local : Table.WorldTransforms[ParentIndex] * Local);
+
+    for (entity* Child : Entity->Children)
+        AppendEntityTableSubtree(Table, Child, Index);
+
+    Table.SubtreeEnds[Index] = static_cast<uint32_t>(Table.Entities.size());
+}
+
+static void RebuildEntityTable(scene* Scene)
+{
+    scene_entity_table& Table = Scene->EntityTable;
+    Table = {};
+    AppendEntityTableSubtree(Table, &Scene->Root, ENTITY_INDEX_NONE);
+}
+
+// Recomputes the transforms in the subtrees of the entities marked dirty.
+// The local transforms are only recomputed for the marked entities.
+static void UpdateEntityTable(scene* Scene, bool Rebuild)
 {
-    if (!Entity->Active)
+    scene_entity_table& Table = Scene->EntityTable;
+
+    if (Rebuild || Table.Entities.empty())
+    {
+        RebuildEntityTable(Scene);
         return;
+    }
 
-    mat4 Transform = OuterTransform *
-        MakeTransformMatrix
-        (
-            Entity->Transform.Position,
-            Entity->Transform.Rotation,
-            Entity->Transform.Scale
-        );
+    // Subtrees nested in an earlier dirty subtree are updated along with it.
+    std::sort(Table.DirtyIndices.begin(), Table.DirtyIndices.end());
+
+    uint32_t UpdatedEnd = 0;
+    for (uint32_t DirtyIndex : Table.DirtyIndices)
+    {
+        if (DirtyIndex < UpdatedEnd) continue;
+        UpdatedEnd = Table.SubtreeEnds[DirtyIndex];
+
+        for (uint32_t Index = DirtyIndex; Index < UpdatedEnd; Index++)
+        {
+            if (Table.IsDirty[Index])
+            {
+                entity const* Entity = Table.Entities[Index];
+                Table.LocalTransforms[Index] = GetEntityLocalTransform(Entity);
+                Table.IsActive[Index] = Entity->Active;
+                Table.IsDirty[Index] = false;
+            }
 
-    for (entity* InnerEntity : Entity->Children)
-        ForEachEntityWithTransform(InnerEntity, Transform, Function);
+            uint32_t ParentIndex = Table.ParentIndices[Index];
+            if (ParentIndex == ENTITY_INDEX_NONE)
+            {
+                Table.WorldTransforms[Index] = Table.LocalTransforms[Index];
+                Table.IsTreeActive[Index] = Table.IsActive[Index];
+            }
+            else
+            {
+                Table.WorldTransforms[Index] = Table.WorldTransforms[ParentIndex] * Table.LocalTransforms[Index];
+                Table.IsTreeActive[Index] = Table.IsActive[Index] && Table.IsTreeActive[ParentIndex];
+            }
+        }
+    }
 
-    Function(Entity, Transform);
+    Table.DirtyIndices.clear();
 }
 
+// Calls Function(Entity, WorldTransform) for the active entities of the
+// entity table, skipping over the subtrees of inactive entities.
 template<typename function_type>
-static void ForEachEntityWithTransform
-(
-    entity* Entity,
-    function_type&& Function
-)
+static void ForEachActiveEntity(scene_entity_table const& Table, function_type&& Function)
+{
+    uint32_t Index = 0;
+    while (Index < Table.Entities.size())
+    {
+        if (!Table.IsTreeActive[Index])
+        {
+            Index = Table.SubtreeEnds[Index];
+            continue;
+        }
+        Function(Table.Entities[Index], Table.WorldTransforms[Index]);
+        Index++;
+    }
+}
+
+void MarkEntityDirty(scene* Scene, entity* Entity)
 {
-    ForEachEntityWithTransform(Entity, mat4(1.0f), Function);
+    scene_entity_table& Table = Scene->EntityTable;
+
+    // Entities not in the table yet are added with up-to-date transforms
+    // when it is rebuilt.
+    uint32_t Index = Entity->EntityIndex;
+    if (Index >= Table.Entities.size() || Table.Entities[Index] != Entity)
+    {
+        Scene->DirtyFlags |= SCENE_DIRTY_SHAPES | SCENE_DIRTY_CAMERAS;
+        return;
+    }
+
+    // Repack the shapes and cameras of the subtree.  A camera moving on
+    // its own leaves the shapes as they are.
+    for (uint32_t I = Index; I < Table.SubtreeEnds[Index]; I++)
+    {
+        if (Table.Entities[I]->Type == ENTITY_TYPE_CAMERA)
+            Scene->DirtyFlags |= SCENE_DIRTY_CAMERAS;
+        else if (Table.Entities[I]->Type != ENTITY_TYPE_CONTAINER)
+            Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
+    }
+
+    if (!Table.IsDirty[Index])
+    {
+        Table.IsDirty[Index] = true;
+        Table.DirtyIndices.push_back(Index);
+    }
 }
 
 entity* CreateEntityRaw(entity_type Type)
@@ -183,6 +297,9 @@ entity* CreateEntityRaw(entity_type Type)
         case ENTITY_TYPE_CUBE:
             return new cube_entity;
             break;
+        case ENTITY_TYPE_PREFAB_INSTANCE:
+            return new prefab_entity;
+            break;
         default:
             assert(false);
             break;
@@ -200,6 +317,8 @@ entity* CreateEntity(scene* Scene, entity_type Type, entity* Parent)
     Entity->Parent = Parent;
     Parent->Children.push_back(Entity);
 
+    Scene->DirtyFlags |= SCENE_DIRTY_ENTITIES;
+
     return Entity;
 }
 
@@ -230,6 +349,9 @@ entity* CreateEntity(scene* Scene, entity* Source, entity* Parent)
         case ENTITY_TYPE_CUBE:
             Entity = new cube_entity(*static_cast<cube_entity*>(Source));
             break;
+        case ENTITY_TYPE_PREFAB_INSTANCE:
+            Entity = new prefab_entity(*static_cast<prefab_entity*>(Source));
+            break;
         default:
             assert(false);
             break;
@@ -240,6 +362,8 @@ entity* CreateEntity(scene* Scene, entity* Source, entity* Parent)
     Entity->Parent = Parent;
     Parent->Children.push_back(Entity);
 
+    Scene->DirtyFlags |= SCENE_DIRTY_ENTITIES;
+
     std::vector<entity*> Children = std::move(Entity->Children);
     Entity->Children.clear();
     for (entity* Child : Children)
@@ -253,6 +377,14 @@ entity* CreateEntity(scene* Scene, prefab* Prefab, entity* Parent)
     return CreateEntity(Scene, Prefab->Entity, Parent);
 }
 
+prefab_entity* CreatePrefabInstance(scene* Scene, prefab* Prefab, entity* Parent)
+{
+    auto Instance = static_cast<prefab_entity*>(CreateEntity(Scene, ENTITY_TYPE_PREFAB_INSTANCE, Parent));
+    Instance->Name = Prefab->Entity->Name;
+    Instance->Prefab = Prefab;
+    return Instance;
+}
+
 void DestroyEntity(scene* Scene, entity* Entity)
 {
     entity* Parent = Entity->Parent;
@@ -264,6 +396,28 @@ void DestroyEntity(scene* Scene, entity* Entity)
     for (entity* Child : Entity->Children)
         DestroyEntity(Scene, Child);
 
+    auto DetachShape = [Scene, Entity](uint32_t ShapeIndex)
+    {
+        if (ShapeIndex < Scene->ShapeEntities.size() && Scene->ShapeEntities[ShapeIndex] == Entity)
+            Scene->ShapeEntities[ShapeIndex] = nullptr;
+    };
+
+    // Prefab instances own a range of unbounded and a range of bounded
+    // packed shapes.
+    if (Entity->Type == ENTITY_TYPE_PREFAB_INSTANCE)
+    {
+        auto Instance = static_cast<prefab_entity*>(Entity);
+        for (packed_shape_range const& Range : { Instance->PackedUnboundedShapes, Instance->PackedBoundedShapes })
+            for (uint32_t I = 0; I < Range.Count; I++)
+                DetachShape(Range.Index + I);
+    }
+    else
+    {
+        DetachShape(Entity->PackedShapeIndex);
+    }
+
+    Scene->DirtyFlags |= SCENE_DIRTY_ENTITIES;
+
     delete Entity;
 }
 
@@ -312,23 +466,44 @@ texture* LoadTexture(scene* Scene, char const* Path, texture_type Type, char con
     return Texture;
 }
 
+// The user lists of the assets are rebuilt by PackSceneData(), and can be
+// used instead of scanning the whole scene until the references they were
+// built from may have changed.
+static bool AreEntityUsersIndexed(scene const* Scene)
+{
+    return Scene->EntityUsersAreIndexed && !(Scene->DirtyFlags & (SCENE_DIRTY_SHAPES | SCENE_DIRTY_ENTITIES));
+}
+
+static bool AreTextureUsersIndexed(scene const* Scene)
+{
+    return Scene->TextureUsersAreIndexed && !(Scene->DirtyFlags & (SCENE_DIRTY_MATERIALS | SCENE_DIRTY_MATERIAL_SLOTS));
+}
+
+static bool IsScenePackJobRunning(scene const* Scene);
+static void WaitForScenePackJob(scene* Scene);
+static void DetachScenePackJob(scene* Scene, texture* Texture);
+static void DetachScenePackJob(scene* Scene, mesh* Mesh);
+
 void DestroyTexture(scene* Scene, texture* Texture)
 {
     bool MaterialsDirty = false;
-    for (material* Material : Scene->Materials)
+    auto ClearReferences = [Texture, &MaterialsDirty](texture*& T)
     {
-        ForEachMaterialTexture(Scene, Material, [Texture, &MaterialsDirty](texture*& T)
+        if (T == Texture)
         {
-            if (T == Texture)
-            {
-                T = nullptr;
-                MaterialsDirty = true;
-            }
-        });
-    }
+            T = nullptr;
+            MaterialsDirty = true;
+        }
+    };
+
+    std::vector<material*> const& Materials = AreTextureUsersIndexed(Scene) ? Texture->Users : Scene->Materials;
+    for (material* Material : Materials)
+        ForEachMaterialTexture(Scene, Material, ClearReferences);
 
     if (MaterialsDirty) Scene->DirtyFlags |= SCENE_DIRTY_MATERIALS;
 
+    DetachScenePackJob(Scene, Texture);
+
     std::erase(Scene->Textures, Texture);
     Scene->DirtyFlags |= SCENE_DIRTY_TEXTURES;
 
@@ -336,9 +511,11 @@ void DestroyTexture(scene* Scene, texture* Texture)
     delete Texture;
 }
 
+static void DetachMeshTreeUpgrade(scene* Scene, mesh* Mesh);
+
 void DestroyMesh(scene* Scene, mesh* Mesh)
 {
-    ForEachEntity(&Scene->Root, [Scene, Mesh](entity* Entity)
+    auto ClearReference = [Scene, Mesh](entity* Entity)
     {
         if (Entity->Type == ENTITY_TYPE_MESH_INSTANCE)
         {
@@ -349,7 +526,17 @@ void DestroyMesh(scene* Scene, mesh* Mesh)
                 Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
             }
         }
-    });
+    };
+
+    if (AreEntityUsersIndexed(Scene))
+    {
+        for (entity* Entity : Mesh->Users)
+            ClearReference(Entity);
+    }
+    else
+    {
+        ForEachEntity(&Scene->Root, ClearReference);
+    }
 
     for (prefab* Prefab : Scene->Prefabs)
     {
@@ -364,6 +551,9 @@ void DestroyMesh(scene* Scene, mesh* Mesh)
         });
     }
 
+    DetachMeshTreeUpgrade(Scene, Mesh);
+    DetachScenePackJob(Scene, Mesh);
+
     std::erase(Scene->Meshes, Mesh);
     Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
 
@@ -403,14 +593,28 @@ material* CreateMaterial(scene* Scene, material_type Type, char const* Name)
 
 void ReplaceMaterialReferences(scene* Scene, material* Old, material* New)
 {
-    ForEachEntity(&Scene->Root, [Scene, Old, New](entity* Entity)
+    auto ReplaceReference = [Scene, Old, New](entity* Entity)
     {
         if (Entity->Material == Old)
         {
             Entity->Material = New;
             Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
         }
-    });
+    };
+
+    if (Old && AreEntityUsersIndexed(Scene))
+    {
+        for (entity* Entity : Old->Users)
+            ReplaceReference(Entity);
+    }
+    else
+    {
+        ForEachEntity(&Scene->Root, ReplaceReference);
+    }
+
+    // Prefab instances pack the entities of their prefabs directly.
+    for (prefab* Prefab : Scene->Prefabs)
+        ForEachEntity(Prefab->Entity, ReplaceReference);
 }
 
 void DestroyMaterial(scene* Scene, material* Material)
@@ -421,6 +625,12 @@ void DestroyMaterial(scene* Scene, material* Material)
     Scene->DirtyFlags |= SCENE_DIRTY_MATERIALS;
 }
 
+void MarkMaterialDirty(scene* Scene, material* Material)
+{
+    Material->SlotIsDirty = true;
+    Scene->DirtyFlags |= SCENE_DIRTY_MATERIAL_SLOTS;
+}
+
 static float GetMeshFaceCentroid(mesh* Mesh, uint FaceIndex, int Axis)
 {
     float Centroid = 0.0f;
@@ -432,7 +642,86 @@ static float GetMeshFaceCentroid(mesh* Mesh, uint FaceIndex, int Axis)
     return Centroid / 3.0f;
 }
 
-static void BuildMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t Depth)
+static void BuildMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t Depth, uint32_t MaximumDepth);
+
+// Splits a mesh node into two children at the given face index, and builds
+// the subtrees of the children.
+static void SplitMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t SplitIndex, uint32_t Depth, uint32_t MaximumDepth)
+{
+    uint32_t BeginIndex = Mesh->Nodes[NodeIndex].FaceBeginIndex;
+    uint32_t EndIndex = Mesh->Nodes[NodeIndex].FaceEndIndex;
+
+    uint32_t LeftNodeIndex = static_cast<uint32_t>(Mesh->Nodes.size());
+    uint32_t RightNodeIndex = LeftNodeIndex + 1;
+
+    Mesh->Nodes[NodeIndex].ChildNodeIndex = LeftNodeIndex;
+
+    Mesh->Nodes.push_back
+    ({
+        .FaceBeginIndex = BeginIndex,
+        .FaceEndIndex = SplitIndex,
+    });
+
+    Mesh->Nodes.push_back
+    ({
+        .FaceBeginIndex = SplitIndex,
+        .FaceEndIndex = EndIndex,
+    });
+
+    Mesh->Depth = std::max(Mesh->Depth, Depth+1);
+
+    BuildMeshNode(Mesh, LeftNodeIndex, Depth+1, MaximumDepth);
+    BuildMeshNode(Mesh, RightNodeIndex, Depth+1, MaximumDepth);
+}
+
+static int GetLongestAxis(bounds const& Bounds)
+{
+    vec3 Extent = Bounds.Maximum - Bounds.Minimum;
+    if (Extent.x >= Extent.y && Extent.x >= Extent.z) return 0;
+    return Extent.y >= Extent.z ? 1 : 2;
+}
+
+// Partitions the faces of a mesh node in half by their centroids along the
+// axis where the centroids are spread the most.  Returns the split index.
+static uint32_t FindMeshNodeMedian(mesh* Mesh, mesh_node const& Node)
+{
+    bounds CentroidBounds;
+    for (uint32_t FaceIndex = Node.FaceBeginIndex; FaceIndex < Node.FaceEndIndex; FaceIndex++)
+    {
+        vec3 Centroid;
+        for (int Axis = 0; Axis < 3; Axis++)
+            Centroid[Axis] = GetMeshFaceCentroid(Mesh, FaceIndex, Axis);
+        Grow(CentroidBounds, Centroid);
+    }
+
+    int Axis = GetLongestAxis(CentroidBounds);
+
+    auto Begin = Mesh->Faces.begin() + Node.FaceBeginIndex;
+    auto End = Mesh->Faces.begin() + Node.FaceEndIndex;
+    auto Middle = Begin + (End - Begin) / 2;
+
+    auto GetCentroid = [Mesh, Axis](mesh_face const& Face)
+    {
+        float Centroid = 0.0f;
+        for (uint VertexIndex : Face.VertexIndex)
+            Centroid += Mesh->Vertices[VertexIndex].Position[Axis];
+        return Centroid;
+    };
+
+    std::nth_element(Begin, Middle, End, [&](mesh_face const& A, mesh_face const& B)
+    {
+        return GetCentroid(A) < GetCentroid(B);
+    });
+
+    return static_cast<uint32_t>(Middle - Mesh->Faces.begin());
+}
+
+// Builds the subtree of a mesh node.  The depth of the subtree is limited
+// so that no node is deeper than MaximumDepth: a median split needs at most
+// ceil(log2(N)) more levels to separate N faces, so when the remaining depth
+// budget gets tight, median splits are used instead of SAH splits.  If the
+// budget is too small for the mesh, the deepest leaves hold several faces.
+static void BuildMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t Depth, uint32_t MaximumDepth)
 {
     mesh_node& Node = Mesh->Nodes[NodeIndex];
 
@@ -449,6 +738,12 @@ static void BuildMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t Depth)
         }
     }
 
+    if (FaceCount <= 1 || Depth >= MaximumDepth)
+        return;
+
+    if (Depth + std::bit_width(FaceCount - 1) >= MaximumDepth)
+        return SplitMeshNode(Mesh, NodeIndex, FindMeshNodeMedian(Mesh, Node), Depth, MaximumDepth);
+
     int SplitAxis = 0;
     float SplitPosition = 0;
     float SplitCost = +INF;
@@ -575,1067 +870,4336 @@ static void BuildMeshNode(mesh* Mesh, uint32_t NodeIndex, uint32_t Depth)
     if (SplitIndex == BeginIndex || SplitIndex == EndIndex)
         return;
 
-    uint32_t LeftNodeIndex = static_cast<uint32_t>(Mesh->Nodes.size());
-    uint32_t RightNodeIndex = LeftNodeIndex + 1;
+    SplitMeshNode(Mesh, NodeIndex, SplitIndex, Depth, MaximumDepth);
+}
+
+// Builds the BVH of a mesh from scratch with the SAH builder.
+static void BuildMeshTree(mesh* Mesh, uint32_t MaximumDepth)
+{
+    Mesh->Nodes.clear();
+    Mesh->Nodes.reserve(2 * Mesh->Faces.size());
 
-    Node.ChildNodeIndex = LeftNodeIndex;
+    auto Root = mesh_node
+    {
+        .FaceBeginIndex = 0,
+        .FaceEndIndex = static_cast<uint32_t>(Mesh->Faces.size()),
+        .ChildNodeIndex = 0,
+    };
 
-    Mesh->Nodes.push_back
-    ({
-        .FaceBeginIndex = BeginIndex,
-        .FaceEndIndex = SplitIndex,
-    });
+    Mesh->Depth = 0;
+    Mesh->Nodes.push_back(Root);
+    BuildMeshNode(Mesh, 0, 0, MaximumDepth);
+}
 
-    Mesh->Nodes.push_back
-    ({
-        .FaceBeginIndex = SplitIndex,
-        .FaceEndIndex = EndIndex,
-    });
+/* --- Spatial Split BVH --------------------------------------------------- */
 
-    Mesh->Depth = std::max(Mesh->Depth, Depth+1);
+// A spatial split BVH (SBVH) considers, in addition to partitioning faces
+// by their centroids, splitting the node volume with a plane and placing
+// the faces that straddle the plane into both children, with their bounds
+// clipped to each side.  This removes most of the child overlap caused by
+// long, thin faces.  Leaves remain face ranges, so a face referenced from
+// several leaves is stored once for each leaf.
+
+// Spatial splits are only attempted when the overlap of the best object
+// split children is at least this fraction of the root surface area.
+float const SBVH_MINIMUM_OVERLAP = 1e-5f;
 
-    BuildMeshNode(Mesh, LeftNodeIndex, Depth+1);
-    BuildMeshNode(Mesh, RightNodeIndex, Depth+1);
+struct sbvh_reference
+{
+    uint32_t FaceIndex;
+    bounds   Bounds; // Bounds of the part of the face within the node.
+};
+
+struct sbvh_builder
+{
+    mesh*                  Mesh;
+    std::vector<mesh_face> Faces;
+    std::vector<mesh_node> Nodes;
+    size_t                 ReferenceCount;
+    size_t                 ReferenceLimit;
+    float                  MinimumOverlapArea;
+    uint32_t               MaximumDepth;
+};
+
+struct sbvh_split
+{
+    float  Cost = +INF;
+    int    Axis = 0;
+    float  Position = 0.0f;
+    bool   IsSpatial = false;
+    bounds LeftBounds;
+    bounds RightBounds;
+};
+
+static vec3 GetBoundsCenter(bounds const& Bounds)
+{
+    return 0.5f * (Bounds.Minimum + Bounds.Maximum);
 }
 
-prefab* LoadModelAsPrefab(scene* Scene, char const* Path, load_model_options* Options)
+static bounds Intersect(bounds const& A, bounds const& B)
 {
-    load_model_options DefaultOptions {};
-    if (!Options) Options = &DefaultOptions;
+    return { glm::max(A.Minimum, B.Minimum), glm::min(A.Maximum, B.Maximum) };
+}
 
-    tinyobj::attrib_t Attrib;
-    std::vector<tinyobj::shape_t> Shapes;
-    std::vector<tinyobj::material_t> FileMaterials;
-    std::string Warnings;
-    std::string Errors;
+static bool IsEmpty(bounds const& Bounds)
+{
+    return Bounds.Minimum.x > Bounds.Maximum.x
+        || Bounds.Minimum.y > Bounds.Maximum.y
+        || Bounds.Minimum.z > Bounds.Maximum.z;
+}
 
-    if (!tinyobj::LoadObj(&Attrib, &Shapes, &FileMaterials, &Warnings, &Errors, Path, Options->DirectoryPath.c_str()))
-        return nullptr;
+// Splits a reference with an axis-aligned plane, computing the bounds of the
+// parts of the face on either side of the plane.
+static void SplitReference
+(
+    mesh const* Mesh,
+    sbvh_reference const& Reference,
+    int Axis,
+    float Position,
+    bounds* Left,
+    bounds* Right
+)
+{
+    *Left = {};
+    *Right = {};
 
-    if (Attrib.normals.empty())
+    mesh_face const& Face = Mesh->Faces[Reference.FaceIndex];
+
+    for (int I = 0; I < 3; I++)
     {
-        auto& Normals = Attrib.normals;
+        vec3 V0 = Mesh->Vertices[Face.VertexIndex[I]].Position;
+        vec3 V1 = Mesh->Vertices[Face.VertexIndex[(I+1)%3]].Position;
+        float P0 = V0[Axis], P1 = V1[Axis];
 
-        Normals.resize(Attrib.vertices.size());
+        if (P0 <= Position) Grow(*Left, V0);
+        if (P0 >= Position) Grow(*Right, V0);
 
-        for (tinyobj::shape_t& Shape : Shapes)
+        if ((P0 < Position && P1 > Position) || (P0 > Position && P1 < Position))
         {
-            size_t n = Shape.mesh.indices.size();
-            for (size_t i = 0; i < n; i += 3)
-            {
-                glm::vec3 vertices[3];
-                for (size_t j = 0; j < 3; j++)
-                {
-                    tinyobj::index_t const& Index = Shape.mesh.indices[i+j];
-                    vertices[j] = glm::vec3(
-                        Attrib.vertices[3*Index.vertex_index+0],
-                        Attrib.vertices[3*Index.vertex_index+1],
-                        Attrib.vertices[3*Index.vertex_index+2]);
-                }
-                glm::vec3 normal = glm::normalize(glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
-                for (size_t j = 0; j < 3; j++)
-                {
-                    tinyobj::index_t& Index = Shape.mesh.indices[i+j];
-                    Index.normal_index = Index.vertex_index;
-                    Normals[3*Index.normal_index+0] += normal.x;
-                    Normals[3*Index.normal_index+1] += normal.y;
-                    Normals[3*Index.normal_index+2] += normal.z;
-                }
-            }
+            float T = std::clamp((Position - P0) / (P1 - P0), 0.0f, 1.0f);
+            vec3 Intersection = V0 + T * (V1 - V0);
+            Intersection[Axis] = Position;
+            Grow(*Left, Intersection);
+            Grow(*Right, Intersection);
         }
+    }
 
-        size_t n = Normals.size();
-        for (size_t i = 0; i < n; i += 3)
-        {
-            float length = glm::length(glm::vec3(Normals[i+0], Normals[i+1], Normals[i+2]));
-            if (length > EPSILON)
-            {
-                Normals[i+0] /= length;
-                Normals[i+1] /= length;
-                Normals[i+2] /= length;
-            }
-            else
-            {
-                Normals[i+0] = 0;
-                Normals[i+1] = 0;
-                Normals[i+2] = 1;
-            }
-        }
-    }
+    *Left = Intersect(*Left, Reference.Bounds);
+    *Right = Intersect(*Right, Reference.Bounds);
+}
 
-    // Map from in-file texture name to scene texture.
-    std::unordered_map<std::string, texture*> TextureMap;
-    std::vector<material*> Materials;
+static void FindObjectSplit
+(
+    std::vector<sbvh_reference> const& References,
+    bounds const& CentroidBounds,
+    sbvh_split* Best
+)
+{
+    constexpr uint32_t BINS = 32;
 
-    // Scan the material definitions and build scene materials.
-    for (int MaterialId = 0; MaterialId < FileMaterials.size(); MaterialId++)
+    for (int Axis = 0; Axis < 3; Axis++)
     {
-        tinyobj::material_t const& FileMaterial = FileMaterials[MaterialId];
+        float Minimum = CentroidBounds.Minimum[Axis];
+        float Maximum = CentroidBounds.Maximum[Axis];
+        if (Minimum == Maximum) continue;
 
-        auto Material = (openpbr_material*)CreateMaterial(Scene, MATERIAL_TYPE_OPENPBR, FileMaterial.name.c_str());
+        struct bin
+        {
+            bounds   Bounds;
+            uint32_t Count = 0;
+        };
+        bin Bins[BINS];
 
-        Material->BaseColor = glm::vec4
-        (
-            FileMaterial.diffuse[0],
-            FileMaterial.diffuse[1],
-            FileMaterial.diffuse[2],
-            1.0
-        );
+        float BinIndexPerUnit = float(BINS) / (Maximum - Minimum);
 
-        Material->EmissionColor = glm::vec4
-        (
-            FileMaterial.emission[0],
-            FileMaterial.emission[1],
-            FileMaterial.emission[2],
-            1.0
-        );
+        for (sbvh_reference const& Reference : References)
+        {
+            float Centroid = GetBoundsCenter(Reference.Bounds)[Axis];
+            uint32_t BinIndex = std::min(static_cast<uint32_t>(BinIndexPerUnit * (Centroid - Minimum)), BINS - 1);
+            Grow(Bins[BinIndex].Bounds, Reference.Bounds);
+            Bins[BinIndex].Count++;
+        }
 
-        Material->SpecularRoughness = 1.0f;
-        Material->SpecularIOR = 0.0f;
-        Material->TransmissionWeight = 0.0f;
+        bounds RightBounds[BINS];
+        uint32_t RightCounts[BINS] = {};
+        for (uint32_t I = BINS - 1; I > 0; I--)
+        {
+            RightBounds[I-1] = RightBounds[I];
+            Grow(RightBounds[I-1], Bins[I].Bounds);
+            RightCounts[I-1] = RightCounts[I] + Bins[I].Count;
+        }
 
-        std::tuple<std::string, texture_type, texture**> Textures[] =
+        bounds LeftBounds;
+        uint32_t LeftCount = 0;
+        for (uint32_t I = 0; I < BINS - 1; I++)
         {
+            Grow(LeftBounds, Bins[I].Bounds);
+            LeftCount += Bins[I].Count;
+            if (LeftCount == 0 || RightCounts[I] == 0) continue;
+
+            float Cost = LeftCount * HalfArea(LeftBounds) + RightCounts[I] * HalfArea(RightBounds[I]);
+            if (Cost < Best->Cost)
             {
-                FileMaterial.diffuse_texname,
-                TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA,
-                &Material->BaseColorTexture,
-            },
-            {
-                FileMaterial.emissive_texname,
-                TEXTURE_TYPE_RADIANCE,
-                &Material->EmissionColorTexture,
-            },
+                Best->Cost = Cost;
+                Best->Axis = Axis;
+                Best->Position = Minimum + (I + 1) / BinIndexPerUnit;
+                Best->IsSpatial = false;
+                Best->LeftBounds = LeftBounds;
+                Best->RightBounds = RightBounds[I];
+            }
+        }
+    }
+}
+
+static void FindSpatialSplit
+(
+    mesh const* Mesh,
+    std::vector<sbvh_reference> const& References,
+    bounds const& NodeBounds,
+    sbvh_split* Best
+)
+{
+    constexpr uint32_t BINS = 32;
+
+    for (int Axis = 0; Axis < 3; Axis++)
+    {
+        float Minimum = NodeBounds.Minimum[Axis];
+        float Maximum = NodeBounds.Maximum[Axis];
+        if (Minimum == Maximum) continue;
+
+        struct bin
+        {
+            bounds   Bounds;
+            uint32_t EntryCount = 0;
+            uint32_t ExitCount = 0;
         };
+        bin Bins[BINS];
 
-        for (auto const& [Name, Type, TexturePtr] : Textures)
+        float BinWidth = (Maximum - Minimum) / float(BINS);
+        auto GetBinIndex = [&](float Position)
         {
-            if (!Name.empty())
+            int Index = static_cast<int>((Position - Minimum) / BinWidth);
+            return static_cast<uint32_t>(std::clamp(Index, 0, int(BINS) - 1));
+        };
+
+        // Chop each reference into the bins that it overlaps.
+        for (sbvh_reference const& Reference : References)
+        {
+            uint32_t FirstBin = GetBinIndex(Reference.Bounds.Minimum[Axis]);
+            uint32_t LastBin = GetBinIndex(Reference.Bounds.Maximum[Axis]);
+
+            sbvh_reference Remainder = Reference;
+            for (uint32_t I = FirstBin; I < LastBin; I++)
             {
-                if (!TextureMap.contains(Name))
-                {
-                    std::string Path = std::format("{}/{}", Options->DirectoryPath, Name);
-                    TextureMap[Name] = LoadTexture(Scene, Path.c_str(), Type, Name.c_str());
-                }
-                *TexturePtr = TextureMap[Name];
+                bounds Left, Right;
+                SplitReference(Mesh, Remainder, Axis, Minimum + (I + 1) * BinWidth, &Left, &Right);
+                Grow(Bins[I].Bounds, Left);
+                Remainder.Bounds = Right;
             }
-            else
+            Grow(Bins[LastBin].Bounds, Remainder.Bounds);
+
+            Bins[FirstBin].EntryCount++;
+            Bins[LastBin].ExitCount++;
+        }
+
+        bounds RightBounds[BINS];
+        uint32_t RightCounts[BINS] = {};
+        for (uint32_t I = BINS - 1; I > 0; I--)
+        {
+            RightBounds[I-1] = RightBounds[I];
+            Grow(RightBounds[I-1], Bins[I].Bounds);
+            RightCounts[I-1] = RightCounts[I] + Bins[I].ExitCount;
+        }
+
+        bounds LeftBounds;
+        uint32_t LeftCount = 0;
+        for (uint32_t I = 0; I < BINS - 1; I++)
+        {
+            Grow(LeftBounds, Bins[I].Bounds);
+            LeftCount += Bins[I].EntryCount;
+            if (LeftCount == 0 || RightCounts[I] == 0) continue;
+
+            float Cost = LeftCount * HalfArea(LeftBounds) + RightCounts[I] * HalfArea(RightBounds[I]);
+            if (Cost < Best->Cost)
             {
-                *TexturePtr = nullptr;
+                Best->Cost = Cost;
+                Best->Axis = Axis;
+                Best->Position = Minimum + (I + 1) * BinWidth;
+                Best->IsSpatial = true;
+                Best->LeftBounds = LeftBounds;
+                Best->RightBounds = RightBounds[I];
             }
         }
+    }
+}
 
-        Materials.push_back(Material);
+// Finds the split at the median reference centroid along the axis where the
+// centroids are spread the most.  Used near the depth limit, like in
+// BuildMeshNode().
+static void FindMedianSplit
+(
+    std::vector<sbvh_reference> const& References,
+    bounds const& CentroidBounds,
+    sbvh_split* Split
+)
+{
+    int Axis = GetLongestAxis(CentroidBounds);
+
+    std::vector<float> Centroids(References.size());
+    for (size_t I = 0; I < References.size(); I++)
+        Centroids[I] = GetBoundsCenter(References[I].Bounds)[Axis];
+
+    auto Middle = Centroids.begin() + Centroids.size() / 2;
+    std::nth_element(Centroids.begin(), Middle, Centroids.end());
+
+    Split->Cost = -INF;
+    Split->Axis = Axis;
+    Split->Position = *Middle;
+    Split->IsSpatial = false;
+}
+
+static void BuildSpatialSplitNode(sbvh_builder& Builder, uint32_t NodeIndex, std::vector<sbvh_reference>& References, uint32_t Depth)
+{
+    bounds NodeBounds, CentroidBounds;
+    for (sbvh_reference const& Reference : References)
+    {
+        Grow(NodeBounds, Reference.Bounds);
+        Grow(CentroidBounds, GetBoundsCenter(Reference.Bounds));
     }
 
-    std::string ModelName;
-    if (Options->Name)
+    Builder.Nodes[NodeIndex].Bounds = NodeBounds;
+
+    auto MakeLeaf = [&]()
     {
-        ModelName = Options->Name;
+        mesh_node& Node = Builder.Nodes[NodeIndex];
+        Node.FaceBeginIndex = static_cast<uint32_t>(Builder.Faces.size());
+        for (sbvh_reference const& Reference : References)
+            Builder.Faces.push_back(Builder.Mesh->Faces[Reference.FaceIndex]);
+        Node.FaceEndIndex = static_cast<uint32_t>(Builder.Faces.size());
+        Node.ChildNodeIndex = 0;
+    };
+
+    if (References.size() <= 1 || Depth >= Builder.MaximumDepth)
+        return MakeLeaf();
+
+    sbvh_split Split, ObjectSplit;
+
+    if (Depth + std::bit_width(References.size() - 1) >= Builder.MaximumDepth)
+    {
+        FindMedianSplit(References, CentroidBounds, &Split);
     }
     else
     {
-        std::filesystem::path P = Path;
-        ModelName = P.stem().string();
+        FindObjectSplit(References, CentroidBounds, &Split);
+        ObjectSplit = Split;
+
+        // Only look for spatial splits if the object split children overlap
+        // significantly, and the reference budget has not been exhausted.
+        bounds Overlap = Intersect(Split.LeftBounds, Split.RightBounds);
+        if (!IsEmpty(Overlap) && HalfArea(Overlap) >= Builder.MinimumOverlapArea && Builder.ReferenceCount < Builder.ReferenceLimit)
+            FindSpatialSplit(Builder.Mesh, References, NodeBounds, &Split);
     }
 
-    // Import meshes.
-    std::vector<mesh*> Meshes;
-    std::vector<material*> MeshMaterials;
+    // If splitting is more costly than not splitting, then leave this node as a leaf.
+    float NoSplitCost = References.size() * HalfArea(NodeBounds);
+    if (Split.Cost >= NoSplitCost)
+        return MakeLeaf();
 
-    std::vector<std::pair<size_t, int>> ShapeMaterialPairs;
-    std::vector<vec3> Origins;
+    std::vector<sbvh_reference> Left, Right;
 
-    for (size_t ShapeIndex = 0; ShapeIndex < Shapes.size(); ShapeIndex++)
+    if (Split.IsSpatial)
     {
-        tinyobj::shape_t const& Shape = Shapes[ShapeIndex];
-        size_t FaceCount = Shape.mesh.indices.size() / 3;
-
-        if (FaceCount == 0)
-            continue;
-
-        vec3 Minimum = { +INFINITY, +INFINITY, +INFINITY };
-        vec3 Maximum = { -INFINITY, -INFINITY, -INFINITY };
-        for (size_t I = 0; I < 3*FaceCount; I++)
+        for (sbvh_reference const& Reference : References)
         {
-            tinyobj::index_t const& Index = Shape.mesh.indices[I];
-            vec3 Position =
+            if (Reference.Bounds.Maximum[Split.Axis] <= Split.Position)
+                Left.push_back(Reference);
+            else if (Reference.Bounds.Minimum[Split.Axis] >= Split.Position)
+                Right.push_back(Reference);
+            else
             {
-                Attrib.vertices[3*Index.vertex_index+0],
-                Attrib.vertices[3*Index.vertex_index+1],
-                Attrib.vertices[3*Index.vertex_index+2]
-            };
-            Minimum = glm::min(Minimum, Position);
-            Maximum = glm::max(Maximum, Position);
+                sbvh_reference LeftPart = Reference, RightPart = Reference;
+                SplitReference(Builder.Mesh, Reference, Split.Axis, Split.Position, &LeftPart.Bounds, &RightPart.Bounds);
+                if (!IsEmpty(LeftPart.Bounds)) Left.push_back(LeftPart);
+                if (!IsEmpty(RightPart.Bounds)) Right.push_back(RightPart);
+            }
         }
-        Origins.push_back(0.5f * (Minimum + Maximum));
-
-        std::unordered_set<int> MaterialIndices;
-        for (size_t I = 0; I < FaceCount; I++)
-            MaterialIndices.insert(Shape.mesh.material_ids[I]);
 
-        for (int MaterialIndex : MaterialIndices)
-            ShapeMaterialPairs.push_back({ ShapeIndex, MaterialIndex });
+        // Fall back to the object split if the spatial split would overrun
+        // the reference budget.
+        if (Builder.ReferenceCount + Left.size() + Right.size() - References.size() > Builder.ReferenceLimit)
+        {
+            Split = ObjectSplit;
+            Left.clear();
+            Right.clear();
+            if (Split.Cost >= NoSplitCost)
+                return MakeLeaf();
+        }
     }
 
-    for (auto [ShapeIndex, MaterialIndex] : ShapeMaterialPairs)
+    if (!Split.IsSpatial)
     {
-        tinyobj::shape_t const& Shape = Shapes[ShapeIndex];
-        size_t ShapeFaceCount = Shape.mesh.indices.size() / 3;
-
-        MeshMaterials.push_back(MaterialIndex >= 0 ? Materials[MaterialIndex] : nullptr);
+        for (sbvh_reference const& Reference : References)
+        {
+            if (GetBoundsCenter(Reference.Bounds)[Split.Axis] < Split.Position)
+                Left.push_back(Reference);
+            else
+                Right.push_back(Reference);
+        }
+    }
 
-        vec3 Origin = Origins[ShapeIndex];
+    if (Left.empty() || Right.empty())
+        return MakeLeaf();
 
-        auto Mesh = new mesh;
-        Mesh->Name = !Shape.name.empty() ? Shape.name : std::format("{} {}", ModelName, ShapeIndex);
+    Builder.ReferenceCount += Left.size() + Right.size() - References.size();
 
-        std::unordered_map<mesh_vertex, uint> VertexIndexMap;
+    // The references of this node are no longer needed.
+    std::vector<sbvh_reference>().swap(References);
 
-        for (size_t I = 0; I < ShapeFaceCount; I++)
-        {
-            if (Shape.mesh.material_ids[I] != MaterialIndex) continue;
+    uint32_t LeftNodeIndex = static_cast<uint32_t>(Builder.Nodes.size());
+    uint32_t RightNodeIndex = LeftNodeIndex + 1;
 
-            mesh_face Face;
+    Builder.Nodes[NodeIndex].ChildNodeIndex = LeftNodeIndex;
+    Builder.Nodes.push_back({});
+    Builder.Nodes.push_back({});
 
-            for (size_t J = 0; J < 3; J++)
-            {
-                tinyobj::index_t const& Index = Shape.mesh.indices[3*I+J];
+    Builder.Mesh->Depth = std::max(Builder.Mesh->Depth, Depth+1);
 
-                mesh_vertex Vertex = {};
+    // The face references of the subtree are emitted contiguously.
+    uint32_t FaceBeginIndex = static_cast<uint32_t>(Builder.Faces.size());
+    BuildSpatialSplitNode(Builder, LeftNodeIndex, Left, Depth+1);
+    BuildSpatialSplitNode(Builder, RightNodeIndex, Right, Depth+1);
+    Builder.Nodes[NodeIndex].FaceBeginIndex = FaceBeginIndex;
+    Builder.Nodes[NodeIndex].FaceEndIndex = static_cast<uint32_t>(Builder.Faces.size());
+}
 
-                Vertex.Position = Options->VertexTransform * vec4
-                (
-                    Attrib.vertices[3*Index.vertex_index+0] - Origin.x,
-                    Attrib.vertices[3*Index.vertex_index+1] - Origin.y,
-                    Attrib.vertices[3*Index.vertex_index+2] - Origin.z,
-                    1.0f
-                );
+// Builds the BVH of a mesh with spatial splits, allowing the number of face
+// references to grow by at most the given fraction of the face count.  The
+// faces of the mesh are replaced by the face references of the leaves.
+static void BuildMeshSpatialSplitTree(mesh* Mesh, float DuplicationBudget, uint32_t MaximumDepth)
+{
+    sbvh_builder Builder;
+    Builder.Mesh = Mesh;
+    Builder.MaximumDepth = MaximumDepth;
+    Builder.ReferenceCount = Mesh->Faces.size();
+    Builder.ReferenceLimit = static_cast<size_t>(Mesh->Faces.size() * (1.0f + DuplicationBudget));
+
+    std::vector<sbvh_reference> References(Mesh->Faces.size());
+    bounds RootBounds;
+    for (uint32_t FaceIndex = 0; FaceIndex < Mesh->Faces.size(); FaceIndex++)
+    {
+        sbvh_reference& Reference = References[FaceIndex];
+        Reference.FaceIndex = FaceIndex;
+        for (int J = 0; J < 3; J++)
+            Grow(Reference.Bounds, Mesh->Vertices[Mesh->Faces[FaceIndex].VertexIndex[J]].Position);
+        Grow(RootBounds, Reference.Bounds);
+    }
 
-                if (Index.normal_index >= 0)
-                {
-                    Vertex.Normal = Options->NormalTransform * vec4
-                    (
-                        Attrib.normals[3*Index.normal_index+0],
-                        Attrib.normals[3*Index.normal_index+1],
-                        Attrib.normals[3*Index.normal_index+2],
-                        0.0f
-                    );
-                }
+    Builder.MinimumOverlapArea = SBVH_MINIMUM_OVERLAP * HalfArea(RootBounds);
+    Builder.Faces.reserve(Builder.ReferenceLimit);
+    Builder.Nodes.reserve(2 * Builder.ReferenceLimit);
+    Builder.Nodes.push_back({});
 
-                if (Index.texcoord_index >= 0)
-                {
-                    Vertex.UV = Options->TextureCoordinateTransform * vec3
-                    (
-                        Attrib.texcoords[2*Index.texcoord_index+0],
-                        Attrib.texcoords[2*Index.texcoord_index+1],
-                        1.0f
-                    );
-                }
+    Mesh->Depth = 0;
+    BuildSpatialSplitNode(Builder, 0, References, 0);
 
-                if (!VertexIndexMap.contains(Vertex))
-                {
-                    VertexIndexMap[Vertex] = static_cast<uint>(Mesh->Vertices.size());
-                    Mesh->Vertices.push_back(Vertex);
-                }
+    Mesh->Faces = std::move(Builder.Faces);
+    Mesh->Nodes = std::move(Builder.Nodes);
+}
 
-                Face.VertexIndex[J] = VertexIndexMap[Vertex];
-            }
+float GetMeshTreeCost(mesh const* Mesh)
+{
+    if (Mesh->Nodes.empty()) return 0.0f;
 
-            Mesh->Faces.push_back(Face);
-        }
+    float RootArea = HalfArea(Mesh->Nodes[0].Bounds);
+    if (RootArea <= 0.0f) return 0.0f;
 
-        Meshes.push_back(Mesh);
+    float Cost = 0.0f;
+    for (mesh_node const& Node : Mesh->Nodes)
+    {
+        float Area = HalfArea(Node.Bounds) / RootArea;
+        if (Node.ChildNodeIndex == 0)
+            Cost += Area * (Node.FaceEndIndex - Node.FaceBeginIndex);
+        else
+            Cost += Area;
     }
+    return Cost;
+}
 
-    for (mesh* Mesh : Meshes)
-    {
-        Mesh->Nodes.reserve(2 * Mesh->Faces.size());
+/* --- Linear BVH ---------------------------------------------------------- */
 
-        auto Root = mesh_node
-        {
-            .FaceBeginIndex = 0,
-            .FaceEndIndex = static_cast<uint32_t>(Mesh->Faces.size()),
-            .ChildNodeIndex = 0,
-        };
+// The linear BVH (LBVH) builder sorts the faces along a Morton curve through
+// their centroids, and derives the hierarchy from the sorted Morton codes,
+// building every node independently of the others (Karras, "Maximizing
+// Parallelism in the Construction of BVHs, Octrees, and k-d Trees").  It is
+// much faster than the SAH builder, but the tree is slower to trace.  Some
+// of the difference is recovered by rebuilding the top levels of the tree
+// with SAH splits over the subtrees below them.
 
-        Mesh->Nodes.push_back(Root);
-        BuildMeshNode(Mesh, 0, 0);
+// Subtrees with at most this many faces are collapsed into leaves, if that
+// lowers their SAH cost.
+static constexpr uint32_t LBVH_LEAF_FACE_LIMIT = 8;
 
-        Scene->Meshes.push_back(Mesh);
-    }
+// Number of subtrees that the top levels of the tree are rebuilt over.
+static constexpr uint32_t LBVH_TOP_LEVEL_SUBTREE_COUNT = 1024;
 
-    Scene->DirtyFlags |= SCENE_DIRTY_MATERIALS;
-    Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
+static constexpr uint32_t LBVH_NODE_NONE = ~0u;
 
-    auto Prefab = new prefab;
+struct lbvh_key
+{
+    uint64_t Code;
+    uint32_t FaceIndex;
+};
 
-    if (Meshes.size() == 1)
-    {
-        auto Instance = new mesh_entity;
-        Instance->Name = Meshes[0]->Name;
-        Instance->Mesh = Meshes[0];
-        Instance->Material = MeshMaterials[0];
-        Prefab->Entity = Instance;
-    }
-    else
-    {
-        auto Container = new container_entity;
-        Container->Name = ModelName;
-        for (size_t I = 0; I < Meshes.size(); I++)
-        {
-            mesh* Mesh = Meshes[I];
-            glm::vec3 const& Origin = Origins[I];
+enum lbvh_node_type
+{
+    LBVH_NODE_TYPE_FACE     = 0, // Single face.
+    LBVH_NODE_TYPE_INTERNAL = 1, // Node of the Morton code hierarchy.
+    LBVH_NODE_TYPE_TOP      = 2, // Node of the rebuilt top levels.
+};
 
-            auto Instance = new mesh_entity;
-            Instance->Name = Mesh->Name;
-            Instance->Mesh = Mesh;
-            Instance->Material = MeshMaterials[I];
-            Instance->Transform.Position = Options->VertexTransform * glm::vec4(Origin, 1);
-            Container->Children.push_back(Instance);
-        }
-        Prefab->Entity = Container;
-    }
+struct lbvh_node_ref
+{
+    lbvh_node_type Type;
+    uint32_t       Index;
+};
 
-    Scene->Prefabs.push_back(Prefab);
+// Internal node of the Morton code hierarchy, covering a range of sorted
+// faces.  Internal node I is either the first or the last face of its range.
+struct lbvh_internal_node
+{
+    bounds   Bounds;
+    uint32_t FirstIndex;
+    uint32_t LastIndex;
+    uint32_t SplitIndex; // Last face of the left child.
+    uint32_t Parent;
+    float    Cost;       // SAH cost of the subtree.
+    bool     IsLeaf;     // Subtree is collapsed into a leaf.
+};
 
-    return Prefab;
-}
+struct lbvh_top_node
+{
+    bounds        Bounds;
+    lbvh_node_ref Children[2];
+};
 
-void DestroyPrefab(scene* Scene, prefab* Prefab)
+struct lbvh_builder
 {
-    DestroyEntity(Scene, Prefab->Entity);
-    std::erase(Scene->Prefabs, Prefab);
-    delete Prefab;
+    std::vector<mesh_face>          Faces; // Sorted by Morton code.
+    std::vector<bounds>             FaceBounds;
+    std::vector<uint32_t>           FaceParents;
+    std::vector<lbvh_internal_node> Nodes;
+    std::vector<lbvh_top_node>      TopNodes;
+};
+
+// Spreads the low 21 bits of a value out to every third bit.
+static uint64_t SpreadMortonBits(uint64_t X)
+{
+    X &= 0x1FFFFF;
+    X = (X | X << 32) & 0x001F00000000FFFF;
+    X = (X | X << 16) & 0x001F0000FF0000FF;
+    X = (X | X << 8)  & 0x100F00F00F00F00F;
+    X = (X | X << 4)  & 0x10C30C30C30C30C3;
+    X = (X | X << 2)  & 0x1249249249249249;
+    return X;
 }
 
-scene* CreateScene()
+// Sorts the keys by Morton code with a parallel least significant digit
+// radix sort.  Digits in which all of the keys agree are skipped.
+static void SortMortonKeys(std::vector<lbvh_key>& Keys)
 {
-    auto Scene = new scene;
+    constexpr uint32_t DIGIT_BITS = 8;
+    constexpr uint32_t BUCKET_COUNT = 1 << DIGIT_BITS;
+    constexpr size_t BLOCK_SIZE = 1 << 16;
 
-    Scene->Root.Name = "Scene";
+    size_t Count = Keys.size();
+    size_t BlockCount = (Count + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-    char const* SRGB_SPECTRUM_TABLE_FILE = "sRGBSpectrumTable.dat";
+    std::vector<lbvh_key> Sorted(Count);
+    std::vector<size_t> Offsets(BlockCount * BUCKET_COUNT);
 
-    Scene->RGBSpectrumTable = new parametric_spectrum_table;
-    if (!LoadParametricSpectrumTable(Scene->RGBSpectrumTable, SRGB_SPECTRUM_TABLE_FILE))
+    for (uint32_t Shift = 0; Shift < 63; Shift += DIGIT_BITS)
     {
-        printf("%s not found, generating it.\n", SRGB_SPECTRUM_TABLE_FILE);
-        printf("This will probably take a few minutes...\n");
-        BuildParametricSpectrumTableForSRGB(Scene->RGBSpectrumTable);
-        SaveParametricSpectrumTable(Scene->RGBSpectrumTable, SRGB_SPECTRUM_TABLE_FILE);
-    }
+        // Count the digits in each block.
+        std::fill(Offsets.begin(), Offsets.end(), 0);
+        ParallelForRange(Count, BLOCK_SIZE, [&](size_t Begin, size_t End)
+        {
+            size_t* BlockOffsets = &Offsets[Begin / BLOCK_SIZE * BUCKET_COUNT];
+            for (size_t I = Begin; I < End; I++)
+                BlockOffsets[(Keys[I].Code >> Shift) & (BUCKET_COUNT - 1)]++;
+        });
 
-    auto PlaneMaterial = (basic_diffuse_material*)CreateMaterial(Scene, MATERIAL_TYPE_BASIC_DIFFUSE, "Plane Material");
-    PlaneMaterial->BaseTexture = CreateCheckerTexture(Scene, "Plane Texture", TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA, glm::vec4(1,1,1,1), glm::vec4(0.5,0.5,0.5,1));
-    PlaneMaterial->BaseTexture->EnableNearestFiltering = true;
-    plane_entity* Plane = (plane_entity*)CreateEntity(Scene, ENTITY_TYPE_PLANE);
-    Plane->Name = "Plane";
-    Plane->Material = PlaneMaterial;
+        // Turn the counts into output offsets, ordered by digit and then by
+        // block, so that the sort is stable.
+        size_t Offset = 0;
+        bool IsUniform = false;
+        for (uint32_t Digit = 0; Digit < BUCKET_COUNT; Digit++)
+        {
+            size_t DigitCount = 0;
+            for (size_t Block = 0; Block < BlockCount; Block++)
+            {
+                size_t& BlockOffset = Offsets[Block * BUCKET_COUNT + Digit];
+                size_t BlockDigitCount = BlockOffset;
+                BlockOffset = Offset;
+                Offset += BlockDigitCount;
+                DigitCount += BlockDigitCount;
+            }
+            IsUniform |= DigitCount == Count;
+        }
 
-    camera_entity* Camera = (camera_entity*)CreateEntity(Scene, ENTITY_TYPE_CAMERA);
-    Camera->Name = "Camera";
-    Camera->Transform.Position = { 0, 0, 1 };
+        if (IsUniform) continue;
 
-    Scene->DirtyFlags = SCENE_DIRTY_ALL;
+        ParallelForRange(Count, BLOCK_SIZE, [&](size_t Begin, size_t End)
+        {
+            size_t* BlockOffsets = &Offsets[Begin / BLOCK_SIZE * BUCKET_COUNT];
+            for (size_t I = Begin; I < End; I++)
+                Sorted[BlockOffsets[(Keys[I].Code >> Shift) & (BUCKET_COUNT - 1)]++] = Keys[I];
+        });
 
-    return Scene;
+        Keys.swap(Sorted);
+    }
 }
 
-void DestroyScene(scene* Scene)
+// Builds internal node I of the Morton code hierarchy over the sorted keys.
+// The number of leading bits shared by two keys determines the hierarchy;
+// equal codes are told apart by their position.
+static void BuildLinearInternalNode(lbvh_builder& Builder, std::vector<lbvh_key> const& Keys, int64_t I)
 {
-    while (!Scene->Root.Children.empty())
-        DestroyEntity(Scene, Scene->Root.Children[0]);
-    for (prefab* Prefab : Scene->Prefabs)
-        delete Prefab;
-    for (mesh* Mesh : Scene->Meshes)
-        delete Mesh;
-    for (material* Material : Scene->Materials)
-        delete Material;
-    for (texture* Texture : Scene->Textures)
-        delete Texture;
-    delete Scene->RGBSpectrumTable;
-    delete Scene;
+    int64_t Count = static_cast<int64_t>(Keys.size());
+
+    auto GetCommonPrefix = [&](int64_t J) -> int
+    {
+        if (J < 0 || J >= Count) return -1;
+        uint64_t A = Keys[I].Code, B = Keys[J].Code;
+        if (A == B) return 64 + std::countl_zero(static_cast<uint64_t>(I ^ J));
+        return std::countl_zero(A ^ B);
+    };
+
+    // Determine the direction of the range, and its length.
+    int64_t D = GetCommonPrefix(I + 1) > GetCommonPrefix(I - 1) ? +1 : -1;
+    int MinimumPrefix = GetCommonPrefix(I - D);
+
+    int64_t LengthBound = 2;
+    while (GetCommonPrefix(I + LengthBound * D) > MinimumPrefix)
+        LengthBound *= 2;
+
+    int64_t Length = 0;
+    for (int64_t Step = LengthBound / 2; Step >= 1; Step /= 2)
+        if (GetCommonPrefix(I + (Length + Step) * D) > MinimumPrefix)
+            Length += Step;
+
+    int64_t J = I + Length * D;
+
+    // Find the split position, where the common prefix gets longer.
+    int NodePrefix = GetCommonPrefix(J);
+    int64_t Split = 0;
+    for (int64_t Step = Length; Step > 1; )
+    {
+        Step = (Step + 1) / 2;
+        if (GetCommonPrefix(I + (Split + Step) * D) > NodePrefix)
+            Split += Step;
+    }
+    int64_t SplitIndex = I + Split * D + std::min<int64_t>(D, 0);
+
+    lbvh_internal_node& Node = Builder.Nodes[I];
+    Node.FirstIndex = static_cast<uint32_t>(std::min(I, J));
+    Node.LastIndex = static_cast<uint32_t>(std::max(I, J));
+    Node.SplitIndex = static_cast<uint32_t>(SplitIndex);
+
+    // Each node is the parent of its children.
+    uint32_t Parent = static_cast<uint32_t>(I);
+    if (Node.FirstIndex == Node.SplitIndex)
+        Builder.FaceParents[Node.SplitIndex] = Parent;
+    else
+        Builder.Nodes[Node.SplitIndex].Parent = Parent;
+    if (Node.LastIndex == Node.SplitIndex + 1)
+        Builder.FaceParents[Node.SplitIndex + 1] = Parent;
+    else
+        Builder.Nodes[Node.SplitIndex + 1].Parent = Parent;
 }
 
-//bool LoadSkybox(scene* Scene, char const* Path)
-//{
-    //int Width, Height, Components;
+static void GetLinearNodeChildren(lbvh_builder const& Builder, lbvh_node_ref Ref, lbvh_node_ref* Children)
+{
+    if (Ref.Type == LBVH_NODE_TYPE_TOP)
+    {
+        Children[0] = Builder.TopNodes[Ref.Index].Children[0];
+        Children[1] = Builder.TopNodes[Ref.Index].Children[1];
+        return;
+    }
 
-    //Scene->SkyboxPixels = reinterpret_cast<glm::vec4*>(stbi_loadf(Path, &Width, &Height, &Components, STBI_rgb_alpha));
-    //Scene->SkyboxWidth = static_cast<uint32_t>(Width);
-    //Scene->SkyboxHeight = static_cast<uint32_t>(Height);
+    lbvh_internal_node const& Node = Builder.Nodes[Ref.Index];
+    uint32_t Left = Node.SplitIndex;
+    uint32_t Right = Node.SplitIndex + 1;
+    Children[0] = { Left == Node.FirstIndex ? LBVH_NODE_TYPE_FACE : LBVH_NODE_TYPE_INTERNAL, Left };
+    Children[1] = { Right == Node.LastIndex ? LBVH_NODE_TYPE_FACE : LBVH_NODE_TYPE_INTERNAL, Right };
+}
 
-    //for (int Y = 0; Y < Height; Y++)
-    //{
-    //    for (int X = 0; X < Width; X++)
-    //    {
-    //        int Index = Y * Width + X;
+static bounds const& GetLinearNodeBounds(lbvh_builder const& Builder, lbvh_node_ref Ref)
+{
+    switch (Ref.Type)
+    {
+        case LBVH_NODE_TYPE_FACE:     return Builder.FaceBounds[Ref.Index];
+        case LBVH_NODE_TYPE_INTERNAL: return Builder.Nodes[Ref.Index].Bounds;
+        default:                      return Builder.TopNodes[Ref.Index].Bounds;
+    }
+}
 
-    //        glm::vec3 Color = Scene->SkyboxPixels[Index].rgb();
-    //        float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
-    //        glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Color / Intensity);
-    //        Scene->SkyboxPixels[Index] = glm::vec4(Beta, Intensity);
-    //    }
-    //}
+static bool IsLinearNodeLeaf(lbvh_builder const& Builder, lbvh_node_ref Ref)
+{
+    if (Ref.Type == LBVH_NODE_TYPE_FACE) return true;
+    if (Ref.Type == LBVH_NODE_TYPE_INTERNAL) return Builder.Nodes[Ref.Index].IsLeaf;
+    return false;
+}
 
-    //Scene->DirtyFlags |= SCENE_DIRTY_SKYBOX;
+// Computes the bounds and SAH costs of the internal nodes bottom-up.  Each
+// face walks up the tree, and the second child to arrive at a node computes
+// the node and continues upwards.
+static void ComputeLinearNodeBounds(lbvh_builder& Builder)
+{
+    size_t FaceCount = Builder.Faces.size();
+    std::vector<std::atomic<uint32_t>> ArrivalCounts(Builder.Nodes.size());
 
-    //float* Pixels = Scene->SkyboxPixels;
+    ParallelForRange(FaceCount, 1 << 14, [&](size_t Begin, size_t End)
+    {
+        for (size_t FaceIndex = Begin; FaceIndex < End; FaceIndex++)
+        {
+            uint32_t Index = Builder.FaceParents[FaceIndex];
+            while (Index != LBVH_NODE_NONE)
+            {
+                if (ArrivalCounts[Index].fetch_add(1, std::memory_order_acq_rel) == 0)
+                    break;
 
-    //glm::vec3 Mean = {};
-    //float WeightSum = 0.0f;
-    //for (int Y = 0; Y < Height; Y++)
-    //{
-    //    float Theta = (0.5f - (Y + 0.5f) / Height) * PI;
-    //    for (int X = 0; X < Width; X++)
-    //    {
-    //        float Phi = ((X + 0.5f) / Width - 0.5f) * TAU;
+                lbvh_internal_node& Node = Builder.Nodes[Index];
 
-    //        int Index = (Y * Width + X) * 4;
-    //        float R = Pixels[Index+0];
-    //        float G = Pixels[Index+1];
-    //        float B = Pixels[Index+2];
-    //        float Luminance = 0.2126f * R + 0.7152f * G + 0.0722f * B;
-    //        float Area = glm::cos(Theta);
+                lbvh_node_ref Children[2];
+                GetLinearNodeChildren(Builder, { LBVH_NODE_TYPE_INTERNAL, Index }, Children);
 
-    //        float Weight = Area * Luminance * Luminance;
+                Node.Bounds = {};
+                float ChildCost = 0.0f;
+                for (lbvh_node_ref Child : Children)
+                {
+                    bounds const& ChildBounds = GetLinearNodeBounds(Builder, Child);
+                    Grow(Node.Bounds, ChildBounds);
+                    ChildCost += Child.Type == LBVH_NODE_TYPE_FACE ? HalfArea(ChildBounds) : Builder.Nodes[Child.Index].Cost;
+                }
 
-    //        glm::vec3 Direction =
-    //        {
-    //            glm::cos(Theta) * glm::cos(Phi),
-    //            glm::cos(Theta) * glm::sin(Phi),
-    //            glm::sin(Theta),
-    //        };
+                uint32_t NodeFaceCount = Node.LastIndex - Node.FirstIndex + 1;
+                float SplitCost = HalfArea(Node.Bounds) + ChildCost;
+                float LeafCost = HalfArea(Node.Bounds) * NodeFaceCount;
 
-    //        Mean += Weight * Direction;
-    //        WeightSum += Weight;
-    //    }
-    //}
-    //Mean /= WeightSum;
+                Node.IsLeaf = NodeFaceCount <= LBVH_LEAF_FACE_LIMIT && LeafCost <= SplitCost;
+                Node.Cost = Node.IsLeaf ? LeafCost : SplitCost;
 
-    //float MeanLength = glm::length(Mean);
+                Index = Node.Parent;
+            }
+        }
+    });
+}
 
-    //glm::vec3 FrameZ = Mean / MeanLength;
-    //glm::vec3 FrameX = OrthogonalVector(FrameZ);
-    //glm::vec3 FrameY = glm::cross(FrameX, FrameZ);
+// Builds a top-level node with binned SAH splits over a set of subtrees.
+// The face index of each reference is the index of the subtree.
+static lbvh_node_ref BuildLinearTopNode
+(
+    lbvh_builder& Builder,
+    std::vector<lbvh_node_ref> const& Subtrees,
+    std::vector<sbvh_reference>& References
+)
+{
+    if (References.size() == 1)
+        return Subtrees[References[0].FaceIndex];
 
-    //float Concentration = MeanLength * (3.0f - MeanLength * MeanLength) / (1 - MeanLength * MeanLength);
+    bounds NodeBounds, CentroidBounds;
+    for (sbvh_reference const& Reference : References)
+    {
+        Grow(NodeBounds, Reference.Bounds);
+        Grow(CentroidBounds, GetBoundsCenter(Reference.Bounds));
+    }
 
-    //Scene->SkyboxDistributionFrame = glm::mat3(FrameX, FrameY, FrameZ);
-    //Scene->SkyboxDistributionConcentration = Concentration;
+    sbvh_split Split;
+    FindObjectSplit(References, CentroidBounds, &Split);
 
-//    return true;
-//}
+    std::vector<sbvh_reference> Left, Right;
+    for (sbvh_reference const& Reference : References)
+    {
+        if (GetBoundsCenter(Reference.Bounds)[Split.Axis] < Split.Position)
+            Left.push_back(Reference);
+        else
+            Right.push_back(Reference);
+    }
 
-static bounds ShapeBounds(scene const* Scene, packed_shape const& Object)
+    // If the subtrees could not be told apart, keep them in Morton order.
+    if (Split.Cost == INF || Left.empty() || Right.empty())
+    {
+        size_t Middle = References.size() / 2;
+        Left.assign(References.begin(), References.begin() + Middle);
+        Right.assign(References.begin() + Middle, References.end());
+    }
+
+    uint32_t Index = static_cast<uint32_t>(Builder.TopNodes.size());
+    Builder.TopNodes.push_back({ NodeBounds });
+
+    lbvh_node_ref LeftRef = BuildLinearTopNode(Builder, Subtrees, Left);
+    lbvh_node_ref RightRef = BuildLinearTopNode(Builder, Subtrees, Right);
+    Builder.TopNodes[Index].Children[0] = LeftRef;
+    Builder.TopNodes[Index].Children[1] = RightRef;
+
+    return { LBVH_NODE_TYPE_TOP, Index };
+}
+
+// Rebuilds the top levels of the tree, by opening up the largest subtree
+// until there are enough of them, and building a tree over the subtrees
+// with SAH splits.  Returns the new root.
+static lbvh_node_ref BuildLinearTopLevels(lbvh_builder& Builder, lbvh_node_ref Root)
 {
-    glm::vec4 Corners[8] = {};
+    auto GetFaceCount = [&](lbvh_node_ref Ref) -> uint32_t
+    {
+        if (Ref.Type == LBVH_NODE_TYPE_FACE) return 1;
+        return Builder.Nodes[Ref.Index].LastIndex - Builder.Nodes[Ref.Index].FirstIndex + 1;
+    };
 
-    switch (Object.Type)
+    auto IsSmaller = [&](lbvh_node_ref A, lbvh_node_ref B)
     {
-        case SHAPE_TYPE_MESH_INSTANCE:
+        return GetFaceCount(A) < GetFaceCount(B);
+    };
+
+    std::vector<lbvh_node_ref> Subtrees = { Root };
+    std::vector<lbvh_node_ref> Opened;
+
+    while (!Subtrees.empty() && Subtrees.size() + Opened.size() < LBVH_TOP_LEVEL_SUBTREE_COUNT)
+    {
+        std::pop_heap(Subtrees.begin(), Subtrees.end(), IsSmaller);
+        lbvh_node_ref Largest = Subtrees.back();
+        Subtrees.pop_back();
+
+        if (IsLinearNodeLeaf(Builder, Largest))
         {
-            glm::vec3 MeshMin = Scene->MeshNodePack[Object.MeshRootNodeIndex].Minimum;
-            glm::vec3 MeshMax = Scene->MeshNodePack[Object.MeshRootNodeIndex].Maximum;
+            Opened.push_back(Largest);
+            continue;
+        }
+
+        lbvh_node_ref Children[2];
+        GetLinearNodeChildren(Builder, Largest, Children);
+        for (lbvh_node_ref Child : Children)
+        {
+            Subtrees.push_back(Child);
+            std::push_heap(Subtrees.begin(), Subtrees.end(), IsSmaller);
+        }
+    }
 
-            Corners[0] = { MeshMin.x, MeshMin.y, MeshMin.z, 1 };
-            Corners[1] = { MeshMin.x, MeshMin.y, MeshMax.z, 1 };
-            Corners[2] = { MeshMin.x, MeshMax.y, MeshMin.z, 1 };
-            Corners[3] = { MeshMin.x, MeshMax.y, MeshMax.z, 1 };
-            Corners[4] = { MeshMax.x, MeshMin.y, MeshMin.z, 1 };
-            Corners[5] = { MeshMax.x, MeshMin.y, MeshMax.z, 1 };
-            Corners[6] = { MeshMax.x, MeshMax.y, MeshMin.z, 1 };
-            Corners[7] = { MeshMax.x, MeshMax.y, MeshMax.z, 1 };
+    Subtrees.insert(Subtrees.end(), Opened.begin(), Opened.end());
 
-            break;
+    // Keep the subtrees in Morton order, for when they cannot be split.
+    std::sort(Subtrees.begin(), Subtrees.end(), [&](lbvh_node_ref A, lbvh_node_ref B)
+    {
+        uint32_t FirstA = A.Type == LBVH_NODE_TYPE_FACE ? A.Index : Builder.Nodes[A.Index].FirstIndex;
+        uint32_t FirstB = B.Type == LBVH_NODE_TYPE_FACE ? B.Index : Builder.Nodes[B.Index].FirstIndex;
+        return FirstA < FirstB;
+    });
+
+    std::vector<sbvh_reference> References(Subtrees.size());
+    for (uint32_t I = 0; I < Subtrees.size(); I++)
+        References[I] = { I, GetLinearNodeBounds(Builder, Subtrees[I]) };
+
+    return BuildLinearTopNode(Builder, Subtrees, References);
+}
+
+static void AppendLinearNodeFaces(lbvh_builder const& Builder, lbvh_node_ref Ref, std::vector<mesh_face>& Faces)
+{
+    if (Ref.Type == LBVH_NODE_TYPE_FACE)
+    {
+        Faces.push_back(Builder.Faces[Ref.Index]);
+    }
+    else if (Ref.Type == LBVH_NODE_TYPE_INTERNAL)
+    {
+        lbvh_internal_node const& Node = Builder.Nodes[Ref.Index];
+        Faces.insert(Faces.end(), Builder.Faces.begin() + Node.FirstIndex, Builder.Faces.begin() + Node.LastIndex + 1);
+    }
+    else
+    {
+        for (lbvh_node_ref Child : Builder.TopNodes[Ref.Index].Children)
+            AppendLinearNodeFaces(Builder, Child, Faces);
+    }
+}
+
+// Writes the tree into the mesh, with the faces in depth-first leaf order.
+// Nodes at the depth limit become leaves with all of the faces of their
+// subtree.
+static void WriteLinearNode
+(
+    lbvh_builder const& Builder,
+    lbvh_node_ref Ref,
+    mesh* Mesh,
+    uint32_t OutputIndex,
+    uint32_t Depth,
+    uint32_t MaximumDepth
+)
+{
+    uint32_t FaceBeginIndex = static_cast<uint32_t>(Mesh->Faces.size());
+
+    Mesh->Nodes[OutputIndex].Bounds = GetLinearNodeBounds(Builder, Ref);
+    Mesh->Depth = std::max(Mesh->Depth, Depth);
+
+    if (IsLinearNodeLeaf(Builder, Ref) || Depth >= MaximumDepth)
+    {
+        AppendLinearNodeFaces(Builder, Ref, Mesh->Faces);
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = 0;
+    }
+    else
+    {
+        lbvh_node_ref Children[2];
+        GetLinearNodeChildren(Builder, Ref, Children);
+
+        uint32_t ChildIndex = static_cast<uint32_t>(Mesh->Nodes.size());
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = ChildIndex;
+        WriteLinearNode(Builder, Children[0], Mesh, ChildIndex, Depth+1, MaximumDepth);
+        WriteLinearNode(Builder, Children[1], Mesh, ChildIndex+1, Depth+1, MaximumDepth);
+    }
+
+    Mesh->Nodes[OutputIndex].FaceBeginIndex = FaceBeginIndex;
+    Mesh->Nodes[OutputIndex].FaceEndIndex = static_cast<uint32_t>(Mesh->Faces.size());
+}
+
+// Builds the BVH of a mesh with the LBVH builder, using all cores.  The
+// faces of the mesh are reordered.
+static void BuildMeshLinearTree(mesh* Mesh, uint32_t MaximumDepth, bool OptimizeTopLevels)
+{
+    size_t FaceCount = Mesh->Faces.size();
+
+    Mesh->Nodes.clear();
+    Mesh->Nodes.push_back({ .FaceBeginIndex = 0, .FaceEndIndex = static_cast<uint32_t>(FaceCount) });
+    Mesh->Depth = 0;
+
+    if (FaceCount == 0)
+        return;
+
+    lbvh_builder Builder;
+    Builder.FaceBounds.resize(FaceCount);
+
+    // Compute the face bounds, and the bounds of the face centroids.
+    size_t const BLOCK_SIZE = 1 << 14;
+    std::vector<bounds> BlockCentroidBounds((FaceCount + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    ParallelForRange(FaceCount, BLOCK_SIZE, [&](size_t Begin, size_t End)
+    {
+        bounds& CentroidBounds = BlockCentroidBounds[Begin / BLOCK_SIZE];
+        for (size_t I = Begin; I < End; I++)
+        {
+            bounds& Bounds = Builder.FaceBounds[I];
+            for (uint VertexIndex : Mesh->Faces[I].VertexIndex)
+                Grow(Bounds, Mesh->Vertices[VertexIndex].Position);
+            Grow(CentroidBounds, GetBoundsCenter(Bounds));
         }
-        case SHAPE_TYPE_PLANE:
+    });
+
+    bounds CentroidBounds;
+    for (bounds const& Bounds : BlockCentroidBounds)
+        Grow(CentroidBounds, Bounds);
+
+    // Compute the 63-bit Morton codes of the face centroids, and sort.
+    vec3 Extent = CentroidBounds.Maximum - CentroidBounds.Minimum;
+    vec3 Scale = 2097151.0f / glm::max(Extent, vec3(1e-30f));
+
+    std::vector<lbvh_key> Keys(FaceCount);
+    ParallelForRange(FaceCount, BLOCK_SIZE, [&](size_t Begin, size_t End)
+    {
+        for (size_t I = Begin; I < End; I++)
         {
-            Corners[0] = { -1e9f, -1e9f, -EPSILON, 1 };
-            Corners[1] = { +1e9f, -1e9f, -EPSILON, 1 };
-            Corners[2] = { -1e9f, +1e9f, -EPSILON, 1 };
-            Corners[3] = { +1e9f, +1e9f, -EPSILON, 1 };
-            Corners[4] = { -1e9f, -1e9f, +EPSILON, 1 };
-            Corners[5] = { +1e9f, -1e9f, +EPSILON, 1 };
-            Corners[6] = { -1e9f, +1e9f, +EPSILON, 1 };
-            Corners[7] = { +1e9f, +1e9f, +EPSILON, 1 };
+            vec3 Position = (GetBoundsCenter(Builder.FaceBounds[I]) - CentroidBounds.Minimum) * Scale;
+            uint64_t Code = 0;
+            for (int Axis = 0; Axis < 3; Axis++)
+                Code |= SpreadMortonBits(static_cast<uint64_t>(std::clamp(Position[Axis], 0.0f, 2097151.0f))) << (2 - Axis);
+            Keys[I] = { Code, static_cast<uint32_t>(I) };
+        }
+    });
 
-            break;
+    SortMortonKeys(Keys);
+
+    // Reorder the faces and their bounds.
+    Builder.Faces.resize(FaceCount);
+    std::vector<bounds> FaceBounds(FaceCount);
+    ParallelForRange(FaceCount, BLOCK_SIZE, [&](size_t Begin, size_t End)
+    {
+        for (size_t I = Begin; I < End; I++)
+        {
+            Builder.Faces[I] = Mesh->Faces[Keys[I].FaceIndex];
+            FaceBounds[I] = Builder.FaceBounds[Keys[I].FaceIndex];
         }
-        case SHAPE_TYPE_SPHERE:
-        case SHAPE_TYPE_CUBE:
+    });
+    Builder.FaceBounds = std::move(FaceBounds);
+
+    // Build the hierarchy.
+    lbvh_node_ref Root = { LBVH_NODE_TYPE_FACE, 0 };
+
+    if (FaceCount > 1)
+    {
+        Builder.Nodes.resize(FaceCount - 1);
+        Builder.FaceParents.resize(FaceCount);
+        Builder.Nodes[0].Parent = LBVH_NODE_NONE;
+
+        ParallelForRange(FaceCount - 1, BLOCK_SIZE, [&](size_t Begin, size_t End)
         {
-            Corners[0] = { -1, -1, -1, 1 };
-            Corners[1] = { +1, -1, -1, 1 };
-            Corners[2] = { -1, +1, -1, 1 };
-            Corners[3] = { +1, +1, -1, 1 };
-            Corners[4] = { -1, -1, +1, 1 };
-            Corners[5] = { +1, -1, +1, 1 };
-            Corners[6] = { -1, +1, +1, 1 };
-            Corners[7] = { +1, +1, +1, 1 };
+            for (size_t I = Begin; I < End; I++)
+                BuildLinearInternalNode(Builder, Keys, static_cast<int64_t>(I));
+        });
 
+        ComputeLinearNodeBounds(Builder);
+
+        Root = { LBVH_NODE_TYPE_INTERNAL, 0 };
+
+        if (OptimizeTopLevels)
+            Root = BuildLinearTopLevels(Builder, Root);
+    }
+
+    Mesh->Faces.clear();
+    Mesh->Nodes.reserve(2 * FaceCount);
+    WriteLinearNode(Builder, Root, Mesh, 0, 0, MaximumDepth);
+}
+
+/* --- BVH Optimization ---------------------------------------------------- */
+
+// The BVH of a mesh can be optimized after it has been built, by repeatedly
+// removing a node and reinserting it where it increases the SAH cost the
+// least (Bittner et al., "Fast Insertion-Based Optimization of Bounding
+// Volume Hierarchies").  Reinsertion within a subtree does not change the
+// bounds of the subtree, so disjoint subtrees are first optimized in
+// parallel, followed by passes over the whole tree.
+
+static constexpr uint32_t REINSERTION_NODE_NONE = ~0u;
+
+struct reinsertion_node
+{
+    bounds   Bounds;
+    uint32_t Parent;
+    uint32_t Children[2]; // REINSERTION_NODE_NONE for leaves.
+    uint32_t FaceBeginIndex;
+    uint32_t FaceEndIndex;
+};
+
+using reinsertion_clock = std::chrono::steady_clock;
+
+// Recomputes the bounds of the ancestors of a node, up to but not
+// including the root of the subtree being optimized.
+static void RefitReinsertionNodes(std::vector<reinsertion_node>& Nodes, uint32_t NodeIndex, uint32_t RootIndex)
+{
+    while (NodeIndex != RootIndex)
+    {
+        reinsertion_node& Node = Nodes[NodeIndex];
+        Node.Bounds = Nodes[Node.Children[0]].Bounds;
+        Grow(Node.Bounds, Nodes[Node.Children[1]].Bounds);
+        NodeIndex = Node.Parent;
+    }
+}
+
+static void ReplaceReinsertionChild(reinsertion_node& Node, uint32_t OldIndex, uint32_t NewIndex)
+{
+    if (Node.Children[0] == OldIndex)
+        Node.Children[0] = NewIndex;
+    else
+        Node.Children[1] = NewIndex;
+}
+
+// Moves a node to the position within the subtree that minimizes the SAH
+// cost of the subtree.  The children of the subtree root are not moved.
+static void ReinsertNode(std::vector<reinsertion_node>& Nodes, uint32_t NodeIndex, uint32_t RootIndex)
+{
+    uint32_t ParentIndex = Nodes[NodeIndex].Parent;
+    if (NodeIndex == RootIndex || ParentIndex == RootIndex)
+        return;
+
+    reinsertion_node& Parent = Nodes[ParentIndex];
+    uint32_t SiblingIndex = Parent.Children[0] == NodeIndex ? Parent.Children[1] : Parent.Children[0];
+    uint32_t GrandparentIndex = Parent.Parent;
+
+    // Remove the node from the tree, replacing its parent by its sibling.
+    ReplaceReinsertionChild(Nodes[GrandparentIndex], ParentIndex, SiblingIndex);
+    Nodes[SiblingIndex].Parent = GrandparentIndex;
+    RefitReinsertionNodes(Nodes, GrandparentIndex, RootIndex);
+
+    // Branch and bound search for the node that, when paired with the
+    // removed node, increases the cost the least.  The induced cost of a
+    // candidate is the growth of the areas of its ancestors.
+    using entry = std::pair<float, uint32_t>;
+    thread_local std::vector<entry> Queue;
+    Queue.clear();
+
+    bounds const& Bounds = Nodes[NodeIndex].Bounds;
+    float NodeArea = HalfArea(Bounds);
+
+    float BestCost = +INF;
+    uint32_t BestIndex = SiblingIndex;
+
+    for (uint32_t ChildIndex : Nodes[RootIndex].Children)
+        Queue.push_back({ 0.0f, ChildIndex });
+    std::make_heap(Queue.begin(), Queue.end(), std::greater<entry>());
+
+    while (!Queue.empty())
+    {
+        std::pop_heap(Queue.begin(), Queue.end(), std::greater<entry>());
+        auto [InducedCost, Index] = Queue.back();
+        Queue.pop_back();
+
+        if (InducedCost + NodeArea >= BestCost)
             break;
+
+        reinsertion_node const& Candidate = Nodes[Index];
+        bounds Merged = Candidate.Bounds;
+        Grow(Merged, Bounds);
+        float Cost = InducedCost + HalfArea(Merged);
+
+        if (Cost < BestCost)
+        {
+            BestCost = Cost;
+            BestIndex = Index;
+        }
+
+        if (Candidate.Children[0] != REINSERTION_NODE_NONE)
+        {
+            float ChildInducedCost = Cost - HalfArea(Candidate.Bounds);
+            if (ChildInducedCost + NodeArea < BestCost)
+            {
+                for (uint32_t ChildIndex : Candidate.Children)
+                {
+                    Queue.push_back({ ChildInducedCost, ChildIndex });
+                    std::push_heap(Queue.begin(), Queue.end(), std::greater<entry>());
+                }
+            }
+        }
+    }
+
+    // Insert the node as the sibling of the best node, reusing its old
+    // parent node as the new parent.
+    uint32_t TargetParentIndex = Nodes[BestIndex].Parent;
+    ReplaceReinsertionChild(Nodes[TargetParentIndex], BestIndex, ParentIndex);
+    Parent.Parent = TargetParentIndex;
+    Parent.Children[0] = BestIndex;
+    Parent.Children[1] = NodeIndex;
+    Nodes[BestIndex].Parent = ParentIndex;
+    RefitReinsertionNodes(Nodes, ParentIndex, RootIndex);
+}
+
+// Collects the nodes of a subtree in depth-first order.
+static void GetReinsertionSubtreeNodes(std::vector<reinsertion_node> const& Nodes, uint32_t RootIndex, std::vector<uint32_t>& Result)
+{
+    Result.clear();
+    Result.push_back(RootIndex);
+    for (size_t I = 0; I < Result.size(); I++)
+    {
+        reinsertion_node const& Node = Nodes[Result[I]];
+        if (Node.Children[0] != REINSERTION_NODE_NONE)
+        {
+            Result.push_back(Node.Children[0]);
+            Result.push_back(Node.Children[1]);
+        }
+    }
+}
+
+// Sum of the areas of the internal nodes of a subtree.  The leaf terms of
+// the SAH cost do not change with reinsertion, so they are left out.
+static float GetReinsertionSubtreeCost(std::vector<reinsertion_node> const& Nodes, std::vector<uint32_t> const& SubtreeNodes)
+{
+    float Cost = 0.0f;
+    for (uint32_t Index : SubtreeNodes)
+        if (Nodes[Index].Children[0] != REINSERTION_NODE_NONE)
+            Cost += HalfArea(Nodes[Index].Bounds);
+    return Cost;
+}
+
+// Reinserts all nodes of a subtree, largest first, until a pass no longer
+// improves the cost noticeably or the deadline is reached.
+static void OptimizeReinsertionSubtree(std::vector<reinsertion_node>& Nodes, uint32_t RootIndex, reinsertion_clock::time_point Deadline)
+{
+    std::vector<uint32_t> SubtreeNodes;
+    GetReinsertionSubtreeNodes(Nodes, RootIndex, SubtreeNodes);
+
+    float Cost = GetReinsertionSubtreeCost(Nodes, SubtreeNodes);
+
+    while (true)
+    {
+        std::sort(SubtreeNodes.begin(), SubtreeNodes.end(), [&](uint32_t A, uint32_t B)
+        {
+            return HalfArea(Nodes[A].Bounds) > HalfArea(Nodes[B].Bounds);
+        });
+
+        for (size_t I = 0; I < SubtreeNodes.size(); I++)
+        {
+            if (I % 64 == 0 && reinsertion_clock::now() >= Deadline)
+                return;
+            ReinsertNode(Nodes, SubtreeNodes[I], RootIndex);
+        }
+
+        float NewCost = GetReinsertionSubtreeCost(Nodes, SubtreeNodes);
+        if (NewCost > 0.999f * Cost) break;
+        Cost = NewCost;
+    }
+}
+
+// Writes the optimized tree back into the mesh, with the children of each
+// node next to each other and the faces in depth-first leaf order.  Nodes
+// at the depth limit become leaves with all of the faces of their subtree.
+static void WriteReinsertionNode
+(
+    std::vector<reinsertion_node> const& Nodes,
+    uint32_t Index,
+    mesh* Mesh,
+    std::vector<mesh_face> const& Faces,
+    uint32_t OutputIndex,
+    uint32_t Depth,
+    uint32_t MaximumDepth
+)
+{
+    reinsertion_node const& Node = Nodes[Index];
+    uint32_t FaceBeginIndex = static_cast<uint32_t>(Mesh->Faces.size());
+
+    Mesh->Nodes[OutputIndex].Bounds = Node.Bounds;
+    Mesh->Depth = std::max(Mesh->Depth, Depth);
+
+    if (Node.Children[0] == REINSERTION_NODE_NONE)
+    {
+        Mesh->Faces.insert(Mesh->Faces.end(), Faces.begin() + Node.FaceBeginIndex, Faces.begin() + Node.FaceEndIndex);
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = 0;
+    }
+    else if (Depth >= MaximumDepth)
+    {
+        std::vector<uint32_t> SubtreeNodes;
+        GetReinsertionSubtreeNodes(Nodes, Index, SubtreeNodes);
+        for (uint32_t SubtreeIndex : SubtreeNodes)
+        {
+            reinsertion_node const& Leaf = Nodes[SubtreeIndex];
+            if (Leaf.Children[0] != REINSERTION_NODE_NONE) continue;
+            Mesh->Faces.insert(Mesh->Faces.end(), Faces.begin() + Leaf.FaceBeginIndex, Faces.begin() + Leaf.FaceEndIndex);
+        }
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = 0;
+    }
+    else
+    {
+        uint32_t ChildIndex = static_cast<uint32_t>(Mesh->Nodes.size());
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = ChildIndex;
+        WriteReinsertionNode(Nodes, Node.Children[0], Mesh, Faces, ChildIndex, Depth+1, MaximumDepth);
+        WriteReinsertionNode(Nodes, Node.Children[1], Mesh, Faces, ChildIndex+1, Depth+1, MaximumDepth);
+    }
+
+    Mesh->Nodes[OutputIndex].FaceBeginIndex = FaceBeginIndex;
+    Mesh->Nodes[OutputIndex].FaceEndIndex = static_cast<uint32_t>(Mesh->Faces.size());
+}
+
+// Optimizes the BVH of a mesh by node reinsertion for at most the given
+// number of seconds.  Reinsertion can make the tree deeper, so the subtrees
+// below the depth limit are collapsed into leaves afterwards.
+static void ReinsertMeshNodes(mesh* Mesh, float TimeLimit, uint32_t MaximumDepth)
+{
+    if (Mesh->Nodes.size() < 5 || TimeLimit <= 0.0f)
+        return;
+
+    auto StartTime = reinsertion_clock::now();
+    auto Duration = std::chrono::duration_cast<reinsertion_clock::duration>(std::chrono::duration<float>(TimeLimit));
+    auto ParallelDeadline = StartTime + Duration * 3 / 4;
+    auto Deadline = StartTime + Duration;
+
+    float InitialCost = GetMeshTreeCost(Mesh);
+
+    std::vector<reinsertion_node> Nodes(Mesh->Nodes.size());
+    Nodes[0].Parent = REINSERTION_NODE_NONE;
+    for (uint32_t Index = 0; Index < Mesh->Nodes.size(); Index++)
+    {
+        mesh_node const& Node = Mesh->Nodes[Index];
+        reinsertion_node& Out = Nodes[Index];
+        Out.Bounds = Node.Bounds;
+        Out.FaceBeginIndex = Node.FaceBeginIndex;
+        Out.FaceEndIndex = Node.FaceEndIndex;
+        if (Node.ChildNodeIndex > 0)
+        {
+            Out.Children[0] = Node.ChildNodeIndex;
+            Out.Children[1] = Node.ChildNodeIndex + 1;
+            Nodes[Node.ChildNodeIndex + 0].Parent = Index;
+            Nodes[Node.ChildNodeIndex + 1].Parent = Index;
+        }
+        else
+        {
+            Out.Children[0] = REINSERTION_NODE_NONE;
+            Out.Children[1] = REINSERTION_NODE_NONE;
+        }
+    }
+
+    // Split the tree into subtrees for the worker threads, by opening up
+    // the subtree with the most nodes until there are enough of them.
+    std::vector<uint32_t> SubtreeNodes;
+    using subtree = std::pair<size_t, uint32_t>;
+    std::vector<subtree> Subtrees = { { Nodes.size(), 0 } };
+
+    while (Subtrees.size() < 16 * GetWorkerThreadCount())
+    {
+        std::pop_heap(Subtrees.begin(), Subtrees.end());
+        auto [NodeCount, Index] = Subtrees.back();
+        if (NodeCount < 256)
+        {
+            std::push_heap(Subtrees.begin(), Subtrees.end());
+            break;
+        }
+        Subtrees.pop_back();
+
+        for (uint32_t ChildIndex : Nodes[Index].Children)
+        {
+            GetReinsertionSubtreeNodes(Nodes, ChildIndex, SubtreeNodes);
+            Subtrees.push_back({ SubtreeNodes.size(), ChildIndex });
+            std::push_heap(Subtrees.begin(), Subtrees.end());
+        }
+    }
+
+    // Largest subtrees first, for better load balancing.
+    std::sort(Subtrees.begin(), Subtrees.end(), std::greater<subtree>());
+
+    ParallelFor(Subtrees.size(), [&](size_t Index)
+    {
+        OptimizeReinsertionSubtree(Nodes, Subtrees[Index].second, ParallelDeadline);
+    });
+
+    OptimizeReinsertionSubtree(Nodes, 0, Deadline);
+
+    // Write the tree back, with the faces in the new leaf order.
+    std::vector<mesh_face> Faces = std::move(Mesh->Faces);
+    Mesh->Faces.clear();
+    Mesh->Faces.reserve(Faces.size());
+    Mesh->Nodes.clear();
+    Mesh->Nodes.push_back({});
+    Mesh->Depth = 0;
+    WriteReinsertionNode(Nodes, 0, Mesh, Faces, 0, 0, MaximumDepth);
+
+    std::chrono::duration<float> Elapsed = reinsertion_clock::now() - StartTime;
+    printf("Optimized BVH of '%s' in %.1f s: SAH cost %.1f -> %.1f\n",
+        Mesh->Name.c_str(), Elapsed.count(), InitialCost, GetMeshTreeCost(Mesh));
+}
+
+/* --- Mesh Layout --------------------------------------------------------- */
+
+// After the BVH of a mesh has been built, its nodes, faces and vertices are
+// laid out in depth-first order, with the child that is more likely to be
+// hit (the one with the larger surface area) first.  The nodes visited by
+// a ray and the faces and vertices of nearby leaves then tend to be close
+// to each other in memory.
+
+static void WriteMeshLayoutNode
+(
+    std::vector<mesh_node> const& Nodes,
+    std::vector<mesh_face> const& Faces,
+    uint32_t Index,
+    mesh* Mesh,
+    uint32_t OutputIndex
+)
+{
+    mesh_node const& Node = Nodes[Index];
+    uint32_t FaceBeginIndex = static_cast<uint32_t>(Mesh->Faces.size());
+
+    Mesh->Nodes[OutputIndex].Bounds = Node.Bounds;
+
+    if (Node.ChildNodeIndex == 0)
+    {
+        Mesh->Faces.insert(Mesh->Faces.end(), Faces.begin() + Node.FaceBeginIndex, Faces.begin() + Node.FaceEndIndex);
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = 0;
+    }
+    else
+    {
+        uint32_t HotIndex = Node.ChildNodeIndex;
+        uint32_t ColdIndex = Node.ChildNodeIndex + 1;
+        if (HalfArea(Nodes[ColdIndex].Bounds) > HalfArea(Nodes[HotIndex].Bounds))
+            std::swap(HotIndex, ColdIndex);
+
+        uint32_t ChildIndex = static_cast<uint32_t>(Mesh->Nodes.size());
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes.push_back({});
+        Mesh->Nodes[OutputIndex].ChildNodeIndex = ChildIndex;
+        WriteMeshLayoutNode(Nodes, Faces, HotIndex, Mesh, ChildIndex);
+        WriteMeshLayoutNode(Nodes, Faces, ColdIndex, Mesh, ChildIndex+1);
+    }
+
+    Mesh->Nodes[OutputIndex].FaceBeginIndex = FaceBeginIndex;
+    Mesh->Nodes[OutputIndex].FaceEndIndex = static_cast<uint32_t>(Mesh->Faces.size());
+}
+
+static void OptimizeMeshLayout(mesh* Mesh)
+{
+    if (Mesh->Nodes.empty())
+        return;
+
+    // Reorder the nodes and faces.
+    std::vector<mesh_node> Nodes = std::move(Mesh->Nodes);
+    std::vector<mesh_face> Faces = std::move(Mesh->Faces);
+
+    Mesh->Nodes.clear();
+    Mesh->Nodes.reserve(Nodes.size());
+    Mesh->Nodes.push_back({});
+    Mesh->Faces.clear();
+    Mesh->Faces.reserve(Faces.size());
+    WriteMeshLayoutNode(Nodes, Faces, 0, Mesh, 0);
+
+    // Number the vertices in the order of their first use by the faces.
+    // Vertices that are not used by any face are dropped.
+    std::vector<uint32_t> VertexIndexMap(Mesh->Vertices.size(), ~0u);
+    std::vector<mesh_vertex> Vertices;
+    Vertices.reserve(Mesh->Vertices.size());
+
+    for (mesh_face& Face : Mesh->Faces)
+    {
+        for (uint& VertexIndex : Face.VertexIndex)
+        {
+            if (VertexIndexMap[VertexIndex] == ~0u)
+            {
+                VertexIndexMap[VertexIndex] = static_cast<uint32_t>(Vertices.size());
+                Vertices.push_back(Mesh->Vertices[VertexIndex]);
+            }
+            VertexIndex = VertexIndexMap[VertexIndex];
+        }
+    }
+
+    Mesh->Vertices = std::move(Vertices);
+}
+
+void OptimizeMeshTree(scene* Scene, mesh* Mesh, float TimeLimit)
+{
+    Mesh->TreeOptimizationTime = std::max(TimeLimit, 1e-3f);
+}
+
+/* --- BVH Upgrade -------------------------------------------------------- */
+
+// Rebuild or optimization of a mesh BVH in progress on a background thread.
+// The thread works on a copy of the mesh, so the mesh can still be rendered.
+struct mesh_tree_upgrade
+{
+    mesh*             Mesh; // Null if the mesh was destroyed.
+    mesh              Result;
+    float             OptimizationTime = 0.0f; // Optimizes the existing tree if positive.
+    std::thread       Thread;
+    std::atomic<bool> IsDone = false;
+};
+
+// Builds the SAH BVH of a mesh with the given options, and lays it out.
+// Runs on the calling thread only, as neither the SAH and spatial split
+// builders nor the layout pass use the thread pool.
+static void BuildMeshTree(mesh* Mesh, mesh_tree_options const& Options)
+{
+    if (Options.UseSpatialSplits && !Mesh->Faces.empty())
+        BuildMeshSpatialSplitTree(Mesh, Options.SpatialSplitBudget, Options.MaximumDepth);
+    else
+        BuildMeshTree(Mesh, Options.MaximumDepth);
+
+    if (Options.OptimizeLayout)
+        OptimizeMeshLayout(Mesh);
+}
+
+// Discards the result of the background rebuild of a mesh BVH, if there is
+// one in progress.  The rebuild still runs to completion.
+static void DetachMeshTreeUpgrade(scene* Scene, mesh* Mesh)
+{
+    if (Scene->MeshTreeUpgrade && Scene->MeshTreeUpgrade->Mesh == Mesh)
+        Scene->MeshTreeUpgrade->Mesh = nullptr;
+}
+
+void UpdateMeshTreeUpgrades(scene* Scene, bool IsInteracting)
+{
+    mesh_tree_upgrade* Upgrade = Scene->MeshTreeUpgrade;
+
+    if (Upgrade)
+    {
+        if (!Upgrade->IsDone.load(std::memory_order_acquire))
+            return;
+
+        // The mesh may be read by a background scene pack.
+        if (IsScenePackJobRunning(Scene))
+            return;
+
+        Upgrade->Thread.join();
+
+        mesh* Mesh = Upgrade->Mesh;
+        bool IsOptimization = Upgrade->OptimizationTime > 0.0f;
+        if (Mesh && (IsOptimization || Mesh->NeedsTreeUpgrade))
+        {
+            float Cost = Mesh->TreeCost;
+
+            Mesh->Vertices = std::move(Upgrade->Result.Vertices);
+            Mesh->Faces = std::move(Upgrade->Result.Faces);
+            Mesh->Nodes = std::move(Upgrade->Result.Nodes);
+            Mesh->Depth = Upgrade->Result.Depth;
+            Mesh->TreeCost = Upgrade->Result.TreeCost;
+            Mesh->NeedsTreeUpgrade = false;
+            if (IsOptimization)
+                Mesh->TreeOptimizationTime = 0.0f;
+
+            // The mesh payload has changed, so it must be saved again.
+            Mesh->PayloadHash = 0;
+            Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
+
+            // Reinsertion reports its own result.
+            if (!IsOptimization)
+                printf("Rebuilt BVH for '%s': SAH cost %.1f (was %.1f)\n", Mesh->Name.c_str(), Mesh->TreeCost, Cost);
+        }
+
+        delete Upgrade;
+        Scene->MeshTreeUpgrade = nullptr;
+    }
+
+    // Requested optimizations start right away, and rebuilds only while
+    // the user is not interacting.
+    mesh* Mesh = nullptr;
+    for (mesh* Candidate : Scene->Meshes)
+    {
+        if (Candidate->TreeOptimizationTime > 0.0f)
+        {
+            Mesh = Candidate;
+            break;
+        }
+        if (!Mesh && !IsInteracting && Candidate->NeedsTreeUpgrade)
+            Mesh = Candidate;
+    }
+
+    if (!Mesh)
+        return;
+
+    Upgrade = new mesh_tree_upgrade;
+    Upgrade->Mesh = Mesh;
+    Upgrade->OptimizationTime = Mesh->TreeOptimizationTime;
+    Upgrade->Result.Name = Mesh->Name;
+    Upgrade->Result.Vertices = Mesh->Vertices;
+    Upgrade->Result.Faces = Mesh->Faces;
+    Upgrade->Result.TreeOptions = Mesh->TreeOptions;
+
+    if (Upgrade->OptimizationTime > 0.0f)
+    {
+        Upgrade->Result.Nodes = Mesh->Nodes;
+        Upgrade->Result.Depth = Mesh->Depth;
+    }
+
+    Upgrade->Thread = std::thread([Upgrade]
+    {
+        mesh* Result = &Upgrade->Result;
+        if (Upgrade->OptimizationTime > 0.0f)
+        {
+            ReinsertMeshNodes(Result, Upgrade->OptimizationTime, std::max(Result->Depth, MESH_TREE_DEPTH_LIMIT));
+            if (Result->TreeOptions.OptimizeLayout)
+                OptimizeMeshLayout(Result);
+        }
+        else
+        {
+            // A single core is used, leaving the rest for rendering.
+            BuildMeshTree(Result, Result->TreeOptions);
+        }
+        Result->TreeCost = GetMeshTreeCost(Result);
+        Upgrade->IsDone.store(true, std::memory_order_release);
+    });
+
+    Scene->MeshTreeUpgrade = Upgrade;
+}
+
+/* --- Wide Mesh BVH ------------------------------------------------------- */
+
+// The binary mesh BVH is collapsed into a wide BVH for the GPU when the
+// scene is packed.  Each wide node holds the quantized bounds of up to
+// MESH_NODE_WIDTH children, which are either wide nodes or leaves.
+
+// Maximum number of faces in a leaf of a wide node.
+static constexpr uint32_t MESH_NODE_LEAF_FACE_LIMIT = 255;
+
+static_assert(MESH_NODE_WIDTH <= 4, "Quantized child bounds are packed 4 per uint");
+
+// A child of a wide node under construction.  It is either a node of the
+// binary BVH, or a range of faces that did not fit into a single leaf.
+struct wide_mesh_child
+{
+    bounds   Bounds;
+    uint32_t NodeIndex; // Index of the binary node, or ~0u for a face range.
+    uint32_t FaceBeginIndex;
+    uint32_t FaceEndIndex;
+};
+
+static wide_mesh_child MakeWideMeshChild(mesh const* Mesh, uint32_t NodeIndex)
+{
+    mesh_node const& Node = Mesh->Nodes[NodeIndex];
+    return { Node.Bounds, NodeIndex, Node.FaceBeginIndex, Node.FaceEndIndex };
+}
+
+static wide_mesh_child MakeWideMeshChild(mesh const* Mesh, uint32_t FaceBeginIndex, uint32_t FaceEndIndex)
+{
+    wide_mesh_child Child = { {}, ~0u, FaceBeginIndex, FaceEndIndex };
+    for (uint32_t FaceIndex = FaceBeginIndex; FaceIndex < FaceEndIndex; FaceIndex++)
+        for (int J = 0; J < 3; J++)
+            Grow(Child.Bounds, Mesh->Vertices[Mesh->Faces[FaceIndex].VertexIndex[J]].Position);
+    return Child;
+}
+
+// A child becomes a wide node unless it is a small enough binary leaf.
+static bool IsWideMeshChildInternal(mesh const* Mesh, wide_mesh_child const& Child)
+{
+    if (Child.NodeIndex != ~0u && Mesh->Nodes[Child.NodeIndex].ChildNodeIndex > 0)
+        return true;
+    return Child.FaceEndIndex - Child.FaceBeginIndex > MESH_NODE_LEAF_FACE_LIMIT;
+}
+
+// Computes the biased exponent of the power-of-two cell size of the
+// quantization grid, such that 255 cells cover the given interval.
+static uint32_t GetQuantizationExponent(float Minimum, float Maximum)
+{
+    int Exponent = -126;
+    if (Maximum > Minimum)
+    {
+        std::frexp((Maximum - Minimum) / 255.0f, &Exponent);
+        Exponent = std::clamp(Exponent, -126, 127);
+    }
+
+    // Grow the cell size until the grid covers the interval also after
+    // rounding.
+    while (Exponent < 127 && Minimum + std::ldexp(255.0f, Exponent) < Maximum)
+        Exponent++;
+
+    return static_cast<uint32_t>(Exponent + 127);
+}
+
+// Quantizes a child bound conservatively: the dequantized minimum is never
+// above, and the dequantized maximum never below, the original value.
+static uint32_t QuantizeMinimum(float Value, float Origin, float Scale)
+{
+    uint32_t Q = static_cast<uint32_t>(std::clamp(std::floor((Value - Origin) / Scale), 0.0f, 255.0f));
+    while (Q > 0 && Origin + float(Q) * Scale > Value) Q--;
+    return Q;
+}
+
+static uint32_t QuantizeMaximum(float Value, float Origin, float Scale)
+{
+    uint32_t Q = static_cast<uint32_t>(std::clamp(std::ceil((Value - Origin) / Scale), 0.0f, 255.0f));
+    while (Q < 255 && Origin + float(Q) * Scale < Value) Q++;
+    return Q;
+}
+
+static vec3 GetPackedMeshNodeScale(packed_mesh_node const& Node)
+{
+    return
+    {
+        std::bit_cast<float>(((Node.Exponents >> 0) & 0xFF) << 23),
+        std::bit_cast<float>(((Node.Exponents >> 8) & 0xFF) << 23),
+        std::bit_cast<float>(((Node.Exponents >> 16) & 0xFF) << 23),
+    };
+}
+
+// Dequantizes the bounds of a child of a packed wide node.
+static bounds GetPackedMeshChildBounds(packed_mesh_node const& Node, uint32_t ChildIndex)
+{
+    vec3 Scale = GetPackedMeshNodeScale(Node);
+    uint32_t Shift = 8 * ChildIndex;
+
+    bounds Bounds;
+    for (int Axis = 0; Axis < 3; Axis++)
+    {
+        Bounds.Minimum[Axis] = Node.Origin[Axis] + float((Node.QuantizedMinimum[Axis] >> Shift) & 0xFF) * Scale[Axis];
+        Bounds.Maximum[Axis] = Node.Origin[Axis] + float((Node.QuantizedMaximum[Axis] >> Shift) & 0xFF) * Scale[Axis];
+    }
+    return Bounds;
+}
+
+// Computes the bounds of a packed wide node from the bounds of its children.
+static bounds GetPackedMeshNodeBounds(packed_mesh_node const& Node)
+{
+    uint32_t ChildCount = Node.Exponents >> 24;
+
+    bounds Bounds;
+    for (uint32_t I = 0; I < ChildCount; I++)
+    {
+        bounds ChildBounds = GetPackedMeshChildBounds(Node, I);
+        Bounds.Minimum = glm::min(Bounds.Minimum, ChildBounds.Minimum);
+        Bounds.Maximum = glm::max(Bounds.Maximum, ChildBounds.Maximum);
+    }
+    return Bounds;
+}
+
+// Collapses the binary BVH of a mesh into wide nodes and appends them to
+// the packed node array.  Face indices are offset by FaceIndexBase, and
+// all bounds are padded by Margin.  Returns the index of the packed root
+// node.
+static uint32_t PackMeshNodes(mesh const* Mesh, uint32_t FaceIndexBase, vec3 Margin, std::vector<packed_mesh_node>& Pack)
+{
+    struct pending_node
+    {
+        wide_mesh_child Child;
+        uint32_t        PackedIndex;
+        uint32_t        ParentIndex;
+    };
+
+    uint32_t RootIndex = static_cast<uint32_t>(Pack.size());
+    Pack.push_back({});
+
+    if (Mesh->Faces.empty())
+        return RootIndex;
+
+    // The root node starts out with the root of the binary BVH as its only
+    // child, so that a mesh with a single leaf gets a valid wide node.
+    std::vector<pending_node> Stack;
+    Stack.push_back({ MakeWideMeshChild(Mesh, 0), RootIndex, MESH_NODE_INDEX_NONE });
+
+    while (!Stack.empty())
+    {
+        pending_node Pending = Stack.back();
+        Stack.pop_back();
+
+        // Gather the children by repeatedly opening up the internal child
+        // with the largest surface area.
+        wide_mesh_child Children[MESH_NODE_WIDTH];
+        uint32_t ChildCount = 1;
+        Children[0] = Pending.Child;
+
+        while (ChildCount < MESH_NODE_WIDTH)
+        {
+            int BestIndex = -1;
+            float BestArea = -INF;
+            for (uint32_t I = 0; I < ChildCount; I++)
+            {
+                if (!IsWideMeshChildInternal(Mesh, Children[I])) continue;
+                float Area = HalfArea(Children[I].Bounds);
+                if (Area > BestArea)
+                {
+                    BestIndex = static_cast<int>(I);
+                    BestArea = Area;
+                }
+            }
+            if (BestIndex < 0) break;
+
+            wide_mesh_child Opened = Children[BestIndex];
+            if (Opened.NodeIndex != ~0u && Mesh->Nodes[Opened.NodeIndex].ChildNodeIndex > 0)
+            {
+                uint32_t ChildNodeIndex = Mesh->Nodes[Opened.NodeIndex].ChildNodeIndex;
+                Children[BestIndex] = MakeWideMeshChild(Mesh, ChildNodeIndex);
+                Children[ChildCount++] = MakeWideMeshChild(Mesh, ChildNodeIndex + 1);
+            }
+            else
+            {
+                uint32_t MiddleIndex = Opened.FaceBeginIndex + (Opened.FaceEndIndex - Opened.FaceBeginIndex) / 2;
+                Children[BestIndex] = MakeWideMeshChild(Mesh, Opened.FaceBeginIndex, MiddleIndex);
+                Children[ChildCount++] = MakeWideMeshChild(Mesh, MiddleIndex, Opened.FaceEndIndex);
+            }
+        }
+
+        // Order the children by decreasing surface area, so that the child
+        // most likely to be hit comes first.
+        std::stable_sort(Children, Children + ChildCount, [](wide_mesh_child const& A, wide_mesh_child const& B)
+        {
+            return HalfArea(A.Bounds) > HalfArea(B.Bounds);
+        });
+
+        // Quantize the child bounds relative to the bounds of this node.
+        bounds Bounds = Pending.Child.Bounds;
+        Bounds.Minimum -= Margin;
+        Bounds.Maximum += Margin;
+
+        packed_mesh_node Packed = {};
+        Packed.Origin = Bounds.Minimum;
+        Packed.ParentIndex = Pending.ParentIndex;
+
+        for (int Axis = 0; Axis < 3; Axis++)
+            Packed.Exponents |= GetQuantizationExponent(Bounds.Minimum[Axis], Bounds.Maximum[Axis]) << (8 * Axis);
+
+        vec3 Scale = GetPackedMeshNodeScale(Packed);
+
+        size_t StackBase = Stack.size();
+
+        uint32_t PackedChildCount = 0;
+        for (uint32_t I = 0; I < ChildCount; I++)
+        {
+            wide_mesh_child const& Child = Children[I];
+            bool IsInternal = IsWideMeshChildInternal(Mesh, Child);
+            if (!IsInternal && Child.FaceBeginIndex == Child.FaceEndIndex) continue;
+
+            uint32_t Slot = PackedChildCount++;
+            uint32_t Shift = 8 * Slot;
+
+            for (int Axis = 0; Axis < 3; Axis++)
+            {
+                Packed.QuantizedMinimum[Axis] |= QuantizeMinimum(Child.Bounds.Minimum[Axis] - Margin[Axis], Packed.Origin[Axis], Scale[Axis]) << Shift;
+                Packed.QuantizedMaximum[Axis] |= QuantizeMaximum(Child.Bounds.Maximum[Axis] + Margin[Axis], Packed.Origin[Axis], Scale[Axis]) << Shift;
+            }
+
+            if (IsInternal)
+            {
+                uint32_t PackedIndex = static_cast<uint32_t>(Pack.size());
+                Pack.push_back({});
+                Stack.push_back({ Child, PackedIndex, Pending.PackedIndex });
+                Packed.ChildIndices[Slot] = PackedIndex;
+            }
+            else
+            {
+                Packed.ChildIndices[Slot] = FaceIndexBase + Child.FaceBeginIndex;
+                Packed.LeafFaceCounts |= (Child.FaceEndIndex - Child.FaceBeginIndex) << Shift;
+            }
+        }
+
+        Packed.Exponents |= PackedChildCount << 24;
+        Pack[Pending.PackedIndex] = Packed;
+
+        // The internal children were allocated next to each other.  Lay out
+        // the subtree of the first child right after them.
+        std::reverse(Stack.begin() + StackBase, Stack.end());
+    }
+
+    return RootIndex;
+}
+
+// Meshes with at least this many faces are welded using all cores.
+static constexpr size_t LARGE_MESH_FACE_COUNT = 1 << 16;
+
+// Fills in the vertices and faces of a mesh from the vertices at the corners
+// of its faces, welding equal vertices together.  The vertices are numbered
+// in the order of their first occurrence.
+//
+// The corners are scattered into buckets by hash, and each bucket is
+// deduplicated in parallel using an open-addressing table that maps every
+// corner to the first corner with an equal vertex.  A final pass over the
+// corners then numbers the vertices.
+static void WeldMeshVertices(mesh* Mesh, std::vector<mesh_vertex> const& Corners)
+{
+    constexpr uint32_t EMPTY = UINT32_MAX;
+
+    size_t CornerCount = Corners.size();
+    assert(CornerCount < EMPTY);
+
+    std::vector<uint64_t> Hashes(CornerCount);
+
+    ParallelForRange(CornerCount, 1 << 14, [&](size_t Begin, size_t End)
+    {
+        for (size_t I = Begin; I < End; I++)
+            Hashes[I] = HashMeshVertex(Corners[I]);
+    });
+
+    uint32_t PartitionCount = 1;
+    if (CornerCount >= 3 * LARGE_MESH_FACE_COUNT && !IsInsideParallelFor)
+        PartitionCount = GetWorkerThreadCount();
+
+    // Scatter the corner indices into per-partition buckets, ordered by
+    // partition and then by block so that each bucket stays in corner order.
+    constexpr size_t BLOCK_SIZE = 1 << 16;
+    size_t BlockCount = (CornerCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    auto GetPartition = [&](uint64_t Hash)
+    {
+        return static_cast<uint32_t>((Hash >> 32) % PartitionCount);
+    };
+
+    std::vector<size_t> Offsets(BlockCount * PartitionCount);
+    ParallelForRange(CornerCount, BLOCK_SIZE, [&](size_t Begin, size_t End)
+    {
+        size_t* BlockOffsets = &Offsets[Begin / BLOCK_SIZE * PartitionCount];
+        for (size_t I = Begin; I < End; I++)
+            BlockOffsets[GetPartition(Hashes[I])]++;
+    });
+
+    std::vector<size_t> BucketOffsets(PartitionCount + 1);
+    size_t Offset = 0;
+    for (uint32_t Partition = 0; Partition < PartitionCount; Partition++)
+    {
+        BucketOffsets[Partition] = Offset;
+        for (size_t Block = 0; Block < BlockCount; Block++)
+        {
+            size_t& BlockOffset = Offsets[Block * PartitionCount + Partition];
+            size_t BlockPartitionCount = BlockOffset;
+            BlockOffset = Offset;
+            Offset += BlockPartitionCount;
+        }
+    }
+    BucketOffsets[PartitionCount] = Offset;
+
+    std::vector<uint32_t> Buckets(CornerCount);
+    ParallelForRange(CornerCount, BLOCK_SIZE, [&](size_t Begin, size_t End)
+    {
+        size_t* BlockOffsets = &Offsets[Begin / BLOCK_SIZE * PartitionCount];
+        for (size_t I = Begin; I < End; I++)
+            Buckets[BlockOffsets[GetPartition(Hashes[I])]++] = static_cast<uint32_t>(I);
+    });
+
+    // Index of the first corner with an equal vertex, for each corner.
+    std::vector<uint32_t> FirstCorners(CornerCount);
+
+    ParallelFor(PartitionCount, [&](size_t Partition)
+    {
+        size_t BucketBegin = BucketOffsets[Partition];
+        size_t BucketEnd = BucketOffsets[Partition + 1];
+
+        size_t Capacity = std::bit_ceil(2 * (BucketEnd - BucketBegin) + 1);
+        std::vector<uint32_t> Table(Capacity, EMPTY);
+
+        for (size_t J = BucketBegin; J < BucketEnd; J++)
+        {
+            uint32_t I = Buckets[J];
+            uint64_t Hash = Hashes[I];
+
+            size_t Slot = Hash & (Capacity - 1);
+            while (true)
+            {
+                uint32_t Corner = Table[Slot];
+                if (Corner == EMPTY)
+                {
+                    Table[Slot] = I;
+                    FirstCorners[I] = I;
+                    break;
+                }
+                if (Hashes[Corner] == Hash && Corners[Corner] == Corners[I])
+                {
+                    FirstCorners[I] = Corner;
+                    break;
+                }
+                Slot = (Slot + 1) & (Capacity - 1);
+            }
+        }
+    });
+
+    // Number the vertices.  The first corner of each vertex always precedes
+    // the other corners, so the entries can be replaced with vertex indices
+    // in place.
+    std::vector<uint32_t>& VertexIndices = FirstCorners;
+
+    Mesh->Vertices.clear();
+    for (uint32_t I = 0; I < CornerCount; I++)
+    {
+        if (FirstCorners[I] == I)
+        {
+            VertexIndices[I] = static_cast<uint32_t>(Mesh->Vertices.size());
+            Mesh->Vertices.push_back(Corners[I]);
+        }
+        else
+        {
+            VertexIndices[I] = VertexIndices[FirstCorners[I]];
+        }
+    }
+
+    Mesh->Faces.resize(CornerCount / 3);
+    for (size_t I = 0; I < Mesh->Faces.size(); I++)
+    {
+        Mesh->Faces[I].VertexIndex[0] = VertexIndices[3*I+0];
+        Mesh->Faces[I].VertexIndex[1] = VertexIndices[3*I+1];
+        Mesh->Faces[I].VertexIndex[2] = VertexIndices[3*I+2];
+    }
+}
+
+// Reference frame of a mesh used to match meshes that are identical up to
+// a rigid transform.  The frame is centered at the centroid of the vertices,
+// and its axes are defined by two reference vertices: the vertex furthest
+// from the centroid, and the vertex that spans the largest triangle with it
+// and the centroid.  Meshes with equal topology and texture coordinates have
+// equal hashes.
+struct mesh_frame
+{
+    uint64_t Hash;
+    bool     IsValid;
+    vec3     Centroid;
+    float    Radius;
+    uint32_t ReferenceIndices[2];
+};
+
+static mat3 GetMeshFrameBasis(mesh const* Mesh, mesh_frame const& Frame)
+{
+    vec3 A = Mesh->Vertices[Frame.ReferenceIndices[0]].Position - Frame.Centroid;
+    vec3 B = Mesh->Vertices[Frame.ReferenceIndices[1]].Position - Frame.Centroid;
+    vec3 X = glm::normalize(A);
+    vec3 Y = glm::normalize(B - glm::dot(B, X) * X);
+    return mat3(X, Y, glm::cross(X, Y));
+}
+
+static mesh_frame ComputeMeshFrame(mesh const* Mesh)
+{
+    mesh_frame Frame = {};
+
+    Frame.Hash = HashBytes(Mesh->Faces.data(), Mesh->Faces.size() * sizeof(mesh_face));
+    for (mesh_vertex const& Vertex : Mesh->Vertices)
+        Frame.Hash = HashBytes(&Vertex.UV, sizeof(vec2), Frame.Hash);
+
+    glm::dvec3 Sum = {};
+    for (mesh_vertex const& Vertex : Mesh->Vertices)
+        Sum += glm::dvec3(Vertex.Position);
+    Frame.Centroid = vec3(Sum / double(Mesh->Vertices.size()));
+
+    float MaximumLength = 0.0f;
+    for (uint32_t I = 0; I < Mesh->Vertices.size(); I++)
+    {
+        float Length = glm::length(Mesh->Vertices[I].Position - Frame.Centroid);
+        if (Length > MaximumLength)
+        {
+            MaximumLength = Length;
+            Frame.ReferenceIndices[0] = I;
+        }
+    }
+    Frame.Radius = MaximumLength;
+
+    vec3 A = Mesh->Vertices[Frame.ReferenceIndices[0]].Position - Frame.Centroid;
+    float MaximumArea = 0.0f;
+    for (uint32_t I = 0; I < Mesh->Vertices.size(); I++)
+    {
+        float Area = glm::length(glm::cross(A, Mesh->Vertices[I].Position - Frame.Centroid));
+        if (Area > MaximumArea)
+        {
+            MaximumArea = Area;
+            Frame.ReferenceIndices[1] = I;
+        }
+    }
+
+    // Degenerate (collinear) meshes have no well-defined frame.
+    Frame.IsValid = MaximumArea > 1e-3f * Frame.Radius * Frame.Radius;
+
+    return Frame;
+}
+
+// Checks whether mesh B is mesh A transformed by a rigid transform, and if
+// so, computes the Euler angles and translation of the transform.  The
+// frame of B is built from the same reference vertices as that of A.
+static bool MatchMeshes
+(
+    mesh const* A, mesh_frame const& FrameA,
+    mesh const* B, mesh_frame const& FrameB,
+    vec3* Rotation, vec3* Translation
+)
+{
+    if (A->Vertices.size() != B->Vertices.size() || A->Faces.size() != B->Faces.size())
+        return false;
+    if (std::abs(FrameA.Radius - FrameB.Radius) > 1e-4f * FrameA.Radius)
+        return false;
+    if (memcmp(A->Faces.data(), B->Faces.data(), A->Faces.size() * sizeof(mesh_face)) != 0)
+        return false;
+
+    mesh_frame FrameBA = FrameB;
+    FrameBA.ReferenceIndices[0] = FrameA.ReferenceIndices[0];
+    FrameBA.ReferenceIndices[1] = FrameA.ReferenceIndices[1];
+
+    mat3 R = GetMeshFrameBasis(B, FrameBA) * glm::transpose(GetMeshFrameBasis(A, FrameA));
+
+    // Go through Euler angles, so that the match is verified against the
+    // transform that the instance will actually use.
+    float AngleZ, AngleY, AngleX;
+    glm::extractEulerAngleZYX(mat4(R), AngleZ, AngleY, AngleX);
+    *Rotation = vec3(AngleX, AngleY, AngleZ);
+    R = mat3(glm::eulerAngleZYX(AngleZ, AngleY, AngleX));
+
+    *Translation = FrameB.Centroid - R * FrameA.Centroid;
+
+    float PositionTolerance = 1e-4f * FrameA.Radius;
+
+    for (size_t I = 0; I < A->Vertices.size(); I++)
+    {
+        mesh_vertex const& VA = A->Vertices[I];
+        mesh_vertex const& VB = B->Vertices[I];
+
+        if (VA.UV != VB.UV)
+            return false;
+        if (glm::length(R * VA.Position + *Translation - VB.Position) > PositionTolerance)
+            return false;
+        if (glm::length(R * VA.Normal - VB.Normal) > 1e-3f)
+            return false;
+    }
+
+    return true;
+}
+
+// Splits an affine transform into the position, Euler angles and scale of
+// an entity transform.  Shear is discarded.
+static void DecomposeTransform(mat4 const& Transform, vec3* Position, vec3* Rotation, vec3* Scale)
+{
+    mat3 M = mat3(Transform);
+
+    *Position = vec3(Transform[3]);
+    *Scale = vec3(glm::length(M[0]), glm::length(M[1]), glm::length(M[2]));
+    if (glm::determinant(M) < 0.0f)
+        Scale->x = -Scale->x;
+
+    mat3 R;
+    for (int I = 0; I < 3; I++)
+        R[I] = Scale->operator[](I) != 0.0f ? M[I] / Scale->operator[](I) : vec3(0);
+
+    float AngleZ, AngleY, AngleX;
+    glm::extractEulerAngleZYX(mat4(R), AngleZ, AngleY, AngleX);
+    *Rotation = vec3(AngleX, AngleY, AngleZ);
+}
+
+// Finds meshes that are identical up to a rigid transform, and replaces
+// them with instances of a single mesh.  Meshes are only matched if their
+// vertices and faces are in the same order, as is the case for copies of
+// an object exported from a content creation tool.
+static void InstanceDuplicateMeshes(imported_model* Model)
+{
+    size_t MeshCount = Model->Meshes.size();
+
+    std::vector<mesh_frame> Frames(MeshCount);
+    ParallelFor(MeshCount, [&](size_t Index)
+    {
+        Frames[Index] = ComputeMeshFrame(Model->Meshes[Index]);
+    });
+
+    // A rotation applied under a non-uniform scale would need shear, so
+    // meshes placed with a non-uniform scale are kept as they are.
+    for (imported_instance const& Instance : Model->Instances)
+    {
+        vec3 Scale = glm::abs(Instance.Scale);
+        if (Scale.x != Scale.y || Scale.y != Scale.z)
+            Frames[Instance.MeshIndex].IsValid = false;
+    }
+
+    // Group the meshes by hash, in order.
+    std::unordered_map<uint64_t, std::vector<uint32_t>> GroupMap;
+    std::vector<std::vector<uint32_t>*> Groups;
+    for (uint32_t Index = 0; Index < MeshCount; Index++)
+    {
+        if (!Frames[Index].IsValid) continue;
+        auto& Group = GroupMap[Frames[Index].Hash];
+        if (Group.empty()) Groups.push_back(&Group);
+        Group.push_back(Index);
+    }
+
+    // Match each mesh against the unique meshes that precede it in its
+    // group.
+    struct mesh_match
+    {
+        uint32_t SourceIndex;
+        vec3     Rotation;
+        vec3     Translation;
+    };
+
+    std::vector<mesh_match> Matches(MeshCount);
+    for (uint32_t Index = 0; Index < MeshCount; Index++)
+        Matches[Index].SourceIndex = Index;
+
+    ParallelFor(Groups.size(), [&](size_t GroupIndex)
+    {
+        std::vector<uint32_t> const& Group = *Groups[GroupIndex];
+        std::vector<uint32_t> Sources;
+
+        for (uint32_t Index : Group)
+        {
+            mesh_match& Match = Matches[Index];
+            for (uint32_t Source : Sources)
+            {
+                if (MatchMeshes(Model->Meshes[Source], Frames[Source], Model->Meshes[Index], Frames[Index], &Match.Rotation, &Match.Translation))
+                {
+                    Match.SourceIndex = Source;
+                    break;
+                }
+            }
+            if (Match.SourceIndex == Index)
+                Sources.push_back(Index);
+        }
+    });
+
+    // Remove the duplicate meshes and point their instances to the sources.
+    std::vector<uint32_t> NewIndices(MeshCount);
+    std::vector<mesh*> Meshes;
+    size_t SavedBytes = 0;
+
+    for (uint32_t Index = 0; Index < MeshCount; Index++)
+    {
+        mesh* Mesh = Model->Meshes[Index];
+        if (Matches[Index].SourceIndex == Index)
+        {
+            NewIndices[Index] = static_cast<uint32_t>(Meshes.size());
+            Meshes.push_back(Mesh);
+        }
+        else
+        {
+            // The BVH has not been built yet, so estimate its size as two
+            // nodes per face.
+            SavedBytes += Mesh->Vertices.size() * sizeof(mesh_vertex);
+            SavedBytes += Mesh->Faces.size() * (sizeof(mesh_face) + 2 * sizeof(mesh_node));
+            delete Mesh;
+        }
+    }
+
+    for (imported_instance& Instance : Model->Instances)
+    {
+        mesh_match const& Match = Matches[Instance.MeshIndex];
+        if (Match.SourceIndex != Instance.MeshIndex)
+        {
+            mat4 Transform = MakeTransformMatrix(Instance.Position, Instance.Rotation, Instance.Scale)
+                           * MakeTransformMatrix(Match.Translation, Match.Rotation);
+            DecomposeTransform(Transform, &Instance.Position, &Instance.Rotation, &Instance.Scale);
+        }
+        Instance.MeshIndex = NewIndices[Match.SourceIndex];
+    }
+
+    if (Meshes.size() < MeshCount)
+    {
+        printf("Instanced %zu duplicate meshes, saving about %.1f MB\n",
+            MeshCount - Meshes.size(), SavedBytes / 1048576.0);
+    }
+
+    Model->Meshes = std::move(Meshes);
+}
+
+// Instances duplicate meshes if requested, and builds the mesh BVHs.  This
+// is the last step of importing a model, shared by all file formats.
+static void FinishImportedModel(imported_model* Model, load_model_options const* Options)
+{
+    if (Options->InstanceDuplicateMeshes)
+        InstanceDuplicateMeshes(Model);
+
+    for (size_t Index = 0; Index < Model->Meshes.size(); Index++)
+    {
+        mesh* Mesh = Model->Meshes[Index];
+
+        // Meshes are named only once they are added to the scene.
+        std::string Label = Mesh->Name.empty() ? std::format("mesh {}", Index) : Mesh->Name;
+
+        if (Options->TreeBuilder == MESH_TREE_BUILDER_LBVH)
+        {
+            auto StartTime = std::chrono::steady_clock::now();
+            BuildMeshLinearTree(Mesh, Options->MaximumTreeDepth, Options->OptimizeLinearTreeTop);
+            std::chrono::duration<float> Duration = std::chrono::steady_clock::now() - StartTime;
+
+            printf("Linear BVH for '%s': %zu faces in %.3f seconds, SAH cost %.1f\n",
+                Label.c_str(),
+                Mesh->Faces.size(),
+                Duration.count(),
+                GetMeshTreeCost(Mesh));
+            continue;
+        }
+
+        if (Options->UseSpatialSplits && !Mesh->Faces.empty())
+        {
+            size_t FaceCount = Mesh->Faces.size();
+
+            BuildMeshSpatialSplitTree(Mesh, Options->SpatialSplitBudget, Options->MaximumTreeDepth);
+
+            printf("Spatial split BVH for '%s': %zu face references (+%.1f%%), SAH cost %.1f\n",
+                Label.c_str(),
+                Mesh->Faces.size(),
+                100.0f * (float(Mesh->Faces.size()) / float(FaceCount) - 1.0f),
+                GetMeshTreeCost(Mesh));
+            continue;
+        }
+
+        BuildMeshTree(Mesh, Options->MaximumTreeDepth);
+    }
+
+    // Spend the optimization time on the meshes in proportion to their size.
+    if (Options->TreeOptimizationTime > 0.0f && Options->TreeBuilder == MESH_TREE_BUILDER_SAH)
+    {
+        size_t TotalFaceCount = 0;
+        for (mesh* Mesh : Model->Meshes)
+            TotalFaceCount += Mesh->Faces.size();
+
+        for (mesh* Mesh : Model->Meshes)
+        {
+            float TimeLimit = Options->TreeOptimizationTime * Mesh->Faces.size() / std::max<size_t>(TotalFaceCount, 1);
+            ReinsertMeshNodes(Mesh, TimeLimit, Options->MaximumTreeDepth);
+        }
+    }
+
+    ParallelFor(Model->Meshes.size(), [&](size_t Index)
+    {
+        mesh* Mesh = Model->Meshes[Index];
+        if (Options->OptimizeMeshLayout)
+            OptimizeMeshLayout(Mesh);
+        Mesh->TreeCost = GetMeshTreeCost(Mesh);
+    });
+}
+
+// Reads an OBJ file and builds the meshes and their BVHs.
+static bool ImportObjModel(char const* Path, load_model_options const* Options, imported_model* Model)
+{
+    tinyobj::attrib_t Attrib;
+    std::vector<tinyobj::shape_t> Shapes;
+    std::vector<tinyobj::material_t> FileMaterials;
+    std::string Warnings;
+    std::string Errors;
+
+    if (!ParseObjFile(Path, Options->DirectoryPath.c_str(), &Attrib, &Shapes, &FileMaterials, &Warnings, &Errors, &Model->DependencyPaths))
+        return false;
+
+    if (Attrib.normals.empty())
+    {
+        auto& Normals = Attrib.normals;
+
+        Normals.resize(Attrib.vertices.size());
+
+        for (tinyobj::shape_t& Shape : Shapes)
+        {
+            size_t n = Shape.mesh.indices.size();
+            for (size_t i = 0; i < n; i += 3)
+            {
+                glm::vec3 vertices[3];
+                for (size_t j = 0; j < 3; j++)
+                {
+                    tinyobj::index_t const& Index = Shape.mesh.indices[i+j];
+                    vertices[j] = glm::vec3(
+                        Attrib.vertices[3*Index.vertex_index+0],
+                        Attrib.vertices[3*Index.vertex_index+1],
+                        Attrib.vertices[3*Index.vertex_index+2]);
+                }
+                glm::vec3 normal = glm::normalize(glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+                for (size_t j = 0; j < 3; j++)
+                {
+                    tinyobj::index_t& Index = Shape.mesh.indices[i+j];
+                    Index.normal_index = Index.vertex_index;
+                    Normals[3*Index.normal_index+0] += normal.x;
+                    Normals[3*Index.normal_index+1] += normal.y;
+                    Normals[3*Index.normal_index+2] += normal.z;
+                }
+            }
+        }
+
+        size_t n = Normals.size();
+        for (size_t i = 0; i < n; i += 3)
+        {
+            float length = glm::length(glm::vec3(Normals[i+0], Normals[i+1], Normals[i+2]));
+            if (length > EPSILON)
+            {
+                Normals[i+0] /= length;
+                Normals[i+1] /= length;
+                Normals[i+2] /= length;
+            }
+            else
+            {
+                Normals[i+0] = 0;
+                Normals[i+1] = 0;
+                Normals[i+2] = 1;
+            }
+        }
+    }
+
+    for (tinyobj::material_t const& FileMaterial : FileMaterials)
+    {
+        Model->Materials.push_back
+        ({
+            .Name = FileMaterial.name,
+            .BaseColor = { FileMaterial.diffuse[0], FileMaterial.diffuse[1], FileMaterial.diffuse[2] },
+            .EmissionColor = { FileMaterial.emission[0], FileMaterial.emission[1], FileMaterial.emission[2] },
+            .BaseColorTextureName = FileMaterial.diffuse_texname,
+            .EmissionColorTextureName = FileMaterial.emissive_texname,
+        });
+    }
+
+    // Bucket the faces of each shape by material in a single pass, giving
+    // one mesh per bucket.  The buckets of a shape are ordered by the first
+    // appearance of their material, and keep the original face order.
+    struct mesh_bucket
+    {
+        size_t                ShapeIndex;
+        int                   MaterialIndex;
+        vec3                  Origin;
+        std::vector<uint32_t> FaceIndices;
+    };
+
+    std::vector<std::vector<mesh_bucket>> ShapeBuckets(Shapes.size());
+
+    ParallelFor(Shapes.size(), [&](size_t ShapeIndex)
+    {
+        tinyobj::shape_t const& Shape = Shapes[ShapeIndex];
+        size_t FaceCount = Shape.mesh.indices.size() / 3;
+
+        if (FaceCount == 0)
+            return;
+
+        vec3 Minimum = { +INFINITY, +INFINITY, +INFINITY };
+        vec3 Maximum = { -INFINITY, -INFINITY, -INFINITY };
+        for (size_t I = 0; I < 3*FaceCount; I++)
+        {
+            tinyobj::index_t const& Index = Shape.mesh.indices[I];
+            vec3 Position =
+            {
+                Attrib.vertices[3*Index.vertex_index+0],
+                Attrib.vertices[3*Index.vertex_index+1],
+                Attrib.vertices[3*Index.vertex_index+2]
+            };
+            Minimum = glm::min(Minimum, Position);
+            Maximum = glm::max(Maximum, Position);
+        }
+        vec3 Origin = 0.5f * (Minimum + Maximum);
+
+        std::vector<mesh_bucket>& Buckets = ShapeBuckets[ShapeIndex];
+
+        // Bucket index for each material index, offset by one so that faces
+        // without a material (index -1) map to the first entry.
+        std::vector<uint32_t> BucketIndices(FileMaterials.size() + 1, UINT32_MAX);
+
+        for (size_t I = 0; I < FaceCount; I++)
+        {
+            int MaterialIndex = Shape.mesh.material_ids[I];
+            uint32_t& BucketIndex = BucketIndices[MaterialIndex + 1];
+            if (BucketIndex == UINT32_MAX)
+            {
+                BucketIndex = static_cast<uint32_t>(Buckets.size());
+                Buckets.push_back({ ShapeIndex, MaterialIndex, Origin });
+            }
+            Buckets[BucketIndex].FaceIndices.push_back(static_cast<uint32_t>(I));
+        }
+    });
+
+    std::vector<mesh_bucket> Buckets;
+    for (std::vector<mesh_bucket>& Shape : ShapeBuckets)
+        for (mesh_bucket& Bucket : Shape)
+            Buckets.push_back(std::move(Bucket));
+
+    // Import meshes.
+    Model->Meshes.resize(Buckets.size());
+    Model->Instances.resize(Buckets.size());
+
+    auto ImportMesh = [&](size_t BucketIndex)
+    {
+        mesh_bucket const& Bucket = Buckets[BucketIndex];
+        tinyobj::shape_t const& Shape = Shapes[Bucket.ShapeIndex];
+        vec3 Origin = Bucket.Origin;
+
+        auto Mesh = new mesh;
+
+        std::vector<mesh_vertex> Corners(3 * Bucket.FaceIndices.size());
+
+        ParallelForRange(Corners.size(), 1 << 14, [&](size_t Begin, size_t End)
+        {
+            for (size_t I = Begin; I < End; I++)
+            {
+                tinyobj::index_t const& Index = Shape.mesh.indices[3*Bucket.FaceIndices[I/3]+I%3];
+
+                mesh_vertex& Vertex = Corners[I];
+
+                Vertex.Position = Options->VertexTransform * vec4
+                (
+                    Attrib.vertices[3*Index.vertex_index+0] - Origin.x,
+                    Attrib.vertices[3*Index.vertex_index+1] - Origin.y,
+                    Attrib.vertices[3*Index.vertex_index+2] - Origin.z,
+                    1.0f
+                );
+
+                if (Index.normal_index >= 0)
+                {
+                    Vertex.Normal = Options->NormalTransform * vec4
+                    (
+                        Attrib.normals[3*Index.normal_index+0],
+                        Attrib.normals[3*Index.normal_index+1],
+                        Attrib.normals[3*Index.normal_index+2],
+                        0.0f
+                    );
+                }
+
+                if (Index.texcoord_index >= 0)
+                {
+                    Vertex.UV = Options->TextureCoordinateTransform * vec3
+                    (
+                        Attrib.texcoords[2*Index.texcoord_index+0],
+                        Attrib.texcoords[2*Index.texcoord_index+1],
+                        1.0f
+                    );
+                }
+            }
+        });
+
+        WeldMeshVertices(Mesh, Corners);
+
+        Model->Meshes[BucketIndex] = Mesh;
+        Model->Instances[BucketIndex] =
+        {
+            .MeshIndex = static_cast<uint32_t>(BucketIndex),
+            .Name = Shape.name,
+            .ShapeIndex = static_cast<uint32_t>(Bucket.ShapeIndex),
+            .MaterialIndex = Bucket.MaterialIndex,
+            .Position = Options->VertexTransform * vec4(Origin, 1),
+            .Rotation = vec3(0),
+        };
+    };
+
+    // Large meshes are imported one at a time, each using all cores, and
+    // the rest are imported in parallel with each other.
+    std::vector<size_t> SmallBucketIndices;
+    for (size_t BucketIndex = 0; BucketIndex < Buckets.size(); BucketIndex++)
+    {
+        if (Buckets[BucketIndex].FaceIndices.size() >= LARGE_MESH_FACE_COUNT)
+            ImportMesh(BucketIndex);
+        else
+            SmallBucketIndices.push_back(BucketIndex);
+    }
+
+    ParallelFor(SmallBucketIndices.size(), [&](size_t Index)
+    {
+        ImportMesh(SmallBucketIndices[Index]);
+    });
+
+    FinishImportedModel(Model, Options);
+
+    return true;
+}
+
+// Builds a mesh from indexed vertex attributes, applying the vertex, normal
+// and texture coordinate transforms.  If Indices has no data, every three
+// consecutive vertices form a face.  Normals are computed from the faces if
+// the source has none.  Returns null if the indices are invalid.
+static mesh* BuildMeshFromAttributes
+(
+    attribute_view const& Positions,
+    attribute_view const& Normals,
+    attribute_view const& TexCoords,
+    attribute_view const& Indices,
+    bool FlipTexCoords,
+    load_model_options const* Options
+)
+{
+    size_t VertexCount = Positions.Count;
+    size_t CornerCount = Indices.Data ? Indices.Count : VertexCount;
+
+    if (CornerCount % 3 != 0)
+        return nullptr;
+
+    auto Mesh = new mesh;
+    Mesh->Vertices.resize(VertexCount);
+    Mesh->Faces.resize(CornerCount / 3);
+
+    std::atomic<bool> IndicesAreValid = true;
+
+    ParallelForRange(VertexCount, 1 << 14, [&](size_t Begin, size_t End)
+    {
+        for (size_t I = Begin; I < End; I++)
+        {
+            mesh_vertex& Vertex = Mesh->Vertices[I];
+
+            vec3 Position = { ReadAttribute(Positions, I, 0), ReadAttribute(Positions, I, 1), ReadAttribute(Positions, I, 2) };
+            Vertex.Position = Options->VertexTransform * vec4(Position, 1.0f);
+
+            if (Normals.Data)
+            {
+                vec3 Normal = { ReadAttribute(Normals, I, 0), ReadAttribute(Normals, I, 1), ReadAttribute(Normals, I, 2) };
+                Vertex.Normal = Options->NormalTransform * vec4(Normal, 0.0f);
+            }
+
+            if (TexCoords.Data)
+            {
+                vec2 UV = { ReadAttribute(TexCoords, I, 0), ReadAttribute(TexCoords, I, 1) };
+                if (FlipTexCoords) UV.y = 1.0f - UV.y;
+                Vertex.UV = Options->TextureCoordinateTransform * vec3(UV, 1.0f);
+            }
+        }
+    });
+
+    ParallelForRange(Mesh->Faces.size(), 1 << 14, [&](size_t Begin, size_t End)
+    {
+        for (size_t I = Begin; I < End; I++)
+        {
+            for (uint32_t J = 0; J < 3; J++)
+            {
+                uint32_t Index = Indices.Data ? ReadAttributeIndex(Indices, 3*I+J) : static_cast<uint32_t>(3*I+J);
+                if (Index >= VertexCount)
+                {
+                    IndicesAreValid = false;
+                    Index = 0;
+                }
+                Mesh->Faces[I].VertexIndex[J] = Index;
+            }
+        }
+    });
+
+    if (!IndicesAreValid)
+    {
+        delete Mesh;
+        return nullptr;
+    }
+
+    if (!Normals.Data)
+    {
+        for (mesh_face const& Face : Mesh->Faces)
+        {
+            vec3 P0 = Mesh->Vertices[Face.VertexIndex[0]].Position;
+            vec3 P1 = Mesh->Vertices[Face.VertexIndex[1]].Position;
+            vec3 P2 = Mesh->Vertices[Face.VertexIndex[2]].Position;
+            vec3 Normal = glm::cross(P1 - P0, P2 - P0);
+            for (uint32_t J = 0; J < 3; J++)
+                Mesh->Vertices[Face.VertexIndex[J]].Normal += Normal;
+        }
+
+        for (mesh_vertex& Vertex : Mesh->Vertices)
+        {
+            float Length = glm::length(Vertex.Normal);
+            Vertex.Normal = Length > EPSILON ? Vertex.Normal / Length : vec3(0, 0, 1);
+        }
+    }
+
+    return Mesh;
+}
+
+// Reads a binary glTF file.  Each primitive of each glTF mesh becomes a
+// mesh, and each placement of a glTF mesh in the node hierarchy becomes a
+// set of instances sharing those meshes.
+static bool ImportGlbModel(char const* Path, load_model_options const* Options, imported_model* Model)
+{
+    glb_file Glb;
+    std::string Warnings, Errors;
+
+    if (!OpenGlbFile(Path, &Glb, &Warnings, &Errors))
+    {
+        printf("%s", Errors.c_str());
+        return false;
+    }
+
+    if (!Warnings.empty())
+        printf("%s", Warnings.c_str());
+
+    for (glb_material const& Material : Glb.Materials)
+    {
+        Model->Materials.push_back
+        ({
+            .Name = Material.Name,
+            .BaseColor = Material.BaseColor,
+            .EmissionColor = Material.EmissionColor,
+            .BaseColorTextureName = Material.BaseColorTexturePath,
+            .EmissionColorTextureName = Material.EmissionColorTexturePath,
+        });
+    }
+
+    // Index of the first imported mesh of each glTF mesh.
+    std::vector<uint32_t> FirstMeshIndices;
+    std::vector<glb_primitive const*> Primitives;
+
+    for (glb_mesh const& Mesh : Glb.Meshes)
+    {
+        FirstMeshIndices.push_back(static_cast<uint32_t>(Primitives.size()));
+        for (glb_primitive const& Primitive : Mesh.Primitives)
+            Primitives.push_back(&Primitive);
+    }
+
+    Model->Meshes.resize(Primitives.size());
+
+    ParallelFor(Primitives.size(), [&](size_t Index)
+    {
+        glb_primitive const* P = Primitives[Index];
+        Model->Meshes[Index] = BuildMeshFromAttributes(P->Positions, P->Normals, P->TexCoords, P->Indices, true, Options);
+    });
+
+    CloseGlbFile(&Glb);
+
+    if (std::ranges::find(Model->Meshes, nullptr) != Model->Meshes.end())
+    {
+        printf("%s: Invalid primitive indices\n", Path);
+        for (mesh* Mesh : Model->Meshes)
+            delete Mesh;
+        *Model = {};
+        return false;
+    }
+
+    // The vertex transform is applied to the mesh vertices, so conjugate
+    // the instance transforms by it to keep the instances in place.
+    mat4 InverseVertexTransform = glm::inverse(Options->VertexTransform);
+
+    for (glb_instance const& Instance : Glb.Instances)
+    {
+        glb_mesh const& Mesh = Glb.Meshes[Instance.MeshIndex];
+
+        vec3 Position, Rotation, Scale;
+        DecomposeTransform(Options->VertexTransform * Instance.Transform * InverseVertexTransform, &Position, &Rotation, &Scale);
+
+        for (size_t I = 0; I < Mesh.Primitives.size(); I++)
+        {
+            Model->Instances.push_back
+            ({
+                .MeshIndex = FirstMeshIndices[Instance.MeshIndex] + static_cast<uint32_t>(I),
+                .Name = Mesh.Primitives.size() > 1 ? std::format("{} {}", Instance.Name, I) : Instance.Name,
+                .ShapeIndex = static_cast<uint32_t>(Model->Instances.size()),
+                .MaterialIndex = Mesh.Primitives[I].MaterialIndex,
+                .Position = Position,
+                .Rotation = Rotation,
+                .Scale = Scale,
+            });
+        }
+    }
+
+    // Drop meshes that are not placed in the scene.
+    std::vector<uint32_t> NewIndices(Model->Meshes.size(), UINT32_MAX);
+    std::vector<mesh*> Meshes;
+    for (imported_instance& Instance : Model->Instances)
+    {
+        uint32_t& NewIndex = NewIndices[Instance.MeshIndex];
+        if (NewIndex == UINT32_MAX)
+        {
+            NewIndex = static_cast<uint32_t>(Meshes.size());
+            Meshes.push_back(Model->Meshes[Instance.MeshIndex]);
+            Model->Meshes[Instance.MeshIndex] = nullptr;
+        }
+        Instance.MeshIndex = NewIndex;
+    }
+    for (mesh* Mesh : Model->Meshes)
+        delete Mesh;
+    Model->Meshes = std::move(Meshes);
+
+    FinishImportedModel(Model, Options);
+
+    return true;
+}
+
+// Reads a binary PLY file as a single mesh.
+static bool ImportPlyModel(char const* Path, load_model_options const* Options, imported_model* Model)
+{
+    ply_file Ply;
+    std::string Errors;
+
+    if (!OpenPlyFile(Path, &Ply, &Errors))
+    {
+        printf("%s", Errors.c_str());
+        return false;
+    }
+
+    attribute_view Indices;
+    Indices.Data = reinterpret_cast<uint8_t const*>(Ply.Indices.data());
+    Indices.Count = Ply.Indices.size();
+    Indices.Stride = sizeof(uint32_t);
+    Indices.ComponentCount = 1;
+    Indices.Type = ATTRIBUTE_TYPE_UINT32;
+
+    mesh* Mesh = BuildMeshFromAttributes(Ply.Positions, Ply.Normals, Ply.TexCoords, Indices, false, Options);
+
+    ClosePlyFile(&Ply);
+
+    if (!Mesh)
+    {
+        printf("%s: Invalid face indices\n", Path);
+        return false;
+    }
+
+    Model->Meshes.push_back(Mesh);
+    Model->Instances.push_back
+    ({
+        .MeshIndex = 0,
+        .ShapeIndex = 0,
+        .MaterialIndex = -1,
+        .Position = vec3(0),
+        .Rotation = vec3(0),
+    });
+
+    FinishImportedModel(Model, Options);
+
+    return true;
+}
+
+static bool ImportModel(char const* Path, load_model_options const* Options, imported_model* Model)
+{
+    std::string Extension = std::filesystem::path(Path).extension().string();
+    std::ranges::transform(Extension, Extension.begin(), [](char C) { return static_cast<char>(tolower(C)); });
+
+    if (Extension == ".glb")
+        return ImportGlbModel(Path, Options, Model);
+    if (Extension == ".ply")
+        return ImportPlyModel(Path, Options, Model);
+    return ImportObjModel(Path, Options, Model);
+}
+
+prefab* LoadModelAsPrefab(scene* Scene, char const* Path, load_model_options* Options)
+{
+    load_model_options DefaultOptions {};
+    if (!Options) Options = &DefaultOptions;
+
+    imported_model Model;
+
+    uint64_t CacheKey = Options->UseCache ? GetModelCacheKey(Path, Options) : 0;
+
+    if (CacheKey && ReadModelCache(CacheKey, &Model))
+    {
+        printf("Loaded %s from the model cache\n", Path);
+    }
+    else
+    {
+        if (!ImportModel(Path, Options, &Model))
+            return nullptr;
+        if (CacheKey)
+            WriteModelCache(CacheKey, Model);
+    }
+
+    if (CacheKey)
+    {
+        model_cache_stats Stats = GetModelCacheStats();
+        printf("Model cache: %u hits, %u misses, %u evictions\n", Stats.HitCount, Stats.MissCount, Stats.EvictionCount);
+    }
+
+    // Map from in-file texture name to scene texture.
+    std::unordered_map<std::string, texture*> TextureMap;
+    std::vector<material*> Materials;
+
+    // Build scene materials from the material definitions.
+    for (imported_material const& Imported : Model.Materials)
+    {
+        auto Material = (openpbr_material*)CreateMaterial(Scene, MATERIAL_TYPE_OPENPBR, Imported.Name.c_str());
+
+        Material->BaseColor = glm::vec4(Imported.BaseColor, 1.0);
+        Material->EmissionColor = glm::vec4(Imported.EmissionColor, 1.0);
+
+        Material->SpecularRoughness = 1.0f;
+        Material->SpecularIOR = 0.0f;
+        Material->TransmissionWeight = 0.0f;
+
+        std::tuple<std::string, texture_type, texture**> Textures[] =
+        {
+            {
+                Imported.BaseColorTextureName,
+                TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA,
+                &Material->BaseColorTexture,
+            },
+            {
+                Imported.EmissionColorTextureName,
+                TEXTURE_TYPE_RADIANCE,
+                &Material->EmissionColorTexture,
+            },
+        };
+
+        for (auto const& [Name, Type, TexturePtr] : Textures)
+        {
+            if (!Name.empty())
+            {
+                if (!TextureMap.contains(Name))
+                {
+                    std::string Path = std::format("{}/{}", Options->DirectoryPath, Name);
+                    TextureMap[Name] = LoadTexture(Scene, Path.c_str(), Type, Name.c_str());
+                }
+                *TexturePtr = TextureMap[Name];
+            }
+            else
+            {
+                *TexturePtr = nullptr;
+            }
+        }
+
+        Materials.push_back(Material);
+    }
+
+    std::string ModelName;
+    if (Options->Name)
+    {
+        ModelName = Options->Name;
+    }
+    else
+    {
+        std::filesystem::path P = Path;
+        ModelName = P.stem().string();
+    }
+
+    // Name each instance after its shape, and each mesh after its first
+    // instance.
+    std::vector<std::string> InstanceNames;
+
+    for (imported_instance const& Imported : Model.Instances)
+    {
+        std::string Name = Imported.Name;
+        if (Name.empty())
+            Name = std::format("{} {}", ModelName, Imported.ShapeIndex);
+
+        mesh* Mesh = Model.Meshes[Imported.MeshIndex];
+        if (Mesh->Name.empty())
+            Mesh->Name = Name;
+
+        InstanceNames.push_back(Name);
+    }
+
+    for (mesh* Mesh : Model.Meshes)
+    {
+        Mesh->NeedsTreeUpgrade = Options->TreeBuilder != MESH_TREE_BUILDER_SAH;
+        Mesh->TreeOptions =
+        {
+            .MaximumDepth = Options->MaximumTreeDepth,
+            .UseSpatialSplits = Options->UseSpatialSplits,
+            .SpatialSplitBudget = Options->SpatialSplitBudget,
+            .OptimizeLayout = Options->OptimizeMeshLayout,
+        };
+        Scene->Meshes.push_back(Mesh);
+    }
+
+    Scene->DirtyFlags |= SCENE_DIRTY_MATERIALS;
+    Scene->DirtyFlags |= SCENE_DIRTY_MESHES;
+
+    auto Prefab = new prefab;
+
+    if (Model.Instances.size() == 1)
+    {
+        imported_instance const& Imported = Model.Instances[0];
+
+        auto Instance = new mesh_entity;
+        Instance->Name = InstanceNames[0];
+        Instance->Mesh = Model.Meshes[Imported.MeshIndex];
+        Instance->Material = Imported.MaterialIndex >= 0 ? Materials[Imported.MaterialIndex] : nullptr;
+        Instance->Transform.Position = Imported.Position;
+        Instance->Transform.Rotation = Imported.Rotation;
+        Instance->Transform.Scale = Imported.Scale;
+        Instance->Transform.ScaleIsUniform = Imported.Scale.x == Imported.Scale.y && Imported.Scale.y == Imported.Scale.z;
+        Prefab->Entity = Instance;
+    }
+    else
+    {
+        auto Container = new container_entity;
+        Container->Name = ModelName;
+        for (size_t I = 0; I < Model.Instances.size(); I++)
+        {
+            imported_instance const& Imported = Model.Instances[I];
+
+            auto Instance = new mesh_entity;
+            Instance->Name = InstanceNames[I];
+            Instance->Mesh = Model.Meshes[Imported.MeshIndex];
+            Instance->Material = Imported.MaterialIndex >= 0 ? Materials[Imported.MaterialIndex] : nullptr;
+            Instance->Transform.Position = Imported.Position;
+            Instance->Transform.Rotation = Imported.Rotation;
+            Instance->Transform.Scale = Imported.Scale;
+            Instance->Transform.ScaleIsUniform = Imported.Scale.x == Imported.Scale.y && Imported.Scale.y == Imported.Scale.z;
+            Container->Children.push_back(Instance);
+        }
+        Prefab->Entity = Container;
+    }
+
+    Scene->Prefabs.push_back(Prefab);
+
+    return Prefab;
+}
+
+void DestroyPrefab(scene* Scene, prefab* Prefab)
+{
+    auto ClearReference = [Scene, Prefab](entity* Entity)
+    {
+        if (Entity->Type == ENTITY_TYPE_PREFAB_INSTANCE)
+        {
+            auto Instance = static_cast<prefab_entity*>(Entity);
+            if (Instance->Prefab == Prefab)
+            {
+                Instance->Prefab = nullptr;
+                Scene->DirtyFlags |= SCENE_DIRTY_SHAPES;
+            }
+        }
+    };
+
+    ForEachEntity(&Scene->Root, ClearReference);
+    for (prefab* Other : Scene->Prefabs)
+        if (Other != Prefab)
+            ForEachEntity(Other->Entity, ClearReference);
+
+    DestroyEntity(Scene, Prefab->Entity);
+    std::erase(Scene->Prefabs, Prefab);
+    delete Prefab;
+}
+
+scene* CreateScene()
+{
+    auto Scene = new scene;
+
+    Scene->Root.Name = "Scene";
+
+    char const* SRGB_SPECTRUM_TABLE_FILE = "sRGBSpectrumTable.dat";
+
+    Scene->RGBSpectrumTable = new parametric_spectrum_table;
+    if (!LoadParametricSpectrumTable(Scene->RGBSpectrumTable, SRGB_SPECTRUM_TABLE_FILE))
+    {
+        printf("%s not found, generating it.\n", SRGB_SPECTRUM_TABLE_FILE);
+        printf("This will probably take a few minutes...\n");
+        BuildParametricSpectrumTableForSRGB(Scene->RGBSpectrumTable);
+        SaveParametricSpectrumTable(Scene->RGBSpectrumTable, SRGB_SPECTRUM_TABLE_FILE);
+    }
+
+    auto PlaneMaterial = (basic_diffuse_material*)CreateMaterial(Scene, MATERIAL_TYPE_BASIC_DIFFUSE, "Plane Material");
+    PlaneMaterial->BaseTexture = CreateCheckerTexture(Scene, "Plane Texture", TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA, glm::vec4(1,1,1,1), glm::vec4(0.5,0.5,0.5,1));
+    PlaneMaterial->BaseTexture->EnableNearestFiltering = true;
+    plane_entity* Plane = (plane_entity*)CreateEntity(Scene, ENTITY_TYPE_PLANE);
+    Plane->Name = "Plane";
+    Plane->Material = PlaneMaterial;
+
+    camera_entity* Camera = (camera_entity*)CreateEntity(Scene, ENTITY_TYPE_CAMERA);
+    Camera->Name = "Camera";
+    Camera->Transform.Position = { 0, 0, 1 };
+
+    Scene->DirtyFlags = SCENE_DIRTY_ALL;
+
+    return Scene;
+}
+
+void DestroyScene(scene* Scene)
+{
+    if (Scene->PackJob)
+    {
+        WaitForScenePackJob(Scene);
+        delete Scene->PackJob;
+    }
+    if (Scene->MeshTreeUpgrade)
+    {
+        Scene->MeshTreeUpgrade->Thread.join();
+        delete Scene->MeshTreeUpgrade;
+    }
+    while (!Scene->Root.Children.empty())
+        DestroyEntity(Scene, Scene->Root.Children[0]);
+    for (prefab* Prefab : Scene->Prefabs)
+        delete Prefab;
+    for (mesh* Mesh : Scene->Meshes)
+        delete Mesh;
+    for (material* Material : Scene->Materials)
+        delete Material;
+    for (texture* Texture : Scene->Textures)
+        delete Texture;
+    UnmapFile(&Scene->PackCacheFile);
+    delete Scene->RGBSpectrumTable;
+    delete Scene;
+}
+
+//bool LoadSkybox(scene* Scene, char const* Path)
+//{
+    //int Width, Height, Components;
+
+    //Scene->SkyboxPixels = reinterpret_cast<glm::vec4*>(stbi_loadf(Path, &Width, &Height, &Components, STBI_rgb_alpha));
+    //Scene->SkyboxWidth = static_cast<uint32_t>(Width);
+    //Scene->SkyboxHeight = static_cast<uint32_t>(Height);
+
+    //for (int Y = 0; Y < Height; Y++)
+    //{
+    //    for (int X = 0; X < Width; X++)
+    //    {
+    //        int Index = Y * Width + X;
+
+    //        glm::vec3 Color = Scene->SkyboxPixels[Index].rgb();
+    //        float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
+    //        glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Color / Intensity);
+    //        Scene->SkyboxPixels[Index] = glm::vec4(Beta, Intensity);
+    //    }
+    //}
+
+    //Scene->DirtyFlags |= SCENE_DIRTY_SKYBOX;
+
+    //float* Pixels = Scene->SkyboxPixels;
+
+    //glm::vec3 Mean = {};
+    //float WeightSum = 0.0f;
+    //for (int Y = 0; Y < Height; Y++)
+    //{
+    //    float Theta = (0.5f - (Y + 0.5f) / Height) * PI;
+    //    for (int X = 0; X < Width; X++)
+    //    {
+    //        float Phi = ((X + 0.5f) / Width - 0.5f) * TAU;
+
+    //        int Index = (Y * Width + X) * 4;
+    //        float R = Pixels[Index+0];
+    //        float G = Pixels[Index+1];
+    //        float B = Pixels[Index+2];
+    //        float Luminance = 0.2126f * R + 0.7152f * G + 0.0722f * B;
+    //        float Area = glm::cos(Theta);
+
+    //        float Weight = Area * Luminance * Luminance;
+
+    //        glm::vec3 Direction =
+    //        {
+    //            glm::cos(Theta) * glm::cos(Phi),
+    //            glm::cos(Theta) * glm::sin(Phi),
+    //            glm::sin(Theta),
+    //        };
+
+    //        Mean += Weight * Direction;
+    //        WeightSum += Weight;
+    //    }
+    //}
+    //Mean /= WeightSum;
+
+    //float MeanLength = glm::length(Mean);
+
+    //glm::vec3 FrameZ = Mean / MeanLength;
+    //glm::vec3 FrameX = OrthogonalVector(FrameZ);
+    //glm::vec3 FrameY = glm::cross(FrameX, FrameZ);
+
+    //float Concentration = MeanLength * (3.0f - MeanLength * MeanLength) / (1 - MeanLength * MeanLength);
+
+    //Scene->SkyboxDistributionFrame = glm::mat3(FrameX, FrameY, FrameZ);
+    //Scene->SkyboxDistributionConcentration = Concentration;
+
+//    return true;
+//}
+
+// Computes the transformation of a face to the coordinate system where it
+// is the unit triangle, see packed_mesh_transformed_face.  The projection
+// axis is the dominant axis of the face normal.  Degenerate faces get a
+// transformation that never produces a hit.
+static packed_mesh_transformed_face PackTransformedMeshFace(vec3 P0, vec3 P1, vec3 P2)
+{
+    vec3 E1 = P1 - P0;
+    vec3 E2 = P2 - P0;
+    vec3 N = glm::cross(E1, E2);
+    vec3 A = glm::abs(N);
+
+    uint32_t K = A.x >= A.y && A.x >= A.z ? 0 : A.y >= A.z ? 1 : 2;
+    uint32_t I = (K + 1) % 3;
+    uint32_t J = (K + 2) % 3;
+
+    packed_mesh_transformed_face Packed = {};
+    Packed.VertexIndex2AndAxis = K << 30;
+
+    if (N[K] == 0.0f)
+    {
+        Packed.Transform0 = vec3(0.0f, 0.0f, -1.0f);
+        return Packed;
+    }
+
+    float InverseNK = 1.0f / N[K];
+    Packed.Transform0 = vec3(E2[J], -E2[I], P0[J] * E2[I] - P0[I] * E2[J]) * InverseNK;
+    Packed.Transform1 = vec3(-E1[J], E1[I], P0[I] * E1[J] - P0[J] * E1[I]) * InverseNK;
+    Packed.Transform2 = vec3(N[I], N[J], -glm::dot(N, P0)) * InverseNK;
+    return Packed;
+}
+
+// Unbounded shapes are kept out of the shape BVH, as their bounds would
+// cover every other node.  They are packed ahead of the bounded shapes,
+// and tested by every ray before the BVH traversal.
+static bool IsUnboundedShape(packed_shape const& Object)
+{
+    return Object.Type == SHAPE_TYPE_PLANE;
+}
+
+// Grows world space bounds to contain a local space box under a transform.
+static void GrowTransformedBounds(bounds& Bounds, mat4 const& Transform, bounds const& Box)
+{
+    for (int I = 0; I < 8; I++)
+    {
+        glm::vec4 Corner =
+        {
+            I & 1 ? Box.Maximum.x : Box.Minimum.x,
+            I & 2 ? Box.Maximum.y : Box.Minimum.y,
+            I & 4 ? Box.Maximum.z : Box.Minimum.z,
+            1,
+        };
+        glm::vec3 WorldCorner = (Transform * Corner).xyz();
+        Bounds.Minimum = glm::min(Bounds.Minimum, WorldCorner);
+        Bounds.Maximum = glm::max(Bounds.Maximum, WorldCorner);
+    }
+}
+
+// Number of wide mesh BVH levels whose child boxes are transformed to bound
+// a mesh instance.  The transformed root box of a rotated, elongated mesh
+// is much larger than the mesh, while the boxes a few levels down follow
+// its shape closely.
+static constexpr uint32_t MESH_INSTANCE_BOUNDS_DEPTH = 3;
+
+static void GrowMeshInstanceBounds(bounds& Bounds, scene const* Scene, mat4 const& Transform, uint32_t NodeIndex, uint32_t Depth)
+{
+    packed_mesh_node const& Node = Scene->MeshNodePack[NodeIndex];
+    uint32_t ChildCount = Node.Exponents >> 24;
+
+    for (uint32_t I = 0; I < ChildCount; I++)
+    {
+        bool IsLeaf = ((Node.LeafFaceCounts >> (8 * I)) & 0xFF) > 0;
+        if (!IsLeaf && Depth > 1)
+            GrowMeshInstanceBounds(Bounds, Scene, Transform, Node.ChildIndices[I], Depth - 1);
+        else
+            GrowTransformedBounds(Bounds, Transform, GetPackedMeshChildBounds(Node, I));
+    }
+}
+
+// Bounds of a bounded shape, see IsUnboundedShape().
+static bounds ShapeBounds(scene const* Scene, packed_shape const& Object)
+{
+    bounds Bounds;
+
+    switch (Object.Type)
+    {
+        case SHAPE_TYPE_MESH_INSTANCE:
+        {
+            GrowMeshInstanceBounds(Bounds, Scene, Object.Transform.To, Object.MeshRootNodeIndex, MESH_INSTANCE_BOUNDS_DEPTH);
+            break;
+        }
+        case SHAPE_TYPE_SPHERE:
+        case SHAPE_TYPE_CUBE:
+        {
+            GrowTransformedBounds(Bounds, Object.Transform.To, { vec3(-1), vec3(+1) });
+            break;
+        }
+    }
+
+    return Bounds;
+}
+
+/* --- Scene Packing ------------------------------------------------------ */
+
+// Texture parameters that affect the packed texture data, copied so that
+// they can be edited while the texture is packed in the background.
+struct texture_snapshot
+{
+    texture*     Texture;
+    texture_type Type;
+    bool         EnableNearestFiltering;
+};
+
+// Texture atlases and mesh data packed from a snapshot of the textures and
+// meshes of a scene.  The packed indices of the assets are recorded here
+// instead of being stored into the assets, so that a pack built in the
+// background replaces the current one all at once.
+struct scene_asset_pack
+{
+    // Snapshot of the assets to pack.
+    uint32_t                         Flags = 0; // SCENE_DIRTY_TEXTURES and/or SCENE_DIRTY_MESHES.
+    std::vector<texture_snapshot>    Textures;
+    std::vector<mesh*>               Meshes;
+    mesh_face_encoding               MeshFaceEncoding = MESH_FACE_ENCODING_FULL;
+    parametric_spectrum_table const* RGBSpectrumTable = nullptr;
+
+    // Packed data, see the corresponding fields of the scene.
+    std::vector<image>                        Images;
+    std::vector<packed_texture>               TexturePack;
+    std::vector<packed_mesh_face>             MeshFacePack;
+    std::vector<packed_mesh_vertex>           MeshVertexPack;
+    std::vector<packed_mesh_node>             MeshNodePack;
+    std::vector<packed_mesh>                  MeshPack;
+    std::vector<packed_mesh_compact_face>     MeshCompactFacePack;
+    std::vector<packed_mesh_compact_vertex>   MeshCompactVertexPack;
+    std::vector<packed_mesh_transformed_face> MeshTransformedFacePack;
+
+    // Packed indices of the assets, parallel to Textures and Meshes.
+    std::vector<uint32_t> PackedTextureIndices;
+    std::vector<uint32_t> PackedRootNodeIndices;
+    std::vector<uint32_t> PackedMeshIndices;
+
+    // Sizes of the packed mesh data, for the pack log.
+    std::string MeshSummary;
+};
+
+// Packing of scene assets in progress on a background thread, see
+// PackSceneDataAsync().
+struct scene_pack_job
+{
+    scene_asset_pack  Pack;
+    std::thread       Thread;
+    std::atomic<bool> IsDone = false;
+};
+
+static void SnapshotSceneAssets(scene const* Scene, uint32_t Flags, scene_asset_pack* Pack)
+{
+    Pack->Flags = Flags;
+
+    if (Flags & SCENE_DIRTY_TEXTURES)
+    {
+        Pack->Textures.reserve(Scene->Textures.size());
+        for (texture* Texture : Scene->Textures)
+            Pack->Textures.push_back({ Texture, Texture->Type, Texture->EnableNearestFiltering });
+        Pack->RGBSpectrumTable = Scene->RGBSpectrumTable;
+    }
+
+    if (Flags & SCENE_DIRTY_MESHES)
+    {
+        Pack->Meshes = Scene->Meshes;
+        Pack->MeshFaceEncoding = Scene->Root.MeshFaceEncoding;
+    }
+}
+
+// Packs the snapshot textures into atlas images.  The placements are
+// decided serially, after which the textures are converted into the atlas
+// in parallel.
+static void PackTextures(scene_asset_pack* Pack)
+{
+    constexpr int ATLAS_WIDTH = 4096;
+    constexpr int ATLAS_HEIGHT = 4096;
+
+    std::vector<stbrp_node> Nodes(ATLAS_WIDTH);
+    std::vector<stbrp_rect> Rects(Pack->Textures.size());
+    
+    for (int I = 0; I < Rects.size(); I++)
+    {
+        texture const* Texture = Pack->Textures[I].Texture;
+        Rects[I] =
+        {
+            .id = I,
+            .w = static_cast<int>(Texture->Width),
+            .h = static_cast<int>(Texture->Height),
+            .was_packed = 0,
+        };
+    }
+
+    Pack->PackedTextureIndices.resize(Pack->Textures.size(), TEXTURE_INDEX_NONE);
+
+    while (!Rects.empty())
+    {
+        stbrp_context Context;
+        stbrp_init_target(&Context, 4096, 4096, Nodes.data(), static_cast<int>(Nodes.size()));
+        stbrp_pack_rects(&Context, Rects.data(), static_cast<int>(Rects.size()));
+
+        glm::vec4* Pixels = new glm::vec4[4096 * 4096];
+
+        uint32_t ImageIndex = static_cast<uint32_t>(Pack->Images.size());
+
+        std::vector<stbrp_rect> PackedRects;
+
+        for (stbrp_rect& Rect : Rects)
+        {
+            if (!Rect.was_packed)
+                continue;
+
+            texture_snapshot const& Snapshot = Pack->Textures[Rect.id];
+            texture const* Texture = Snapshot.Texture;
+            assert(Texture->Width == Rect.w);
+            assert(Texture->Height == Rect.h);
+
+            Pack->PackedTextureIndices[Rect.id] = static_cast<uint32_t>(Pack->TexturePack.size());
+
+            packed_texture Packed;
+
+            Packed.Flags = 0;
+            Packed.AtlasImageIndex = ImageIndex;
+            Packed.AtlasPlacementMinimum =
+            {
+                (Rect.x + 0.5f) / float(ATLAS_WIDTH),
+                (Rect.y + Rect.h - 0.5f) / float(ATLAS_HEIGHT),
+            };
+            Packed.AtlasPlacementMaximum =
+            {
+                (Rect.x + Rect.w - 0.5f) / float(ATLAS_WIDTH),
+                (Rect.y + 0.5f) / float(ATLAS_HEIGHT),
+            };
+
+            if (Snapshot.EnableNearestFiltering)
+                Packed.Flags |= TEXTURE_FLAG_FILTER_NEAREST;
+
+            Pack->TexturePack.push_back(Packed);
+            PackedRects.push_back(Rect);
+        }
+
+        ParallelFor(PackedRects.size(), [&](size_t RectIndex)
+        {
+            stbrp_rect const& Rect = PackedRects[RectIndex];
+            texture_snapshot const& Snapshot = Pack->Textures[Rect.id];
+            texture const* Texture = Snapshot.Texture;
+
+            for (uint32_t Y = 0; Y < Texture->Height; Y++)
+            {
+                glm::vec4 const* Src = Texture->Pixels + Y * Texture->Width;
+                glm::vec4* Dst = Pixels + (Rect.y + Y) * ATLAS_WIDTH + Rect.x;
+                if (Snapshot.Type == TEXTURE_TYPE_RAW)
+                {
+                    memcpy(Dst, Src, Texture->Width * sizeof(glm::vec4));
+                }
+                else if (Snapshot.Type == TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA)
+                {
+                    for (uint32_t X = 0; X < Texture->Width; X++)
+                    {
+                        glm::vec4 Value = *Src++;
+                        glm::vec3 Beta = GetParametricSpectrumCoefficients(Pack->RGBSpectrumTable, Value.xyz());
+                        *Dst++ = glm::vec4(Beta, Value.a);
+                    }
+                }
+                else if (Snapshot.Type == TEXTURE_TYPE_RADIANCE)
+                {
+                    for (uint32_t X = 0; X < Texture->Width; X++)
+                    {
+                        glm::vec4 Color = *Src++;
+                        float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
+                        if (Intensity > 1e-6f)
+                        {
+                            glm::vec3 Beta = GetParametricSpectrumCoefficients(Pack->RGBSpectrumTable, Color / Intensity);
+                            *Dst++ = glm::vec4(Beta, Intensity);
+                        }
+                        else
+                        {
+                            *Dst++ = glm::vec4(0, 0, 0, 0);
+                        }
+                    }
+                }
+            }
+        });
+
+        auto Atlas = image
+        {
+            .Width = ATLAS_WIDTH,
+            .Height = ATLAS_HEIGHT,
+            .Pixels = Pixels,
+        };
+        Pack->Images.push_back(Atlas);
+
+        std::erase_if(Rects, [](stbrp_rect& R) { return R.was_packed; });
+    }
+}
+
+// Offsets the node indices of a wide node that was packed into an array
+// of its own, when the array is appended to the packed node array.
+static void OffsetPackedMeshNode(packed_mesh_node& Node, uint32_t NodeIndexBase)
+{
+    if (Node.ParentIndex != MESH_NODE_INDEX_NONE)
+        Node.ParentIndex += NodeIndexBase;
+
+    uint32_t ChildCount = Node.Exponents >> 24;
+    for (uint32_t I = 0; I < ChildCount; I++)
+        if (((Node.LeafFaceCounts >> (8 * I)) & 0xFF) == 0)
+            Node.ChildIndices[I] += NodeIndexBase;
+}
+
+// Packs the faces, vertices and BVH nodes of the snapshot meshes.  The
+// vertex and face offsets of every mesh are known up front, so the meshes
+// are packed in parallel.  The wide node counts are not, so every mesh
+// packs its nodes into an array of its own, and the arrays are appended
+// once all of them are done.
+static void PackMeshes(scene_asset_pack* Pack)
+{
+    size_t MeshCount = Pack->Meshes.size();
+
+    std::vector<uint32_t> VertexIndexBases(MeshCount);
+    std::vector<uint32_t> FaceIndexBases(MeshCount);
+
+    uint32_t VertexCount = 0;
+    uint32_t FaceCount = 0;
+    uint32_t NodeCount = 0;
+    for (size_t MeshIndex = 0; MeshIndex < MeshCount; MeshIndex++)
+    {
+        mesh const* Mesh = Pack->Meshes[MeshIndex];
+        VertexIndexBases[MeshIndex] = VertexCount;
+        FaceIndexBases[MeshIndex] = FaceCount;
+        VertexCount += static_cast<uint32_t>(Mesh->Vertices.size());
+        FaceCount += static_cast<uint32_t>(Mesh->Faces.size());
+        NodeCount += static_cast<uint32_t>(Mesh->Nodes.size());
+    }
+
+    mesh_face_encoding Encoding = Pack->MeshFaceEncoding;
+    bool IsCompact = Encoding == MESH_FACE_ENCODING_COMPACT;
+    bool IsTransformed = Encoding == MESH_FACE_ENCODING_TRANSFORMED;
+    bool IsFull = !IsCompact && !IsTransformed;
+
+    Pack->MeshVertexPack.resize(IsCompact ? 0 : VertexCount);
+    Pack->MeshFacePack.resize(IsFull ? FaceCount : 0);
+    Pack->MeshCompactVertexPack.resize(IsCompact ? VertexCount : 0);
+    Pack->MeshCompactFacePack.resize(IsCompact ? FaceCount : 0);
+    Pack->MeshTransformedFacePack.resize(IsTransformed ? FaceCount : 0);
+    Pack->MeshPack.resize(MeshCount);
+    Pack->PackedMeshIndices.resize(MeshCount);
+    Pack->PackedRootNodeIndices.resize(MeshCount);
+
+    std::vector<std::vector<packed_mesh_node>> MeshNodePacks(MeshCount);
+
+    ParallelFor(MeshCount, [&](size_t MeshIndex)
+    {
+        mesh const* Mesh = Pack->Meshes[MeshIndex];
+        uint32_t VertexIndexBase = VertexIndexBases[MeshIndex];
+        uint32_t FaceIndexBase = FaceIndexBases[MeshIndex];
+
+        // Quantize the vertex positions to 16 bits per axis within the
+        // bounds of the mesh.
+        bounds Bounds = Mesh->Faces.empty() ? bounds { vec3(0), vec3(0) } : Mesh->Nodes[0].Bounds;
+
+        packed_mesh PackedMesh = {};
+        PackedMesh.PositionOrigin = Bounds.Minimum;
+        PackedMesh.PositionScale = (Bounds.Maximum - Bounds.Minimum) / 65535.0f;
+
+        Pack->PackedMeshIndices[MeshIndex] = static_cast<uint32_t>(MeshIndex);
+        Pack->MeshPack[MeshIndex] = PackedMesh;
+
+        vec3 InverseScale = 1.0f / glm::max(PackedMesh.PositionScale, vec3(std::numeric_limits<float>::min()));
+
+        // Build the packed mesh vertices.
+        for (size_t VertexIndex = 0; VertexIndex < Mesh->Vertices.size(); VertexIndex++)
+        {
+            mesh_vertex const& Vertex = Mesh->Vertices[VertexIndex];
+            uint32_t PackedNormal = PackUnitVector(Vertex.Normal);
+            uint32_t PackedUV = glm::packHalf2x16(Vertex.UV);
+
+            if (IsCompact)
+            {
+                vec3 Position = (Vertex.Position - PackedMesh.PositionOrigin) * InverseScale;
+                glm::uvec3 Q = glm::uvec3(glm::clamp(glm::round(Position), vec3(0.0f), vec3(65535.0f)));
+
+                packed_mesh_compact_vertex Packed;
+                Packed.PackedNormal = PackedNormal;
+                Packed.PackedUV = PackedUV;
+                Packed.PackedPositionXY = Q.x | Q.y << 16;
+                Packed.PackedPositionZ = Q.z;
+                Pack->MeshCompactVertexPack[VertexIndexBase + VertexIndex] = Packed;
+            }
+            else
+            {
+                packed_mesh_vertex Packed;
+                Packed.PackedNormal = PackedNormal;
+                Packed.PackedUV = PackedUV;
+                Pack->MeshVertexPack[VertexIndexBase + VertexIndex] = Packed;
+            }
+        }
+
+        // Build the packed mesh faces.
+        for (size_t FaceIndex = 0; FaceIndex < Mesh->Faces.size(); FaceIndex++)
+        {
+            mesh_face const& Face = Mesh->Faces[FaceIndex];
+            if (IsCompact)
+            {
+                packed_mesh_compact_face Packed;
+                Packed.VertexIndex0 = VertexIndexBase + Face.VertexIndex[0];
+                Packed.VertexIndex1 = VertexIndexBase + Face.VertexIndex[1];
+                Packed.VertexIndex2 = VertexIndexBase + Face.VertexIndex[2];
+                Pack->MeshCompactFacePack[FaceIndexBase + FaceIndex] = Packed;
+            }
+            else if (IsTransformed)
+            {
+                packed_mesh_transformed_face Packed = PackTransformedMeshFace(
+                    Mesh->Vertices[Face.VertexIndex[0]].Position,
+                    Mesh->Vertices[Face.VertexIndex[1]].Position,
+                    Mesh->Vertices[Face.VertexIndex[2]].Position);
+                Packed.VertexIndex0 = VertexIndexBase + Face.VertexIndex[0];
+                Packed.VertexIndex1 = VertexIndexBase + Face.VertexIndex[1];
+                Packed.VertexIndex2AndAxis |= VertexIndexBase + Face.VertexIndex[2];
+                Pack->MeshTransformedFacePack[FaceIndexBase + FaceIndex] = Packed;
+            }
+            else
+            {
+                packed_mesh_face Packed;
+                Packed.Position0 = Mesh->Vertices[Face.VertexIndex[0]].Position;
+                Packed.VertexIndex0 = VertexIndexBase + Face.VertexIndex[0];
+                Packed.Position1 = Mesh->Vertices[Face.VertexIndex[1]].Position;
+                Packed.VertexIndex1 = VertexIndexBase + Face.VertexIndex[1];
+                Packed.Position2 = Mesh->Vertices[Face.VertexIndex[2]].Position;
+                Packed.VertexIndex2 = VertexIndexBase + Face.VertexIndex[2];
+                Pack->MeshFacePack[FaceIndexBase + FaceIndex] = Packed;
+            }
+        }
+
+        // Build the packed mesh nodes.  Decoded positions can be off by
+        // half a grid cell plus rounding, so the node bounds are padded
+        // to keep the faces inside them.
+        vec3 Margin = vec3(0);
+        if (IsCompact)
+        {
+            vec3 Magnitude = glm::max(glm::abs(Bounds.Minimum), glm::abs(Bounds.Maximum));
+            Margin = PackedMesh.PositionScale + Magnitude * (4.0f * std::numeric_limits<float>::epsilon());
+        }
+        PackMeshNodes(Mesh, FaceIndexBase, Margin, MeshNodePacks[MeshIndex]);
+    });
+
+    // Append the node arrays of the meshes.
+    std::vector<uint32_t> NodeIndexBases(MeshCount);
+
+    uint32_t WideNodeCount = 0;
+    for (size_t MeshIndex = 0; MeshIndex < MeshCount; MeshIndex++)
+    {
+        NodeIndexBases[MeshIndex] = WideNodeCount;
+        Pack->PackedRootNodeIndices[MeshIndex] = WideNodeCount;
+        WideNodeCount += static_cast<uint32_t>(MeshNodePacks[MeshIndex].size());
+    }
+
+    Pack->MeshNodePack.resize(WideNodeCount);
+
+    ParallelFor(MeshCount, [&](size_t MeshIndex)
+    {
+        std::vector<packed_mesh_node>& Nodes = MeshNodePacks[MeshIndex];
+        for (size_t I = 0; I < Nodes.size(); I++)
+        {
+            packed_mesh_node& Node = Pack->MeshNodePack[NodeIndexBases[MeshIndex] + I];
+            Node = Nodes[I];
+            OffsetPackedMeshNode(Node, NodeIndexBases[MeshIndex]);
+        }
+        std::vector<packed_mesh_node>().swap(Nodes);
+    });
+
+    size_t FaceDataSize = IsCompact
+        ? sizeof(packed_mesh_compact_face) * FaceCount + sizeof(packed_mesh_compact_vertex) * VertexCount
+        : IsTransformed
+        ? sizeof(packed_mesh_transformed_face) * FaceCount + sizeof(packed_mesh_vertex) * VertexCount
+        : sizeof(packed_mesh_face) * FaceCount + sizeof(packed_mesh_vertex) * VertexCount;
+
+    // Binary nodes took 32 bytes each.
+    Pack->MeshSummary = std::format("{} faces, {} vertices, {} encoding ({:.1f} MB), {} wide nodes ({:.1f} MB) from {} binary nodes ({:.1f} MB)",
+        FaceCount,
+        VertexCount,
+        MeshFaceEncodingName(Encoding),
+        FaceDataSize / 1048576.0,
+        Pack->MeshNodePack.size(),
+        sizeof(packed_mesh_node) * Pack->MeshNodePack.size() / 1048576.0,
+        NodeCount,
+        32 * NodeCount / 1048576.0);
+}
+
+// Prints the time taken by each stage of a scene pack, and the sizes of
+// the packed meshes if they were packed.
+static void PrintScenePackTimes(char const* Title, task_graph const& Graph, double TotalTime, scene_asset_pack const* Pack)
+{
+    std::string Stages;
+    for (task const& Task : Graph.Tasks)
+        Stages += std::format("{}{} {:.1f} ms", Stages.empty() ? "" : ", ", Task.Name, Task.Duration);
+    printf("%s in %.1f ms (%s)\n", Title, TotalTime, Stages.c_str());
+
+    if (!Pack->MeshSummary.empty())
+        printf("  Meshes: %s\n", Pack->MeshSummary.c_str());
+}
+
+// Replaces the packed textures of a scene with those of a new pack.
+static void ApplyTexturePack(scene* Scene, scene_asset_pack* Pack)
+{
+    Scene->Images = std::move(Pack->Images);
+    Scene->TexturePack = std::move(Pack->TexturePack);
+
+    for (size_t I = 0; I < Pack->Textures.size(); I++)
+        if (Pack->Textures[I].Texture)
+            Pack->Textures[I].Texture->PackedTextureIndex = Pack->PackedTextureIndices[I];
+}
+
+// Replaces the packed meshes of a scene with those of a new pack.
+static void ApplyMeshPack(scene* Scene, scene_asset_pack* Pack)
+{
+    Scene->MeshFacePack = std::move(Pack->MeshFacePack);
+    Scene->MeshVertexPack = std::move(Pack->MeshVertexPack);
+    Scene->MeshNodePack = std::move(Pack->MeshNodePack);
+    Scene->MeshPack = std::move(Pack->MeshPack);
+    Scene->MeshCompactFacePack = std::move(Pack->MeshCompactFacePack);
+    Scene->MeshCompactVertexPack = std::move(Pack->MeshCompactVertexPack);
+    Scene->MeshTransformedFacePack = std::move(Pack->MeshTransformedFacePack);
+
+    for (size_t I = 0; I < Pack->Meshes.size(); I++)
+    {
+        if (!Pack->Meshes[I]) continue;
+        Pack->Meshes[I]->PackedRootNodeIndex = Pack->PackedRootNodeIndices[I];
+        Pack->Meshes[I]->PackedMeshIndex = Pack->PackedMeshIndices[I];
+    }
+
+    Scene->Globals.MeshFaceEncoding = Pack->MeshFaceEncoding;
+}
+
+// Packs the snapshot textures and meshes of a background scene pack.  The
+// two are independent of each other, and are packed in parallel.
+static void PackSceneAssets(scene_asset_pack* Pack)
+{
+    auto StartTime = std::chrono::steady_clock::now();
+
+    task_graph Graph;
+    if (Pack->Flags & SCENE_DIRTY_TEXTURES)
+        AddTask(&Graph, "textures", [Pack] { PackTextures(Pack); });
+    if (Pack->Flags & SCENE_DIRTY_MESHES)
+        AddTask(&Graph, "meshes", [Pack] { PackMeshes(Pack); });
+    RunTaskGraph(&Graph);
+
+    double TotalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+    PrintScenePackTimes("Packed scene assets in the background", Graph, TotalTime, Pack);
+}
+
+// Replaces the packed textures and meshes of a scene with a new pack, and
+// updates the packed indices of the assets.  Assets destroyed since the
+// snapshot was taken have been detached from it.  Returns the dirty flags
+// of the packed data that depends on the assets.
+static uint32_t ApplySceneAssetPack(scene* Scene, scene_asset_pack* Pack)
+{
+    uint32_t DirtyFlags = 0;
+
+    if (Pack->Flags & SCENE_DIRTY_TEXTURES)
+    {
+        ApplyTexturePack(Scene, Pack);
+        DirtyFlags |= SCENE_DIRTY_MATERIALS;
+    }
+
+    if (Pack->Flags & SCENE_DIRTY_MESHES)
+    {
+        ApplyMeshPack(Scene, Pack);
+        DirtyFlags |= SCENE_DIRTY_SHAPES | SCENE_DIRTY_GLOBALS;
+    }
+
+    return DirtyFlags;
+}
+
+static bool IsScenePackJobRunning(scene const* Scene)
+{
+    return Scene->PackJob && !Scene->PackJob->IsDone.load(std::memory_order_acquire);
+}
+
+// Waits for the background scene pack to stop reading the scene assets.
+// The result is applied by the next PackSceneData() or PackSceneDataAsync().
+static void WaitForScenePackJob(scene* Scene)
+{
+    if (Scene->PackJob && Scene->PackJob->Thread.joinable())
+        Scene->PackJob->Thread.join();
+}
+
+static void DetachScenePackJob(scene* Scene, texture* Texture)
+{
+    WaitForScenePackJob(Scene);
+    if (!Scene->PackJob) return;
+    for (texture_snapshot& Snapshot : Scene->PackJob->Pack.Textures)
+        if (Snapshot.Texture == Texture)
+            Snapshot.Texture = nullptr;
+}
+
+static void DetachScenePackJob(scene* Scene, mesh* Mesh)
+{
+    WaitForScenePackJob(Scene);
+    if (!Scene->PackJob) return;
+    std::replace(Scene->PackJob->Pack.Meshes.begin(), Scene->PackJob->Pack.Meshes.end(), Mesh, static_cast<mesh*>(nullptr));
+}
+
+// Applies the result of the background scene pack, waiting for it if it
+// is still running.  Returns the flags of the packed data to upload.
+static uint32_t FinishScenePackJob(scene* Scene)
+{
+    scene_pack_job* Job = Scene->PackJob;
+    if (!Job) return 0;
+
+    WaitForScenePackJob(Scene);
+
+    Scene->DirtyFlags |= ApplySceneAssetPack(Scene, &Job->Pack);
+    uint32_t UploadFlags = Job->Pack.Flags;
+
+    delete Job;
+    Scene->PackJob = nullptr;
+
+    return UploadFlags;
+}
+
+void PrintShapeNode(scene* Scene, uint32_t Index, int Depth)
+{
+    packed_shape_node const& Node = Scene->ShapeNodePack[Index];
+
+    for (int I = 0; I < Depth; I++) printf("  ");
+
+    if (!(Node.ChildOrShapeIndex & SHAPE_NODE_LEAF))
+    {
+        printf("Node %u\n", Index);
+        PrintShapeNode(Scene, Node.ChildOrShapeIndex + 0, Depth+1);
+        PrintShapeNode(Scene, Node.ChildOrShapeIndex + 1, Depth+1);
+    }
+    else
+    {
+        printf("Leaf %u (object %u)\n", Index, Node.ChildOrShapeIndex & ~SHAPE_NODE_LEAF);
+    }
+}
+
+// Rebuilds the user lists of the textures from all materials.
+static void IndexTextureUsers(scene* Scene)
+{
+    for (texture* Texture : Scene->Textures)
+        Texture->Users.clear();
+    for (material* Material : Scene->Materials)
+        ForEachMaterialTexture(Scene, Material, [Material](texture*& Texture)
+        {
+            if (Texture) Texture->Users.push_back(Material);
+        });
+    Scene->TextureUsersAreIndexed = true;
+}
+
+// Packs the materials into slots of 32 or 64 words.  Refers to the packed
+// textures.  Unless the set of materials or the textures have changed, the
+// materials marked dirty are repacked in place, and the rest are left as
+// they are.  Returns true if the packed index of any material changed.
+static bool PackMaterials(scene* Scene, uint32_t DirtyFlags)
+{
+    if (!(DirtyFlags & SCENE_DIRTY_MATERIALS))
+    {
+        for (material* Material : Scene->Materials)
+        {
+            if (!Material->SlotIsDirty) continue;
+            size_t Offset = 32 * Material->PackedMaterialIndex;
+            assert(Offset + MaterialTypePackedSize(Material->Type) <= Scene->MaterialAttributePack.size());
+            PackMaterialData(Scene, Material, &Scene->MaterialAttributePack[Offset]);
+            Scene->DirtyMaterialSlots.push_back(Material->PackedMaterialIndex);
+            Material->SlotIsDirty = false;
+        }
+
+        // The textures of the repacked materials may have changed.
+        IndexTextureUsers(Scene);
+        return false;
+    }
+
+    Scene->MaterialAttributePack.clear();
+    Scene->DirtyMaterialSlots.clear();
+
+    IndexTextureUsers(Scene);
+
+    // Fallback material.
+    {
+        openpbr_material OpenPBR = {};
+
+        material* Material = &OpenPBR;
+        size_t Offset = Scene->MaterialAttributePack.size();
+        size_t Size = MaterialTypePackedSize(Material->Type);
+        Scene->MaterialAttributePack.resize(Offset + 64);
+        Scene->MaterialAttributePack[Offset] = Material->Type;
+        PackMaterialData(Scene, Material, &Scene->MaterialAttributePack[Offset]);
+    }
+
+    bool IndicesChanged = false;
+
+    for (material* Material : Scene->Materials)
+    {
+        size_t Offset = Scene->MaterialAttributePack.size();
+        size_t Size = MaterialTypePackedSize(Material->Type);
+        Scene->MaterialAttributePack.resize(Offset + Size);
+        Scene->MaterialAttributePack[Offset] = Material->Type;
+        PackMaterialData(Scene, Material, &Scene->MaterialAttributePack[Offset]);
+
+        uint32_t PackedMaterialIndex = static_cast<uint32_t>(Offset) / 32;
+        IndicesChanged |= Material->PackedMaterialIndex != PackedMaterialIndex;
+        Material->PackedMaterialIndex = PackedMaterialIndex;
+        Material->SlotIsDirty = false;
+    }
+
+    return IndicesChanged;
+}
+
+// Rebuilds the user lists of the materials and meshes from all entities in
+// the scene, including inactive ones.
+static void IndexEntityUsers(scene* Scene)
+{
+    for (material* Material : Scene->Materials)
+        Material->Users.clear();
+    for (mesh* Mesh : Scene->Meshes)
+        Mesh->Users.clear();
+
+    for (entity* Entity : Scene->EntityTable.Entities)
+    {
+        if (Entity->Material)
+            Entity->Material->Users.push_back(Entity);
+
+        if (Entity->Type == ENTITY_TYPE_MESH_INSTANCE)
+        {
+            auto Instance = static_cast<mesh_entity*>(Entity);
+            if (Instance->Mesh)
+                Instance->Mesh->Users.push_back(Entity);
+        }
+    }
+
+    Scene->EntityUsersAreIndexed = true;
+}
+
+// Fills in the type and the material of the packed shape of an entity,
+// but not the transform.  Returns false if the entity has no shape.
+static bool GetPackedShape(entity const* Entity, packed_shape* Packed)
+{
+    Packed->MaterialIndex = GetPackedMaterialIndex(Entity->Material);
+
+    switch (Entity->Type)
+    {
+        case ENTITY_TYPE_MESH_INSTANCE:
+        {
+            auto Instance = static_cast<mesh_entity const*>(Entity);
+            if (!Instance->Mesh || Instance->Mesh->PackedRootNodeIndex == MESH_NODE_INDEX_NONE) return false;
+            Packed->MeshRootNodeIndex = Instance->Mesh->PackedRootNodeIndex;
+            Packed->MeshIndex = Instance->Mesh->PackedMeshIndex;
+            Packed->Type = SHAPE_TYPE_MESH_INSTANCE;
+            return true;
+        }
+        case ENTITY_TYPE_PLANE:
+            Packed->Type = SHAPE_TYPE_PLANE;
+            return true;
+        case ENTITY_TYPE_SPHERE:
+            Packed->Type = SHAPE_TYPE_SPHERE;
+            return true;
+        case ENTITY_TYPE_CUBE:
+            Packed->Type = SHAPE_TYPE_CUBE;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Packed shape of an entity in a prefab, with the transform relative to
+// the instances of the prefab.
+struct prefab_shape
+{
+    packed_shape Packed;
+    mat4         To;
+    mat4         From;
+};
+
+// Collects the shapes of the active entities in a prefab subtree.  Prefab
+// instances nested in prefabs are not expanded.
+static void CollectPrefabShapes(entity const* Entity, mat4 const& ParentTransform, std::vector<prefab_shape>& Shapes)
+{
+    if (!Entity->Active) return;
+
+    mat4 Transform = ParentTransform * GetEntityLocalTransform(Entity);
+
+    prefab_shape Shape = {};
+    if (GetPackedShape(Entity, &Shape.Packed))
+    {
+        Shape.To = Transform;
+        Shape.From = glm::inverse(Transform);
+        Shapes.push_back(Shape);
+    }
+
+    for (entity const* Child : Entity->Children)
+        CollectPrefabShapes(Child, Transform, Shapes);
+}
+
+// Bounded shape to build the shape BVH over.
+struct shape_tree_item
+{
+    bounds    Bounds;
+    glm::vec3 Centroid;
+    uint32_t  ShapeIndex;
+};
+
+// Chooses where to split a range of shape tree items by binning their
+// centroids along each axis and minimizing the surface area heuristic.
+// Partitions the items, and returns the index of the first item of the
+// right half.  Falls back to a median split on the longest axis when no
+// binned split separates the items.
+static uint32_t SplitShapeTreeItems(std::vector<shape_tree_item>& Items, uint32_t BeginIndex, uint32_t EndIndex, bounds const& CentroidBounds)
+{
+    constexpr uint32_t BINS = 16;
+
+    struct bin
+    {
+        bounds   Bounds;
+        uint32_t Count = 0;
+    };
+
+    int SplitAxis = -1;
+    uint32_t SplitBin = 0;
+    float SplitCost = +INF;
+
+    for (int Axis = 0; Axis < 3; Axis++)
+    {
+        float Minimum = CentroidBounds.Minimum[Axis];
+        float Maximum = CentroidBounds.Maximum[Axis];
+        if (Minimum == Maximum) continue;
+
+        float BinIndexPerUnit = float(BINS) / (Maximum - Minimum);
+
+        bin Bins[BINS];
+        for (uint32_t I = BeginIndex; I < EndIndex; I++)
+        {
+            uint32_t BinIndex = std::min(static_cast<uint32_t>(BinIndexPerUnit * (Items[I].Centroid[Axis] - Minimum)), BINS - 1);
+            Grow(Bins[BinIndex].Bounds, Items[I].Bounds);
+            Bins[BinIndex].Count++;
+        }
+
+        // Cost of the items to the right of each bin boundary.
+        float RightCosts[BINS];
+        bounds RightBounds;
+        uint32_t RightCount = 0;
+        for (uint32_t I = BINS - 1; I > 0; I--)
+        {
+            Grow(RightBounds, Bins[I].Bounds);
+            RightCount += Bins[I].Count;
+            RightCosts[I] = RightCount ? RightCount * HalfArea(RightBounds) : +INF;
+        }
+
+        bounds LeftBounds;
+        uint32_t LeftCount = 0;
+        for (uint32_t I = 1; I < BINS; I++)
+        {
+            Grow(LeftBounds, Bins[I-1].Bounds);
+            LeftCount += Bins[I-1].Count;
+            if (LeftCount == 0) continue;
+
+            float Cost = LeftCount * HalfArea(LeftBounds) + RightCosts[I];
+            if (Cost < SplitCost)
+            {
+                SplitCost = Cost;
+                SplitAxis = Axis;
+                SplitBin = I;
+            }
         }
     }
 
-    glm::vec3 WorldMin = glm::vec3(+INFINITY);
-    glm::vec3 WorldMax = glm::vec3(-INFINITY);
+    auto Begin = Items.begin() + BeginIndex;
+    auto End = Items.begin() + EndIndex;
 
-    for (glm::vec4 const& Corner : Corners)
+    if (SplitAxis >= 0)
     {
-        glm::vec3 WorldCorner = (Object.Transform.To * Corner).xyz();
-        WorldMin = glm::min(WorldMin, WorldCorner.xyz());
-        WorldMax = glm::max(WorldMax, WorldCorner.xyz());
+        float Minimum = CentroidBounds.Minimum[SplitAxis];
+        float BinIndexPerUnit = float(BINS) / (CentroidBounds.Maximum[SplitAxis] - Minimum);
+        auto Middle = std::partition(Begin, End, [=](shape_tree_item const& Item)
+        {
+            return std::min(static_cast<uint32_t>(BinIndexPerUnit * (Item.Centroid[SplitAxis] - Minimum)), BINS - 1) < SplitBin;
+        });
+        return static_cast<uint32_t>(Middle - Items.begin());
     }
 
-    return { WorldMin, WorldMax };
+    // All centroids coincide, so any split is as good as any other.
+    glm::vec3 Extent = CentroidBounds.Maximum - CentroidBounds.Minimum;
+    int Axis = Extent.x >= Extent.y && Extent.x >= Extent.z ? 0 : Extent.y >= Extent.z ? 1 : 2;
+    auto Middle = Begin + (EndIndex - BeginIndex) / 2;
+    std::nth_element(Begin, Middle, End, [Axis](shape_tree_item const& A, shape_tree_item const& B)
+    {
+        return A.Centroid[Axis] < B.Centroid[Axis];
+    });
+    return static_cast<uint32_t>(Middle - Items.begin());
 }
 
-void PrintShapeNode(scene* Scene, uint16_t Index, int Depth)
+// Builds the shape BVH over a non-empty set of bounded shapes, with binned
+// SAH splits.  The root is node 0, each leaf holds one shape, and the two
+// children of a node are adjacent.
+static void BuildShapeTree(std::vector<packed_shape_node>& Nodes, std::vector<shape_tree_item>& Items)
 {
-    packed_shape_node const& Node = Scene->ShapeNodePack[Index];
-
-    for (int I = 0; I < Depth; I++) printf("  ");
-
-    if (Node.ChildNodeIndices > 0)
-    {
-        uint16_t IndexA = Node.ChildNodeIndices & 0xFFFF;
-        uint16_t IndexB = Node.ChildNodeIndices >> 16;
-        printf("Node %u\n", Index);
-        PrintShapeNode(Scene, IndexA, Depth+1);
-        PrintShapeNode(Scene, IndexB, Depth+1);
-    }
-    else
+    struct pending_node
     {
-        printf("Leaf %u (object %lu)\n", Index, Node.ShapeIndex);
-    }
-}
+        uint32_t NodeIndex;
+        uint32_t BeginIndex;
+        uint32_t EndIndex;
+    };
 
-uint32_t PackSceneData(scene* Scene)
-{
-    uint32_t DirtyFlags = Scene->DirtyFlags;
+    Nodes.assign(1, packed_shape_node { .ParentIndex = 0 });
+    Nodes.reserve(2 * Items.size() - 1);
 
-    // Pack textures.
-    if (DirtyFlags & SCENE_DIRTY_TEXTURES)
+    // Subtrees are built from an explicit stack, as unbalanced splits can
+    // make the tree deep.
+    std::vector<pending_node> Pending = { { 0, 0, static_cast<uint32_t>(Items.size()) } };
+
+    while (!Pending.empty())
     {
-        constexpr int ATLAS_WIDTH = 4096;
-        constexpr int ATLAS_HEIGHT = 4096;
+        pending_node Current = Pending.back();
+        Pending.pop_back();
 
-        std::vector<stbrp_node> Nodes(ATLAS_WIDTH);
-        std::vector<stbrp_rect> Rects(Scene->Textures.size());
-        
-        for (int I = 0; I < Rects.size(); I++)
+        bounds Bounds, CentroidBounds;
+        for (uint32_t I = Current.BeginIndex; I < Current.EndIndex; I++)
         {
-            texture* Texture = Scene->Textures[I];
-            Rects[I] =
-            {
-                .id = I,
-                .w = static_cast<int>(Texture->Width),
-                .h = static_cast<int>(Texture->Height),
-                .was_packed = 0,
-            };
+            Grow(Bounds, Items[I].Bounds);
+            Grow(CentroidBounds, Items[I].Centroid);
         }
 
-        Scene->Images.clear();
-        Scene->TexturePack.clear();
+        packed_shape_node& Node = Nodes[Current.NodeIndex];
+        Node.Minimum = Bounds.Minimum;
+        Node.Maximum = Bounds.Maximum;
 
-        while (!Rects.empty())
+        if (Current.EndIndex - Current.BeginIndex == 1)
         {
-            stbrp_context Context;
-            stbrp_init_target(&Context, 4096, 4096, Nodes.data(), static_cast<int>(Nodes.size()));
-            stbrp_pack_rects(&Context, Rects.data(), static_cast<int>(Rects.size()));
-
-            glm::vec4* Pixels = new glm::vec4[4096 * 4096];
-
-            uint32_t ImageIndex = static_cast<uint32_t>(Scene->Images.size());
-
-            for (stbrp_rect& Rect : Rects)
-            {
-                if (!Rect.was_packed)
-                    continue;
-
-                texture* Texture = Scene->Textures[Rect.id];
-                assert(Texture->Width == Rect.w);
-                assert(Texture->Height == Rect.h);
-
-                Texture->PackedTextureIndex = static_cast<uint32_t>(Scene->TexturePack.size());
-
-                packed_texture Packed;
-
-                Packed.Flags = 0;
-                Packed.AtlasImageIndex = ImageIndex;
-                Packed.AtlasPlacementMinimum =
-                {
-                    (Rect.x + 0.5f) / float(ATLAS_WIDTH),
-                    (Rect.y + Rect.h - 0.5f) / float(ATLAS_HEIGHT),
-                };
-                Packed.AtlasPlacementMaximum =
-                {
-                    (Rect.x + Rect.w - 0.5f) / float(ATLAS_WIDTH),
-                    (Rect.y + 0.5f) / float(ATLAS_HEIGHT),
-                };
-
-                for (uint32_t Y = 0; Y < Texture->Height; Y++)
-                {
-                    glm::vec4 const* Src = Texture->Pixels + Y * Texture->Width;
-                    glm::vec4* Dst = Pixels + (Rect.y + Y) * ATLAS_WIDTH + Rect.x;
-                    if (Texture->Type == TEXTURE_TYPE_RAW)
-                    {
-                        memcpy(Dst, Src, Texture->Width * sizeof(glm::vec4));
-                    }
-                    else if (Texture->Type == TEXTURE_TYPE_REFLECTANCE_WITH_ALPHA)
-                    {
-                        for (uint32_t X = 0; X < Texture->Width; X++)
-                        {
-                            glm::vec4 Value = *Src++;
-                            glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Value.xyz());
-                            *Dst++ = glm::vec4(Beta, Value.a);
-                        }
-                    }
-                    else if (Texture->Type == TEXTURE_TYPE_RADIANCE)
-                    {
-                        for (uint32_t X = 0; X < Texture->Width; X++)
-                        {
-                            glm::vec4 Color = *Src++;
-                            float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
-                            if (Intensity > 1e-6f)
-                            {
-                                glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Color / Intensity);
-                                *Dst++ = glm::vec4(Beta, Intensity);
-                            }
-                            else
-                            {
-                                *Dst++ = glm::vec4(0, 0, 0, 0);
-                            }
-                        }
-                    }
-                }
-
-                if (Texture->EnableNearestFiltering)
-                    Packed.Flags |= TEXTURE_FLAG_FILTER_NEAREST;
-
-                Scene->TexturePack.push_back(Packed);
-            }
+            Node.ChildOrShapeIndex = SHAPE_NODE_LEAF | Items[Current.BeginIndex].ShapeIndex;
+            continue;
+        }
 
-            auto Atlas = image
-            {
-                .Width = ATLAS_WIDTH,
-                .Height = ATLAS_HEIGHT,
-                .Pixels = Pixels,
-            };
-            Scene->Images.push_back(Atlas);
+        uint32_t SplitIndex = SplitShapeTreeItems(Items, Current.BeginIndex, Current.EndIndex, CentroidBounds);
+        uint32_t ChildIndex = static_cast<uint32_t>(Nodes.size());
+        Node.ChildOrShapeIndex = ChildIndex;
 
-            std::erase_if(Rects, [](stbrp_rect& R) { return R.was_packed; });
-        }
+        Nodes.push_back({ .ParentIndex = Current.NodeIndex });
+        Nodes.push_back({ .ParentIndex = Current.NodeIndex });
 
-        DirtyFlags |= SCENE_DIRTY_MATERIALS;
+        Pending.push_back({ ChildIndex + 0, Current.BeginIndex, SplitIndex });
+        Pending.push_back({ ChildIndex + 1, SplitIndex, Current.EndIndex });
     }
+}
 
-    // Pack materials.
-    if (DirtyFlags & SCENE_DIRTY_MATERIALS)
-    {
-        Scene->MaterialAttributePack.clear();
+// Packs the shapes and builds the shape BVH.  Refers to the packed
+// materials and meshes.
+static void PackShapes(scene* Scene)
+{
+    IndexEntityUsers(Scene);
 
-        // Fallback material.
-        {
-            openpbr_material OpenPBR = {};
+    Scene->ShapePack.clear();
+    Scene->ShapeEntities.clear();
+    Scene->ShapeNodePack.resize(1);
 
-            material* Material = &OpenPBR;
-            size_t Offset = Scene->MaterialAttributePack.size();
-            size_t Size = MaterialTypePackedSize(Material->Type);
-            Scene->MaterialAttributePack.resize(Offset + 64);
-            Scene->MaterialAttributePack[Offset] = Material->Type;
-            PackMaterialData(Scene, Material, &Scene->MaterialAttributePack[Offset]);
-        }
+    std::vector<entity*> BoundedEntities;
+    std::vector<packed_shape> BoundedShapes;
 
-        for (material* Material : Scene->Materials)
+    // A prefab instance refers to the first of its packed shapes, and
+    // keeps the ranges of all of them.
+    auto AppendShape = [Scene](entity* Entity, packed_shape const& Packed, bool IsBounded)
+    {
+        uint32_t ShapeIndex = static_cast<uint32_t>(Scene->ShapePack.size());
+        if (Entity->Type == ENTITY_TYPE_PREFAB_INSTANCE)
         {
-            size_t Offset = Scene->MaterialAttributePack.size();
-            size_t Size = MaterialTypePackedSize(Material->Type);
-            Scene->MaterialAttributePack.resize(Offset + Size);
-            Scene->MaterialAttributePack[Offset] = Material->Type;
-            PackMaterialData(Scene, Material, &Scene->MaterialAttributePack[Offset]);
-            Material->PackedMaterialIndex = static_cast<uint32_t>(Offset) / 32;
+            auto Instance = static_cast<prefab_entity*>(Entity);
+            packed_shape_range& Range = IsBounded ? Instance->PackedBoundedShapes : Instance->PackedUnboundedShapes;
+            if (Range.Count++ == 0)
+                Range.Index = ShapeIndex;
         }
+        if (Entity->Type != ENTITY_TYPE_PREFAB_INSTANCE || Entity->PackedShapeIndex == SHAPE_INDEX_NONE)
+            Entity->PackedShapeIndex = ShapeIndex;
+        Scene->ShapeEntities.push_back(Entity);
+        Scene->ShapePack.push_back(Packed);
+    };
 
-        DirtyFlags |= SCENE_DIRTY_SHAPES;
-    }
-
-    // Pack mesh face and node data.
-    if (DirtyFlags & SCENE_DIRTY_MESHES)
+    auto AddShape = [&](entity* Entity, packed_shape const& Packed)
     {
-        uint32_t VertexCount = 0;
-        uint32_t FaceCount = 0;
-        uint32_t NodeCount = 0;
-        for (mesh* Mesh : Scene->Meshes)
+        if (!IsUnboundedShape(Packed))
         {
-            VertexCount += static_cast<uint32_t>(Mesh->Vertices.size());
-            FaceCount += static_cast<uint32_t>(Mesh->Faces.size());
-            NodeCount += static_cast<uint32_t>(Mesh->Nodes.size());
+            BoundedEntities.push_back(Entity);
+            BoundedShapes.push_back(Packed);
+            return;
         }
+        AppendShape(Entity, Packed, false);
+    };
 
-        Scene->MeshVertexPack.clear();
-        Scene->MeshVertexPack.reserve(VertexCount);
-        Scene->MeshFacePack.clear();
-        Scene->MeshFacePack.reserve(FaceCount);
-        Scene->MeshNodePack.clear();
-        Scene->MeshNodePack.reserve(NodeCount);
+    // The shapes of a prefab are collected once per pack, and then placed
+    // at each of its instances.
+    std::unordered_map<prefab const*, std::vector<prefab_shape>> PrefabShapes;
 
-        for (mesh* Mesh : Scene->Meshes)
+    ForEachActiveEntity(Scene->EntityTable, [&](entity* Entity, mat4 const& Transform)
+    {
+        if (Entity->Type == ENTITY_TYPE_PREFAB_INSTANCE)
         {
-            uint32_t VertexIndexBase = static_cast<uint32_t>(Scene->MeshVertexPack.size());
-            uint32_t FaceIndexBase = static_cast<uint32_t>(Scene->MeshFacePack.size());
-            uint32_t NodeIndexBase = static_cast<uint32_t>(Scene->MeshNodePack.size());
-
-            // Build the packed mesh vertices.
-            for (mesh_vertex const& Vertex : Mesh->Vertices)
+            auto Instance = static_cast<prefab_entity*>(Entity);
+            Instance->PackedShapeIndex = SHAPE_INDEX_NONE;
+            Instance->PackedUnboundedShapes = {};
+            Instance->PackedBoundedShapes = {};
+            if (!Instance->Prefab) return;
+
+            auto [Iterator, IsNew] = PrefabShapes.try_emplace(Instance->Prefab);
+            if (IsNew)
+                CollectPrefabShapes(Instance->Prefab->Entity, mat4(1), Iterator->second);
+
+            mat4 InverseTransform = glm::inverse(Transform);
+            for (prefab_shape const& Shape : Iterator->second)
             {
-                packed_mesh_vertex Packed;
-
-                Packed.PackedNormal = PackUnitVector(Vertex.Normal);
-                Packed.PackedUV = glm::packHalf2x16(Vertex.UV);
-
-                Scene->MeshVertexPack.push_back(Packed);
+                packed_shape Packed = Shape.Packed;
+                Packed.Transform = { .To = Transform * Shape.To, .From = Shape.From * InverseTransform };
+                AddShape(Entity, Packed);
             }
+            return;
+        }
 
-            // Build the packed mesh faces.
-            for (mesh_face const& Face : Mesh->Faces)
-            {
-                packed_mesh_face Packed;
+        packed_shape Packed = {};
+        if (!GetPackedShape(Entity, &Packed)) return;
+        Packed.Transform = PackTransform(Transform);
+        AddShape(Entity, Packed);
+    });
 
-                Packed.Position0 = Mesh->Vertices[Face.VertexIndex[0]].Position;
-                Packed.VertexIndex0 = VertexIndexBase + Face.VertexIndex[0];
-                Packed.Position1 = Mesh->Vertices[Face.VertexIndex[1]].Position;
-                Packed.VertexIndex1 = VertexIndexBase + Face.VertexIndex[1];
-                Packed.Position2 = Mesh->Vertices[Face.VertexIndex[2]].Position;
-                Packed.VertexIndex2 = VertexIndexBase + Face.VertexIndex[2];
+    uint32_t UnboundedShapeCount = static_cast<uint32_t>(Scene->ShapePack.size());
 
-                Scene->MeshFacePack.push_back(Packed);
-            }
+    for (size_t I = 0; I < BoundedShapes.size(); I++)
+        AppendShape(BoundedEntities[I], BoundedShapes[I], true);
 
-            // Build the packed mesh nodes.
-            for (mesh_node const& Node : Mesh->Nodes)
-            {
-                packed_mesh_node Packed;
+    // Build the shape BVH over the bounded shapes.
+    std::vector<shape_tree_item> Items(Scene->ShapePack.size() - UnboundedShapeCount);
 
-                Packed.Minimum = Node.Bounds.Minimum;
-                Packed.Maximum = Node.Bounds.Maximum;
+    ParallelFor(Items.size(), [&](size_t I)
+    {
+        uint32_t ShapeIndex = UnboundedShapeCount + static_cast<uint32_t>(I);
+        bounds Bounds = ShapeBounds(Scene, Scene->ShapePack[ShapeIndex]);
+        Items[I] = { Bounds, 0.5f * (Bounds.Minimum + Bounds.Maximum), ShapeIndex };
+    });
 
-                if (Node.ChildNodeIndex > 0)
-                {
-                    Packed.FaceBeginOrNodeIndex = NodeIndexBase + Node.ChildNodeIndex;
-                    Packed.FaceEndIndex = 0;
-                }
-                else
-                {
-                    Packed.FaceBeginOrNodeIndex = FaceIndexBase + Node.FaceBeginIndex;
-                    Packed.FaceEndIndex = FaceIndexBase + Node.FaceEndIndex;
-                }
+    if (!Items.empty())
+        BuildShapeTree(Scene->ShapeNodePack, Items);
 
-                Scene->MeshNodePack.push_back(Packed);
-            }
+    Scene->Globals.UnboundedShapeCount = UnboundedShapeCount;
 
-            Mesh->PackedRootNodeIndex = NodeIndexBase;
-        }
+    //PrintShapeNode(scene, 0, 0);
+}
 
-        DirtyFlags |= SCENE_DIRTY_SHAPES;
-    }
+static void PackCameras(scene* Scene)
+{
+    Scene->CameraPack.clear();
 
-    // Pack object data.
-    if (DirtyFlags & SCENE_DIRTY_SHAPES)
+    ForEachActiveEntity(Scene->EntityTable, [Scene](entity* Entity, mat4 const& Transform)
     {
-        Scene->ShapePack.clear();
-        Scene->ShapeNodePack.resize(1);
-
-        ForEachEntityWithTransform(&Scene->Root, [Scene](entity* Entity, mat4 const& Transform)
-        {
-            packed_shape Packed;
-
-            Packed.MaterialIndex = 0;
-
-            switch (Entity->Type)
-            {
-                case ENTITY_TYPE_MESH_INSTANCE:
-                {
-                    auto Instance = static_cast<mesh_entity*>(Entity);
-                    if (!Instance->Mesh) return;
-                    Packed.MaterialIndex = GetPackedMaterialIndex(Instance->Material);
-                    Packed.MeshRootNodeIndex = Instance->Mesh->PackedRootNodeIndex;
-                    Packed.Type = SHAPE_TYPE_MESH_INSTANCE;
-                    break;
-                }
-                case ENTITY_TYPE_PLANE:
-                {
-                    auto Plane = static_cast<plane_entity*>(Entity);
-                    Packed.MaterialIndex = GetPackedMaterialIndex(Plane->Material);
-                    Packed.Type = SHAPE_TYPE_PLANE;
-                    break;
-                }
-                case ENTITY_TYPE_SPHERE:
-                {
-                    auto Sphere = static_cast<sphere_entity*>(Entity);
-                    Packed.MaterialIndex = GetPackedMaterialIndex(Sphere->Material);
-                    Packed.Type = SHAPE_TYPE_SPHERE;
-                    break;
-                }
-                case ENTITY_TYPE_CUBE:
-                {
-                    auto Cube = static_cast<cube_entity*>(Entity);
-                    Packed.MaterialIndex = GetPackedMaterialIndex(Cube->Material);
-                    Packed.Type = SHAPE_TYPE_CUBE;
-                    break;
-                }
-                default:
-                {
-                    return;
-                }
-            }
-
-            Packed.Transform = PackTransform(Transform);
+        if (Entity->Type != ENTITY_TYPE_CAMERA)
+            return;
 
-            Entity->PackedShapeIndex = static_cast<uint32_t>(Scene->ShapePack.size());
+        auto Camera = static_cast<camera_entity*>(Entity);
 
-            Scene->ShapePack.push_back(Packed);
-        });
+        packed_camera Packed;
 
-        std::vector<uint16_t> Map;
+        Packed.Model = Camera->CameraModel;
 
-        for (uint32_t ShapeIndex = 0; ShapeIndex < Scene->ShapePack.size(); ShapeIndex++)
+        if (Camera->CameraModel == CAMERA_MODEL_PINHOLE)
         {
-            packed_shape const& Object = Scene->ShapePack[ShapeIndex];
-            bounds Bounds = ShapeBounds(Scene, Object);
-
-            uint16_t NodeIndex = static_cast<uint16_t>(Scene->ShapeNodePack.size());
-            Map.push_back(NodeIndex);
-
-            packed_shape_node Node =
-            {
-                .Minimum = Bounds.Minimum,
-                .ChildNodeIndices = 0,
-                .Maximum = Bounds.Maximum,
-                .ShapeIndex = ShapeIndex,
-            };
-            Scene->ShapeNodePack.push_back(Node);
+            float const AspectRatio = 2.0f;
+            Packed.ApertureRadius = Camera->Pinhole.ApertureDiameterInMM / 2000.0f;
+            Packed.SensorSize.x   = 2 * glm::tan(glm::radians(Camera->Pinhole.FieldOfViewInDegrees / 2));
+            Packed.SensorSize.y   = Packed.SensorSize.x / AspectRatio;
+            Packed.SensorDistance = 1.0f;
         }
 
-        auto FindBestMatch = [](scene const* Scene, std::vector<uint16_t> const& Map, uint16_t IndexA) -> uint16_t
+        if (Camera->CameraModel == CAMERA_MODEL_THIN_LENS)
         {
-            glm::vec3 MinA = Scene->ShapeNodePack[Map[IndexA]].Minimum;
-            glm::vec3 MaxA = Scene->ShapeNodePack[Map[IndexA]].Maximum;
+            Packed.FocalLength    = Camera->ThinLens.FocalLengthInMM / 1000.0f;
+            Packed.ApertureRadius = Camera->ThinLens.ApertureDiameterInMM / 2000.0f;
+            Packed.SensorDistance = 1.0f / (1000.0f / Camera->ThinLens.FocalLengthInMM - 1.0f / Camera->ThinLens.FocusDistance);
+            Packed.SensorSize     = Camera->ThinLens.SensorSizeInMM / 1000.0f;
+        }
 
-            float BestArea = INFINITY;
-            uint16_t BestIndexB = 0xFFFF;
+        Packed.Transform = PackTransform(Transform);
 
-            for (uint16_t IndexB = 0; IndexB < Map.size(); IndexB++)
-            {
-                if (IndexA == IndexB) continue;
+        Camera->PackedCameraIndex = static_cast<uint>(Scene->CameraPack.size());
 
-                glm::vec3 MinB = Scene->ShapeNodePack[Map[IndexB]].Minimum;
-                glm::vec3 MaxB = Scene->ShapeNodePack[Map[IndexB]].Maximum;
-                glm::vec3 Size = glm::max(MaxA, MaxB) - glm::min(MinA, MinB);
-                float Area = Size.x * Size.y + Size.y * Size.z + Size.z * Size.z;
-                if (Area <= BestArea)
-                {
-                    BestArea = Area;
-                    BestIndexB = IndexB;
-                }
-            }
+        Scene->CameraPack.push_back(Packed);
+    });
+}
 
-            return BestIndexB;
-        };
+// Computes the statistics used for sampling the skybox.  Only reads the
+// skybox pixels, so it does not wait for the textures to be packed.
+static void PackSkyboxStatistics(scene* Scene)
+{
+    packed_scene_globals* G = &Scene->Globals;
 
-        if (!Scene->ShapePack.empty())
-        {
-            uint16_t IndexA = 0;
-            uint16_t IndexB = FindBestMatch(Scene, Map, IndexA);
+    texture* SkyboxTexture = Scene->Root.SkyboxTexture;
 
-            while (Map.size() > 1)
+    if (SkyboxTexture)
+    {
+        vec4 const* Pixels = SkyboxTexture->Pixels;
+        uint Width = SkyboxTexture->Width;
+        uint Height = SkyboxTexture->Height;
+
+        //for (int Y = 0; Y < Height; Y++)
+        //{
+        //    for (int X = 0; X < Width; X++)
+        //    {
+        //        int Index = Y * Width + X;
+
+        //        glm::vec3 Color = Scene->SkyboxPixels[Index].rgb();
+        //        float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
+        //        glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Color / Intensity);
+        //        Scene->SkyboxPixels[Index] = glm::vec4(Beta, Intensity);
+        //    }
+        //}
+
+        vec3 Mean = {};
+        float WeightSum = 0.0f;
+        for (uint Y = 0; Y < Height; Y++)
+        {
+            float Theta = (0.5f - (Y + 0.5f) / Height) * PI;
+            for (uint X = 0; X < Width; X++)
             {
-                uint16_t IndexC = FindBestMatch(Scene, Map, IndexB);
-                if (IndexA == IndexC)
-                {
-                    uint16_t NodeIndexA = Map[IndexA];
-                    packed_shape_node const& NodeA = Scene->ShapeNodePack[NodeIndexA];
-                    uint16_t NodeIndexB = Map[IndexB];
-                    packed_shape_node const& NodeB = Scene->ShapeNodePack[NodeIndexB];
-
-                    packed_shape_node Node =
-                    {
-                        .Minimum = glm::min(NodeA.Minimum, NodeB.Minimum),
-                        .ChildNodeIndices = uint32_t(NodeIndexA) | uint32_t(NodeIndexB) << 16,
-                        .Maximum = glm::max(NodeA.Maximum, NodeB.Maximum),
-                        .ShapeIndex = SHAPE_INDEX_NONE,
-                    };
-
-                    Map[IndexA] = static_cast<uint16_t>(Scene->ShapeNodePack.size());
-                    Map[IndexB] = Map.back();
-                    Map.pop_back();
+                float Phi = ((X + 0.5f) / Width - 0.5f) * TAU;
 
-                    if (IndexA == Map.size())
-                        IndexA = IndexB;
+                vec4 Color = Pixels[Y * Width + X];
+                float Luminance = glm::dot(vec3(0.2126f, 0.7152f, 0.0722f), Color.rgb());
+                float Area = glm::cos(Theta);
 
-                    Scene->ShapeNodePack.push_back(Node);
+                float Weight = Area * Luminance * Luminance;
 
-                    IndexB = FindBestMatch(Scene, Map, IndexA);
-                }
-                else
+                vec3 Direction =
                 {
-                    IndexA = IndexB;
-                    IndexB = IndexC;
-                }
-            }
+                    glm::cos(Theta) * glm::cos(Phi),
+                    glm::cos(Theta) * glm::sin(Phi),
+                    glm::sin(Theta),
+                };
 
-            Scene->ShapeNodePack[0] = Scene->ShapeNodePack[Map[IndexA]];
-            Scene->ShapeNodePack[Map[IndexA]] = Scene->ShapeNodePack.back();
-            Scene->ShapeNodePack.pop_back();
+                Mean += Weight * Direction;
+                WeightSum += Weight;
+            }
         }
+        Mean /= WeightSum;
 
-        // To update the ShapeCount.
-        DirtyFlags |= SCENE_DIRTY_GLOBALS;
+        float MeanLength = glm::length(Mean);
 
-        //PrintShapeNode(scene, 0, 0);
+        G->SkyboxMeanDirection = Mean / MeanLength;
+        G->SkyboxConcentration = MeanLength * (3.0f - MeanLength * MeanLength) / (1 - MeanLength * MeanLength);
     }
+}
 
-    // Pack cameras.
-    if (DirtyFlags & SCENE_DIRTY_CAMERAS)
-    {
-        Scene->CameraPack.clear();
+static void PackGlobals(scene* Scene)
+{
+    packed_scene_globals* G = &Scene->Globals;
 
-        ForEachEntityWithTransform(&Scene->Root, [Scene](entity* Entity, mat4 const& Transform)
-        {
-            if (Entity->Type != ENTITY_TYPE_CAMERA)
-                return;
+    G->SkyboxTextureIndex = GetPackedTextureIndex(Scene->Root.SkyboxTexture);
 
-            auto Camera = static_cast<camera_entity*>(Entity);
+    G->SkyboxSamplingProbability = Scene->Root.SkyboxSamplingProbability;
 
-            packed_camera Packed;
+    G->SkyboxBrightness = Scene->Root.SkyboxBrightness;
+    G->SceneScatterRate = Scene->Root.ScatterRate;
+    G->ShapeCount = static_cast<uint>(Scene->ShapePack.size());
+}
 
-            Packed.Model = Camera->CameraModel;
+// Packs the portions of the scene data whose dirty flags are set.  The
+// stages form a task graph: textures and meshes are independent of each
+// other, materials refer to the packed textures, and shapes refer to the
+// packed materials and meshes.  Cameras and skybox statistics depend on
+// nothing else, and the globals are packed last.
+static uint32_t PackDirtySceneData(scene* Scene)
+{
+    uint32_t DirtyFlags = Scene->DirtyFlags;
 
-            if (Camera->CameraModel == CAMERA_MODEL_PINHOLE)
-            {
-                float const AspectRatio = 2.0f;
-                Packed.ApertureRadius = Camera->Pinhole.ApertureDiameterInMM / 2000.0f;
-                Packed.SensorSize.x   = 2 * glm::tan(glm::radians(Camera->Pinhole.FieldOfViewInDegrees / 2));
-                Packed.SensorSize.y   = Packed.SensorSize.x / AspectRatio;
-                Packed.SensorDistance = 1.0f;
-            }
+    // Packed data restored from a scene cache is already up to date, but
+    // has not been uploaded yet, so report all of it as changed.
+    uint32_t UploadFlags = 0;
+    if (Scene->PackedDataIsCached)
+    {
+        Scene->PackedDataIsCached = false;
+        UploadFlags = SCENE_DIRTY_ALL;
+    }
 
-            if (Camera->CameraModel == CAMERA_MODEL_THIN_LENS)
-            {
-                Packed.FocalLength    = Camera->ThinLens.FocalLengthInMM / 1000.0f;
-                Packed.ApertureRadius = Camera->ThinLens.ApertureDiameterInMM / 2000.0f;
-                Packed.SensorDistance = 1.0f / (1000.0f / Camera->ThinLens.FocalLengthInMM - 1.0f / Camera->ThinLens.FocusDistance);
-                Packed.SensorSize     = Camera->ThinLens.SensorSizeInMM / 1000.0f;
-            }
+    // Changes propagate to the packed data that depends on them.  Shapes
+    // only depend on the packed material indices, so whether a material
+    // repack propagates to them is decided by the material stage.
+    if (DirtyFlags & SCENE_DIRTY_TEXTURES)
+        DirtyFlags |= SCENE_DIRTY_MATERIALS;
+    if (DirtyFlags & SCENE_DIRTY_MESHES)
+        DirtyFlags |= SCENE_DIRTY_SHAPES;
+    if (DirtyFlags & SCENE_DIRTY_ENTITIES)
+        DirtyFlags |= SCENE_DIRTY_SHAPES | SCENE_DIRTY_CAMERAS;
 
-            Packed.Transform = PackTransform(Transform);
+    // Bring the world transforms of the entities up to date for the shape
+    // and camera stages.
+    if (DirtyFlags & (SCENE_DIRTY_SHAPES | SCENE_DIRTY_MATERIALS | SCENE_DIRTY_CAMERAS))
+        UpdateEntityTable(Scene, DirtyFlags & SCENE_DIRTY_ENTITIES);
 
-            Camera->PackedCameraIndex = static_cast<uint>(Scene->CameraPack.size());
+    uint32_t AssetFlags = DirtyFlags & (SCENE_DIRTY_TEXTURES | SCENE_DIRTY_MESHES);
 
-            Scene->CameraPack.push_back(Packed);
-        });
-    }
+    auto StartTime = std::chrono::steady_clock::now();
 
-    //
-    if (DirtyFlags & SCENE_DIRTY_SKYBOX_TEXTURE)
-    {
-        packed_scene_globals* G = &Scene->Globals;
+    scene_asset_pack Pack;
+    SnapshotSceneAssets(Scene, AssetFlags, &Pack);
 
-        texture* SkyboxTexture = Scene->Root.SkyboxTexture;
+    task_graph Graph;
+    uint32_t TextureTask = TASK_NONE;
+    uint32_t MeshTask = TASK_NONE;
+    uint32_t MaterialTask = TASK_NONE;
 
-        G->SkyboxTextureIndex = GetPackedTextureIndex(SkyboxTexture);
+    if (DirtyFlags & SCENE_DIRTY_TEXTURES)
+        TextureTask = AddTask(&Graph, "textures", [Scene, &Pack] { PackTextures(&Pack); ApplyTexturePack(Scene, &Pack); });
+    if (DirtyFlags & SCENE_DIRTY_MESHES)
+        MeshTask = AddTask(&Graph, "meshes", [Scene, &Pack] { PackMeshes(&Pack); ApplyMeshPack(Scene, &Pack); });
+    bool MaterialIndicesChanged = false;
+    if (DirtyFlags & (SCENE_DIRTY_MATERIALS | SCENE_DIRTY_MATERIAL_SLOTS))
+        MaterialTask = AddTask(&Graph, "materials", [Scene, DirtyFlags, &MaterialIndicesChanged] { MaterialIndicesChanged = PackMaterials(Scene, DirtyFlags); }, { TextureTask });
 
-        if (SkyboxTexture)
+    bool ShapesArePacked = false;
+    if (DirtyFlags & (SCENE_DIRTY_SHAPES | SCENE_DIRTY_MATERIALS))
+    {
+        AddTask(&Graph, "shapes", [Scene, DirtyFlags, &MaterialIndicesChanged, &ShapesArePacked]
         {
-            vec4 const* Pixels = SkyboxTexture->Pixels;
-            uint Width = SkyboxTexture->Width;
-            uint Height = SkyboxTexture->Height;
-
-            //for (int Y = 0; Y < Height; Y++)
-            //{
-            //    for (int X = 0; X < Width; X++)
-            //    {
-            //        int Index = Y * Width + X;
-
-            //        glm::vec3 Color = Scene->SkyboxPixels[Index].rgb();
-            //        float Intensity = 2 * glm::max(glm::max(Color.r, Color.g), Color.b);
-            //        glm::vec3 Beta = GetParametricSpectrumCoefficients(Scene->RGBSpectrumTable, Color / Intensity);
-            //        Scene->SkyboxPixels[Index] = glm::vec4(Beta, Intensity);
-            //    }
-            //}
+            if (!(DirtyFlags & SCENE_DIRTY_SHAPES) && !MaterialIndicesChanged) return;
+            PackShapes(Scene);
+            ShapesArePacked = true;
+        }, { MaterialTask, MeshTask });
+    }
+    if (DirtyFlags & SCENE_DIRTY_CAMERAS)
+        AddTask(&Graph, "cameras", [Scene] { PackCameras(Scene); });
+    if (DirtyFlags & SCENE_DIRTY_SKYBOX_TEXTURE)
+        AddTask(&Graph, "skybox", [Scene] { PackSkyboxStatistics(Scene); });
 
-            vec3 Mean = {};
-            float WeightSum = 0.0f;
-            for (uint Y = 0; Y < Height; Y++)
-            {
-                float Theta = (0.5f - (Y + 0.5f) / Height) * PI;
-                for (uint X = 0; X < Width; X++)
-                {
-                    float Phi = ((X + 0.5f) / Width - 0.5f) * TAU;
+    RunTaskGraph(&Graph);
 
-                    vec4 Color = Pixels[Y * Width + X];
-                    float Luminance = glm::dot(vec3(0.2126f, 0.7152f, 0.0722f), Color.rgb());
-                    float Area = glm::cos(Theta);
+    if (ShapesArePacked)
+        DirtyFlags |= SCENE_DIRTY_SHAPES;
+    if (DirtyFlags & (SCENE_DIRTY_SHAPES | SCENE_DIRTY_SKYBOX_TEXTURE))
+        DirtyFlags |= SCENE_DIRTY_GLOBALS;
 
-                    float Weight = Area * Luminance * Luminance;
+    if (DirtyFlags & SCENE_DIRTY_GLOBALS)
+        PackGlobals(Scene);
 
-                    vec3 Direction =
-                    {
-                        glm::cos(Theta) * glm::cos(Phi),
-                        glm::cos(Theta) * glm::sin(Phi),
-                        glm::sin(Theta),
-                    };
+    // Only full repacks are logged, as cameras and shapes are repacked on
+    // every frame while they are being edited.
+    if (AssetFlags)
+    {
+        double TotalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+        PrintScenePackTimes("Packed scene", Graph, TotalTime, &Pack);
+    }
 
-                    Mean += Weight * Direction;
-                    WeightSum += Weight;
-                }
-            }
-            Mean /= WeightSum;
+    Scene->DirtyFlags = 0;
 
-            float MeanLength = glm::length(Mean);
+    return DirtyFlags | UploadFlags;
+}
 
-            G->SkyboxMeanDirection = Mean / MeanLength;
-            G->SkyboxConcentration = MeanLength * (3.0f - MeanLength * MeanLength) / (1 - MeanLength * MeanLength);
-        }
+uint32_t PackSceneData(scene* Scene)
+{
+    uint32_t UploadFlags = FinishScenePackJob(Scene);
+    return UploadFlags | PackDirtySceneData(Scene);
+}
 
-        DirtyFlags |= SCENE_DIRTY_GLOBALS;
-    }
+uint32_t PackSceneDataAsync(scene* Scene)
+{
+    uint32_t UploadFlags = 0;
 
-    // Pack scene global data.
-    if (DirtyFlags & SCENE_DIRTY_GLOBALS)
+    scene_pack_job* Job = Scene->PackJob;
+    if (Job && Job->IsDone.load(std::memory_order_acquire))
     {
-        packed_scene_globals* G = &Scene->Globals;
+        UploadFlags |= FinishScenePackJob(Scene);
+        Job = nullptr;
+    }
 
-        G->SkyboxSamplingProbability = Scene->Root.SkyboxSamplingProbability;
+    // Hand changed textures and meshes over to a background pack.  If one
+    // is already in progress, they wait until it is done.
+    uint32_t AssetFlags = Scene->DirtyFlags & (SCENE_DIRTY_TEXTURES | SCENE_DIRTY_MESHES);
+    Scene->DirtyFlags &= ~AssetFlags;
 
-        G->SkyboxBrightness = Scene->Root.SkyboxBrightness;
-        G->SceneScatterRate = Scene->Root.ScatterRate;
-        G->ShapeCount = static_cast<uint>(Scene->ShapePack.size());
+    if (AssetFlags && !Job)
+    {
+        Job = new scene_pack_job;
+        SnapshotSceneAssets(Scene, AssetFlags, &Job->Pack);
+        Job->Thread = std::thread([Job]
+        {
+            PackSceneAssets(&Job->Pack);
+            Job->IsDone.store(true, std::memory_order_release);
+        });
+        Scene->PackJob = Job;
+        AssetFlags = 0;
     }
 
-    Scene->DirtyFlags = 0;
+    // Pack the rest of the changes now, against the current textures and
+    // meshes.
+    UploadFlags |= PackDirtySceneData(Scene);
 
-    return DirtyFlags;
+    Scene->DirtyFlags |= AssetFlags;
+
+    return UploadFlags;
 }
 
-static entity* FindEntityByPackedShapeIndexRecursive(entity* Entity, uint32_t PackedShapeIndex)
+bool IsScenePackPending(scene const* Scene)
 {
-    if (Entity->Active)
-    {
-        if (Entity->PackedShapeIndex == PackedShapeIndex)
-            return Entity;
-        for (entity* Child : Entity->Children)
-            if (entity* Found = FindEntityByPackedShapeIndexRecursive(Child, PackedShapeIndex); Found)
-                return Found;
-    }
-    return nullptr;
-};
+    return Scene->PackJob || Scene->DirtyFlags != 0;
+}
 
 entity* FindEntityByPackedShapeIndex(scene* Scene, uint32_t PackedShapeIndex)
 {
-    return FindEntityByPackedShapeIndexRecursive(&Scene->Root, PackedShapeIndex);
+    if (PackedShapeIndex >= Scene->ShapeEntities.size())
+        return nullptr;
+    return Scene->ShapeEntities[PackedShapeIndex];
 }
 
 /* --- Vulkan --------------------------------------------------------------- */
@@ -1658,6 +5222,7 @@ vulkan_scene* CreateVulkanScene(vulkan* Vulkan)
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // MeshVertexSSBO
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // MeshNodeSSBO
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // CameraSSBO
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,          // MeshSSBO
     };
 
     CreateVulkanDescriptorSetLayout(Vulkan, &VulkanScene->DescriptorSetLayout, SceneDescriptorTypes);
@@ -1713,6 +5278,7 @@ void UpdateVulkanScene
     vulkan_buffer MeshFaceBufferOld = {};
     vulkan_buffer MeshVertexBufferOld = {};
     vulkan_buffer MeshNodeBufferOld = {};
+    vulkan_buffer MeshBufferOld = {};
     vulkan_buffer CameraBufferOld = {};
 
     if (DirtyFlags & SCENE_DIRTY_GLOBALS)
@@ -1787,20 +5353,54 @@ void UpdateVulkanScene
 
     if (DirtyFlags & SCENE_DIRTY_MATERIALS)
     {
-        MaterialBufferOld = VulkanScene->MaterialBuffer;
-        VulkanScene->MaterialBuffer = vulkan_buffer {};
-
         size_t MaterialBufferSize = sizeof(uint) * Scene->MaterialAttributePack.size();
-        Result = CreateVulkanBuffer
-        (
-            Vulkan,
-            &VulkanScene->MaterialBuffer,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            std::max(1024ull, MaterialBufferSize)
-        );
+        size_t MaterialBufferCreateSize = std::max(1024ull, MaterialBufferSize);
+        if (MaterialBufferCreateSize > VulkanScene->MaterialBuffer.Size)
+        {
+            MaterialBufferOld = VulkanScene->MaterialBuffer;
+            VulkanScene->MaterialBuffer = vulkan_buffer {};
+
+            Result = CreateVulkanBuffer
+            (
+                Vulkan,
+                &VulkanScene->MaterialBuffer,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                MaterialBufferCreateSize
+            );
+        }
         WriteToVulkanBuffer(Vulkan, &VulkanScene->MaterialBuffer, Scene->MaterialAttributePack.data(), MaterialBufferSize);
     }
+    else if (DirtyFlags & SCENE_DIRTY_MATERIAL_SLOTS)
+    {
+        // Upload the slots of the materials that were repacked in place,
+        // merging adjacent slots into a single write.
+        std::vector<uint32_t>& Slots = Scene->DirtyMaterialSlots;
+        std::sort(Slots.begin(), Slots.end());
+        Slots.erase(std::unique(Slots.begin(), Slots.end()), Slots.end());
+
+        size_t I = 0;
+        while (I < Slots.size())
+        {
+            size_t BeginOffset = 32 * Slots[I];
+            size_t EndOffset = BeginOffset;
+            while (I < Slots.size() && 32 * Slots[I] == EndOffset)
+            {
+                EndOffset += MaterialTypePackedSize(static_cast<material_type>(Scene->MaterialAttributePack[EndOffset]));
+                I++;
+            }
+
+            WriteToVulkanBuffer
+            (
+                Vulkan, &VulkanScene->MaterialBuffer,
+                Scene->MaterialAttributePack.data() + BeginOffset,
+                sizeof(uint) * (EndOffset - BeginOffset),
+                sizeof(uint) * BeginOffset
+            );
+        }
+    }
+
+    Scene->DirtyMaterialSlots.clear();
 
     if (DirtyFlags & SCENE_DIRTY_SHAPES)
     {
@@ -1857,8 +5457,20 @@ void UpdateVulkanScene
         VulkanScene->MeshFaceBuffer = vulkan_buffer {};
         MeshNodeBufferOld = VulkanScene->MeshNodeBuffer;
         VulkanScene->MeshNodeBuffer = vulkan_buffer {};
-
-        size_t MeshVertexBufferSize = sizeof(packed_mesh_vertex) * Scene->MeshVertexPack.size();
+        MeshBufferOld = VulkanScene->MeshBuffer;
+        VulkanScene->MeshBuffer = vulkan_buffer {};
+
+        // The face and vertex buffers hold the faces and vertices in the
+        // encoding given by packed_scene_globals::MeshFaceEncoding.
+        bool IsCompact = Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_COMPACT;
+        bool IsTransformed = Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_TRANSFORMED;
+
+        void const* MeshVertexData = IsCompact
+            ? static_cast<void const*>(Scene->MeshCompactVertexPack.data())
+            : static_cast<void const*>(Scene->MeshVertexPack.data());
+        size_t MeshVertexBufferSize = IsCompact
+            ? sizeof(packed_mesh_compact_vertex) * Scene->MeshCompactVertexPack.size()
+            : sizeof(packed_mesh_vertex) * Scene->MeshVertexPack.size();
         Result = CreateVulkanBuffer
         (
             Vulkan,
@@ -1867,9 +5479,18 @@ void UpdateVulkanScene
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             std::max(1024ull, MeshVertexBufferSize)
         );
-        WriteToVulkanBuffer(Vulkan, &VulkanScene->MeshVertexBuffer, Scene->MeshVertexPack.data(), MeshVertexBufferSize);
-
-        size_t MeshFaceBufferSize = sizeof(packed_mesh_face) * Scene->MeshFacePack.size();
+        WriteToVulkanBuffer(Vulkan, &VulkanScene->MeshVertexBuffer, MeshVertexData, MeshVertexBufferSize);
+
+        void const* MeshFaceData = IsCompact
+            ? static_cast<void const*>(Scene->MeshCompactFacePack.data())
+            : IsTransformed
+            ? static_cast<void const*>(Scene->MeshTransformedFacePack.data())
+            : static_cast<void const*>(Scene->MeshFacePack.data());
+        size_t MeshFaceBufferSize = IsCompact
+            ? sizeof(packed_mesh_compact_face) * Scene->MeshCompactFacePack.size()
+            : IsTransformed
+            ? sizeof(packed_mesh_transformed_face) * Scene->MeshTransformedFacePack.size()
+            : sizeof(packed_mesh_face) * Scene->MeshFacePack.size();
         Result = CreateVulkanBuffer
         (
             Vulkan,
@@ -1878,7 +5499,18 @@ void UpdateVulkanScene
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             std::max(1024ull, MeshFaceBufferSize)
         );
-        WriteToVulkanBuffer(Vulkan, &VulkanScene->MeshFaceBuffer, Scene->MeshFacePack.data(), MeshFaceBufferSize);
+        WriteToVulkanBuffer(Vulkan, &VulkanScene->MeshFaceBuffer, MeshFaceData, MeshFaceBufferSize);
+
+        size_t MeshBufferSize = sizeof(packed_mesh) * Scene->MeshPack.size();
+        Result = CreateVulkanBuffer
+        (
+            Vulkan,
+            &VulkanScene->MeshBuffer,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            std::max(1024ull, MeshBufferSize)
+        );
+        WriteToVulkanBuffer(Vulkan, &VulkanScene->MeshBuffer, Scene->MeshPack.data(), MeshBufferSize);
 
         size_t MeshNodeBufferSize = sizeof(packed_mesh_node) * Scene->MeshNodePack.size();
         Result = CreateVulkanBuffer
@@ -1959,6 +5591,10 @@ void UpdateVulkanScene
             .Type        = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             .Buffer      = &VulkanScene->CameraBuffer,
         },
+        {
+            .Type        = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .Buffer      = &VulkanScene->MeshBuffer,
+        },
     };
 
     UpdateVulkanDescriptorSet(Vulkan, VulkanScene->DescriptorSet, Descriptors);
@@ -1967,6 +5603,7 @@ void UpdateVulkanScene
     DestroyVulkanBuffer(Vulkan, &MeshVertexBufferOld);
     DestroyVulkanBuffer(Vulkan, &MeshFaceBufferOld);
     DestroyVulkanBuffer(Vulkan, &MeshNodeBufferOld);
+    DestroyVulkanBuffer(Vulkan, &MeshBufferOld);
     DestroyVulkanBuffer(Vulkan, &ShapeBufferOld);
     DestroyVulkanBuffer(Vulkan, &ShapeNodeBufferOld);
     DestroyVulkanBuffer(Vulkan, &MaterialBufferOld);
@@ -1994,6 +5631,7 @@ void DestroyVulkanScene
     DestroyVulkanBuffer(Vulkan, &VulkanScene->MeshNodeBuffer);
     DestroyVulkanBuffer(Vulkan, &VulkanScene->MeshVertexBuffer);
     DestroyVulkanBuffer(Vulkan, &VulkanScene->MeshFaceBuffer);
+    DestroyVulkanBuffer(Vulkan, &VulkanScene->MeshBuffer);
     DestroyVulkanBuffer(Vulkan, &VulkanScene->CameraBuffer);
     DestroyVulkanImage(Vulkan, &VulkanScene->ImageArray);
     DestroyVulkanBuffer(Vulkan, &VulkanScene->UniformBuffer);
@@ -1,11 +1,23 @@
 #pragma once
 
 #include "core/common.hpp"
+#include "core/mapped_file.hpp"
 #include "core/spectrum.hpp"
 #include "core/vulkan.hpp"
 
-uint const SHAPE_INDEX_NONE   = 0xFFFFFFFF;
-uint const TEXTURE_INDEX_NONE = 0xFFFFFFFF;
+uint const SHAPE_INDEX_NONE     = 0xFFFFFFFF;
+uint const TEXTURE_INDEX_NONE   = 0xFFFFFFFF;
+uint const MESH_NODE_INDEX_NONE = 0xFFFFFFFF;
+uint const ENTITY_INDEX_NONE    = 0xFFFFFFFF;
+
+// Maximum number of children of a packed mesh BVH node.
+uint const MESH_NODE_WIDTH = 4;
+
+// Default limit on the depth of mesh BVHs.
+uint const MESH_TREE_DEPTH_LIMIT = 64;
+
+// Flag marking the leaves of the shape BVH, see packed_shape_node.
+uint const SHAPE_NODE_LEAF = 0x80000000;
 
 enum texture_type
 {
@@ -37,6 +49,14 @@ enum shape_type : int32_t
     SHAPE_TYPE_CUBE          = 3,
 };
 
+enum mesh_face_encoding : uint
+{
+    MESH_FACE_ENCODING_FULL        = 0, // Faces hold the full precision positions of their vertices.
+    MESH_FACE_ENCODING_COMPACT     = 1, // Faces hold vertex indices, and vertices hold quantized positions.
+    MESH_FACE_ENCODING_TRANSFORMED = 2, // Faces hold a precomputed transformation to barycentric coordinates.
+    MESH_FACE_ENCODING__COUNT      = 3,
+};
+
 enum camera_model : int32_t
 {
     CAMERA_MODEL_PINHOLE   = 0,
@@ -60,6 +80,21 @@ inline char const* TextureTypeName(texture_type Type)
     return nullptr;
 }
 
+inline char const* MeshFaceEncodingName(mesh_face_encoding Encoding)
+{
+    switch (Encoding)
+    {
+        case MESH_FACE_ENCODING_FULL:
+            return "Full";
+        case MESH_FACE_ENCODING_COMPACT:
+            return "Compact";
+        case MESH_FACE_ENCODING_TRANSFORMED:
+            return "Transformed";
+    }
+    assert(false);
+    return nullptr;
+}
+
 inline char const* CameraModelName(camera_model Model)
 {
     switch (Model)
@@ -104,6 +139,7 @@ struct alignas(16) packed_shape
     shape_type Type;
     uint MaterialIndex;
     uint MeshRootNodeIndex;
+    uint MeshIndex;
     packed_transform Transform;
 };
 
@@ -112,9 +148,9 @@ struct alignas(16) packed_shape
 struct alignas(16) packed_shape_node
 {
     vec3 Minimum;
-    uint ChildNodeIndices;
+    uint ChildOrShapeIndex; // First of the two adjacent children, or SHAPE_NODE_LEAF | shape index for a leaf.
     vec3 Maximum;
-    uint ShapeIndex;
+    uint ParentIndex;
 };
 
 // This structure is shared between CPU and GPU,
@@ -139,12 +175,80 @@ struct alignas(4) packed_mesh_vertex
 
 // This structure is shared between CPU and GPU,
 // and must follow std430 layout rules.
+//
+// Face of a mesh with MESH_FACE_ENCODING_TRANSFORMED.  The face is
+// intersected in the coordinate system where it is the unit triangle
+// (Baldwin and Weber, "Fast Ray-Triangle Intersections by Coordinate
+// Transformation").  With the projection axis K, and the other axes I and
+// J in cyclic order, the barycentric coordinates of a point P on the plane
+// of the face are dot(Transform0, (P[I], P[J], 1)) and dot(Transform1,
+// (P[I], P[J], 1)), and the plane is where P[K] + dot(Transform2, (P[I],
+// P[J], 1)) is zero.
+struct alignas(16) packed_mesh_transformed_face
+{
+    vec3 Transform0;
+    uint VertexIndex0;
+    vec3 Transform1;
+    uint VertexIndex1;
+    vec3 Transform2;
+    uint VertexIndex2AndAxis; // Projection axis in the top 2 bits.
+};
+
+// This structure is shared between CPU and GPU,
+// and must follow std430 layout rules.
+//
+// Face of a mesh with MESH_FACE_ENCODING_COMPACT.  The positions are
+// fetched from the vertices when the face is intersected.
+struct alignas(4) packed_mesh_compact_face
+{
+    uint VertexIndex0;
+    uint VertexIndex1;
+    uint VertexIndex2;
+};
+
+// This structure is shared between CPU and GPU,
+// and must follow std430 layout rules.
+//
+// Vertex of a mesh with MESH_FACE_ENCODING_COMPACT.  The position is
+// quantized to 16 bits per axis within the bounds of the mesh, see
+// packed_mesh.
+struct alignas(4) packed_mesh_compact_vertex
+{
+    uint PackedNormal;
+    uint PackedUV;
+    uint PackedPositionXY;
+    uint PackedPositionZ;
+};
+
+// This structure is shared between CPU and GPU,
+// and must follow std430 layout rules.
+//
+// Per-mesh data.  A quantized vertex position Q decodes to
+// PositionOrigin + Q * PositionScale.
+struct alignas(16) packed_mesh
+{
+    vec3 PositionOrigin;
+    uint Unused0;
+    vec3 PositionScale;
+    uint Unused1;
+};
+
+// This structure is shared between CPU and GPU,
+// and must follow std430 layout rules.
+//
+// Node of the wide mesh BVH.  The bounds of each child are quantized to
+// 8 bits per axis on a grid starting at Origin, with a power-of-two cell
+// size per axis.  A child with a nonzero face count is a leaf, and its
+// child index is the index of its first face.
 struct alignas(16) packed_mesh_node
 {
-    vec3 Minimum;
-    uint FaceBeginOrNodeIndex;
-    vec3 Maximum;
-    uint FaceEndIndex;
+    vec3 Origin;
+    uint Exponents; // Biased cell size exponents (8 bits per axis), and child count (top 8 bits).
+    uint ChildIndices[MESH_NODE_WIDTH];
+    uint LeafFaceCounts; // 8 bits per child.
+    uint QuantizedMinimum[3]; // 8 bits per child, for each axis.
+    uint QuantizedMaximum[3];
+    uint ParentIndex; // MESH_NODE_INDEX_NONE for the root.
 };
 
 // This structure is shared between CPU and GPU,
@@ -158,6 +262,8 @@ struct alignas(16) packed_scene_globals
     uint         SkyboxTextureIndex = TEXTURE_INDEX_NONE;
     uint         ShapeCount = 0;
     float        SceneScatterRate = 0.0f;
+    uint         MeshFaceEncoding = MESH_FACE_ENCODING_FULL;
+    uint         UnboundedShapeCount = 0; // Unbounded shapes are packed first, outside of the shape BVH.
 };
 
 // This structure is shared between CPU and GPU,
@@ -174,24 +280,31 @@ struct alignas(16) packed_camera
 
 /* --- High-Level Scene Representation --------------------------------------- */
 
+struct material;
+struct entity;
+
 struct texture
 {
-    std::string      Name = "New Texture";
-    texture_type     Type = TEXTURE_TYPE_RAW;
-    bool             EnableNearestFiltering = false;
-    uint32_t         Width = 0;
-    uint32_t         Height = 0;
-    glm::vec4 const* Pixels = nullptr;
-    uint32_t         PackedTextureIndex = 0;
+    std::string            Name = "New Texture";
+    texture_type           Type = TEXTURE_TYPE_RAW;
+    bool                   EnableNearestFiltering = false;
+    uint32_t               Width = 0;
+    uint32_t               Height = 0;
+    glm::vec4 const*       Pixels = nullptr;
+    uint64_t               PayloadHash = 0; // Hash of the pixel data, 0 if not yet computed.
+    uint32_t               PackedTextureIndex = TEXTURE_INDEX_NONE; // Until the texture is packed.
+    std::vector<material*> Users; // Materials using the texture, as of the last material pack.
 };
 
 struct material
 {
-    material_type Type = {};
-    std::string   Name = "New Material";
-    uint32_t      Flags = 0;
-    float         Opacity = 1.0f;
-    uint32_t      PackedMaterialIndex = 0;
+    material_type        Type = {};
+    std::string          Name = "New Material";
+    uint32_t             Flags = 0;
+    float                Opacity = 1.0f;
+    uint32_t             PackedMaterialIndex = 0;
+    bool                 SlotIsDirty = false; // Set by MarkMaterialDirty().
+    std::vector<entity*> Users; // Entities using the material, as of the last shape pack.
 
     virtual ~material() {}
 };
@@ -216,6 +329,16 @@ struct mesh_node
     uint32_t ChildNodeIndex;
 };
 
+// Options the BVH of a mesh was built with, so that background rebuilds
+// produce the tree that was asked for, see UpdateMeshTreeUpgrades().
+struct mesh_tree_options
+{
+    uint32_t MaximumDepth       = MESH_TREE_DEPTH_LIMIT;
+    bool     UseSpatialSplits   = false;
+    float    SpatialSplitBudget = 0.3f;
+    bool     OptimizeLayout     = true;
+};
+
 struct mesh
 {
     std::string              Name;
@@ -223,7 +346,14 @@ struct mesh
     std::vector<mesh_face>   Faces;
     std::vector<mesh_node>   Nodes;
     uint32_t                 Depth;
-    uint32_t                 PackedRootNodeIndex;
+    uint64_t                 PayloadHash = 0; // Hash of the mesh data, 0 if not yet computed.
+    uint32_t                 PackedRootNodeIndex = MESH_NODE_INDEX_NONE; // Until the mesh is packed.
+    uint32_t                 PackedMeshIndex = 0;
+    float                    TreeCost = 0.0f; // SAH cost of the BVH, see GetMeshTreeCost().
+    mesh_tree_options        TreeOptions;
+    bool                     NeedsTreeUpgrade = false; // BVH was built with a fast builder, see UpdateMeshTreeUpgrades().
+    float                    TreeOptimizationTime = 0.0f; // Requested by OptimizeMeshTree(), until the result is swapped in.
+    std::vector<entity*>     Users; // Entities in the scene using the mesh, as of the last shape pack.
 };
 
 enum entity_type
@@ -235,8 +365,9 @@ enum entity_type
     ENTITY_TYPE_PLANE = 4,
     ENTITY_TYPE_SPHERE = 5,
     ENTITY_TYPE_CUBE = 6,
+    ENTITY_TYPE_PREFAB_INSTANCE = 7,
 
-    ENTITY_TYPE__COUNT = 7,
+    ENTITY_TYPE__COUNT = 8,
 };
 
 struct entity
@@ -249,6 +380,7 @@ struct entity
     std::vector<entity*> Children = {};
     material*            Material = nullptr;
     uint32_t             PackedShapeIndex = SHAPE_INDEX_NONE;
+    uint32_t             EntityIndex = ENTITY_INDEX_NONE; // In the entity table of the scene.
 
     virtual ~entity() {}
 };
@@ -260,6 +392,11 @@ struct root_entity : entity
     float    SkyboxSamplingProbability = 0.0f;
     texture* SkyboxTexture = nullptr;
 
+    // Encoding of the packed mesh faces.  Compact faces take less memory
+    // and bandwidth, at the cost of position precision.  Transformed faces
+    // are faster to intersect, but not watertight.
+    mesh_face_encoding MeshFaceEncoding = MESH_FACE_ENCODING_FULL;
+
     root_entity() { Type = ENTITY_TYPE_ROOT; }
 };
 
@@ -320,6 +457,28 @@ struct prefab
     entity* Entity = nullptr;
 };
 
+// Instance of a prefab that refers to the entities of the prefab instead
+// of copying them.  The shapes of the prefab are expanded into the shape
+// pack under the transform of the instance.
+// Range of packed shapes.
+struct packed_shape_range
+{
+    uint32_t Index = 0;
+    uint32_t Count = 0;
+};
+
+struct prefab_entity : entity
+{
+    prefab*   Prefab = nullptr;
+
+    // Packed shapes of the instance, as of the last shape pack.  Unbounded
+    // shapes are packed before all bounded ones, so each has its own range.
+    packed_shape_range PackedUnboundedShapes;
+    packed_shape_range PackedBoundedShapes;
+
+    prefab_entity() { Type = ENTITY_TYPE_PREFAB_INSTANCE; }
+};
+
 enum scene_dirty_flag
 {
     SCENE_DIRTY_GLOBALS        = 1 << 0,
@@ -329,9 +488,32 @@ enum scene_dirty_flag
     SCENE_DIRTY_MESHES         = 1 << 4,
     SCENE_DIRTY_CAMERAS        = 1 << 5,
     SCENE_DIRTY_SKYBOX_TEXTURE = 1 << 6,
+    SCENE_DIRTY_MATERIAL_SLOTS = 1 << 7, // Only the materials marked dirty.
+    SCENE_DIRTY_ENTITIES       = 1 << 8, // Entities were created or destroyed.
     SCENE_DIRTY_ALL            = 0xFFFFFFFF,
 };
 
+struct mesh_tree_upgrade;
+struct scene_pack_job;
+
+// Entity hierarchy of a scene flattened into arrays in depth-first order,
+// so that the descendants of an entity directly follow it.  The local and
+// world transforms of the entities are cached here, and only recomputed
+// for the subtrees of entities marked with MarkEntityDirty().  Maintained
+// by PackSceneData().
+struct scene_entity_table
+{
+    std::vector<entity*>  Entities;
+    std::vector<uint32_t> ParentIndices; // ENTITY_INDEX_NONE for the root.
+    std::vector<uint32_t> SubtreeEnds;   // One past the last descendant.
+    std::vector<uint8_t>  IsActive;      // The Active flag of the entity.
+    std::vector<uint8_t>  IsTreeActive;  // Active along with all ancestors.
+    std::vector<uint8_t>  IsDirty;
+    std::vector<uint32_t> DirtyIndices;
+    std::vector<mat4>     LocalTransforms;
+    std::vector<mat4>     WorldTransforms;
+};
+
 struct scene
 {
     // Source description of the scene entities and assets.
@@ -352,13 +534,51 @@ struct scene
     std::vector<packed_mesh_face>   MeshFacePack;
     std::vector<packed_mesh_vertex> MeshVertexPack;
     std::vector<packed_mesh_node>   MeshNodePack;
+    std::vector<packed_mesh>        MeshPack;
+
+    // Mesh faces and vertices with MESH_FACE_ENCODING_COMPACT, which are
+    // packed instead of MeshFacePack and MeshVertexPack.
+    std::vector<packed_mesh_compact_face>   MeshCompactFacePack;
+    std::vector<packed_mesh_compact_vertex> MeshCompactVertexPack;
+
+    // Mesh faces with MESH_FACE_ENCODING_TRANSFORMED, which are packed
+    // instead of MeshFacePack.
+    std::vector<packed_mesh_transformed_face> MeshTransformedFacePack;
+
     std::vector<packed_camera>      CameraPack;
     packed_scene_globals            Globals;
+    scene_entity_table              EntityTable;
+
+    // Entity of each packed shape, for picking.  Also built by the shape
+    // pack are the Users lists of the materials and meshes, and by the
+    // material pack those of the textures.  The user lists are valid until
+    // entities or materials change, see the flags below.
+    std::vector<entity*> ShapeEntities;
+    bool                 EntityUsersAreIndexed = false;
+    bool                 TextureUsersAreIndexed = false;
+
+    // Packed indices of the materials that were repacked in place since
+    // MaterialAttributePack was last uploaded, for uploading just their
+    // slots.  Cleared by UpdateVulkanScene().
+    std::vector<uint32_t> DirtyMaterialSlots;
 
     // Flags that track which portion of the source description has
     // changed relative to the packed data since the last call to
     // PackSceneData().
     uint32_t DirtyFlags;
+
+    // Set by LoadScene() when the packed data was restored from a scene
+    // cache file, in which case the next PackSceneData() only needs to
+    // report it for upload.  The atlas images in Images point directly
+    // into the mapped cache file, so the mapping must outlive them.
+    bool        PackedDataIsCached = false;
+    mapped_file PackCacheFile      = {};
+
+    // Background rebuild of a mesh BVH, see UpdateMeshTreeUpgrades().
+    mesh_tree_upgrade* MeshTreeUpgrade = nullptr;
+
+    // Background packing of textures and meshes, see PackSceneDataAsync().
+    scene_pack_job* PackJob = nullptr;
 };
 
 // Vulkan resources associated with a scene.
@@ -375,9 +595,16 @@ struct vulkan_scene
     vulkan_buffer         MeshFaceBuffer      = {};
     vulkan_buffer         MeshVertexBuffer    = {};
     vulkan_buffer         MeshNodeBuffer      = {};
+    vulkan_buffer         MeshBuffer          = {};
     vulkan_buffer         CameraBuffer        = {};
 };
 
+enum mesh_tree_builder
+{
+    MESH_TREE_BUILDER_SAH  = 0, // Binned SAH splits, optionally with spatial splits.
+    MESH_TREE_BUILDER_LBVH = 1, // Linear BVH from Morton codes.  Much faster to build, but slower to trace.
+};
+
 struct load_model_options
 {
     char const* Name = nullptr;
@@ -386,6 +613,35 @@ struct load_model_options
     mat4        VertexTransform = mat4(1);
     mat4        NormalTransform = mat4(1);
     mat3        TextureCoordinateTransform = mat3(1);
+    bool        UseCache = true; // Use the on-disk model cache.
+    bool        InstanceDuplicateMeshes = true; // Share meshes between shapes that are identical up to a rigid transform.
+    bool        UseSpatialSplits = false; // Build mesh BVHs with spatial splits (SBVH).
+    float       SpatialSplitBudget = 0.3f; // Maximum fraction of extra face references created by spatial splits.
+    float       TreeOptimizationTime = 0.0f; // Seconds spent optimizing the mesh BVHs of the model, or 0 to not optimize.
+    bool        OptimizeMeshLayout = true; // Order mesh nodes, faces and vertices for memory locality.
+    uint32_t    MaximumTreeDepth = MESH_TREE_DEPTH_LIMIT; // Limit on the depth of the mesh BVHs.
+    mesh_tree_builder TreeBuilder = MESH_TREE_BUILDER_SAH; // Spatial splits and optimization only apply to the SAH builder.
+    bool        OptimizeLinearTreeTop = true; // Rebuild the top levels of linear BVHs with SAH splits.
+};
+
+enum scene_compression_level
+{
+    SCENE_COMPRESSION_LEVEL_FAST    = 0,
+    SCENE_COMPRESSION_LEVEL_DEFAULT = 1,
+    SCENE_COMPRESSION_LEVEL_BEST    = 2,
+};
+
+struct save_scene_options
+{
+    // Fast compression is intended for interactive saves, where writing
+    // quickly matters more than the size of the asset files.  It is the
+    // same deflate codec at miniz level 1, not a separate fast codec.
+    scene_compression_level CompressionLevel = SCENE_COMPRESSION_LEVEL_DEFAULT;
+
+    // Write the files on a background thread.  The scene data that needs
+    // to be written is copied before SaveScene() returns, so the scene can
+    // be edited or destroyed while the save is in progress.
+    bool SaveInBackground = false;
 };
 
 inline uint32_t GetPackedTextureIndex(texture* Texture)
@@ -413,16 +669,45 @@ entity* CreateEntityRaw(entity_type Type);
 entity* CreateEntity(scene* Scene, entity_type Type, entity* Parent = nullptr);
 entity* CreateEntity(scene* Scene, entity* Source, entity* Parent = nullptr);
 entity* CreateEntity(scene* Scene, prefab* Prefab, entity* Parent = nullptr);
+prefab_entity* CreatePrefabInstance(scene* Scene, prefab* Prefab, entity* Parent = nullptr);
 void DestroyEntity(scene* Scene, entity* Entity);
 
+// Marks the transform, the Active flag or another property of an entity
+// as changed, so that the world transforms of its subtree are recomputed
+// and its shapes and cameras repacked on the next pack.
+void MarkEntityDirty(scene* Scene, entity* Entity);
+
 material* CreateMaterial(scene* Scene, material_type Type, char const* Name);
 void ReplaceMaterialReferences(scene* Scene, material* Old, material* New);
 void DestroyMaterial(scene* Scene, material* Material);
 
+// Marks the attributes of a material as changed, so that only its slot in
+// the packed material data is repacked and uploaded.
+void MarkMaterialDirty(scene* Scene, material* Material);
+
 texture* CreateCheckerTexture(scene* Scene, char const* Name, texture_type Type, glm::vec4 const& ColorA, glm::vec4 const& ColorB);
 texture* LoadTexture(scene* Scene, char const* Path, texture_type Type, char const* Name = nullptr);
 void DestroyTexture(scene* Scene, texture* Texture);
 
+// Computes the SAH cost of the BVH of a mesh, relative to the cost of
+// intersecting a single face.  Lower is better.  The cost of the current
+// tree is kept in mesh::TreeCost.
+float GetMeshTreeCost(mesh const* Mesh);
+
+// Rebuilds the BVHs of meshes that were imported with a fast builder using
+// the SAH builder, and runs the optimizations requested by
+// OptimizeMeshTree(), one mesh at a time on a background thread.  A rebuild
+// is only started while the user is not interacting, and the result of a
+// job is swapped in by a later call once it is done.  Call once per frame.
+void UpdateMeshTreeUpgrades(scene* Scene, bool IsInteracting);
+
+// Requests an improvement of the BVH of a mesh by node reinsertion, using
+// all cores for at most the given number of seconds.  The optimization runs
+// in the background, see UpdateMeshTreeUpgrades(), and the result is saved
+// with the mesh.  The tree is kept within the larger of
+// MESH_TREE_DEPTH_LIMIT and its current depth.
+void OptimizeMeshTree(scene* Scene, mesh* Mesh, float TimeLimit);
+
 void DestroyMesh(scene* Scene, mesh* Mesh);
 
 prefab* LoadModelAsPrefab(scene* Scene, char const* Path, load_model_options* Options = nullptr);
@@ -430,11 +715,23 @@ void DestroyPrefab(scene* Scene, prefab* Prefab);
 
 scene* CreateScene();
 scene* LoadScene(char const* Path);
-void SaveScene(char const* Path, scene* Scene);
+void SaveScene(char const* Path, scene* Scene, save_scene_options* Options = nullptr);
+void WaitForSceneSave();
 void DestroyScene(scene* Scene);
 
 uint32_t PackSceneData(scene* Scene);
 
+// Same as PackSceneData(), except that changed textures and meshes are
+// packed on a background thread from a snapshot, while the previous packs
+// stay in use.  The new packs are swapped in, and reported for upload, by
+// the first call after they are done.  Call once per frame.
+uint32_t PackSceneDataAsync(scene* Scene);
+
+// Returns true if some scene changes are not reflected in the packed data
+// yet, either because they have not been packed, or because a background
+// pack is still in progress.
+bool IsScenePackPending(scene const* Scene);
+
 entity* FindEntityByPackedShapeIndex(scene* Scene, uint32_t PackedShapeIndex);
 
 vulkan_scene* CreateVulkanScene(vulkan* Vulkan);
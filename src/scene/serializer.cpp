@@ -1,9 +1,14 @@
 #include "core/json.hpp"
 #include "core/miniz.h"
 #include "core/common.hpp"
+#include "core/mapped_file.hpp"
+#include "core/parallel.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <thread>
 
 using nlohmann::json;
 
@@ -13,22 +18,157 @@ struct material;
 struct prefab;
 struct scene;
 
-void WriteCompressed(std::ostream& Out, void const* Data, size_t Size)
+/* --- Compressed Data ----------------------------------------------------- */
+
+// Compressed data is stored as a sequence of independently compressed
+// chunks, so that compression and decompression can be spread over all
+// cores.  A compressed_header is followed by the stored size of each
+// chunk, and then the chunk data.  The payload is always read whole.
+// Chunks that would not shrink are stored uncompressed, in which case the
+// stored size equals the uncompressed chunk size.
+//
+// Before compression, the bytes of the 4-byte words within each chunk are
+// regrouped so that all first bytes come first, then all second bytes, and
+// so on.  For floating point data this places the slowly varying sign and
+// exponent bytes next to each other, which compresses considerably better.
+
+uint32_t const COMPRESSED_MAGIC         = MakeFourCC("CHNK");
+uint32_t const COMPRESSED_VERSION       = 0;
+uint32_t const COMPRESSED_CHUNK_SIZE    = 1 << 20;
+uint32_t const COMPRESSED_SHUFFLE_WIDTH = 4;
+
+struct compressed_header
 {
-    mz_ulong CompressedSize = static_cast<mz_ulong>(std::max(Size, 1024ull));
-    auto CompressedData = std::vector<unsigned char>(CompressedSize);
-    int Result = mz_compress
-    (
-        CompressedData.data(), &CompressedSize,
-        static_cast<unsigned char const*>(Data),
-        static_cast<mz_ulong>(Size)
-    );
-    assert(Result == MZ_OK);
-    Out.write((char const*)&CompressedSize, sizeof(mz_ulong));
-    Out.write((char const*)CompressedData.data(), CompressedSize);
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Size;
+    uint32_t ChunkSize;
+    uint32_t ChunkCount;
+    uint32_t ShuffleWidth;
+    uint32_t Unused;
+};
+
+static void ShuffleBytes(uint8_t* Out, uint8_t const* In, size_t Size, uint32_t Width)
+{
+    size_t Count = Width ? Size / Width : 0;
+    for (size_t I = 0; I < Count; I++)
+        for (uint32_t J = 0; J < Width; J++)
+            Out[J * Count + I] = In[I * Width + J];
+    memcpy(Out + Count * Width, In + Count * Width, Size - Count * Width);
+}
+
+static void UnshuffleBytes(uint8_t* Out, uint8_t const* In, size_t Size, uint32_t Width)
+{
+    size_t Count = Width ? Size / Width : 0;
+    for (size_t I = 0; I < Count; I++)
+        for (uint32_t J = 0; J < Width; J++)
+            Out[I * Width + J] = In[J * Count + I];
+    memcpy(Out + Count * Width, In + Count * Width, Size - Count * Width);
+}
+
+void WriteCompressed(std::ostream& Out, void const* Data, size_t Size, int Level)
+{
+    auto Bytes = static_cast<uint8_t const*>(Data);
+
+    compressed_header Header =
+    {
+        .Magic = COMPRESSED_MAGIC,
+        .Version = COMPRESSED_VERSION,
+        .Size = Size,
+        .ChunkSize = COMPRESSED_CHUNK_SIZE,
+        .ChunkCount = static_cast<uint32_t>((Size + COMPRESSED_CHUNK_SIZE - 1) / COMPRESSED_CHUNK_SIZE),
+        .ShuffleWidth = COMPRESSED_SHUFFLE_WIDTH,
+        .Unused = 0,
+    };
+
+    auto Chunks = std::vector<std::vector<uint8_t>>(Header.ChunkCount);
+    auto ChunkSizes = std::vector<uint64_t>(Header.ChunkCount);
+
+    ParallelFor(Header.ChunkCount, [&](size_t Index)
+    {
+        size_t Offset = Index * Header.ChunkSize;
+        size_t ChunkSize = std::min<size_t>(Header.ChunkSize, Size - Offset);
+
+        auto Shuffled = std::vector<uint8_t>(ChunkSize);
+        ShuffleBytes(Shuffled.data(), Bytes + Offset, ChunkSize, Header.ShuffleWidth);
+
+        std::vector<uint8_t>& Chunk = Chunks[Index];
+        mz_ulong CompressedSize = mz_compressBound(static_cast<mz_ulong>(ChunkSize));
+        Chunk.resize(CompressedSize);
+
+        int Result = mz_compress2
+        (
+            Chunk.data(), &CompressedSize,
+            Shuffled.data(), static_cast<mz_ulong>(ChunkSize),
+            Level
+        );
+        assert(Result == MZ_OK);
+
+        if (CompressedSize < ChunkSize)
+            Chunk.resize(CompressedSize);
+        else
+            Chunk = std::move(Shuffled);
+
+        ChunkSizes[Index] = Chunk.size();
+    });
+
+    Out.write(reinterpret_cast<char const*>(&Header), sizeof(compressed_header));
+    Out.write(reinterpret_cast<char const*>(ChunkSizes.data()), sizeof(uint64_t) * ChunkSizes.size());
+    for (std::vector<uint8_t> const& Chunk : Chunks)
+        Out.write(reinterpret_cast<char const*>(Chunk.data()), Chunk.size());
 }
 
 void ReadCompressed(std::istream& In, void* Data, size_t Size)
+{
+    auto Bytes = static_cast<uint8_t*>(Data);
+
+    compressed_header Header;
+    In.read(reinterpret_cast<char*>(&Header), sizeof(compressed_header));
+    assert(Header.Magic == COMPRESSED_MAGIC);
+    assert(Header.Version == COMPRESSED_VERSION);
+    assert(Header.Size == Size);
+
+    auto ChunkSizes = std::vector<uint64_t>(Header.ChunkCount);
+    In.read(reinterpret_cast<char*>(ChunkSizes.data()), sizeof(uint64_t) * ChunkSizes.size());
+
+    auto ChunkOffsets = std::vector<uint64_t>(Header.ChunkCount + 1);
+    for (uint32_t Index = 0; Index < Header.ChunkCount; Index++)
+        ChunkOffsets[Index + 1] = ChunkOffsets[Index] + ChunkSizes[Index];
+
+    auto CompressedData = std::vector<uint8_t>(ChunkOffsets[Header.ChunkCount]);
+    In.read(reinterpret_cast<char*>(CompressedData.data()), CompressedData.size());
+
+    ParallelFor(Header.ChunkCount, [&](size_t Index)
+    {
+        size_t Offset = Index * Header.ChunkSize;
+        size_t ChunkSize = std::min<size_t>(Header.ChunkSize, Size - Offset);
+
+        uint8_t const* Chunk = CompressedData.data() + ChunkOffsets[Index];
+
+        auto Shuffled = std::vector<uint8_t>(ChunkSize);
+
+        if (ChunkSizes[Index] == ChunkSize)
+        {
+            memcpy(Shuffled.data(), Chunk, ChunkSize);
+        }
+        else
+        {
+            mz_ulong UncompressedSize = static_cast<mz_ulong>(ChunkSize);
+            int Result = mz_uncompress
+            (
+                Shuffled.data(), &UncompressedSize,
+                Chunk, static_cast<mz_ulong>(ChunkSizes[Index])
+            );
+            assert(Result == MZ_OK && UncompressedSize == ChunkSize);
+        }
+
+        UnshuffleBytes(Bytes + Offset, Shuffled.data(), ChunkSize, Header.ShuffleWidth);
+    });
+}
+
+// Reads data written by version 0 of the asset file formats, which stored
+// a single compressed blob prefixed by its platform-dependent mz_ulong size.
+void ReadCompressedLegacy(std::istream& In, void* Data, size_t Size)
 {
     mz_ulong CompressedSize = 0;
     In.read((char*)&CompressedSize, sizeof(mz_ulong));
@@ -59,6 +199,21 @@ std::string MakeFileName(std::string const& Name, char const* Extension)
     return Str;
 }
 
+enum serializer_asset_class
+{
+    SERIALIZER_ASSET_CLASS_TEXTURE        = 0,
+    SERIALIZER_ASSET_CLASS_MESH           = 1,
+    SERIALIZER_ASSET_CLASS_SPECTRUM_TABLE = 2,
+    SERIALIZER_ASSET_CLASS__COUNT         = 3,
+};
+
+// Deferred read or write of the payload file of an asset.
+struct serializer_payload_job
+{
+    serializer_asset_class AssetClass;
+    std::function<void()>  Run;
+};
+
 struct serializer
 {
     std::filesystem::path SceneFilePath;
@@ -71,8 +226,61 @@ struct serializer
 
     scene* Scene;
     bool IsWriting;
+
+    // Compression level (in the range 0-9) for asset payloads when writing.
+    int CompressionLevel = MZ_DEFAULT_LEVEL;
+
+    // Hash of the scene file contents and the spectrum table.  Since the
+    // scene file records the content hash of every asset payload, this
+    // identifies the entire source scene.
+    uint64_t SceneHash = 0;
+
+    // When reading, the payload files of textures and meshes are not read
+    // immediately, but queued here and then read in parallel.
+    std::vector<serializer_payload_job> PayloadLoads;
+
+    // When writing, the payload files that are out of date are queued
+    // here, and written in parallel once the whole scene has been visited.
+    // Payload files whose hash matches the one recorded in the previously
+    // saved scene file are skipped.
+    std::vector<serializer_payload_job>       PayloadWrites;
+    std::unordered_map<std::string, uint64_t> SavedPayloadHashes;
+    uint32_t                                  PayloadCount = 0;
+
+    // Write of the scene cache file, if the packed data is up to date.
+    std::function<void()> CacheWrite;
+
+    // Contents of the scene file to write.
+    std::string SceneText;
+
+    // When set, the queued writes must not refer to scene memory, because
+    // they are run on a background thread while the scene is being edited.
+    // Payload data is then copied here.
+    bool                              IsSnapshot = false;
+    std::vector<std::vector<uint8_t>> SnapshotData;
 };
 
+// Returns a view of data that remains valid until the queued writes have
+// been run, making a copy of it if the serializer is a snapshot.
+static std::span<uint8_t const> GetWriteData(serializer& S, void const* Data, size_t Size, bool AlwaysCopy = false)
+{
+    auto Bytes = static_cast<uint8_t const*>(Data);
+    if (!S.IsSnapshot && !AlwaysCopy)
+        return { Bytes, Size };
+    return S.SnapshotData.emplace_back(Bytes, Bytes + Size);
+}
+
+// Checks whether the payload file at the given path was written by the
+// previous save with identical contents, and counts the payload.
+static bool IsPayloadFileUpToDate(serializer& S, std::filesystem::path const& FilePath, uint64_t Hash)
+{
+    S.PayloadCount++;
+    auto It = S.SavedPayloadHashes.find(FilePath.filename().string());
+    if (It == S.SavedPayloadHashes.end() || It->second != Hash)
+        return false;
+    return std::filesystem::exists(FilePath);
+}
+
 template<typename type, int N>
 void Serialize(serializer& S, json& JSON, type (&Array)[N])
 {
@@ -193,28 +401,61 @@ void Serialize(serializer& S, json& JSON, texture& Object)
 
     if (S.IsWriting)
     {
-        Header.Magic = 'TEX ';
-        Header.Version = 0;
+        Header.Magic = MakeFourCC("TEX ");
+        Header.Version = 1;
         Header.Width = Object.Width;
         Header.Height = Object.Height;
 
-        auto File = std::ofstream(FilePath, std::ios::binary);
-        File.write(reinterpret_cast<char*>(&Header), sizeof(texture_header));
-        WriteCompressed(File, Object.Pixels, sizeof(vec4) * Object.Width * Object.Height);
+        size_t PixelDataSize = sizeof(vec4) * Object.Width * Object.Height;
+
+        if (!Object.PayloadHash)
+            Object.PayloadHash = HashBytes(Object.Pixels, PixelDataSize);
+        JSON["Hash"] = Object.PayloadHash;
+
+        if (!IsPayloadFileUpToDate(S, FilePath, Object.PayloadHash))
+        {
+            auto Pixels = GetWriteData(S, Object.Pixels, PixelDataSize);
+            S.PayloadWrites.push_back
+            ({
+                .AssetClass = SERIALIZER_ASSET_CLASS_TEXTURE,
+                .Run = [FilePath, Header, Pixels, Level = S.CompressionLevel]()
+                {
+                    WriteFileAtomically(FilePath, [&](std::ostream& File)
+                    {
+                        File.write(reinterpret_cast<char const*>(&Header), sizeof(texture_header));
+                        WriteCompressed(File, Pixels.data(), Pixels.size(), Level);
+                    });
+                },
+            });
+        }
     }
     else
     {
-        auto File = std::ifstream(FilePath, std::ios::binary);
+        if (JSON.contains("Hash"))
+            Object.PayloadHash = JSON["Hash"].get<uint64_t>();
+
+        S.PayloadLoads.push_back
+        ({
+            .AssetClass = SERIALIZER_ASSET_CLASS_TEXTURE,
+            .Run = [FilePath, &Object]()
+            {
+                auto File = std::ifstream(FilePath, std::ios::binary);
 
-        File.read(reinterpret_cast<char*>(&Header), sizeof(texture_header));
+                texture_header Header;
+                File.read(reinterpret_cast<char*>(&Header), sizeof(texture_header));
 
-        Object.Width = Header.Width;
-        Object.Height = Header.Height;
+                Object.Width = Header.Width;
+                Object.Height = Header.Height;
 
-        vec4* Pixels = new vec4[Object.Width * Object.Height];
-        ReadCompressed(File, Pixels, sizeof(vec4) * Object.Width * Object.Height);
+                vec4* Pixels = new vec4[Object.Width * Object.Height];
+                if (Header.Version >= 1)
+                    ReadCompressed(File, Pixels, sizeof(vec4) * Object.Width * Object.Height);
+                else
+                    ReadCompressedLegacy(File, Pixels, sizeof(vec4) * Object.Width * Object.Height);
 
-        Object.Pixels = Pixels;
+                Object.Pixels = Pixels;
+            },
+        });
     }
 }
 
@@ -276,6 +517,7 @@ void Serialize(serializer& S, json& JSON, mesh& Object)
         uint32_t Version;
         uint32_t FaceCount;
         uint32_t NodeCount;
+        uint32_t VertexCount; // Version 1 and later.
     };
 
     auto FilePath = S.DirectoryPath / MakeFileName(Object.Name, "mesh");
@@ -284,27 +526,79 @@ void Serialize(serializer& S, json& JSON, mesh& Object)
 
     if (S.IsWriting)
     {
-        Header.Magic = 'MESH';
-        Header.Version = 0;
+        Header.Magic = MakeFourCC("MESH");
+        Header.Version = 1;
         Header.FaceCount = static_cast<uint>(Object.Faces.size());
         Header.NodeCount = static_cast<uint>(Object.Nodes.size());
+        Header.VertexCount = static_cast<uint>(Object.Vertices.size());
+
+        if (!Object.PayloadHash)
+        {
+            uint64_t Hash = HashBytes(Object.Vertices.data(), sizeof(mesh_vertex) * Object.Vertices.size());
+            Hash = HashBytes(Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size(), Hash);
+            Hash = HashBytes(Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size(), Hash);
+            Object.PayloadHash = Hash;
+        }
+        JSON["Hash"] = Object.PayloadHash;
 
-        auto File = std::ofstream(FilePath, std::ios::binary);
-        File.write(reinterpret_cast<char*>(&Header), sizeof(mesh_header));
-        WriteCompressed(File, Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size());
-        WriteCompressed(File, Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size());
+        if (!IsPayloadFileUpToDate(S, FilePath, Object.PayloadHash))
+        {
+            auto Faces = GetWriteData(S, Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size());
+            auto Nodes = GetWriteData(S, Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size());
+            auto Vertices = GetWriteData(S, Object.Vertices.data(), sizeof(mesh_vertex) * Object.Vertices.size());
+            S.PayloadWrites.push_back
+            ({
+                .AssetClass = SERIALIZER_ASSET_CLASS_MESH,
+                .Run = [FilePath, Header, Faces, Nodes, Vertices, Level = S.CompressionLevel]()
+                {
+                    WriteFileAtomically(FilePath, [&](std::ostream& File)
+                    {
+                        File.write(reinterpret_cast<char const*>(&Header), sizeof(mesh_header));
+                        WriteCompressed(File, Faces.data(), Faces.size(), Level);
+                        WriteCompressed(File, Nodes.data(), Nodes.size(), Level);
+                        WriteCompressed(File, Vertices.data(), Vertices.size(), Level);
+                    });
+                },
+            });
+        }
     }
     else
     {
-        auto File = std::ifstream(FilePath, std::ios::binary);
-
-        File.read(reinterpret_cast<char*>(&Header), sizeof(mesh_header));
-
-        Object.Faces.resize(Header.FaceCount);
-        Object.Nodes.resize(Header.NodeCount);
+        if (JSON.contains("Hash"))
+            Object.PayloadHash = JSON["Hash"].get<uint64_t>();
 
-        ReadCompressed(File, Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size());
-        ReadCompressed(File, Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size());
+        S.PayloadLoads.push_back
+        ({
+            .AssetClass = SERIALIZER_ASSET_CLASS_MESH,
+            .Run = [FilePath, &Object]()
+            {
+                auto File = std::ifstream(FilePath, std::ios::binary);
+
+                mesh_header Header = {};
+                File.read(reinterpret_cast<char*>(&Header), offsetof(mesh_header, VertexCount));
+
+                if (Header.Version >= 1)
+                    File.read(reinterpret_cast<char*>(&Header.VertexCount), sizeof(uint32_t));
+
+                Object.Faces.resize(Header.FaceCount);
+                Object.Nodes.resize(Header.NodeCount);
+                Object.Vertices.resize(Header.VertexCount);
+
+                if (Header.Version >= 1)
+                {
+                    ReadCompressed(File, Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size());
+                    ReadCompressed(File, Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size());
+                    ReadCompressed(File, Object.Vertices.data(), sizeof(mesh_vertex) * Object.Vertices.size());
+                }
+                else
+                {
+                    ReadCompressedLegacy(File, Object.Faces.data(), sizeof(mesh_face) * Object.Faces.size());
+                    ReadCompressedLegacy(File, Object.Nodes.data(), sizeof(mesh_node) * Object.Nodes.size());
+                }
+
+                Object.TreeCost = GetMeshTreeCost(&Object);
+            },
+        });
     }
 }
 
@@ -327,6 +621,25 @@ void Serialize(serializer& S, json& JSON, mesh*& Pointer)
     }
 }
 
+void Serialize(serializer& S, json& JSON, prefab*& Pointer)
+{
+    if (S.IsWriting)
+    {
+        if (S.PrefabIndexMap.contains(Pointer))
+            JSON = S.PrefabIndexMap[Pointer];
+        else
+            JSON = -1;
+    }
+    else
+    {
+        int Index = JSON.get<int>();
+        if (Index >= 0)
+            Pointer = S.Scene->Prefabs[Index];
+        else
+            Pointer = nullptr;
+    }
+}
+
 void Serialize(serializer& S, json& JSON, entity& Entity)
 {
     Serialize(S, JSON["Type"], Entity.Type);
@@ -345,6 +658,9 @@ void Serialize(serializer& S, json& JSON, entity& Entity)
             F(ScatterRate);
             F(SkyboxBrightness);
             F(SkyboxTexture);
+            // Scene files written before the encoding was saved lack it.
+            if (S.IsWriting || JSON.contains("MeshFaceEncoding"))
+                F(MeshFaceEncoding);
             break;
         }
         case ENTITY_TYPE_CAMERA:
@@ -365,6 +681,12 @@ void Serialize(serializer& S, json& JSON, entity& Entity)
             F(Mesh);
             break;
         }
+        case ENTITY_TYPE_PREFAB_INSTANCE:
+        {
+            prefab_entity& Object = static_cast<prefab_entity&>(Entity);
+            F(Prefab);
+            break;
+        }
     }
 
     auto& Children = Entity.Children;
@@ -392,16 +714,54 @@ void Serialize(serializer& S, json& JSON, entity& Entity)
     }
 }
 
+// Reads all queued asset payload files in parallel, and reports the time
+// spent on each class of assets.
+void LoadAssetPayloads(serializer& S)
+{
+    using clock = std::chrono::steady_clock;
+
+    auto StartTime = clock::now();
+
+    std::vector<double> LoadTimes(S.PayloadLoads.size());
+
+    ParallelFor(S.PayloadLoads.size(), [&](size_t Index)
+    {
+        auto LoadStartTime = clock::now();
+        S.PayloadLoads[Index].Run();
+        LoadTimes[Index] = std::chrono::duration<double, std::milli>(clock::now() - LoadStartTime).count();
+    });
+
+    double TotalTime = std::chrono::duration<double, std::milli>(clock::now() - StartTime).count();
+
+    uint32_t ClassCounts[SERIALIZER_ASSET_CLASS__COUNT] = {};
+    double ClassTimes[SERIALIZER_ASSET_CLASS__COUNT] = {};
+
+    for (size_t Index = 0; Index < S.PayloadLoads.size(); Index++)
+    {
+        serializer_asset_class AssetClass = S.PayloadLoads[Index].AssetClass;
+        ClassCounts[AssetClass]++;
+        ClassTimes[AssetClass] += LoadTimes[Index];
+    }
+
+    printf("Loaded asset payloads in %.1f ms using %u threads\n", TotalTime, GetWorkerThreadCount());
+    printf("  %u textures: %.1f ms\n", ClassCounts[SERIALIZER_ASSET_CLASS_TEXTURE], ClassTimes[SERIALIZER_ASSET_CLASS_TEXTURE]);
+    printf("  %u meshes: %.1f ms\n", ClassCounts[SERIALIZER_ASSET_CLASS_MESH], ClassTimes[SERIALIZER_ASSET_CLASS_MESH]);
+
+    S.PayloadLoads.clear();
+}
+
 void Serialize(serializer& S, scene& Scene)
 {
+    json JSON;
+
     // Serialize assets and entities.
     {
-        json JSON;
-
         if (!S.IsWriting)
         {
             auto SceneFile = std::ifstream(S.SceneFilePath);
-            JSON = json::parse(SceneFile);
+            auto SceneText = std::string(std::istreambuf_iterator<char>(SceneFile), {});
+            S.SceneHash = HashBytes(SceneText.data(), SceneText.size());
+            JSON = json::parse(SceneText);
 
             for (uint I = 0; I < JSON["Textures"].size(); I++)
             {
@@ -446,10 +806,16 @@ void Serialize(serializer& S, scene& Scene)
             Serialize(S, JSON["Meshes"][Index], *Mesh);
         }
 
+        if (!S.IsWriting)
+            LoadAssetPayloads(S);
+
+        // Prefabs may refer to each other through prefab instances.
+        for (uint Index = 0; Index < Scene.Prefabs.size(); Index++)
+            S.PrefabIndexMap[Scene.Prefabs[Index]] = Index;
+
         for (uint Index = 0; Index < Scene.Prefabs.size(); Index++)
         {
             prefab* Prefab = Scene.Prefabs[Index];
-            S.PrefabIndexMap[Prefab] = Index;
             if (!S.IsWriting)
             {
                 auto EntityType = static_cast<entity_type>(JSON["Prefabs"][Index]["Type"].get<int>());
@@ -459,12 +825,6 @@ void Serialize(serializer& S, scene& Scene)
         }
 
         Serialize(S, JSON["Root"], static_cast<entity&>(Scene.Root));
-
-        if (S.IsWriting)
-        {
-            auto SceneFile = std::ofstream(S.SceneFilePath);
-            SceneFile << JSON.dump(4);
-        }
     }
 
     // Serialize the RGB spectrum coefficient table.
@@ -481,26 +841,473 @@ void Serialize(serializer& S, scene& Scene)
 
         if (S.IsWriting)
         {
-            Header.Magic = 'SPEC';
-            Header.Version = 0;
+            Header.Magic = MakeFourCC("SPEC");
+            Header.Version = 1;
+
+            auto& Coefficients = Scene.RGBSpectrumTable->Coefficients;
+            uint64_t Hash = HashBytes(&Coefficients, sizeof(Coefficients));
+            JSON["SpectrumTableHash"] = Hash;
 
-            auto File = std::ofstream(FilePath, std::ios::binary);
-            File.write(reinterpret_cast<char*>(&Header), sizeof(spectrum_table_header));
-            WriteCompressed(File, &Scene.RGBSpectrumTable->Coefficients, sizeof(parametric_spectrum_table::Coefficients));
+            if (!IsPayloadFileUpToDate(S, FilePath, Hash))
+            {
+                auto Data = GetWriteData(S, &Coefficients, sizeof(Coefficients));
+                S.PayloadWrites.push_back
+                ({
+                    .AssetClass = SERIALIZER_ASSET_CLASS_SPECTRUM_TABLE,
+                    .Run = [FilePath, Header, Data, Level = S.CompressionLevel]()
+                    {
+                        WriteFileAtomically(FilePath, [&](std::ostream& File)
+                        {
+                            File.write(reinterpret_cast<char const*>(&Header), sizeof(spectrum_table_header));
+                            WriteCompressed(File, Data.data(), Data.size(), Level);
+                        });
+                    },
+                });
+            }
         }
         else
         {
             auto File = std::ifstream(FilePath, std::ios::binary);
             File.read(reinterpret_cast<char*>(&Header), sizeof(spectrum_table_header));
             Scene.RGBSpectrumTable = new parametric_spectrum_table;
-            ReadCompressed(File, &Scene.RGBSpectrumTable->Coefficients, sizeof(parametric_spectrum_table::Coefficients));
+            if (Header.Version >= 1)
+                ReadCompressed(File, &Scene.RGBSpectrumTable->Coefficients, sizeof(parametric_spectrum_table::Coefficients));
+            else
+                ReadCompressedLegacy(File, &Scene.RGBSpectrumTable->Coefficients, sizeof(parametric_spectrum_table::Coefficients));
         }
+
+    }
+
+    if (S.IsWriting)
+    {
+        S.SceneText = JSON.dump(4);
+        S.SceneHash = HashBytes(S.SceneText.data(), S.SceneText.size());
     }
+
+    S.SceneHash = HashBytes(&Scene.RGBSpectrumTable->Coefficients, sizeof(parametric_spectrum_table::Coefficients), S.SceneHash);
+}
+
+/* --- Scene Cache ---------------------------------------------------------- */
+
+// The scene cache file holds the packed scene data exactly as produced by
+// PackSceneData(), so that a scene can be rendered right after loading
+// without rebuilding texture atlases, spectral conversions and the shape
+// hierarchy.  The cache is keyed by the source scene hash, and each of its
+// sections is 16-byte aligned so that it can be used in place once mapped.
+
+// Version 1: wide mesh BVH nodes.
+// Version 2: parent links in the mesh and shape BVH nodes.
+// Version 3: compact mesh face encoding and per-mesh data.
+// Version 4: transformed mesh face encoding.
+// Version 5: unbounded shapes outside of the shape BVH.
+// Version 6: entity of each packed shape, for prefab instances.
+// Version 7: 32-bit shape BVH node indices, with adjacent children.
+uint32_t const SCENE_CACHE_VERSION = 7;
+
+enum scene_cache_section_id
+{
+    SCENE_CACHE_SECTION_GLOBALS                = 0,
+    SCENE_CACHE_SECTION_TEXTURES               = 1,
+    SCENE_CACHE_SECTION_IMAGES                 = 2,
+    SCENE_CACHE_SECTION_MATERIAL_ATTRIBUTES    = 3,
+    SCENE_CACHE_SECTION_MESH_FACES             = 4,
+    SCENE_CACHE_SECTION_MESH_VERTICES          = 5,
+    SCENE_CACHE_SECTION_MESH_NODES             = 6,
+    SCENE_CACHE_SECTION_SHAPES                 = 7,
+    SCENE_CACHE_SECTION_SHAPE_NODES            = 8,
+    SCENE_CACHE_SECTION_CAMERAS                = 9,
+    SCENE_CACHE_SECTION_TEXTURE_INDICES        = 10,
+    SCENE_CACHE_SECTION_MATERIAL_INDICES       = 11,
+    SCENE_CACHE_SECTION_MESH_INDICES           = 12,
+    SCENE_CACHE_SECTION_ENTITY_INDICES         = 13,
+    SCENE_CACHE_SECTION_MESHES                 = 14,
+    SCENE_CACHE_SECTION_MESH_COMPACT_FACES     = 15,
+    SCENE_CACHE_SECTION_MESH_COMPACT_VERTICES  = 16,
+    SCENE_CACHE_SECTION_MESH_TRANSFORMED_FACES = 17,
+    SCENE_CACHE_SECTION_SHAPE_ENTITY_INDICES   = 18,
+    SCENE_CACHE_SECTION__COUNT                 = 19,
+};
+
+struct scene_cache_section
+{
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+struct scene_cache_header
+{
+    uint32_t            Magic;
+    uint32_t            Version;
+    uint64_t            SceneHash;
+    uint32_t            ImageCount;
+    uint32_t            ImageWidth;
+    uint32_t            ImageHeight;
+    uint32_t            EntityCount;
+    scene_cache_section Sections[SCENE_CACHE_SECTION__COUNT];
+};
+
+// Packed indices assigned to an entity by PackSceneData().
+struct scene_cache_mesh
+{
+    uint32_t PackedRootNodeIndex;
+    uint32_t PackedMeshIndex;
+};
+
+struct scene_cache_entity
+{
+    uint32_t PackedShapeIndex;
+    uint32_t PackedCameraIndex;
+};
+
+static void CollectEntities(entity* Entity, std::vector<entity*>& Entities)
+{
+    Entities.push_back(Entity);
+    for (entity* Child : Entity->Children)
+        CollectEntities(Child, Entities);
+}
+
+static std::filesystem::path GetSceneCacheFilePath(serializer const& S)
+{
+    auto Path = S.SceneFilePath;
+    Path.replace_extension("cache");
+    return Path;
+}
+
+// Queues the write of the scene cache file for the packed data of the
+// scene, which must be up to date.
+static void QueueSceneCacheWrite(serializer& S, scene& Scene)
+{
+    auto FilePath = GetSceneCacheFilePath(S);
+
+    // Nothing to do if the existing cache file was made for the same scene.
+    {
+        auto File = std::ifstream(FilePath, std::ios::binary);
+        scene_cache_header Header = {};
+        File.read(reinterpret_cast<char*>(&Header), sizeof(scene_cache_header));
+        if (File && Header.Magic == MakeFourCC("PACK") && Header.Version == SCENE_CACHE_VERSION && Header.SceneHash == S.SceneHash)
+            return;
+    }
+
+    std::vector<entity*> Entities;
+    CollectEntities(&Scene.Root, Entities);
+
+    std::vector<uint32_t> TextureIndices;
+    for (texture* Texture : Scene.Textures)
+        TextureIndices.push_back(Texture->PackedTextureIndex);
+
+    std::vector<uint32_t> MaterialIndices;
+    for (material* Material : Scene.Materials)
+        MaterialIndices.push_back(Material->PackedMaterialIndex);
+
+    std::vector<scene_cache_mesh> MeshIndices;
+    for (mesh* Mesh : Scene.Meshes)
+        MeshIndices.push_back({ Mesh->PackedRootNodeIndex, Mesh->PackedMeshIndex });
+
+    std::unordered_map<entity const*, uint32_t> EntityIndexMap;
+    std::vector<scene_cache_entity> EntityIndices;
+    for (entity* Entity : Entities)
+    {
+        scene_cache_entity Packed = { Entity->PackedShapeIndex, 0 };
+        if (Entity->Type == ENTITY_TYPE_CAMERA)
+            Packed.PackedCameraIndex = static_cast<camera_entity*>(Entity)->PackedCameraIndex;
+        EntityIndexMap[Entity] = static_cast<uint32_t>(EntityIndices.size());
+        EntityIndices.push_back(Packed);
+    }
+
+    // Prefab instances have several packed shapes, so the entity of each
+    // shape is stored separately.
+    std::vector<uint32_t> ShapeEntityIndices;
+    for (entity const* Entity : Scene.ShapeEntities)
+    {
+        auto Iterator = EntityIndexMap.find(Entity);
+        ShapeEntityIndices.push_back(Iterator != EntityIndexMap.end() ? Iterator->second : 0xFFFFFFFF);
+    }
+
+    scene_cache_header Header = {};
+    Header.Magic = MakeFourCC("PACK");
+    Header.Version = SCENE_CACHE_VERSION;
+    Header.SceneHash = S.SceneHash;
+    Header.ImageCount = static_cast<uint32_t>(Scene.Images.size());
+    Header.EntityCount = static_cast<uint32_t>(Entities.size());
+    if (!Scene.Images.empty())
+    {
+        Header.ImageWidth = Scene.Images[0].Width;
+        Header.ImageHeight = Scene.Images[0].Height;
+    }
+
+    // Each section is made up of one or more consecutive parts.
+    using section_parts = std::vector<std::span<uint8_t const>>;
+    auto Sections = std::vector<section_parts>(SCENE_CACHE_SECTION__COUNT);
+
+    auto AddSection = [&]<typename type>(scene_cache_section_id Section, std::vector<type> const& Array, bool AlwaysCopy = false)
+    {
+        Sections[Section].push_back(GetWriteData(S, Array.data(), sizeof(type) * Array.size(), AlwaysCopy));
+    };
+
+    Sections[SCENE_CACHE_SECTION_GLOBALS].push_back(GetWriteData(S, &Scene.Globals, sizeof(packed_scene_globals), true));
+
+    for (image const& Image : Scene.Images)
+    {
+        assert(Image.Width == Header.ImageWidth && Image.Height == Header.ImageHeight);
+        Sections[SCENE_CACHE_SECTION_IMAGES].push_back(GetWriteData(S, Image.Pixels, sizeof(vec4) * Image.Width * Image.Height));
+    }
+
+    AddSection(SCENE_CACHE_SECTION_TEXTURES, Scene.TexturePack);
+    AddSection(SCENE_CACHE_SECTION_MATERIAL_ATTRIBUTES, Scene.MaterialAttributePack);
+    AddSection(SCENE_CACHE_SECTION_MESH_FACES, Scene.MeshFacePack);
+    AddSection(SCENE_CACHE_SECTION_MESH_VERTICES, Scene.MeshVertexPack);
+    AddSection(SCENE_CACHE_SECTION_MESH_NODES, Scene.MeshNodePack);
+    AddSection(SCENE_CACHE_SECTION_MESHES, Scene.MeshPack);
+    AddSection(SCENE_CACHE_SECTION_MESH_COMPACT_FACES, Scene.MeshCompactFacePack);
+    AddSection(SCENE_CACHE_SECTION_MESH_COMPACT_VERTICES, Scene.MeshCompactVertexPack);
+    AddSection(SCENE_CACHE_SECTION_MESH_TRANSFORMED_FACES, Scene.MeshTransformedFacePack);
+    AddSection(SCENE_CACHE_SECTION_SHAPES, Scene.ShapePack);
+    AddSection(SCENE_CACHE_SECTION_SHAPE_NODES, Scene.ShapeNodePack);
+    AddSection(SCENE_CACHE_SECTION_CAMERAS, Scene.CameraPack);
+    AddSection(SCENE_CACHE_SECTION_TEXTURE_INDICES, TextureIndices, true);
+    AddSection(SCENE_CACHE_SECTION_MATERIAL_INDICES, MaterialIndices, true);
+    AddSection(SCENE_CACHE_SECTION_MESH_INDICES, MeshIndices, true);
+    AddSection(SCENE_CACHE_SECTION_ENTITY_INDICES, EntityIndices, true);
+    AddSection(SCENE_CACHE_SECTION_SHAPE_ENTITY_INDICES, ShapeEntityIndices, true);
+
+    S.CacheWrite = [FilePath, Header, Sections]() mutable
+    {
+        // This fails if the previous cache file is still mapped on some
+        // platforms, in which case the old cache simply stays in place.
+        WriteFileAtomically(FilePath, [&](std::ostream& File)
+        {
+            uint64_t Offset = sizeof(scene_cache_header);
+            for (int Section = 0; Section < SCENE_CACHE_SECTION__COUNT; Section++)
+            {
+                Offset = (Offset + 15) & ~uint64_t(15);
+                Header.Sections[Section].Offset = Offset;
+                for (std::span<uint8_t const> Part : Sections[Section])
+                    Header.Sections[Section].Size += Part.size();
+                Offset += Header.Sections[Section].Size;
+            }
+
+            File.write(reinterpret_cast<char const*>(&Header), sizeof(scene_cache_header));
+
+            Offset = sizeof(scene_cache_header);
+            for (int Section = 0; Section < SCENE_CACHE_SECTION__COUNT; Section++)
+            {
+                char const Padding[16] = {};
+                File.write(Padding, Header.Sections[Section].Offset - Offset);
+                for (std::span<uint8_t const> Part : Sections[Section])
+                    File.write(reinterpret_cast<char const*>(Part.data()), Part.size());
+                Offset = Header.Sections[Section].Offset + Header.Sections[Section].Size;
+            }
+        });
+    };
+}
+
+static bool LoadSceneCache(serializer& S, scene& Scene)
+{
+    auto FilePath = GetSceneCacheFilePath(S);
+
+    mapped_file File;
+    if (!MapFile(&File, FilePath.string().c_str()))
+        return false;
+
+    auto Base = static_cast<uint8_t const*>(File.Data);
+    auto Header = static_cast<scene_cache_header const*>(File.Data);
+
+    std::vector<entity*> Entities;
+    CollectEntities(&Scene.Root, Entities);
+
+    auto IsValid = [&]()
+    {
+        if (File.Size < sizeof(scene_cache_header))
+            return false;
+        if (Header->Magic != MakeFourCC("PACK") || Header->Version != SCENE_CACHE_VERSION)
+            return false;
+        if (Header->SceneHash != S.SceneHash)
+            return false;
+
+        for (scene_cache_section const& Section : Header->Sections)
+            if (Section.Offset % 16 != 0 || Section.Offset + Section.Size > File.Size)
+                return false;
+
+        auto const& Sections = Header->Sections;
+        return Sections[SCENE_CACHE_SECTION_GLOBALS].Size == sizeof(packed_scene_globals)
+            && Sections[SCENE_CACHE_SECTION_IMAGES].Size == sizeof(vec4) * Header->ImageCount * Header->ImageWidth * Header->ImageHeight
+            && Sections[SCENE_CACHE_SECTION_TEXTURE_INDICES].Size == sizeof(uint32_t) * Scene.Textures.size()
+            && Sections[SCENE_CACHE_SECTION_MATERIAL_INDICES].Size == sizeof(uint32_t) * Scene.Materials.size()
+            && Sections[SCENE_CACHE_SECTION_MESH_INDICES].Size == sizeof(scene_cache_mesh) * Scene.Meshes.size()
+            && Sections[SCENE_CACHE_SECTION_ENTITY_INDICES].Size == sizeof(scene_cache_entity) * Entities.size()
+            && Sections[SCENE_CACHE_SECTION_SHAPE_ENTITY_INDICES].Size / sizeof(uint32_t) == Sections[SCENE_CACHE_SECTION_SHAPES].Size / sizeof(packed_shape)
+            && Header->EntityCount == Entities.size();
+    };
+
+    if (!IsValid())
+    {
+        UnmapFile(&File);
+        return false;
+    }
+
+    auto GetSection = [&]<typename type>(scene_cache_section_id Section)
+    {
+        auto Data = reinterpret_cast<type const*>(Base + Header->Sections[Section].Offset);
+        return std::span<type const>(Data, Header->Sections[Section].Size / sizeof(type));
+    };
+
+    auto ReadSection = [&]<typename type>(scene_cache_section_id Section, std::vector<type>& Array)
+    {
+        auto Data = GetSection.template operator()<type>(Section);
+        Array.assign(Data.begin(), Data.end());
+    };
+
+    Scene.Globals = GetSection.template operator()<packed_scene_globals>(SCENE_CACHE_SECTION_GLOBALS)[0];
+
+    // The atlas images are by far the largest part of the packed data,
+    // so they are used directly from the mapped file without copying.
+    auto ImagePixels = GetSection.template operator()<vec4>(SCENE_CACHE_SECTION_IMAGES);
+    size_t ImagePixelCount = size_t(Header->ImageWidth) * Header->ImageHeight;
+    Scene.Images.clear();
+    for (uint32_t Index = 0; Index < Header->ImageCount; Index++)
+    {
+        Scene.Images.push_back
+        ({
+            .Width = Header->ImageWidth,
+            .Height = Header->ImageHeight,
+            .Pixels = ImagePixels.data() + Index * ImagePixelCount,
+        });
+    }
+
+    ReadSection(SCENE_CACHE_SECTION_TEXTURES, Scene.TexturePack);
+    ReadSection(SCENE_CACHE_SECTION_MATERIAL_ATTRIBUTES, Scene.MaterialAttributePack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_FACES, Scene.MeshFacePack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_VERTICES, Scene.MeshVertexPack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_NODES, Scene.MeshNodePack);
+    ReadSection(SCENE_CACHE_SECTION_MESHES, Scene.MeshPack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_COMPACT_FACES, Scene.MeshCompactFacePack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_COMPACT_VERTICES, Scene.MeshCompactVertexPack);
+    ReadSection(SCENE_CACHE_SECTION_MESH_TRANSFORMED_FACES, Scene.MeshTransformedFacePack);
+    ReadSection(SCENE_CACHE_SECTION_SHAPES, Scene.ShapePack);
+    ReadSection(SCENE_CACHE_SECTION_SHAPE_NODES, Scene.ShapeNodePack);
+    ReadSection(SCENE_CACHE_SECTION_CAMERAS, Scene.CameraPack);
+
+    auto TextureIndices = GetSection.template operator()<uint32_t>(SCENE_CACHE_SECTION_TEXTURE_INDICES);
+    for (size_t Index = 0; Index < Scene.Textures.size(); Index++)
+        Scene.Textures[Index]->PackedTextureIndex = TextureIndices[Index];
+
+    auto MaterialIndices = GetSection.template operator()<uint32_t>(SCENE_CACHE_SECTION_MATERIAL_INDICES);
+    for (size_t Index = 0; Index < Scene.Materials.size(); Index++)
+        Scene.Materials[Index]->PackedMaterialIndex = MaterialIndices[Index];
+
+    auto MeshIndices = GetSection.template operator()<scene_cache_mesh>(SCENE_CACHE_SECTION_MESH_INDICES);
+    for (size_t Index = 0; Index < Scene.Meshes.size(); Index++)
+    {
+        Scene.Meshes[Index]->PackedRootNodeIndex = MeshIndices[Index].PackedRootNodeIndex;
+        Scene.Meshes[Index]->PackedMeshIndex = MeshIndices[Index].PackedMeshIndex;
+    }
+
+    auto EntityIndices = GetSection.template operator()<scene_cache_entity>(SCENE_CACHE_SECTION_ENTITY_INDICES);
+    for (size_t Index = 0; Index < Entities.size(); Index++)
+    {
+        entity* Entity = Entities[Index];
+        Entity->PackedShapeIndex = EntityIndices[Index].PackedShapeIndex;
+        if (Entity->Type == ENTITY_TYPE_CAMERA)
+            static_cast<camera_entity*>(Entity)->PackedCameraIndex = EntityIndices[Index].PackedCameraIndex;
+    }
+
+    auto ShapeEntityIndices = GetSection.template operator()<uint32_t>(SCENE_CACHE_SECTION_SHAPE_ENTITY_INDICES);
+    Scene.ShapeEntities.assign(Scene.ShapePack.size(), nullptr);
+    for (size_t Index = 0; Index < Scene.ShapeEntities.size(); Index++)
+        if (ShapeEntityIndices[Index] < Entities.size())
+            Scene.ShapeEntities[Index] = Entities[ShapeEntityIndices[Index]];
+
+    // The shape ranges of prefab instances follow from the shape entities.
+    for (size_t Index = 0; Index < Scene.ShapeEntities.size(); Index++)
+    {
+        entity* Entity = Scene.ShapeEntities[Index];
+        if (!Entity || Entity->Type != ENTITY_TYPE_PREFAB_INSTANCE) continue;
+
+        auto Instance = static_cast<prefab_entity*>(Entity);
+        packed_shape_range& Range = Index < Scene.Globals.UnboundedShapeCount ? Instance->PackedUnboundedShapes : Instance->PackedBoundedShapes;
+        if (Range.Count++ == 0)
+            Range.Index = static_cast<uint32_t>(Index);
+    }
+
+    UnmapFile(&Scene.PackCacheFile);
+    Scene.PackCacheFile = File;
+    Scene.PackedDataIsCached = true;
+
+    return true;
+}
+
+/* --- Loading and Saving -------------------------------------------------- */
+
+// Thread running the most recent background save, if any.
+static std::thread BackgroundSaveThread;
+
+// Reads the payload hashes recorded in an existing scene file, so that the
+// payload files written along with it can be recognized as up to date.
+static void ReadSavedPayloadHashes(serializer& S)
+{
+    auto SceneFile = std::ifstream(S.SceneFilePath);
+    if (!SceneFile) return;
+
+    json JSON = json::parse(SceneFile, nullptr, false);
+    if (JSON.is_discarded()) return;
+
+    auto ReadHashes = [&](char const* Key, char const* Extension)
+    {
+        if (!JSON.contains(Key)) return;
+        for (json const& AssetJSON : JSON[Key])
+        {
+            if (!AssetJSON.contains("Name") || !AssetJSON.contains("Hash")) continue;
+            auto FileName = MakeFileName(AssetJSON["Name"].get<std::string>(), Extension);
+            S.SavedPayloadHashes[FileName] = AssetJSON["Hash"].get<uint64_t>();
+        }
+    };
+
+    ReadHashes("Textures", "texture");
+    ReadHashes("Meshes", "mesh");
+
+    if (JSON.contains("SpectrumTableHash"))
+        S.SavedPayloadHashes["spectrum.dat"] = JSON["SpectrumTableHash"].get<uint64_t>();
+}
+
+// Runs the file writes queued by serializing a scene.  The payload files
+// are written first and the scene file after them, so that the scene file
+// never refers to payloads that have not been written.
+static void WriteSceneFiles(serializer& S)
+{
+    using clock = std::chrono::steady_clock;
+
+    auto StartTime = clock::now();
+
+    ParallelFor(S.PayloadWrites.size(), [&](size_t Index)
+    {
+        S.PayloadWrites[Index].Run();
+    });
+
+    bool Success = WriteFileAtomically(S.SceneFilePath, [&](std::ostream& File)
+    {
+        File << S.SceneText;
+    });
+
+    if (S.CacheWrite)
+        S.CacheWrite();
+
+    double TotalTime = std::chrono::duration<double, std::milli>(clock::now() - StartTime).count();
+
+    if (Success)
+        printf("Saved %s in %.1f ms, %zu of %u payload files written\n", S.SceneFilePath.string().c_str(), TotalTime, S.PayloadWrites.size(), S.PayloadCount);
+    else
+        printf("Failed to save %s\n", S.SceneFilePath.string().c_str());
+}
+
+void WaitForSceneSave()
+{
+    if (BackgroundSaveThread.joinable())
+        BackgroundSaveThread.join();
 }
 
 scene* LoadScene(char const* Path)
 {
-    std::filesystem::path SceneFilePath = Path;
+    WaitForSceneSave();
 
     serializer S;
     S.SceneFilePath = Path;
@@ -510,20 +1317,55 @@ scene* LoadScene(char const* Path)
 
     Serialize(S, *S.Scene);
 
-    S.Scene->DirtyFlags = SCENE_DIRTY_ALL;
+    // If the scene cache is up to date, there is nothing left to pack.
+    if (LoadSceneCache(S, *S.Scene))
+        S.Scene->DirtyFlags = 0;
+    else
+        S.Scene->DirtyFlags = SCENE_DIRTY_ALL;
 
     return S.Scene;
 }
 
-void SaveScene(char const* Path, scene* Scene)
+void SaveScene(char const* Path, scene* Scene, save_scene_options* Options)
 {
+    save_scene_options DefaultOptions;
+    if (!Options) Options = &DefaultOptions;
+
+    WaitForSceneSave();
+
     serializer S;
     S.SceneFilePath = Path;
     S.DirectoryPath = S.SceneFilePath.parent_path();
     S.IsWriting = true;
     S.Scene = Scene;
 
+    switch (Options->CompressionLevel)
+    {
+        case SCENE_COMPRESSION_LEVEL_FAST:
+            S.CompressionLevel = MZ_BEST_SPEED;
+            break;
+        case SCENE_COMPRESSION_LEVEL_DEFAULT:
+            S.CompressionLevel = MZ_DEFAULT_LEVEL;
+            break;
+        case SCENE_COMPRESSION_LEVEL_BEST:
+            S.CompressionLevel = MZ_BEST_COMPRESSION;
+            break;
+    }
+
+    S.IsSnapshot = Options->SaveInBackground;
+
     std::filesystem::create_directory(S.DirectoryPath);
 
+    ReadSavedPayloadHashes(S);
+
     Serialize(S, *Scene);
+
+    // The packed data can only be cached if it reflects the scene as saved.
+    if (!IsScenePackPending(Scene))
+        QueueSceneCacheWrite(S, *Scene);
+
+    if (Options->SaveInBackground)
+        BackgroundSaveThread = std::thread([S = std::move(S)]() mutable { WriteSceneFiles(S); });
+    else
+        WriteSceneFiles(S);
 }
@@ -0,0 +1,678 @@
+#include "scene/scene.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+// Traces random rays against the packed BVHs of the meshes of a model on
+// the CPU, with the same short-stack traversal as IntersectMeshNode() in
+// scene.glsl.inc.  Reports the traversal throughput, the number of memory
+// accesses that miss in a simulated cache, and how often the traversal
+// stack overflows, with and without the mesh layout optimization, and
+// with each of the mesh face encodings.  The binary BVHs the wide nodes
+// are collapsed from are traced as a baseline.  Rays aimed exactly at the
+// edges between faces measure how watertight the face intersection tests
+// are.
+
+struct benchmark_ray
+{
+    vec3 Origin;
+    vec3 Velocity;
+};
+
+struct benchmark_stats
+{
+    uint64_t RayCount = 0;
+    uint64_t HitCount = 0;
+    uint64_t NodeCount = 0;
+    uint64_t FaceCount = 0;
+    uint64_t CacheMissCount = 0;
+    uint64_t OverflowCount = 0; // Rays that overflowed the traversal stack.
+    uint64_t AscentCount = 0; // Steps up the tree after a stack overflow.
+};
+
+// Set-associative LRU cache of 32 KiB with 64-byte lines, standing in for
+// the L1 cache of a GPU compute unit.
+struct cache_simulator
+{
+    static constexpr size_t LINE_SIZE = 64;
+    static constexpr size_t SET_COUNT = 64;
+    static constexpr size_t WAY_COUNT = 8;
+
+    uint64_t Tags[SET_COUNT][WAY_COUNT] = {}; // Most recently used first.
+};
+
+enum benchmark_buffer
+{
+    BENCHMARK_BUFFER_MESH_NODES    = 1,
+    BENCHMARK_BUFFER_MESH_FACES    = 2,
+    BENCHMARK_BUFFER_MESH_VERTICES = 3,
+};
+
+// Simulates an access to a range of bytes of a buffer.  Addresses are
+// relative to the start of the buffer, as GPU buffers are aligned to at
+// least the cache line size.
+static void Touch(benchmark_stats* Stats, cache_simulator* Cache, benchmark_buffer Buffer, size_t Offset, size_t Size)
+{
+    if (!Cache) return;
+
+    uint64_t Base = uint64_t(Buffer) << 48;
+    uint64_t Begin = (Base + Offset) / cache_simulator::LINE_SIZE;
+    uint64_t End = (Base + Offset + Size - 1) / cache_simulator::LINE_SIZE;
+
+    for (uint64_t Line = Begin; Line <= End; Line++)
+    {
+        uint64_t* Ways = Cache->Tags[Line % cache_simulator::SET_COUNT];
+
+        size_t Way = 0;
+        while (Way < cache_simulator::WAY_COUNT && Ways[Way] != Line + 1)
+            Way++;
+
+        if (Way == cache_simulator::WAY_COUNT)
+        {
+            Stats->CacheMissCount++;
+            Way = cache_simulator::WAY_COUNT - 1;
+        }
+
+        for (; Way > 0; Way--)
+            Ways[Way] = Ways[Way-1];
+        Ways[0] = Line + 1;
+    }
+}
+
+static float IntersectBoundingBox(benchmark_ray const& Ray, float Reach, vec3 Min, vec3 Max)
+{
+    vec3 MinT = (Min - Ray.Origin) / Ray.Velocity;
+    vec3 MaxT = (Max - Ray.Origin) / Ray.Velocity;
+
+    vec3 EarlierT = glm::min(MinT, MaxT);
+    vec3 LaterT = glm::max(MinT, MaxT);
+
+    float EntryT = std::max(std::max(EarlierT.x, EarlierT.y), EarlierT.z);
+    float ExitT = std::min(std::min(LaterT.x, LaterT.y), LaterT.z);
+
+    if (ExitT < EntryT) return INF;
+    if (ExitT <= 0) return INF;
+    if (EntryT >= Reach) return INF;
+
+    return EntryT;
+}
+
+static vec3 DecodeMeshPosition(packed_mesh const& Mesh, packed_mesh_compact_vertex const& Vertex)
+{
+    vec3 Q = vec3(Vertex.PackedPositionXY & 0xFFFF, Vertex.PackedPositionXY >> 16, Vertex.PackedPositionZ);
+    return Mesh.PositionOrigin + Q * Mesh.PositionScale;
+}
+
+// Same as IntersectMeshTransformedFace() in scene.glsl.inc.
+static void IntersectMeshTransformedFace(scene const* Scene, benchmark_ray const& Ray, uint32_t FaceIndex, float* Time, uint32_t* HitFaceIndex)
+{
+    packed_mesh_transformed_face const& Face = Scene->MeshTransformedFacePack[FaceIndex];
+
+    uint32_t K = Face.VertexIndex2AndAxis >> 30;
+    uint32_t I = K == 2 ? 0 : K + 1;
+    uint32_t J = K == 0 ? 2 : K - 1;
+
+    vec3 O = vec3(Ray.Origin[I], Ray.Origin[J], Ray.Origin[K]);
+    vec3 D = vec3(Ray.Velocity[I], Ray.Velocity[J], Ray.Velocity[K]);
+
+    float Distance = O.z + glm::dot(Face.Transform2, vec3(O.x, O.y, 1));
+    float Slope = D.z + Face.Transform2.x * D.x + Face.Transform2.y * D.y;
+
+    float T = -Distance / Slope;
+    if (!(T >= 0 && T <= *Time)) return;
+
+    vec3 P = vec3(O.x + T * D.x, O.y + T * D.y, 1);
+
+    float U = glm::dot(Face.Transform0, P);
+    if (U < 0 || U > 1) return;
+
+    float V = glm::dot(Face.Transform1, P);
+    if (V < 0 || U + V > 1) return;
+
+    *Time = T;
+    *HitFaceIndex = FaceIndex;
+}
+
+static void IntersectMeshFace(scene const* Scene, mesh const* Mesh, benchmark_ray const& Ray, uint32_t FaceIndex, float* Time, uint32_t* HitFaceIndex, benchmark_stats* Stats, cache_simulator* Cache)
+{
+    if (Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_TRANSFORMED)
+    {
+        IntersectMeshTransformedFace(Scene, Ray, FaceIndex, Time, HitFaceIndex);
+        return;
+    }
+
+    vec3 Position0, Position1, Position2;
+
+    if (Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_COMPACT)
+    {
+        packed_mesh const& PackedMesh = Scene->MeshPack[Mesh->PackedMeshIndex];
+        packed_mesh_compact_face const& Face = Scene->MeshCompactFacePack[FaceIndex];
+        for (uint32_t VertexIndex : { Face.VertexIndex0, Face.VertexIndex1, Face.VertexIndex2 })
+            Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_VERTICES, VertexIndex * sizeof(packed_mesh_compact_vertex), sizeof(packed_mesh_compact_vertex));
+        Position0 = DecodeMeshPosition(PackedMesh, Scene->MeshCompactVertexPack[Face.VertexIndex0]);
+        Position1 = DecodeMeshPosition(PackedMesh, Scene->MeshCompactVertexPack[Face.VertexIndex1]);
+        Position2 = DecodeMeshPosition(PackedMesh, Scene->MeshCompactVertexPack[Face.VertexIndex2]);
+    }
+    else
+    {
+        packed_mesh_face const& Face = Scene->MeshFacePack[FaceIndex];
+        Position0 = Face.Position0;
+        Position1 = Face.Position1;
+        Position2 = Face.Position2;
+    }
+
+    vec3 Edge1 = Position1 - Position0;
+    vec3 Edge2 = Position2 - Position0;
+
+    vec3 RayCrossEdge2 = glm::cross(Ray.Velocity, Edge2);
+    float Det = glm::dot(Edge1, RayCrossEdge2);
+
+    if (std::abs(Det) < 1e-9f) return;
+
+    float InvDet = 1.0f / Det;
+
+    vec3 S = Ray.Origin - Position0;
+    float U = InvDet * glm::dot(S, RayCrossEdge2);
+    if (U < 0 || U > 1) return;
+
+    vec3 SCrossEdge1 = glm::cross(S, Edge1);
+    float V = InvDet * glm::dot(Ray.Velocity, SCrossEdge1);
+    if (V < 0 || U + V > 1) return;
+
+    float T = InvDet * glm::dot(Edge2, SCrossEdge1);
+    if (T < 0 || T > *Time) return;
+
+    *Time = T;
+    *HitFaceIndex = FaceIndex;
+}
+
+// Must match MESH_NODE_STACK_SIZE in scene.glsl.inc.
+static constexpr uint32_t MESH_NODE_STACK_SIZE = 16;
+
+// Returns the hit time, or INF if the ray missed.
+static float TraceMesh(scene const* Scene, mesh const* Mesh, benchmark_ray const& Ray, benchmark_stats* Stats, cache_simulator* Cache)
+{
+    bool IsCompact = Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_COMPACT;
+    bool IsTransformed = Scene->Globals.MeshFaceEncoding == MESH_FACE_ENCODING_TRANSFORMED;
+    size_t FaceSize = IsCompact ? sizeof(packed_mesh_compact_face)
+                    : IsTransformed ? sizeof(packed_mesh_transformed_face)
+                    : sizeof(packed_mesh_face);
+
+    uint32_t Stack[MESH_NODE_STACK_SIZE];
+    uint32_t StackTop = 0;
+    uint32_t StackCount = 0;
+    bool StackOverflowed = false;
+
+    float Time = INF;
+    uint32_t HitFaceIndex = ~0u;
+    uint32_t NodeIndex = Mesh->PackedRootNodeIndex;
+
+    uint32_t FromIndex = MESH_NODE_INDEX_NONE;
+    float FromTime = 0;
+
+    while (true)
+    {
+        packed_mesh_node const& Node = Scene->MeshNodePack[NodeIndex];
+        Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_NODES, NodeIndex * sizeof(packed_mesh_node), sizeof(packed_mesh_node));
+        Stats->NodeCount++;
+
+        vec3 Scale =
+        {
+            std::bit_cast<float>(((Node.Exponents >> 0) & 0xFF) << 23),
+            std::bit_cast<float>(((Node.Exponents >> 8) & 0xFF) << 23),
+            std::bit_cast<float>(((Node.Exponents >> 16) & 0xFF) << 23),
+        };
+        uint32_t ChildCount = Node.Exponents >> 24;
+
+        bool Ascending = FromIndex != MESH_NODE_INDEX_NONE;
+
+        uint32_t HitIndices[MESH_NODE_WIDTH];
+        float HitTimes[MESH_NODE_WIDTH];
+        uint32_t HitCount = 0;
+
+        for (uint32_t I = 0; I < ChildCount; I++)
+        {
+            uint32_t Shift = 8 * I;
+            vec3 Minimum, Maximum;
+            for (int Axis = 0; Axis < 3; Axis++)
+            {
+                Minimum[Axis] = Node.Origin[Axis] + float((Node.QuantizedMinimum[Axis] >> Shift) & 0xFF) * Scale[Axis];
+                Maximum[Axis] = Node.Origin[Axis] + float((Node.QuantizedMaximum[Axis] >> Shift) & 0xFF) * Scale[Axis];
+            }
+
+            float ChildTime = IntersectBoundingBox(Ray, INF, Minimum, Maximum);
+            uint32_t ChildIndex = Node.ChildIndices[I];
+
+            uint32_t FaceCount = (Node.LeafFaceCounts >> Shift) & 0xFF;
+            if (FaceCount > 0)
+            {
+                if (Ascending || ChildTime >= Time) continue;
+                Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_FACES, ChildIndex * FaceSize, FaceCount * FaceSize);
+                Stats->FaceCount += FaceCount;
+                for (uint32_t J = 0; J < FaceCount; J++)
+                    IntersectMeshFace(Scene, Mesh, Ray, ChildIndex + J, &Time, &HitFaceIndex, Stats, Cache);
+            }
+            else
+            {
+                if (ChildIndex == FromIndex) FromTime = ChildTime;
+                if (ChildTime >= Time) continue;
+
+                uint32_t J = HitCount++;
+                while (J > 0 && (HitTimes[J-1] < ChildTime || (HitTimes[J-1] == ChildTime && HitIndices[J-1] < ChildIndex)))
+                {
+                    HitIndices[J] = HitIndices[J-1];
+                    HitTimes[J] = HitTimes[J-1];
+                    J--;
+                }
+                HitIndices[J] = ChildIndex;
+                HitTimes[J] = ChildTime;
+            }
+        }
+
+        if (Ascending)
+        {
+            while (HitCount > 0 && (HitTimes[HitCount-1] < FromTime || (HitTimes[HitCount-1] == FromTime && HitIndices[HitCount-1] <= FromIndex)))
+                HitCount--;
+        }
+
+        for (uint32_t J = 0; J < HitCount; J++)
+        {
+            Stack[StackTop++ % MESH_NODE_STACK_SIZE] = HitIndices[J];
+            if (StackCount < MESH_NODE_STACK_SIZE)
+                StackCount++;
+            else
+                StackOverflowed = true;
+        }
+
+        if (StackCount > 0)
+        {
+            NodeIndex = Stack[--StackTop % MESH_NODE_STACK_SIZE];
+            StackCount--;
+            FromIndex = MESH_NODE_INDEX_NONE;
+            continue;
+        }
+
+        if (!StackOverflowed || NodeIndex == Mesh->PackedRootNodeIndex) break;
+
+        Stats->AscentCount++;
+        FromIndex = NodeIndex;
+        NodeIndex = Node.ParentIndex;
+    }
+
+    if (StackOverflowed)
+        Stats->OverflowCount++;
+
+    Stats->RayCount++;
+
+    // Fetch the vertex attributes of the hit face, as shading would.
+    if (HitFaceIndex != ~0u)
+    {
+        Stats->HitCount++;
+        if (IsCompact)
+        {
+            packed_mesh_compact_face const& Face = Scene->MeshCompactFacePack[HitFaceIndex];
+            for (uint32_t VertexIndex : { Face.VertexIndex0, Face.VertexIndex1, Face.VertexIndex2 })
+                Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_VERTICES, VertexIndex * sizeof(packed_mesh_compact_vertex), sizeof(packed_mesh_compact_vertex));
+        }
+        else if (IsTransformed)
+        {
+            packed_mesh_transformed_face const& Face = Scene->MeshTransformedFacePack[HitFaceIndex];
+            for (uint32_t VertexIndex : { Face.VertexIndex0, Face.VertexIndex1, Face.VertexIndex2AndAxis & 0x3FFFFFFFu })
+                Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_VERTICES, VertexIndex * sizeof(packed_mesh_vertex), sizeof(packed_mesh_vertex));
+        }
+        else
+        {
+            packed_mesh_face const& Face = Scene->MeshFacePack[HitFaceIndex];
+            for (uint32_t VertexIndex : { Face.VertexIndex0, Face.VertexIndex1, Face.VertexIndex2 })
+                Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_VERTICES, VertexIndex * sizeof(packed_mesh_vertex), sizeof(packed_mesh_vertex));
+        }
+    }
+
+    return Time;
+}
+
+// Binary nodes were packed into 32 bytes, and faces into 36 bytes with the
+// full vertex positions.
+static constexpr size_t BINARY_MESH_NODE_SIZE = 32;
+static constexpr size_t BINARY_MESH_FACE_SIZE = 36;
+
+// Same as TraceMesh(), but traverses the binary BVH of the mesh with a full
+// stack, nearer child first, as IntersectMeshNode() did before the nodes
+// were collapsed into wide nodes.  Touches memory with the layout of the
+// binary packed nodes and faces.  The stack must have room for the depth
+// of the tree plus one nodes.
+static float TraceMeshBinary(mesh const* Mesh, benchmark_ray const& Ray, uint32_t* Stack, benchmark_stats* Stats, cache_simulator* Cache)
+{
+    uint32_t StackCount = 0;
+
+    float Time = INF;
+    bool Hit = false;
+
+    if (!Mesh->Nodes.empty())
+        Stack[StackCount++] = 0;
+
+    while (StackCount > 0)
+    {
+        uint32_t NodeIndex = Stack[--StackCount];
+        mesh_node const& Node = Mesh->Nodes[NodeIndex];
+
+        if (Node.ChildNodeIndex == 0)
+        {
+            uint32_t FaceCount = Node.FaceEndIndex - Node.FaceBeginIndex;
+            Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_FACES, Node.FaceBeginIndex * BINARY_MESH_FACE_SIZE, FaceCount * BINARY_MESH_FACE_SIZE);
+            Stats->FaceCount += FaceCount;
+
+            for (uint32_t FaceIndex = Node.FaceBeginIndex; FaceIndex < Node.FaceEndIndex; FaceIndex++)
+            {
+                mesh_face const& Face = Mesh->Faces[FaceIndex];
+                vec3 Position0 = Mesh->Vertices[Face.VertexIndex[0]].Position;
+                vec3 Edge1 = Mesh->Vertices[Face.VertexIndex[1]].Position - Position0;
+                vec3 Edge2 = Mesh->Vertices[Face.VertexIndex[2]].Position - Position0;
+
+                vec3 RayCrossEdge2 = glm::cross(Ray.Velocity, Edge2);
+                float Det = glm::dot(Edge1, RayCrossEdge2);
+                if (std::abs(Det) < 1e-9f) continue;
+
+                float InvDet = 1.0f / Det;
+
+                vec3 S = Ray.Origin - Position0;
+                float U = InvDet * glm::dot(S, RayCrossEdge2);
+                if (U < 0 || U > 1) continue;
+
+                vec3 SCrossEdge1 = glm::cross(S, Edge1);
+                float V = InvDet * glm::dot(Ray.Velocity, SCrossEdge1);
+                if (V < 0 || U + V > 1) continue;
+
+                float T = InvDet * glm::dot(Edge2, SCrossEdge1);
+                if (T < 0 || T > Time) continue;
+
+                Time = T;
+                Hit = true;
+            }
+            continue;
+        }
+
+        // Both children are fetched to test their bounds.
+        uint32_t IndexA = Node.ChildNodeIndex;
+        uint32_t IndexB = Node.ChildNodeIndex + 1;
+        Touch(Stats, Cache, BENCHMARK_BUFFER_MESH_NODES, IndexA * BINARY_MESH_NODE_SIZE, 2 * BINARY_MESH_NODE_SIZE);
+        Stats->NodeCount += 2;
+
+        bounds const& BoundsA = Mesh->Nodes[IndexA].Bounds;
+        bounds const& BoundsB = Mesh->Nodes[IndexB].Bounds;
+        float TimeA = IntersectBoundingBox(Ray, Time, BoundsA.Minimum, BoundsA.Maximum);
+        float TimeB = IntersectBoundingBox(Ray, Time, BoundsB.Minimum, BoundsB.Maximum);
+
+        if (TimeA > TimeB)
+        {
+            std::swap(IndexA, IndexB);
+            std::swap(TimeA, TimeB);
+        }
+
+        if (TimeB < INF)
+            Stack[StackCount++] = IndexB;
+        if (TimeA < INF)
+            Stack[StackCount++] = IndexA;
+    }
+
+    Stats->RayCount++;
+    if (Hit)
+        Stats->HitCount++;
+
+    return Time;
+}
+
+// Generates rays from random points around the mesh towards random points
+// within its bounds.
+static std::vector<benchmark_ray> MakeRays(mesh const* Mesh, size_t Count)
+{
+    bounds Bounds = Mesh->Nodes.empty() ? bounds { vec3(0), vec3(0) } : Mesh->Nodes[0].Bounds;
+    vec3 Center = 0.5f * (Bounds.Minimum + Bounds.Maximum);
+    float Radius = 0.5f * glm::length(Bounds.Maximum - Bounds.Minimum);
+
+    std::mt19937 Random(1);
+    std::uniform_real_distribution<float> Uniform(0.0f, 1.0f);
+    std::normal_distribution<float> Normal;
+
+    std::vector<benchmark_ray> Rays(Count);
+    for (benchmark_ray& Ray : Rays)
+    {
+        vec3 Direction = glm::normalize(vec3(Normal(Random), Normal(Random), Normal(Random)));
+        vec3 Target = Bounds.Minimum + vec3(Uniform(Random), Uniform(Random), Uniform(Random)) * (Bounds.Maximum - Bounds.Minimum);
+        Ray.Origin = Center + 1.5f * Radius * Direction;
+        Ray.Velocity = glm::normalize(Target - Ray.Origin);
+    }
+    return Rays;
+}
+
+// Generates rays from random points around the mesh towards random points
+// on the edges shared by two faces.  A watertight intersection test hits
+// one of the two faces no later than the target point.  Returns the
+// distances to the target points in Distances.
+static std::vector<benchmark_ray> MakeEdgeRays(mesh const* Mesh, size_t Count, std::vector<float>* Distances)
+{
+    std::vector<uint64_t> Edges;
+    Edges.reserve(3 * Mesh->Faces.size());
+    for (mesh_face const& Face : Mesh->Faces)
+    {
+        for (int I = 0; I < 3; I++)
+        {
+            uint64_t A = Face.VertexIndex[I];
+            uint64_t B = Face.VertexIndex[(I + 1) % 3];
+            Edges.push_back(std::min(A, B) << 32 | std::max(A, B));
+        }
+    }
+    std::sort(Edges.begin(), Edges.end());
+
+    std::vector<uint64_t> SharedEdges;
+    for (size_t I = 0; I + 1 < Edges.size(); I++)
+        if (Edges[I] == Edges[I+1] && (I + 2 == Edges.size() || Edges[I+2] != Edges[I]))
+            SharedEdges.push_back(Edges[I]);
+
+    Distances->clear();
+    if (SharedEdges.empty()) return {};
+
+    bounds Bounds = Mesh->Nodes[0].Bounds;
+    vec3 Center = 0.5f * (Bounds.Minimum + Bounds.Maximum);
+    float Radius = 0.5f * glm::length(Bounds.Maximum - Bounds.Minimum);
+
+    std::mt19937 Random(2);
+    std::uniform_real_distribution<float> Uniform(0.0f, 1.0f);
+    std::uniform_int_distribution<size_t> EdgeDistribution(0, SharedEdges.size() - 1);
+    std::normal_distribution<float> Normal;
+
+    std::vector<benchmark_ray> Rays(Count);
+    Distances->resize(Count);
+    for (size_t I = 0; I < Count; I++)
+    {
+        uint64_t Edge = SharedEdges[EdgeDistribution(Random)];
+        vec3 A = Mesh->Vertices[Edge >> 32].Position;
+        vec3 B = Mesh->Vertices[Edge & 0xFFFFFFFF].Position;
+        vec3 Target = glm::mix(A, B, Uniform(Random));
+
+        vec3 Direction = glm::normalize(vec3(Normal(Random), Normal(Random), Normal(Random)));
+        Rays[I].Origin = Center + 1.5f * Radius * Direction;
+        Rays[I].Velocity = glm::normalize(Target - Rays[I].Origin);
+        (*Distances)[I] = glm::length(Target - Rays[I].Origin);
+    }
+    return Rays;
+}
+
+int main(int ArgumentCount, char** Arguments)
+{
+    if (ArgumentCount < 2)
+    {
+        printf("usage: %s <model file> [ray count]\n", Arguments[0]);
+        return 1;
+    }
+
+    char const* Path = Arguments[1];
+    size_t RayCount = ArgumentCount >= 3 ? std::strtoull(Arguments[2], nullptr, 10) : 1000000;
+
+    using clock = std::chrono::steady_clock;
+
+    struct benchmark_config
+    {
+        char const*        Name;
+        bool               OptimizeLayout;
+        mesh_face_encoding Encoding;
+        bool               BinaryNodes = false; // Trace the binary BVHs instead of the packed wide nodes.
+    };
+
+    benchmark_config const Configs[] =
+    {
+        { "Build order",       false, MESH_FACE_ENCODING_FULL },
+        { "Optimized layout",  true,  MESH_FACE_ENCODING_FULL },
+        { "Compact faces",     true,  MESH_FACE_ENCODING_COMPACT },
+        { "Transformed faces", true,  MESH_FACE_ENCODING_TRANSFORMED },
+        { "Binary nodes",      true,  MESH_FACE_ENCODING_FULL, true },
+    };
+
+    // Hit times with full precision faces, to measure the error of the
+    // compact encoding against.
+    std::vector<float> ReferenceTimes;
+
+    for (benchmark_config const& Config : Configs)
+    {
+        scene* Scene = CreateScene();
+
+        load_model_options Options;
+        Options.DirectoryPath = std::filesystem::path(Path).parent_path().string();
+        Options.UseCache = false;
+        Options.OptimizeMeshLayout = Config.OptimizeLayout;
+
+        if (!LoadModelAsPrefab(Scene, Path, &Options))
+        {
+            printf("Failed to load %s\n", Path);
+            return 1;
+        }
+
+        if (Scene->Meshes.empty())
+        {
+            printf("%s has no meshes\n", Path);
+            return 1;
+        }
+
+        Scene->Root.MeshFaceEncoding = Config.Encoding;
+        Scene->DirtyFlags = SCENE_DIRTY_ALL;
+        PackSceneData(Scene);
+
+        benchmark_stats Stats;
+        benchmark_stats CacheStats;
+        double Time = 0.0;
+
+        std::vector<float> HitTimes;
+
+        // Edge rays that miss, or hit beyond their target point by more
+        // than a small fraction of the mesh size.
+        size_t EdgeRayCount = 0;
+        size_t EdgeLeakCount = 0;
+
+        // Size of the BVH nodes traced.
+        size_t NodeDataSize = Config.BinaryNodes ? 0 : sizeof(packed_mesh_node) * Scene->MeshNodePack.size();
+
+        for (mesh const* Mesh : Scene->Meshes)
+        {
+            std::vector<uint32_t> BinaryStack(Mesh->Depth + 2);
+
+            auto Trace = [&](benchmark_ray const& Ray, benchmark_stats* Stats, cache_simulator* Cache)
+            {
+                if (Config.BinaryNodes)
+                    return TraceMeshBinary(Mesh, Ray, BinaryStack.data(), Stats, Cache);
+                return TraceMesh(Scene, Mesh, Ray, Stats, Cache);
+            };
+
+            if (Config.BinaryNodes)
+                NodeDataSize += BINARY_MESH_NODE_SIZE * Mesh->Nodes.size();
+
+            std::vector<benchmark_ray> Rays = MakeRays(Mesh, RayCount / Scene->Meshes.size() + 1);
+
+            auto StartTime = clock::now();
+            for (benchmark_ray const& Ray : Rays)
+                HitTimes.push_back(Trace(Ray, &Stats, nullptr));
+            Time += std::chrono::duration<double>(clock::now() - StartTime).count();
+
+            cache_simulator Cache;
+            for (benchmark_ray const& Ray : Rays)
+                Trace(Ray, &CacheStats, &Cache);
+
+            std::vector<float> Distances;
+            std::vector<benchmark_ray> EdgeRays = MakeEdgeRays(Mesh, RayCount / Scene->Meshes.size() / 10 + 1, &Distances);
+            float Tolerance = EdgeRays.empty() ? 0.0f : 1e-3f * glm::length(Mesh->Nodes[0].Bounds.Maximum - Mesh->Nodes[0].Bounds.Minimum);
+
+            benchmark_stats EdgeStats;
+            for (size_t I = 0; I < EdgeRays.size(); I++)
+            {
+                float HitTime = Trace(EdgeRays[I], &EdgeStats, nullptr);
+                if (HitTime > Distances[I] + Tolerance)
+                    EdgeLeakCount++;
+            }
+            EdgeRayCount += EdgeRays.size();
+        }
+
+        double Rays = static_cast<double>(Stats.RayCount);
+        printf("%-18s %8.2f Mrays/s  %6.1f nodes/ray  %6.1f faces/ray  %6.1f cache misses/ray  %.1f%% hit  %.3f%% overflow  %.2f ascents/ray\n",
+            Config.Name,
+            Rays / Time / 1e6,
+            Stats.NodeCount / Rays,
+            Stats.FaceCount / Rays,
+            CacheStats.CacheMissCount / Rays,
+            100.0 * Stats.HitCount / Rays,
+            100.0 * Stats.OverflowCount / Rays,
+            Stats.AscentCount / Rays);
+
+        size_t FaceSize = Config.BinaryNodes ? BINARY_MESH_FACE_SIZE : sizeof(packed_mesh_face);
+        size_t FaceDataSize = FaceSize * Scene->MeshFacePack.size()
+                            + sizeof(packed_mesh_vertex) * Scene->MeshVertexPack.size()
+                            + sizeof(packed_mesh_compact_face) * Scene->MeshCompactFacePack.size()
+                            + sizeof(packed_mesh_compact_vertex) * Scene->MeshCompactVertexPack.size()
+                            + sizeof(packed_mesh_transformed_face) * Scene->MeshTransformedFacePack.size();
+        size_t FaceCount = std::max({ Scene->MeshFacePack.size(), Scene->MeshCompactFacePack.size(), Scene->MeshTransformedFacePack.size(), size_t(1) });
+
+        printf("%-18s %.1f bytes/face (with vertices)  %.1f node bytes/face  %.4f%% leaks on %zu edge rays\n",
+            "",
+            double(FaceDataSize) / FaceCount,
+            double(NodeDataSize) / FaceCount,
+            100.0 * EdgeLeakCount / std::max(EdgeRayCount, size_t(1)),
+            EdgeRayCount);
+
+        if (Config.Encoding == MESH_FACE_ENCODING_FULL && !Config.BinaryNodes)
+        {
+            ReferenceTimes = HitTimes;
+        }
+        else if (ReferenceTimes.size() == HitTimes.size())
+        {
+            // Rays that hit or miss only with one of the encodings, and the
+            // largest difference in hit time relative to the mesh size.
+            size_t MismatchCount = 0;
+            double MaximumError = 0.0;
+            for (size_t I = 0; I < HitTimes.size(); I++)
+            {
+                if ((HitTimes[I] == INF) != (ReferenceTimes[I] == INF))
+                    MismatchCount++;
+                else if (HitTimes[I] != INF)
+                    MaximumError = std::max(MaximumError, double(std::abs(HitTimes[I] - ReferenceTimes[I])));
+            }
+
+            float MeshSize = 0.0f;
+            for (mesh const* Mesh : Scene->Meshes)
+                if (!Mesh->Nodes.empty())
+                    MeshSize = std::max(MeshSize, glm::length(Mesh->Nodes[0].Bounds.Maximum - Mesh->Nodes[0].Bounds.Minimum));
+
+            printf("%-18s %.3f%% hit/miss mismatches, %.2e maximum hit time error (relative to mesh size)\n",
+                "",
+                100.0 * MismatchCount / HitTimes.size(),
+                MaximumError / std::max(MeshSize, 1e-30f));
+        }
+
+        DestroyScene(Scene);
+    }
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "core/obj_parser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Compares the parallel OBJ parser against tinyobj::LoadObj() on a given
+// file, reporting the time taken by each and whether the results match.
+
+struct obj_data
+{
+    tinyobj::attrib_t                Attrib;
+    std::vector<tinyobj::shape_t>    Shapes;
+    std::vector<tinyobj::material_t> Materials;
+    std::string                      Warnings;
+    std::string                      Errors;
+    bool                             Success;
+    double                           Time;
+};
+
+static bool IndicesEqual(std::vector<tinyobj::index_t> const& A, std::vector<tinyobj::index_t> const& B)
+{
+    if (A.size() != B.size()) return false;
+    for (size_t I = 0; I < A.size(); I++)
+    {
+        if (A[I].vertex_index != B[I].vertex_index) return false;
+        if (A[I].normal_index != B[I].normal_index) return false;
+        if (A[I].texcoord_index != B[I].texcoord_index) return false;
+    }
+    return true;
+}
+
+static bool ShapesEqual(tinyobj::shape_t const& A, tinyobj::shape_t const& B)
+{
+    return A.name == B.name
+        && IndicesEqual(A.mesh.indices, B.mesh.indices)
+        && A.mesh.num_face_vertices == B.mesh.num_face_vertices
+        && A.mesh.material_ids == B.mesh.material_ids
+        && A.mesh.smoothing_group_ids == B.mesh.smoothing_group_ids;
+}
+
+int main(int ArgumentCount, char** Arguments)
+{
+    if (ArgumentCount < 2)
+    {
+        printf("usage: %s <file.obj> [material directory]\n", Arguments[0]);
+        return 1;
+    }
+
+    char const* Path = Arguments[1];
+    char const* MaterialDirectory = ArgumentCount >= 3 ? Arguments[2] : ".";
+
+    using clock = std::chrono::steady_clock;
+
+    obj_data Reference;
+    {
+        auto StartTime = clock::now();
+        Reference.Success = tinyobj::LoadObj
+        (
+            &Reference.Attrib, &Reference.Shapes, &Reference.Materials,
+            &Reference.Warnings, &Reference.Errors,
+            Path, MaterialDirectory
+        );
+        Reference.Time = std::chrono::duration<double, std::milli>(clock::now() - StartTime).count();
+    }
+
+    obj_data Result;
+    {
+        auto StartTime = clock::now();
+        Result.Success = ParseObjFile
+        (
+            Path, MaterialDirectory,
+            &Result.Attrib, &Result.Shapes, &Result.Materials,
+            &Result.Warnings, &Result.Errors
+        );
+        Result.Time = std::chrono::duration<double, std::milli>(clock::now() - StartTime).count();
+    }
+
+    printf("tinyobj::LoadObj: %10.1f ms\n", Reference.Time);
+    printf("ParseObjFile:     %10.1f ms (%.2fx)\n", Result.Time, Reference.Time / Result.Time);
+
+    if (!Reference.Success || !Result.Success)
+    {
+        printf("Failed: %s%s\n", Reference.Errors.c_str(), Result.Errors.c_str());
+        return 1;
+    }
+
+    bool AttributesMatch = Reference.Attrib.vertices == Result.Attrib.vertices
+                        && Reference.Attrib.normals == Result.Attrib.normals
+                        && Reference.Attrib.texcoords == Result.Attrib.texcoords
+                        && Reference.Attrib.colors == Result.Attrib.colors;
+
+    size_t MismatchedShapeCount = 0;
+    if (Reference.Shapes.size() == Result.Shapes.size())
+    {
+        for (size_t I = 0; I < Reference.Shapes.size(); I++)
+            if (!ShapesEqual(Reference.Shapes[I], Result.Shapes[I]))
+                MismatchedShapeCount++;
+    }
+
+    printf("Attributes: %s\n", AttributesMatch ? "identical" : "DIFFERENT");
+    printf("Shapes:     %zu vs. %zu, %zu mismatched\n", Reference.Shapes.size(), Result.Shapes.size(), MismatchedShapeCount);
+    printf("Materials:  %zu vs. %zu\n", Reference.Materials.size(), Result.Materials.size());
+
+    bool ShapesMatch = Reference.Shapes.size() == Result.Shapes.size() && MismatchedShapeCount == 0;
+
+    return AttributesMatch && ShapesMatch ? 0 : 1;
+}